@@ -1,5 +1,8 @@
 #include "cpu_image.hpp"
 
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <memory>
 
 #include <tracy/Tracy.hpp>
@@ -9,6 +12,32 @@
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+namespace {
+
+[[nodiscard]] auto srgb_to_linear_table() -> const std::array<float, 256>&
+{
+  static const std::array<float, 256> table = [] {
+    std::array<float, 256> result{};
+    for (std::size_t i = 0; i < result.size(); ++i) {
+      const float c = static_cast<float>(i) / 255.0f;
+      result[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+    }
+    return result;
+  }();
+  return table;
+}
+
+[[nodiscard]] auto linear_to_srgb(float c) -> uint8_t
+{
+  c = std::clamp(c, 0.0f, 1.0f);
+  const float srgb = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+  return static_cast<uint8_t>(srgb * 255.0f + 0.5f);
+}
+
+} // anonymous namespace
 
 namespace charlie {
 
@@ -50,4 +79,61 @@ namespace charlie {
   };
 }
 
-} // namespace charlie
\ No newline at end of file
+[[nodiscard]] auto generate_next_mip(const CPUImage& image, bool srgb) -> CPUImage
+{
+  ZoneScoped;
+
+  BEYOND_ENSURE(image.width > 1 || image.height > 1);
+
+  const uint32_t width = std::max(image.width / 2, 1u);
+  const uint32_t height = std::max(image.height / 2, 1u);
+
+  CPUImage result{
+      .name = image.name,
+      .width = width,
+      .height = height,
+      .components = image.components,
+      .data = std::make_unique_for_overwrite<uint8_t[]>(std::size_t{width} * height * 4),
+  };
+
+  const auto& to_linear = srgb_to_linear_table();
+  const auto texel = [&](uint32_t x, uint32_t y) {
+    x = std::min(x, image.width - 1);
+    y = std::min(y, image.height - 1);
+    return image.data.get() + (std::size_t{y} * image.width + x) * 4;
+  };
+
+  for (uint32_t y = 0; y < height; ++y) {
+    for (uint32_t x = 0; x < width; ++x) {
+      const uint8_t* samples[] = {texel(2 * x, 2 * y), texel(2 * x + 1, 2 * y),
+                                  texel(2 * x, 2 * y + 1), texel(2 * x + 1, 2 * y + 1)};
+      uint8_t* out = result.data.get() + (std::size_t{y} * width + x) * 4;
+      for (uint32_t c = 0; c < 4; ++c) {
+        // Alpha is always linear
+        if (srgb && c < 3) {
+          float sum = 0.0f;
+          for (const uint8_t* sample : samples) { sum += to_linear[sample[c]]; }
+          out[c] = linear_to_srgb(sum * 0.25f);
+        } else {
+          uint32_t sum = 0;
+          for (const uint8_t* sample : samples) { sum += sample[c]; }
+          out[c] = static_cast<uint8_t>((sum + 2) / 4);
+        }
+      }
+    }
+  }
+
+  return result;
+}
+
+auto save_image_to_png(const CPUImage& image, const std::filesystem::path& path) -> bool
+{
+  ZoneScoped;
+
+  const int stride = beyond::narrow<int>(image.width * image.components);
+  return stbi_write_png(path.string().c_str(), beyond::narrow<int>(image.width),
+                        beyond::narrow<int>(image.height), beyond::narrow<int>(image.components),
+                        image.data.get(), stride) != 0;
+}
+
+} // namespace charlie
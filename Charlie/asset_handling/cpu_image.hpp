@@ -20,6 +20,14 @@ struct CPUImage {
 [[nodiscard]] auto load_image_from_memory(std::span<const uint8_t> bytes, std::string image_name)
     -> CPUImage;
 
+// Downsample a RGBA8 image to the next mip level with a 2x2 box filter.
+// If `srgb` is true, the color channels are averaged in linear space.
+[[nodiscard]] auto generate_next_mip(const CPUImage& image, bool srgb) -> CPUImage;
+
+// Writes an 8 bit image as a PNG file. Returns false on failure
+[[nodiscard]] auto save_image_to_png(const CPUImage& image, const std::filesystem::path& path)
+    -> bool;
+
 } // namespace charlie
 
 #endif // CHARLIE3D_CPU_IMAGE_HPP
@@ -54,6 +54,10 @@ struct CPUSubmesh {
   i32 vertex_offset = 0;
   u32 index_offset = 0;
   u32 index_count = 0;
+
+  // Range in CPUMeshBuffers::meshlets
+  u32 meshlet_offset = 0;
+  u32 meshlet_count = 0;
 };
 
 struct CPUMesh {
@@ -62,12 +66,35 @@ struct CPUMesh {
   beyond::AABB3 aabb;
 };
 
+// Limits of a meshlet. Must match meshlet.h.glsl
+inline constexpr u32 max_meshlet_vertices = 64;
+inline constexpr u32 max_meshlet_triangles = 124;
+
+// A small cluster of triangles of a submesh, with bounds for culling
+struct Meshlet {
+  Point3 center; // Local space bounding sphere
+  f32 radius = 0;
+  // Backface culling cone. The whole meshlet faces away from viewers at `position` if
+  // dot(normalize(cone_apex - position), cone_axis) >= cone_cutoff
+  Point3 cone_apex;
+  f32 cone_cutoff = 0;
+  Vec3 cone_axis;
+  u32 vertex_offset = 0;   // Into CPUMeshBuffers::meshlet_vertices
+  u32 triangle_offset = 0; // Into CPUMeshBuffers::meshlet_triangles
+  u32 vertex_count = 0;
+  u32 triangle_count = 0;
+};
+
 // Buffers for a single combined mesh
 // Each gltf/glb/obj file has concatenated buffers
 struct CPUMeshBuffers {
   std::vector<Point3> positions; // Seperate position from Rest of the vertex attributes
   std::vector<Vertex> vertices;
   std::vector<u32> indices;
+
+  std::vector<Meshlet> meshlets;
+  std::vector<u32> meshlet_vertices;  // Indices into the vertex buffers
+  std::vector<u32> meshlet_triangles; // Three 8 bit indices into the meshlet vertices each
 };
 
 } // namespace charlie
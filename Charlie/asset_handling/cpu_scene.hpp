@@ -38,6 +38,18 @@ template <typename Func> auto offset_material_texture_index(Ref<CPUMaterial> mat
   material->emissive_texture_index = material->emissive_texture_index.map(func);
 }
 
+// KHR_lights_punctual
+enum class LightType { directional, point, spot };
+
+struct CPULight {
+  LightType type = LightType::point;
+  Vec3 color{1.0f, 1.0f, 1.0f};
+  f32 intensity = 1.0f;        // Candela for point and spot lights
+  beyond::optional<f32> range; // Unlimited if absent
+  f32 inner_cone_angle = 0.0f; // Only for spot lights
+  f32 outer_cone_angle = 0.0f;
+};
+
 struct CPUTexture {
   std::string name;
   u32 image_index = 0;
@@ -49,7 +61,8 @@ struct Nodes {
   std::vector<std::string> names;
   std::vector<Mat4> local_transforms;
   std::vector<Mat4> global_transforms;
-  std::vector<i32> mesh_indices; // -1 for no mesh
+  std::vector<i32> mesh_indices;  // -1 for no mesh
+  std::vector<i32> light_indices; // -1 for no light
 };
 
 enum class SamplerFilter : std::uint8_t {
@@ -84,6 +97,7 @@ struct CPUScene {
 
   std::vector<CPUMesh> meshes;
   std::vector<CPUMaterial> materials;
+  std::vector<CPULight> lights;
   std::vector<CPUImage> images;
   std::vector<CPUTexture> textures;
   std::vector<SamplerInfo> samplers;
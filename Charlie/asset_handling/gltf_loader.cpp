@@ -1,4 +1,5 @@
 #include "gltf_loader.hpp"
+#include "gltf_loader_stages.hpp"
 
 #include "../utils/background_tasks.hpp"
 #include "../utils/prelude.hpp"
@@ -11,6 +12,7 @@
 
 #include <tracy/Tracy.hpp>
 
+#include <beyond/math/constants.hpp>
 #include <beyond/math/matrix.hpp>
 #include <beyond/math/rotor.hpp>
 #include <beyond/math/transform.hpp>
@@ -56,11 +58,14 @@ template <typename T> auto to_beyond(fastgltf::OptionalWithFlagValue<T> opt) ->
   return beyond::nullopt;
 }
 
-[[nodiscard]]
+} // anonymous namespace
+
+namespace charlie {
+
 auto parse_gltf_from_file(const std::filesystem::path& file_path)
     -> fastgltf::Expected<fastgltf::Asset>
 {
-  fastgltf::Parser parser;
+  fastgltf::Parser parser{fastgltf::Extensions::KHR_lights_punctual};
 
   using fastgltf::Options;
 
@@ -82,6 +87,10 @@ auto parse_gltf_from_file(const std::filesystem::path& file_path)
   }
 }
 
+} // namespace charlie
+
+namespace {
+
 auto to_cpu_texture(const fastgltf::Texture& texture) -> charlie::CPUTexture
 {
   return {.name = std::string{texture.name},
@@ -140,6 +149,36 @@ auto to_cpu_material(const fastgltf::Material& material) -> charlie::CPUMaterial
   };
 };
 
+[[nodiscard]] auto from_fastgltf(fastgltf::LightType type) -> charlie::LightType
+{
+  switch (type) {
+  case fastgltf::LightType::Directional:
+    return charlie::LightType::directional;
+  case fastgltf::LightType::Spot:
+    return charlie::LightType::spot;
+  case fastgltf::LightType::Point:
+    return charlie::LightType::point;
+  }
+  return charlie::LightType::point;
+}
+
+auto to_cpu_light(const fastgltf::Light& light) -> charlie::CPULight
+{
+  // Default cone angles from the KHR_lights_punctual spec
+  static constexpr float default_outer_cone_angle = beyond::float_constants::pi / 4.0f;
+
+  return charlie::CPULight{
+      .type = from_fastgltf(light.type),
+      .color = Vec3{light.color},
+      .intensity = light.intensity,
+      .range = light.range.has_value() ? beyond::optional<float>{light.range.value()}
+                                       : beyond::nullopt,
+      .inner_cone_angle = light.innerConeAngle.has_value() ? light.innerConeAngle.value() : 0.0f,
+      .outer_cone_angle = light.outerConeAngle.has_value() ? light.outerConeAngle.value()
+                                                           : default_outer_cone_angle,
+  };
+}
+
 [[nodiscard]] auto load_raw_image_data(const std::filesystem::path& gltf_directory,
                                        const fastgltf::Asset& asset, const fastgltf::Image& image)
     -> charlie::CPUImage
@@ -230,8 +269,12 @@ void add_node(const fastgltf::Node& node, std::span<const fastgltf::Node> inputs
   const i32 mesh_index = to_beyond(node.meshIndex).map(narrow<i32, usize>).value_or(-1);
   output.mesh_indices.push_back(mesh_index);
 
+  const i32 light_index = to_beyond(node.lightIndex).map(narrow<i32, usize>).value_or(-1);
+  output.light_indices.push_back(light_index);
+
   BEYOND_ENSURE(output.names.size() == output.local_transforms.size());
   BEYOND_ENSURE(output.names.size() == output.mesh_indices.size());
+  BEYOND_ENSURE(output.names.size() == output.light_indices.size());
 
   const i32 new_node_index = narrow<i32>(output.names.size() - 1);
   for (auto child_index : node.children) {
@@ -239,7 +282,10 @@ void add_node(const fastgltf::Node& node, std::span<const fastgltf::Node> inputs
   }
 }
 
-[[nodiscard]]
+} // anonymous namespace
+
+namespace charlie {
+
 auto populate_global_transforms(std::span<const i32> parent_indices,
                                 std::span<const Mat4> local_transforms) -> std::vector<Mat4>
 {
@@ -262,7 +308,6 @@ auto populate_global_transforms(std::span<const i32> parent_indices,
   return global_transforms;
 }
 
-[[nodiscard]]
 auto populate_nodes(std::span<const fastgltf::Node> asset_nodes) -> charlie::Nodes
 {
   ZoneScoped;
@@ -276,6 +321,7 @@ auto populate_nodes(std::span<const fastgltf::Node> asset_nodes) -> charlie::Nod
   result.names.reserve(node_count);
   result.local_transforms.reserve(node_count);
   result.mesh_indices.reserve(node_count);
+  result.light_indices.reserve(node_count);
 
   const std::vector<bool> node_is_root = calculate_is_root(asset_nodes);
   BEYOND_ENSURE(node_is_root.size() == node_count);
@@ -288,6 +334,10 @@ auto populate_nodes(std::span<const fastgltf::Node> asset_nodes) -> charlie::Nod
   return result;
 }
 
+} // namespace charlie
+
+namespace {
+
 // Append to a std::vector by an accessor
 template <typename T>
 [[nodiscard]]
@@ -342,7 +392,10 @@ struct SubmeshIntermediateData {
   std::vector<u32> indices;
 };
 
-[[nodiscard]]
+} // anonymous namespace
+
+namespace charlie {
+
 auto construct_submesh_aabb(std::span<const Point3> positions) -> beyond::AABB3
 {
   static constexpr auto infinity = std::numeric_limits<float>::infinity();
@@ -355,7 +408,6 @@ auto construct_submesh_aabb(std::span<const Point3> positions) -> beyond::AABB3
   return beyond::AABB3(min, max, beyond::AABB3::unchecked_tag);
 }
 
-// Convert mesh from fastgltf format to charlie::CPUMesh
 auto convert_meshes(const fastgltf::Asset& asset, beyond::Ref<charlie::CPUMeshBuffers> buffers)
     -> std::vector<charlie::CPUMesh>
 {
@@ -493,6 +545,10 @@ auto convert_meshes(const fastgltf::Asset& asset, beyond::Ref<charlie::CPUMeshBu
   return meshes;
 }
 
+} // namespace charlie
+
+namespace {
+
 [[nodiscard]] auto convert_filter(fastgltf::Filter filter) -> charlie::SamplerFilter
 {
   switch (filter) {
@@ -558,6 +614,12 @@ namespace charlie {
     std::ranges::transform(asset.materials, std::back_inserter(result.materials), to_cpu_material);
   }
 
+  {
+    ZoneScopedN("Convert Lights");
+    result.lights.reserve(asset.lights.size());
+    std::ranges::transform(asset.lights, std::back_inserter(result.lights), to_cpu_light);
+  }
+
   result.meshes = convert_meshes(asset, beyond::ref(result.buffers));
 
   {
@@ -0,0 +1,41 @@
+#ifndef CHARLIE3D_GLTF_LOADER_STAGES_HPP
+#define CHARLIE3D_GLTF_LOADER_STAGES_HPP
+
+// The stages of `load_gltf`. They are exposed so that they can be benchmarked one by one.
+
+#include <filesystem>
+#include <span>
+#include <vector>
+
+#include <fastgltf/parser.hpp>
+#include <fastgltf/types.hpp>
+
+#include <beyond/geometry/aabb3.hpp>
+#include <beyond/utils/ref.hpp>
+
+#include "cpu_mesh.hpp"
+#include "cpu_scene.hpp"
+
+namespace charlie {
+
+// Also loads the buffers, but not the images
+[[nodiscard]] auto parse_gltf_from_file(const std::filesystem::path& file_path)
+    -> fastgltf::Expected<fastgltf::Asset>;
+
+// Flattens the node hierarchy so that parents come before their children
+[[nodiscard]] auto populate_nodes(std::span<const fastgltf::Node> asset_nodes) -> Nodes;
+
+// The nodes must be topologically sorted
+[[nodiscard]] auto populate_global_transforms(std::span<const i32> parent_indices,
+                                              std::span<const Mat4> local_transforms)
+    -> std::vector<Mat4>;
+
+// Each glTF primitive becomes a submesh. The vertices of all meshes are appended to `buffers`
+[[nodiscard]] auto convert_meshes(const fastgltf::Asset& asset,
+                                  beyond::Ref<CPUMeshBuffers> buffers) -> std::vector<CPUMesh>;
+
+[[nodiscard]] auto construct_submesh_aabb(std::span<const Point3> positions) -> beyond::AABB3;
+
+} // namespace charlie
+
+#endif // CHARLIE3D_GLTF_LOADER_STAGES_HPP
@@ -0,0 +1,85 @@
+#include "meshlet_builder.hpp"
+
+#include <beyond/utils/narrowing.hpp>
+
+#include <meshoptimizer.h>
+#include <tracy/Tracy.hpp>
+
+#include <algorithm>
+
+using beyond::narrow;
+
+namespace charlie {
+
+namespace {
+
+// Prefer meshlets whose triangles face similar directions, so that more of them get backface culled
+constexpr float cone_weight = 0.25f;
+
+void build_submesh_meshlets(CPUMeshBuffers& buffers, CPUSubmesh& submesh)
+{
+  submesh.meshlet_offset = narrow<u32>(buffers.meshlets.size());
+  submesh.meshlet_count = 0;
+
+  const std::span<const u32> indices{buffers.indices.data() + submesh.index_offset,
+                                     submesh.index_count};
+  if (indices.empty()) { return; }
+
+  // Indices are relative to the first vertex of the submesh
+  const auto vertex_offset = narrow<u32>(submesh.vertex_offset);
+  const usize vertex_count = std::ranges::max(indices) + 1;
+  const float* positions = &buffers.positions[vertex_offset].x;
+
+  const usize max_meshlet_count =
+      meshopt_buildMeshletsBound(indices.size(), max_meshlet_vertices, max_meshlet_triangles);
+  std::vector<meshopt_Meshlet> meshlets(max_meshlet_count);
+  std::vector<unsigned int> meshlet_vertices(max_meshlet_count * max_meshlet_vertices);
+  std::vector<unsigned char> meshlet_triangles(max_meshlet_count * max_meshlet_triangles * 3);
+  const usize meshlet_count = meshopt_buildMeshlets(
+      meshlets.data(), meshlet_vertices.data(), meshlet_triangles.data(), indices.data(),
+      indices.size(), positions, vertex_count, sizeof(Point3), max_meshlet_vertices,
+      max_meshlet_triangles, cone_weight);
+
+  submesh.meshlet_count = narrow<u32>(meshlet_count);
+  for (const meshopt_Meshlet& meshlet : std::span{meshlets.data(), meshlet_count}) {
+    const meshopt_Bounds bounds = meshopt_computeMeshletBounds(
+        &meshlet_vertices[meshlet.vertex_offset], &meshlet_triangles[meshlet.triangle_offset],
+        meshlet.triangle_count, positions, vertex_count, sizeof(Point3));
+
+    buffers.meshlets.push_back(Meshlet{
+        .center = Point3{bounds.center[0], bounds.center[1], bounds.center[2]},
+        .radius = bounds.radius,
+        .cone_apex = Point3{bounds.cone_apex[0], bounds.cone_apex[1], bounds.cone_apex[2]},
+        .cone_cutoff = bounds.cone_cutoff,
+        .cone_axis = Vec3{bounds.cone_axis[0], bounds.cone_axis[1], bounds.cone_axis[2]},
+        .vertex_offset = narrow<u32>(buffers.meshlet_vertices.size()),
+        .triangle_offset = narrow<u32>(buffers.meshlet_triangles.size()),
+        .vertex_count = meshlet.vertex_count,
+        .triangle_count = meshlet.triangle_count,
+    });
+
+    // Store absolute vertex indices so that the mesh shader does not need the submesh offset
+    for (u32 i = 0; i < meshlet.vertex_count; ++i) {
+      buffers.meshlet_vertices.push_back(vertex_offset +
+                                         meshlet_vertices[meshlet.vertex_offset + i]);
+    }
+    for (u32 i = 0; i < meshlet.triangle_count; ++i) {
+      const unsigned char* triangle = &meshlet_triangles[meshlet.triangle_offset + i * 3];
+      buffers.meshlet_triangles.push_back(u32{triangle[0]} | (u32{triangle[1]} << 8) |
+                                          (u32{triangle[2]} << 16));
+    }
+  }
+}
+
+} // anonymous namespace
+
+void build_meshlets(CPUMeshBuffers& buffers, std::span<CPUMesh> meshes)
+{
+  ZoneScoped;
+
+  for (CPUMesh& mesh : meshes) {
+    for (CPUSubmesh& submesh : mesh.submeshes) { build_submesh_meshlets(buffers, submesh); }
+  }
+}
+
+} // namespace charlie
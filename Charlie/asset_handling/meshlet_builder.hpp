@@ -0,0 +1,16 @@
+#ifndef CHARLIE3D_MESHLET_BUILDER_HPP
+#define CHARLIE3D_MESHLET_BUILDER_HPP
+
+#include "cpu_mesh.hpp"
+
+#include <span>
+
+namespace charlie {
+
+// Splits every submesh into meshlets, and appends them to the meshlet buffers. Sets the meshlet
+// range of each submesh
+void build_meshlets(CPUMeshBuffers& buffers, std::span<CPUMesh> meshes);
+
+} // namespace charlie
+
+#endif // CHARLIE3D_MESHLET_BUILDER_HPP
@@ -90,15 +90,205 @@ void draw_gui_stats_window(charlie::Renderer& renderer,
   ImGui::LabelText("SubMeshes", "%u", scene.metadata.submesh_count);
   ImGui::LabelText("Textures", "%u", scene.metadata.texture_count);
   ImGui::LabelText("Materials", "%u", scene.metadata.material_count);
+  ImGui::LabelText("Punctual Lights", "%zu", scene.light_components.size());
 
   ImGui::SeparatorText("Performance Data");
   ImGui::LabelText("FPS", "%.0f", 1e3f / framerate_counter.average_ms_per_frame);
   ImGui::LabelText("ms/frame", "%.2f", framerate_counter.average_ms_per_frame);
 
+  if (ImGui::TreeNode("CPU Stages")) {
+    float total_ms = 0;
+    for (const charlie::CPUStageTiming& timing : renderer.cpu_timer().timings()) {
+      ImGui::LabelText(timing.name.c_str(), "%.3f ms", timing.milliseconds);
+      total_ms += timing.milliseconds;
+    }
+    ImGui::LabelText("Total", "%.3f ms", total_ms);
+    ImGui::TreePop();
+  }
+
+  const charlie::GPUTimer& gpu_timer = renderer.gpu_timer();
+  if (gpu_timer.supported() && ImGui::TreeNode("GPU Passes")) {
+    const auto history_offset = narrow<int>(gpu_timer.history_offset());
+    const auto plot_history = [&](const char* label, std::span<const float> history, float ms) {
+      if (history.empty()) { return; }
+      const std::string overlay = fmt::format("{:.3f} ms", ms);
+      ImGui::PlotLines(label, history.data(), narrow<int>(history.size()), history_offset,
+                       overlay.c_str(), 0.0f, FLT_MAX, ImVec2(0, 40));
+    };
+
+    float total_ms = 0;
+    for (const charlie::GPUPassTiming& timing : gpu_timer.timings()) {
+      plot_history(timing.name.c_str(), timing.history, timing.milliseconds);
+      total_ms += timing.milliseconds;
+    }
+    plot_history("Total", gpu_timer.frame_history(), total_ms);
+
+    if (gpu_timer.pipeline_statistics_supported() && ImGui::TreeNode("Pipeline Statistics")) {
+      constexpr ImGuiTableFlags table_flags =
+          ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit;
+      if (ImGui::BeginTable("Pipeline Statistics", 6, table_flags)) {
+        ImGui::TableSetupColumn("Pass");
+        ImGui::TableSetupColumn("VS Invocations");
+        ImGui::TableSetupColumn("Clipper In");
+        ImGui::TableSetupColumn("Clipper Out");
+        ImGui::TableSetupColumn("FS Invocations");
+        ImGui::TableSetupColumn("CS Invocations");
+        ImGui::TableHeadersRow();
+        for (const charlie::GPUPassTiming& timing : gpu_timer.timings()) {
+          const charlie::GPUPipelineStatistics& statistics = timing.statistics;
+          ImGui::TableNextRow();
+          ImGui::TableNextColumn();
+          ImGui::TextUnformatted(timing.name.c_str());
+          for (const beyond::u64 count :
+               {statistics.vertex_shader_invocations, statistics.clipping_invocations,
+                statistics.clipping_primitives, statistics.fragment_shader_invocations,
+                statistics.compute_shader_invocations}) {
+            ImGui::TableNextColumn();
+            ImGui::Text("%llu", static_cast<unsigned long long>(count));
+          }
+        }
+        ImGui::EndTable();
+      }
+      ImGui::TreePop();
+    }
+    ImGui::TreePop();
+  }
+
+  static constexpr float mib = 1024.f * 1024.f;
+
+  ImGui::SeparatorText("Frame Graph");
+  const charlie::FrameGraphStats& frame_graph_stats = renderer.frame_graph().stats();
+  ImGui::LabelText("Passes", "%u (%u culled)", frame_graph_stats.pass_count,
+                   frame_graph_stats.culled_pass_count);
+  ImGui::LabelText("Barriers", "%u", frame_graph_stats.barrier_count);
+  ImGui::LabelText("Transient Memory", "%.1f MiB (%.1f MiB unaliased)",
+                   static_cast<float>(frame_graph_stats.transient_memory_size) / mib,
+                   static_cast<float>(frame_graph_stats.unaliased_transient_memory_size) / mib);
+
+  ImGui::SeparatorText("GPU Memory");
+  const vkh::MemoryReport memory_report = vkh::query_memory_report(renderer.context());
+  for (std::size_t i = 0; i < vkh::memory_category_count; ++i) {
+    const vkh::MemoryCategoryUsage& usage = memory_report.categories[i];
+    ImGui::LabelText(vkh::to_string(static_cast<vkh::MemoryCategory>(i)), "%.1f MiB (%u)",
+                     static_cast<float>(usage.bytes) / mib, usage.allocation_count);
+  }
+  ImGui::LabelText("VMA Allocations", "%.1f MiB (%u)",
+                   static_cast<float>(memory_report.total.allocationBytes) / mib,
+                   memory_report.total.allocationCount);
+  ImGui::LabelText("VMA Blocks", "%.1f MiB (%u)",
+                   static_cast<float>(memory_report.total.blockBytes) / mib,
+                   memory_report.total.blockCount);
+  if (ImGui::TreeNode("Heaps")) {
+    if (!renderer.context().supports_memory_budget()) {
+      ImGui::TextUnformatted("VK_EXT_memory_budget is unsupported, so the budgets are estimates");
+    }
+    for (std::size_t i = 0; i < memory_report.heaps.size(); ++i) {
+      const vkh::MemoryHeapUsage& heap = memory_report.heaps[i];
+      const std::string label =
+          fmt::format("Heap {}{}", i, heap.device_local ? " (Device Local)" : "");
+      ImGui::LabelText(label.c_str(), "%.1f/%.1f MiB", static_cast<float>(heap.usage) / mib,
+                       static_cast<float>(heap.budget) / mib);
+    }
+    ImGui::TreePop();
+  }
+
+  ImGui::SeparatorText("Texture Streaming");
+  auto& texture_streamer = renderer.texture_streamer();
+  const auto& streaming_stats = texture_streamer.stats();
+  ImGui::LabelText("Resident", "%.1f MiB",
+                   static_cast<float>(streaming_stats.resident_bytes) / mib);
+  ImGui::LabelText("Budget", "%.1f MiB", static_cast<float>(streaming_stats.budget_bytes) / mib);
+  ImGui::LabelText("Fully Resident Images", "%zu/%zu", streaming_stats.fully_resident_image_count,
+                   streaming_stats.image_count);
+  ImGui::LabelText("Pending Images", "%zu", streaming_stats.pending_image_count);
+  ImGui::LabelText("Uploaded", "%.1f MiB",
+                   static_cast<float>(streaming_stats.uploaded_bytes_last_frame) / mib);
+  ImGui::LabelText("Evicted Images", "%u", streaming_stats.evicted_image_count_last_frame);
+
+  int budget_limit_mib = narrow<int>(texture_streamer.budget_limit() / (1024 * 1024));
+  if (ImGui::SliderInt("Budget Limit", &budget_limit_mib, 0, 4096, "%d MiB")) {
+    texture_streamer.set_budget_limit(narrow<VkDeviceSize>(budget_limit_mib) * 1024 * 1024);
+  }
+  if (ImGui::IsItemHovered()) { ImGui::SetTooltip("0 means only limited by the driver budget"); }
+
+  ImGui::SeparatorText("Culling");
+  bool occlusion_culling_enabled = renderer.occlusion_culling_enabled();
+  if (ImGui::Checkbox("Occlusion Culling", &occlusion_culling_enabled)) {
+    renderer.set_occlusion_culling_enabled(occlusion_culling_enabled);
+  }
+
+  // Mesh shading culls meshlets in task shaders instead, and the visibility buffer needs the
+  // original triangles
+  ImGui::BeginDisabled(renderer.mesh_shading_enabled() || renderer.visibility_buffer_enabled());
+  bool cluster_culling_enabled = renderer.cluster_culling_enabled();
+  if (ImGui::Checkbox("Cluster Culling", &cluster_culling_enabled)) {
+    renderer.set_cluster_culling_enabled(cluster_culling_enabled);
+  }
+  if (ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled)) {
+    ImGui::SetTooltip("Cull the meshlets of visible solid draws in a compute pass, and draw the "
+                      "surviving triangles from a compacted index buffer");
+  }
+  ImGui::BeginDisabled(!renderer.cluster_culling_enabled());
+  bool triangle_culling_enabled = renderer.triangle_culling_enabled();
+  if (ImGui::Checkbox("Triangle Culling", &triangle_culling_enabled)) {
+    renderer.set_triangle_culling_enabled(triangle_culling_enabled);
+  }
+  ImGui::EndDisabled();
+  if (ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled)) {
+    ImGui::SetTooltip("Also cull back-facing and zero-area triangles of the visible clusters");
+  }
+  ImGui::EndDisabled();
+
+  ImGui::SeparatorText("Shading");
+  int shading_path = static_cast<int>(renderer.shading_path());
+  ImGui::Combo("Shading Path", &shading_path, "Forward\0Visibility Buffer\0Deferred\0\0");
+  if (ImGui::IsItemHovered()) {
+    ImGui::SetTooltip("%s", renderer.visibility_buffer_supported()
+                                ? "The visibility buffer and deferred shading shade each pixel "
+                                  "once in a compute pass"
+                                : "The scene has too many draws or triangles for the visibility "
+                                  "buffer, which falls back to forward shading");
+  }
+  renderer.set_shading_path(static_cast<charlie::ShadingPath>(shading_path));
+  ImGui::LabelText("HDR Format", "%s",
+                   renderer.hdr_format() == charlie::HDRFormat::b10g11r11 ? "B10G11R11"
+                                                                          : "RGBA16F");
+
+  // The shadow mask reconstructs positions from the prepass, so it keeps the prepass on. The
+  // visibility buffer pass and the G-buffer pass replace the prepass
+  ImGui::BeginDisabled(renderer.shadow_mask_enabled() || renderer.visibility_buffer_enabled() ||
+                       renderer.deferred_shading_enabled());
+  bool depth_prepass_enabled = renderer.depth_prepass_enabled();
+  if (ImGui::Checkbox("Depth Prepass", &depth_prepass_enabled)) {
+    renderer.set_depth_prepass_enabled(depth_prepass_enabled);
+  }
+  ImGui::EndDisabled();
+  if (ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled)) {
+    ImGui::SetTooltip("Render the depth of solid draws first, so that the mesh pass only shades "
+                      "visible fragments. Always on with the shadow mask");
+  }
+
+  // The mesh shading path only replaces the solid draws of forward shading without a prepass
+  ImGui::BeginDisabled(!renderer.mesh_shading_supported() || renderer.depth_prepass_enabled() ||
+                       renderer.visibility_buffer_enabled() ||
+                       renderer.deferred_shading_enabled());
+  bool mesh_shading_enabled = renderer.mesh_shading_enabled();
+  if (ImGui::Checkbox("Mesh Shading", &mesh_shading_enabled)) {
+    renderer.set_mesh_shading_enabled(mesh_shading_enabled);
+  }
+  ImGui::EndDisabled();
+  if (ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled)) {
+    ImGui::SetTooltip("%s", renderer.mesh_shading_supported()
+                                ? "Cull meshlets in task shaders, and draw the visible ones with "
+                                  "mesh shaders. Forward shading without a depth prepass only"
+                                : "The GPU does not support VK_EXT_mesh_shader");
+  }
+
   ImGui::End();
 }
 
-void draw_gui_shadow_options(beyond::Ref<uint32_t> in_shadow_mode)
+void draw_gui_shadow_options(beyond::Ref<uint32_t> in_shadow_mode,
+                             beyond::Ref<uint32_t> in_shadow_filtering)
 {
   int shadow_mode = beyond::narrow<int>(in_shadow_mode.get());
 
@@ -125,6 +315,15 @@ void draw_gui_shadow_options(beyond::Ref<uint32_t> in_shadow_mode)
       ImGui::RadioButton("PCSS", &shadow_map_mode, 3);
       if (ImGui::IsItemHovered()) { ImGui::SetTooltip("Percentage-Closer Soft Shadows"); }
 
+      if (shadow_map_mode != 1) {
+        bool hardware_filtering = in_shadow_filtering.get() != 0;
+        ImGui::Checkbox("Hardware Filtering", &hardware_filtering);
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip("Use comparison samplers, texture gathers and blue noise");
+        }
+        in_shadow_filtering.get() = hardware_filtering ? 1 : 0;
+      }
+
       ImGui::TreePop();
     }
     shadow_mode = shadow_map_mode;
@@ -139,6 +338,14 @@ void charlie::Renderer::draw_gui_lighting_window()
 {
   ImGui::Begin("Environment Lighting");
 
+  ImGui::SeparatorText("Exposure");
+  ImGui::Checkbox("Auto Exposure", &auto_exposure_enabled_);
+  if (ImGui::IsItemHovered()) {
+    ImGui::SetTooltip("Adapt to the average luminance of a histogram of the HDR image");
+  }
+  ImGui::SliderFloat("Compensation (EV)", &exposure_compensation_, -5, 5, "%.1f",
+                     ImGuiSliderFlags_AlwaysClamp);
+
   ImGui::SeparatorText("Ambient");
   ImGui::SliderFloat("Intensity", &scene_parameters_.sunlight_direction.w, 0, 10, "%.3f",
                      ImGuiSliderFlags_AlwaysClamp);
@@ -161,7 +368,22 @@ void charlie::Renderer::draw_gui_lighting_window()
 
   ImGui::SeparatorText("Sunlight Shadow");
 
-  draw_gui_shadow_options(beyond::ref(scene_parameters_.sunlight_shadow_mode));
+  draw_gui_shadow_options(beyond::ref(scene_parameters_.sunlight_shadow_mode),
+                          beyond::ref(scene_parameters_.sunlight_shadow_filtering));
+  if (scene_parameters_.sunlight_shadow_mode != 0) {
+    bool shadow_mask = scene_parameters_.sunlight_shadow_mask != 0;
+    ImGui::Checkbox("Half-Res Shadow Mask", &shadow_mask);
+    if (ImGui::IsItemHovered()) {
+      ImGui::SetTooltip("Filter the shadow once per 2x2 pixels after a depth prepass, and upsample "
+                        "it with the depth of each pixel");
+    }
+    scene_parameters_.sunlight_shadow_mask = shadow_mask ? 1 : 0;
+  }
+  if (scene_parameters_.sunlight_shadow_mode != 0 &&
+      ImGui::TreeNodeEx("Cascades", ImGuiTreeNodeFlags_DefaultOpen)) {
+    if (shadow_map_renderer_->draw_gui()) { update_shadow_map_descriptors(); }
+    ImGui::TreePop();
+  }
 
   ImGui::PopID();
   ImGui::End();
@@ -0,0 +1,105 @@
+// Renders a scene without a window, e.g. on machines without a display, and optionally saves the
+// last frame as a PNG file
+//
+// Usage: charlie3d_headless [scene] [--frames N] [--resolution WxH] [--output file.png]
+
+#include "renderer/camera.hpp"
+#include "renderer/renderer.hpp"
+#include "renderer/scene.hpp"
+#include "utils/command_line.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <tracy/Tracy.hpp>
+
+#include <beyond/utils/narrowing.hpp>
+
+#include <chrono>
+#include <optional>
+#include <string_view>
+
+namespace {
+
+struct Options {
+  std::string_view scene_file = "models/gltf_box/Box.gltf";
+  charlie::u32 frame_count = 1;
+  charlie::Resolution resolution = {.width = 1280, .height = 720};
+  std::string_view output_file;
+};
+
+[[nodiscard]] auto parse_resolution(std::string_view str) -> std::optional<charlie::Resolution>
+{
+  const auto separator = str.find('x');
+  if (separator == std::string_view::npos) { return std::nullopt; }
+  const auto width = charlie::parse_u32(str.substr(0, separator));
+  const auto height = charlie::parse_u32(str.substr(separator + 1));
+  if (!width || !height || *width == 0 || *height == 0) { return std::nullopt; }
+  return charlie::Resolution{.width = *width, .height = *height};
+}
+
+[[nodiscard]] auto parse_options(int argc, const char** argv) -> std::optional<Options>
+{
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (arg == "--frames" && has_value) {
+      const auto frame_count = charlie::parse_u32(argv[++i]);
+      if (!frame_count || *frame_count == 0) { return std::nullopt; }
+      options.frame_count = *frame_count;
+    } else if (arg == "--resolution" && has_value) {
+      const auto resolution = parse_resolution(argv[++i]);
+      if (!resolution) { return std::nullopt; }
+      options.resolution = *resolution;
+    } else if (arg == "--output" && has_value) {
+      options.output_file = argv[++i];
+    } else if (!arg.starts_with("--")) {
+      options.scene_file = arg;
+    } else {
+      return std::nullopt;
+    }
+  }
+  return options;
+}
+
+} // anonymous namespace
+
+auto main(int argc, const char** argv) -> int
+{
+  const auto options = parse_options(argc, argv);
+  if (!options) {
+    SPDLOG_ERROR("Usage: {} [scene] [--frames N] [--resolution WxH] [--output file.png]", argv[0]);
+    return 1;
+  }
+
+  auto renderer = [&]() {
+    ZoneScopedN("Renderer Constructor");
+    return charlie::Renderer{options->resolution};
+  }();
+
+  charlie::LookAtCameraController controller{beyond::Point3{0, 0, -2}, beyond::Point3{0, 0, 0}};
+  charlie::Camera camera{controller};
+  camera.aspect_ratio = beyond::narrow<float>(options->resolution.width) /
+                        beyond::narrow<float>(options->resolution.height);
+
+  renderer.set_scene(charlie::load_scene(options->scene_file, renderer).value());
+
+  using Clock = std::chrono::steady_clock;
+  const auto start_time = Clock::now();
+  for (charlie::u32 i = 0; i < options->frame_count; ++i) {
+    renderer.render(camera);
+    FrameMark;
+  }
+
+  const auto image = renderer.read_back_offscreen_image();
+  const std::chrono::duration<double, std::milli> render_time = Clock::now() - start_time;
+  SPDLOG_INFO("Rendered {} frames in {:.2f} ms", options->frame_count, render_time.count());
+
+  if (!options->output_file.empty()) {
+    if (!charlie::save_image_to_png(image, options->output_file)) {
+      SPDLOG_ERROR("Failed to write {}", options->output_file);
+      return 1;
+    }
+    SPDLOG_INFO("Saved the last frame to {}", options->output_file);
+  }
+}
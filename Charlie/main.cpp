@@ -3,9 +3,12 @@
 #include "window/window_manager.hpp"
 
 #include "renderer/camera.hpp"
+#include "renderer/camera_path.hpp"
 #include "renderer/renderer.hpp"
 #include "renderer/scene.hpp"
 
+#include "utils/benchmark_report.hpp"
+#include "utils/command_line.hpp"
 #include "utils/file.hpp"
 #include "utils/file_watcher.hpp"
 
@@ -25,10 +28,136 @@
 
 using beyond::ref;
 
+namespace {
+
+struct Options {
+  std::string_view scene_file = "models/gltf_box/Box.gltf";
+  std::string_view record_camera_path_file;
+  std::string_view replay_camera_path_file;
+
+  // Benchmark mode measures a number of frames after a warm-up, reports and exits
+  beyond::u32 benchmark_frame_count = 0;
+  beyond::u32 warm_up_frame_count = 60;
+  std::string_view benchmark_report_file;
+  std::string_view baseline_file;
+  charlie::BenchmarkThresholds thresholds;
+};
+
+[[nodiscard]] auto parse_options(int argc, const char** argv) -> beyond::optional<Options>
+{
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (arg == "--record-camera-path" && has_value) {
+      options.record_camera_path_file = argv[++i];
+    } else if (arg == "--replay-camera-path" && has_value) {
+      options.replay_camera_path_file = argv[++i];
+    } else if (arg == "--benchmark" && has_value) {
+      const auto frame_count = charlie::parse_u32(argv[++i]);
+      if (!frame_count || *frame_count == 0) { return beyond::nullopt; }
+      options.benchmark_frame_count = *frame_count;
+    } else if (arg == "--warm-up" && has_value) {
+      const auto frame_count = charlie::parse_u32(argv[++i]);
+      if (!frame_count) { return beyond::nullopt; }
+      options.warm_up_frame_count = *frame_count;
+    } else if (arg == "--benchmark-report" && has_value) {
+      options.benchmark_report_file = argv[++i];
+    } else if (arg == "--baseline" && has_value) {
+      options.baseline_file = argv[++i];
+    } else if (arg == "--max-regression" && has_value) {
+      const auto max_regression = charlie::parse_f64(argv[++i]);
+      if (!max_regression || *max_regression < 0) { return beyond::nullopt; }
+      options.thresholds.max_regression = *max_regression;
+    } else if (!arg.starts_with("--")) {
+      options.scene_file = arg;
+    } else {
+      return beyond::nullopt;
+    }
+  }
+  return options;
+}
+
+[[nodiscard]] auto benchmark_memory_usage(vkh::Context& context)
+    -> std::vector<charlie::NamedMemoryUsage>
+{
+  static constexpr beyond::f64 mib = 1024.0 * 1024.0;
+  const auto to_mib = [](VkDeviceSize bytes) { return static_cast<beyond::f64>(bytes) / mib; };
+
+  const vkh::MemoryReport memory_report = vkh::query_memory_report(context);
+  std::vector<charlie::NamedMemoryUsage> memory;
+  for (std::size_t i = 0; i < vkh::memory_category_count; ++i) {
+    memory.push_back({.name = vkh::to_string(static_cast<vkh::MemoryCategory>(i)),
+                      .mebibytes = to_mib(memory_report.categories[i].bytes)});
+  }
+  memory.push_back({.name = "VMA Allocations",
+                    .mebibytes = to_mib(memory_report.total.allocationBytes)});
+  memory.push_back({.name = "VMA Blocks", .mebibytes = to_mib(memory_report.total.blockBytes)});
+  for (std::size_t i = 0; i < memory_report.heaps.size(); ++i) {
+    const vkh::MemoryHeapUsage& heap = memory_report.heaps[i];
+    memory.push_back({.name = fmt::format("Heap {} Usage", i), .mebibytes = to_mib(heap.usage)});
+    memory.push_back({.name = fmt::format("Heap {} Budget", i), .mebibytes = to_mib(heap.budget)});
+  }
+  return memory;
+}
+
+// Returns the exit code: 1 for errors, and 2 if the run is slower than the baseline
+[[nodiscard]] auto finish_benchmark(const Options& options,
+                                    const charlie::BenchmarkRecorder& recorder,
+                                    beyond::f64 scene_load_milliseconds,
+                                    charlie::Renderer& renderer) -> int
+{
+  charlie::BenchmarkReport report = recorder.report();
+  report.scene = std::string{options.scene_file};
+  report.warm_up_frame_count = options.warm_up_frame_count;
+  report.scene_load_milliseconds = scene_load_milliseconds;
+  report.memory = benchmark_memory_usage(renderer.context());
+
+  const charlie::TimingStatistics& frame_time = report.frame_time;
+  SPDLOG_INFO("Benchmarked {} frames: p50 {:.3f} ms, p95 {:.3f} ms, p99 {:.3f} ms, max {:.3f} ms",
+              report.frame_count, frame_time.p50, frame_time.p95, frame_time.p99,
+              frame_time.max);
+
+  if (!options.benchmark_report_file.empty()) {
+    if (!charlie::save_benchmark_report(report, options.benchmark_report_file)) { return 1; }
+    SPDLOG_INFO("Wrote the benchmark report to {}", options.benchmark_report_file);
+  }
+
+  if (!options.baseline_file.empty()) {
+    const auto baseline = charlie::load_benchmark_report(options.baseline_file);
+    if (!baseline) { return 1; }
+    const std::vector<std::string> regressions =
+        charlie::find_benchmark_regressions(report, *baseline, options.thresholds);
+    for (const std::string& regression : regressions) {
+      SPDLOG_ERROR("Regression: {}", regression);
+    }
+    if (!regressions.empty()) { return 2; }
+    SPDLOG_INFO("No regressions against {}", options.baseline_file);
+  }
+
+  return 0;
+}
+
+} // anonymous namespace
+
 auto main(int argc, const char** argv) -> int
 {
-  std::string_view scene_file = "models/gltf_box/Box.gltf";
-  if (argc == 2) { scene_file = argv[1]; }
+  const auto options = parse_options(argc, argv);
+  if (!options) {
+    SPDLOG_ERROR("Usage: {} [scene] [--record-camera-path file] [--replay-camera-path file] "
+                 "[--benchmark frames] [--warm-up frames] [--benchmark-report file.json|csv] "
+                 "[--baseline file.csv] [--max-regression fraction]",
+                 argv[0]);
+    return 1;
+  }
+  const bool benchmarking = options->benchmark_frame_count > 0;
+
+  beyond::optional<charlie::CameraPathPlayer> camera_path_player;
+  if (!options->replay_camera_path_file.empty()) {
+    auto frames = charlie::load_camera_path(options->replay_camera_path_file);
+    if (!frames) { return 1; }
+    camera_path_player.emplace(std::move(*frames));
+  }
 
   auto window = charlie::WindowManager::instance().create(1440, 900, "Charlie3D",
                                                           {.resizable = true, .maximized = true});
@@ -42,7 +171,10 @@ auto main(int argc, const char** argv) -> int
 
   charlie::ArcballCameraController arcball_controller{window, beyond::Point3{0, 0, -2},
                                                       beyond::Point3{0, 0, 0}};
-  charlie::Camera camera{arcball_controller};
+  charlie::CameraController& camera_controller =
+      camera_path_player ? static_cast<charlie::CameraController&>(*camera_path_player)
+                         : arcball_controller;
+  charlie::Camera camera{camera_controller};
   {
     const auto [width, height] = window.resolution();
     camera.aspect_ratio = beyond::narrow<float>(width) / beyond::narrow<float>(height);
@@ -64,25 +196,79 @@ auto main(int argc, const char** argv) -> int
         }
       });
 
-  renderer.set_scene(charlie::load_scene(scene_file, renderer).value());
-
   using Clock = std::chrono::steady_clock;
+  using Milliseconds = std::chrono::duration<beyond::f64, std::milli>;
   using namespace std::literals::chrono_literals;
+
+  const auto scene_load_start = Clock::now();
+  renderer.set_scene(charlie::load_scene(options->scene_file, renderer).value());
+  const Milliseconds scene_load_time = Clock::now() - scene_load_start;
+
+  beyond::optional<charlie::CameraPathRecorder> camera_path_recorder;
+  if (!options->record_camera_path_file.empty()) {
+    camera_path_recorder.emplace(options->record_camera_path_file);
+  }
+
+  // Replays and benchmarks ignore the wall clock, so that every run renders the same frames
+  constexpr auto fixed_time_step = std::chrono::duration_cast<Clock::duration>(1s) / 60;
+  const bool use_fixed_time_step = camera_path_player || benchmarking;
+  if (use_fixed_time_step) { renderer.set_fixed_time_step(fixed_time_step); }
+
+  charlie::BenchmarkRecorder benchmark_recorder;
+  beyond::usize frame_index = 0;
   auto previous_time = Clock::now();
   while (true) {
     const auto current_time = Clock::now();
-    const auto delta_time = current_time - previous_time;
+    const auto delta_time = use_fixed_time_step ? fixed_time_step : current_time - previous_time;
     previous_time = current_time;
 
-    input_handler.handle_events();
+    {
+      const auto cpu_timer_scope = renderer.cpu_timer().scope("Input Handling");
+      input_handler.handle_events();
+    }
 
-    camera.update(delta_time);
+    {
+      const auto cpu_timer_scope = renderer.cpu_timer().scope("Camera Update");
+      camera.update(delta_time);
+    }
 
     if (not window.is_minimized()) {
-      gui.draw(delta_time);
+      {
+        const auto cpu_timer_scope = renderer.cpu_timer().scope("GUI");
+        gui.draw(delta_time);
+      }
+      // Benchmarks loop over the camera path
+      if (camera_path_player) {
+        camera_path_player->apply_frame(frame_index % camera_path_player->frame_count(), camera,
+                                        renderer);
+      }
       renderer.render(camera);
+      if (camera_path_recorder) {
+        camera_path_recorder->record(charlie::capture_camera_path_frame(camera, renderer));
+      }
+
+      if (benchmarking && frame_index >= options->warm_up_frame_count) {
+        benchmark_recorder.add_frame_time(Milliseconds{Clock::now() - current_time}.count());
+        for (const charlie::CPUStageTiming& timing : renderer.cpu_timer().timings()) {
+          benchmark_recorder.add_cpu_stage(timing.name, timing.frame_milliseconds);
+        }
+        // The GPU timings lag a few frames behind, which the warm-up covers
+        for (const charlie::GPUPassTiming& timing : renderer.gpu_timer().timings()) {
+          benchmark_recorder.add_gpu_pass(timing.name, timing.frame_milliseconds);
+        }
+      }
+      ++frame_index;
     }
 
     FrameMark;
+
+    if (benchmarking && benchmark_recorder.frame_count() == options->benchmark_frame_count) {
+      return finish_benchmark(*options, benchmark_recorder, scene_load_time.count(), renderer);
+    }
+    if (!benchmarking && camera_path_player &&
+        frame_index == camera_path_player->frame_count()) {
+      SPDLOG_INFO("Replayed {} frames", frame_index);
+      return 0;
+    }
   }
 }
@@ -293,5 +293,9 @@ void ArcballCameraController::fixed_update()
 {
   return lookat_ - zooming * forward_axis_;
 }
+auto LookAtCameraController::view_matrix() const -> beyond::Mat4
+{
+  return beyond::look_at(eye_, lookat_, up_);
+}
 
-} // namespace charlie
\ No newline at end of file
+} // namespace charlie
@@ -130,6 +130,21 @@ private:
   void reset() override;
 };
 
+// A camera that stays at one place, e.g. for rendering without user input
+class LookAtCameraController : public CameraController {
+public:
+  LookAtCameraController(Point3 eye, Point3 lookat) : eye_{eye}, lookat_{lookat} {}
+
+  [[nodiscard]] auto position() const -> Vec3 override { return eye_; }
+  [[nodiscard]] auto view_matrix() const -> Mat4 override;
+
+private:
+  Point3 eye_;
+  Point3 lookat_;
+
+  static constexpr Vec3 up_ = beyond::Vec3{0, 1, 0};
+};
+
 } // namespace charlie
 
 #endif // CHARLIE3D_CAMERA_HPP
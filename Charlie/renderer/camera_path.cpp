@@ -0,0 +1,172 @@
+#include "camera_path.hpp"
+
+#include <beyond/utils/assert.hpp>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include <array>
+#include <cstring>
+#include <iterator>
+#include <sstream>
+
+namespace charlie {
+
+namespace {
+
+constexpr std::string_view camera_path_header = "charlie3d_camera_path 2";
+
+static_assert(sizeof(Mat4) == 16 * sizeof(f32));
+
+[[nodiscard]] auto parse_camera_path_frame(const std::string& line)
+    -> beyond::optional<CameraPathFrame>
+{
+  std::istringstream stream{line};
+
+  CameraPathFrame frame;
+  std::array<f32, 16> view_matrix{};
+  for (f32& value : view_matrix) { stream >> value; }
+  std::memcpy(&frame.view_matrix, view_matrix.data(), sizeof(Mat4));
+  stream >> frame.position.x >> frame.position.y >> frame.position.z;
+  stream >> frame.fovy >> frame.aspect_ratio >> frame.z_near >> frame.z_far;
+
+  RendererSettings& settings = frame.settings;
+  int shading_path = 0;
+  stream >> settings.occlusion_culling >> settings.depth_prepass >> shading_path >>
+      settings.mesh_shading >> settings.cluster_culling >> settings.triangle_culling >>
+      settings.auto_exposure >> settings.exposure_compensation;
+  for (f32& value : settings.sunlight_direction.elem) { stream >> value; }
+  for (f32& value : settings.sunlight_color.elem) { stream >> value; }
+  stream >> settings.sunlight_shadow_mode >> settings.sunlight_shadow_filtering >>
+      settings.sunlight_shadow_mask;
+
+  if (stream.fail() || shading_path < 0 ||
+      shading_path > static_cast<int>(ShadingPath::deferred)) {
+    return beyond::nullopt;
+  }
+  settings.shading_path = static_cast<ShadingPath>(shading_path);
+
+  // Trailing numbers mean that the line comes from a different version
+  std::string rest;
+  if (stream >> rest) { return beyond::nullopt; }
+  return frame;
+}
+
+} // anonymous namespace
+
+auto capture_camera_path_frame(const Camera& camera, const Renderer& renderer) -> CameraPathFrame
+{
+  return CameraPathFrame{
+      .view_matrix = camera.view_matrix(),
+      .position = camera.position(),
+      .fovy = camera.fovy.value(),
+      .aspect_ratio = camera.aspect_ratio,
+      .z_near = camera.z_near,
+      .z_far = camera.z_far,
+      .settings = renderer.settings(),
+  };
+}
+
+auto format_camera_path_frame(const CameraPathFrame& frame) -> std::string
+{
+  std::string line;
+  auto out = std::back_inserter(line);
+
+  std::array<f32, 16> view_matrix{};
+  std::memcpy(view_matrix.data(), &frame.view_matrix, sizeof(Mat4));
+  for (const f32 value : view_matrix) { fmt::format_to(out, "{} ", value); }
+  fmt::format_to(out, "{} {} {} ", frame.position.x, frame.position.y, frame.position.z);
+  fmt::format_to(out, "{} {} {} {} ", frame.fovy, frame.aspect_ratio, frame.z_near, frame.z_far);
+
+  const RendererSettings& settings = frame.settings;
+  fmt::format_to(out, "{:d} {:d} {} {:d} {:d} {:d} {:d} {} ", settings.occlusion_culling,
+                 settings.depth_prepass, static_cast<int>(settings.shading_path),
+                 settings.mesh_shading, settings.cluster_culling, settings.triangle_culling,
+                 settings.auto_exposure, settings.exposure_compensation);
+  for (const f32 value : settings.sunlight_direction.elem) { fmt::format_to(out, "{} ", value); }
+  for (const f32 value : settings.sunlight_color.elem) { fmt::format_to(out, "{} ", value); }
+  fmt::format_to(out, "{} {} {}", settings.sunlight_shadow_mode,
+                 settings.sunlight_shadow_filtering, settings.sunlight_shadow_mask);
+
+  return line;
+}
+
+auto parse_camera_path(std::string_view text) -> beyond::optional<std::vector<CameraPathFrame>>
+{
+  std::istringstream stream{std::string{text}};
+
+  std::string line;
+  if (!std::getline(stream, line) || line != camera_path_header) { return beyond::nullopt; }
+
+  std::vector<CameraPathFrame> frames;
+  while (std::getline(stream, line)) {
+    if (line.empty()) { continue; }
+    auto frame = parse_camera_path_frame(line);
+    if (!frame) { return beyond::nullopt; }
+    frames.push_back(*frame);
+  }
+
+  if (frames.empty()) { return beyond::nullopt; }
+  return frames;
+}
+
+auto load_camera_path(const std::filesystem::path& path)
+    -> beyond::optional<std::vector<CameraPathFrame>>
+{
+  std::ifstream file{path};
+  if (!file) {
+    SPDLOG_ERROR("Failed to open camera path {}", path.string());
+    return beyond::nullopt;
+  }
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+
+  auto frames = parse_camera_path(buffer.str());
+  if (!frames) { SPDLOG_ERROR("{} is not a valid camera path", path.string()); }
+  return frames;
+}
+
+CameraPathRecorder::CameraPathRecorder(const std::filesystem::path& path) : file_{path}
+{
+  if (!file_) {
+    SPDLOG_ERROR("Failed to create camera path {}", path.string());
+    return;
+  }
+  file_ << camera_path_header << '\n';
+}
+
+void CameraPathRecorder::record(const CameraPathFrame& frame)
+{
+  if (!file_) { return; }
+  file_ << format_camera_path_frame(frame) << std::endl;
+}
+
+CameraPathPlayer::CameraPathPlayer(std::vector<CameraPathFrame> frames) : frames_{std::move(frames)}
+{
+  BEYOND_ENSURE(!frames_.empty());
+}
+
+void CameraPathPlayer::apply_frame(usize index, Camera& camera, Renderer& renderer)
+{
+  BEYOND_ENSURE(index < frames_.size());
+  frame_index_ = index;
+
+  const CameraPathFrame& frame = frames_[index];
+
+  // The camera has the aspect ratio of the window until the first frame gets applied, or after a
+  // resize
+  if (camera.aspect_ratio != frame.aspect_ratio && !warned_aspect_ratio_mismatch_) {
+    SPDLOG_WARN("The window has an aspect ratio of {}, but the camera path was recorded with {}. "
+                "The replay uses the recorded one, so the image is stretched",
+                camera.aspect_ratio, frame.aspect_ratio);
+    warned_aspect_ratio_mismatch_ = true;
+  }
+
+  camera.fovy = beyond::Radian{frame.fovy};
+  camera.aspect_ratio = frame.aspect_ratio;
+  camera.z_near = frame.z_near;
+  camera.z_far = frame.z_far;
+  renderer.set_settings(frame.settings);
+}
+
+} // namespace charlie
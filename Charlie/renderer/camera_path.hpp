@@ -0,0 +1,88 @@
+#ifndef CHARLIE3D_CAMERA_PATH_HPP
+#define CHARLIE3D_CAMERA_PATH_HPP
+
+// Records the camera and the renderer settings of every frame into a file, and replays them.
+//
+// A camera path file has a header line and then one line of numbers per frame. The numbers keep
+// their shortest round-trip representation, so a replay sees exactly the recorded values.
+
+#include "../utils/prelude.hpp"
+#include "camera.hpp"
+#include "renderer.hpp"
+
+#include <beyond/types/optional.hpp>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace charlie {
+
+struct CameraPathFrame {
+  Mat4 view_matrix;
+  Vec3 position;
+  f32 fovy = 0; // In radians
+  f32 aspect_ratio = 1;
+  f32 z_near = 0;
+  f32 z_far = 0;
+  RendererSettings settings;
+};
+
+[[nodiscard]] auto capture_camera_path_frame(const Camera& camera, const Renderer& renderer)
+    -> CameraPathFrame;
+
+// A single line without the line break
+[[nodiscard]] auto format_camera_path_frame(const CameraPathFrame& frame) -> std::string;
+
+// Returns nullopt if the text is not a camera path with at least one frame
+[[nodiscard]] auto parse_camera_path(std::string_view text)
+    -> beyond::optional<std::vector<CameraPathFrame>>;
+[[nodiscard]] auto load_camera_path(const std::filesystem::path& path)
+    -> beyond::optional<std::vector<CameraPathFrame>>;
+
+// Writes every frame as soon as it is recorded, so that the recording survives quitting the
+// application at any time
+class CameraPathRecorder {
+public:
+  explicit CameraPathRecorder(const std::filesystem::path& path);
+
+  [[nodiscard]] auto is_open() const -> bool { return file_.is_open(); }
+
+  void record(const CameraPathFrame& frame);
+
+private:
+  std::ofstream file_;
+};
+
+// Follows the camera of a recorded camera path
+class CameraPathPlayer : public CameraController {
+public:
+  // `frames` must not be empty
+  explicit CameraPathPlayer(std::vector<CameraPathFrame> frames);
+
+  [[nodiscard]] auto frame_count() const -> usize { return frames_.size(); }
+
+  // Moves to a frame, and applies its projection and renderer settings. The settings get applied
+  // after the GUI, so that they win over what the GUI set.
+  //
+  // The recorded aspect ratio is applied even if the window has a different one, which stretches
+  // the image but keeps the projection and the culling the same as in the recording
+  void apply_frame(usize index, Camera& camera, Renderer& renderer);
+
+  [[nodiscard]] auto position() const -> Vec3 override { return frames_[frame_index_].position; }
+  [[nodiscard]] auto view_matrix() const -> Mat4 override
+  {
+    return frames_[frame_index_].view_matrix;
+  }
+
+private:
+  std::vector<CameraPathFrame> frames_;
+  usize frame_index_ = 0;
+  bool warned_aspect_ratio_mismatch_ = false;
+};
+
+} // namespace charlie
+
+#endif // CHARLIE3D_CAMERA_PATH_HPP
@@ -0,0 +1,710 @@
+#include "frame_graph.hpp"
+#include "deletion_queue.hpp"
+
+#include "../vulkan_helpers/context.hpp"
+#include "../vulkan_helpers/debug_utils.hpp"
+#include "../vulkan_helpers/error_handling.hpp"
+#include "../vulkan_helpers/initializers.hpp"
+#include "../vulkan_helpers/pipeline_barrier.hpp"
+
+#include <beyond/types/optional.hpp>
+#include <beyond/utils/narrowing.hpp>
+
+#include <algorithm>
+#include <numeric>
+#include <ranges>
+#include <utility>
+
+#include <spdlog/spdlog.h>
+#include <tracy/Tracy.hpp>
+
+namespace charlie {
+
+namespace {
+
+constexpr VkAccessFlags2 write_access_mask =
+    VK_ACCESS_2_SHADER_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT |
+    VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+    VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_HOST_WRITE_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+
+void destroy_images_and_memory(vkh::Context& context, std::span<const VkImage> images,
+                               std::span<const VmaAllocation> memory_blocks)
+{
+  for (VkImage image : images) { vkDestroyImage(context, image, nullptr); }
+  for (VmaAllocation allocation : memory_blocks) {
+    VmaAllocationInfo allocation_info = {};
+    vmaGetAllocationInfo(context.allocator(), allocation, &allocation_info);
+    context.memory_usage_tracker().remove(vkh::MemoryCategory::render_target,
+                                          allocation_info.size);
+    vmaFreeMemory(context.allocator(), allocation);
+  }
+}
+
+// Synchronization state of a resource while recording a frame. Buffers stay in the undefined layout
+struct ResourceState {
+  VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+  VkPipelineStageFlags2 write_stages = VK_PIPELINE_STAGE_2_NONE; // Last write or layout transition
+  VkAccessFlags2 write_access = VK_ACCESS_2_NONE;
+  VkPipelineStageFlags2 read_stages = VK_PIPELINE_STAGE_2_NONE; // Reads since the last write
+  // Where the last write is visible
+  VkPipelineStageFlags2 visible_stages = VK_PIPELINE_STAGE_2_NONE;
+  VkAccessFlags2 visible_access = VK_ACCESS_2_NONE;
+};
+
+// Accesses before the frame are only known to have happened. Reads of the frame wait for a write
+// before the frame, and writes wait for any access before the frame
+[[nodiscard]] auto initial_state(VkPipelineStageFlags2 stage_mask, VkAccessFlags2 access_mask,
+                                 VkImageLayout layout) -> ResourceState
+{
+  const VkAccessFlags2 write_access = access_mask & write_access_mask;
+  const bool writes = write_access != VK_ACCESS_2_NONE;
+  return ResourceState{
+      .layout = layout,
+      .write_stages = writes ? stage_mask : VK_PIPELINE_STAGE_2_NONE,
+      .write_access = write_access,
+      .read_stages = writes ? VK_PIPELINE_STAGE_2_NONE : stage_mask,
+  };
+}
+
+struct Dependency {
+  VkPipelineStageFlags2 src_stage_mask = VK_PIPELINE_STAGE_2_NONE;
+  VkAccessFlags2 src_access_mask = VK_ACCESS_2_NONE;
+  VkPipelineStageFlags2 dst_stage_mask = VK_PIPELINE_STAGE_2_NONE;
+  VkAccessFlags2 dst_access_mask = VK_ACCESS_2_NONE;
+  VkImageLayout old_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+  VkImageLayout new_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+};
+
+// Updates the state of a resource for an access, and returns the dependency that the access needs.
+// Writes and layout transitions wait for all previous accesses, while reads only wait for the last
+// write, once per stage
+[[nodiscard]] auto access_resource(ResourceState& state, VkPipelineStageFlags2 stage_mask,
+                                   VkAccessFlags2 access_mask, VkImageLayout layout, bool writes)
+    -> beyond::optional<Dependency>
+{
+  const bool layout_changes = layout != state.layout;
+  if (writes || layout_changes) {
+    const Dependency dependency{
+        .src_stage_mask = state.write_stages | state.read_stages,
+        .src_access_mask = state.write_access,
+        .dst_stage_mask = stage_mask,
+        .dst_access_mask = access_mask,
+        .old_layout = state.layout,
+        .new_layout = layout,
+    };
+    state = ResourceState{
+        .layout = layout,
+        .write_stages = stage_mask,
+        .write_access = writes ? access_mask & write_access_mask : VK_ACCESS_2_NONE,
+        .visible_stages = stage_mask,
+        .visible_access = access_mask,
+    };
+    if (dependency.src_stage_mask == VK_PIPELINE_STAGE_2_NONE && !layout_changes) {
+      return beyond::nullopt;
+    }
+    return dependency;
+  }
+
+  state.read_stages |= stage_mask;
+  const bool is_visible = (stage_mask & ~state.visible_stages) == 0 &&
+                          (access_mask & ~state.visible_access) == 0;
+  if (is_visible || state.write_stages == VK_PIPELINE_STAGE_2_NONE) { return beyond::nullopt; }
+  state.visible_stages |= stage_mask;
+  state.visible_access |= access_mask;
+  return Dependency{
+      .src_stage_mask = state.write_stages,
+      .src_access_mask = state.write_access,
+      .dst_stage_mask = stage_mask,
+      .dst_access_mask = access_mask,
+      .old_layout = layout,
+      .new_layout = layout,
+  };
+}
+
+[[nodiscard]] auto to_image_create_info(const TransientImageDesc& desc) -> VkImageCreateInfo
+{
+  return VkImageCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+      .imageType = VK_IMAGE_TYPE_2D,
+      .format = desc.format,
+      .extent = VkExtent3D{desc.extent.width, desc.extent.height, 1},
+      .mipLevels = desc.mip_levels,
+      .arrayLayers = 1,
+      .samples = VK_SAMPLE_COUNT_1_BIT,
+      .tiling = VK_IMAGE_TILING_OPTIMAL,
+      .usage = desc.usage,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+      .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+  };
+}
+
+[[nodiscard]] auto aspect_mask_of(VkFormat format) -> VkImageAspectFlags
+{
+  switch (format) {
+  case VK_FORMAT_D16_UNORM:
+  case VK_FORMAT_X8_D24_UNORM_PACK32:
+  case VK_FORMAT_D32_SFLOAT: return VK_IMAGE_ASPECT_DEPTH_BIT;
+  case VK_FORMAT_D16_UNORM_S8_UINT:
+  case VK_FORMAT_D24_UNORM_S8_UINT:
+  case VK_FORMAT_D32_SFLOAT_S8_UINT: return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+  default: return VK_IMAGE_ASPECT_COLOR_BIT;
+  }
+}
+
+[[nodiscard]] auto same_requirements(const VkMemoryRequirements& lhs,
+                                     const VkMemoryRequirements& rhs) -> bool
+{
+  return lhs.size == rhs.size && lhs.alignment == rhs.alignment &&
+         lhs.memoryTypeBits == rhs.memoryTypeBits;
+}
+
+} // anonymous namespace
+
+auto TransientImageDesc::operator==(const TransientImageDesc& other) const -> bool
+{
+  return format == other.format && extent.width == other.extent.width &&
+         extent.height == other.extent.height && usage == other.usage &&
+         mip_levels == other.mip_levels;
+}
+
+auto TransientMemoryPlan::operator==(const TransientMemoryPlan& other) const -> bool
+{
+  return std::ranges::equal(blocks, other.blocks, same_requirements) &&
+         block_indices == other.block_indices;
+}
+
+auto plan_transient_memory(std::span<const TransientMemoryRequest> requests)
+    -> TransientMemoryPlan
+{
+  const auto is_used = [](const TransientMemoryRequest& request) {
+    return request.first_pass <= request.last_pass;
+  };
+
+  std::vector<u32> order(requests.size());
+  std::iota(order.begin(), order.end(), 0u);
+  std::ranges::stable_sort(order, [&](u32 lhs, u32 rhs) {
+    if (is_used(requests[lhs]) != is_used(requests[rhs])) { return is_used(requests[lhs]); }
+    return requests[lhs].requirements.size > requests[rhs].requirements.size;
+  });
+
+  TransientMemoryPlan plan;
+  plan.block_indices.resize(requests.size());
+  std::vector<std::vector<u32>> block_requests;
+
+  for (const u32 request_index : order) {
+    const TransientMemoryRequest& request = requests[request_index];
+    const auto fits = [&](usize block_index) {
+      if ((plan.blocks[block_index].memoryTypeBits & request.requirements.memoryTypeBits) == 0) {
+        return false;
+      }
+      return !is_used(request) ||
+             std::ranges::none_of(block_requests[block_index], [&](u32 other_index) {
+               const TransientMemoryRequest& other = requests[other_index];
+               return is_used(other) && request.first_pass <= other.last_pass &&
+                      other.first_pass <= request.last_pass;
+             });
+    };
+
+    usize block_index = 0;
+    while (block_index < plan.blocks.size() && !fits(block_index)) { ++block_index; }
+    if (block_index == plan.blocks.size()) {
+      plan.blocks.push_back(request.requirements);
+      block_requests.emplace_back();
+    } else {
+      VkMemoryRequirements& block = plan.blocks[block_index];
+      block.size = std::max(block.size, request.requirements.size);
+      block.alignment = std::max(block.alignment, request.requirements.alignment);
+      block.memoryTypeBits &= request.requirements.memoryTypeBits;
+    }
+    block_requests[block_index].push_back(request_index);
+    plan.block_indices[request_index] = beyond::narrow<u32>(block_index);
+  }
+
+  return plan;
+}
+
+auto FrameGraphPassBuilder::read(FrameGraphImage image, const ImageAccess& access)
+    -> FrameGraphPassBuilder&
+{
+  graph_->add_image_use(pass_index_, image, access, false);
+  return *this;
+}
+
+auto FrameGraphPassBuilder::write(FrameGraphImage image, const ImageAccess& access)
+    -> FrameGraphPassBuilder&
+{
+  graph_->add_image_use(pass_index_, image, access, true);
+  return *this;
+}
+
+auto FrameGraphPassBuilder::read(FrameGraphBuffer buffer, const BufferAccess& access)
+    -> FrameGraphPassBuilder&
+{
+  graph_->add_buffer_use(pass_index_, buffer, access, false);
+  return *this;
+}
+
+auto FrameGraphPassBuilder::write(FrameGraphBuffer buffer, const BufferAccess& access)
+    -> FrameGraphPassBuilder&
+{
+  graph_->add_buffer_use(pass_index_, buffer, access, true);
+  return *this;
+}
+
+auto FrameGraphPassBuilder::side_effect() -> FrameGraphPassBuilder&
+{
+  graph_->passes_[pass_index_].has_side_effect = true;
+  return *this;
+}
+
+FrameGraph::FrameGraph(vkh::Context& context) : context_{context} {}
+
+FrameGraph::~FrameGraph()
+{
+  std::vector<VkImage> images;
+  for (const RealizedImage& image : realized_images_) { images.push_back(image.image); }
+  destroy_images_and_memory(context_, images, memory_blocks_);
+}
+
+void FrameGraph::reset()
+{
+  images_.clear();
+  buffers_.clear();
+  transient_images_.clear();
+  passes_.clear();
+}
+
+auto FrameGraph::import_image(std::string name, VkImage image, VkImageAspectFlags aspect_mask,
+                              const ImageAccess& initial_access) -> FrameGraphImage
+{
+  images_.push_back(ImageResource{
+      .name = std::move(name),
+      .image = image,
+      .aspect_mask = aspect_mask,
+      .initial_access = initial_access,
+  });
+  return FrameGraphImage{beyond::narrow<u32>(images_.size() - 1)};
+}
+
+auto FrameGraph::import_buffer(std::string name, VkBuffer buffer,
+                               const BufferAccess& initial_access) -> FrameGraphBuffer
+{
+  buffers_.push_back(BufferResource{
+      .name = std::move(name),
+      .buffer = buffer,
+      .initial_access = initial_access,
+  });
+  return FrameGraphBuffer{beyond::narrow<u32>(buffers_.size() - 1)};
+}
+
+auto FrameGraph::create_image(std::string name, const TransientImageDesc& desc) -> FrameGraphImage
+{
+  transient_images_.push_back(TransientImage{.name = name, .desc = desc});
+  images_.push_back(ImageResource{
+      .name = std::move(name),
+      .aspect_mask = aspect_mask_of(desc.format),
+      .transient_index = beyond::narrow<u32>(transient_images_.size() - 1),
+  });
+  return FrameGraphImage{beyond::narrow<u32>(images_.size() - 1)};
+}
+
+void FrameGraph::set_output(FrameGraphImage image, const ImageAccess& final_access)
+{
+  images_.at(image.index).is_output = true;
+  images_.at(image.index).final_access = final_access;
+}
+
+auto FrameGraph::add_pass(std::string name, ExecuteFunction execute) -> FrameGraphPassBuilder
+{
+  passes_.push_back(Pass{.name = std::move(name), .execute = std::move(execute)});
+  return FrameGraphPassBuilder{*this, beyond::narrow<u32>(passes_.size() - 1)};
+}
+
+void FrameGraph::add_image_use(u32 pass_index, FrameGraphImage image, const ImageAccess& access,
+                               bool writes)
+{
+  BEYOND_ENSURE(image.index < images_.size());
+  const bool reads = !writes || (access.access_mask & ~write_access_mask) != 0;
+
+  // Accesses of the same image in a pass get merged, so they must agree on the layout
+  std::vector<ImageUse>& uses = passes_.at(pass_index).image_uses;
+  const auto it =
+      std::ranges::find_if(uses, [&](const ImageUse& use) { return use.image == image.index; });
+  if (it == uses.end()) {
+    uses.push_back(
+        ImageUse{.image = image.index, .access = access, .reads = reads, .writes = writes});
+    return;
+  }
+  BEYOND_ENSURE(it->access.layout == access.layout);
+  it->access.stage_mask |= access.stage_mask;
+  it->access.access_mask |= access.access_mask;
+  it->reads |= reads;
+  it->writes |= writes;
+}
+
+void FrameGraph::add_buffer_use(u32 pass_index, FrameGraphBuffer buffer,
+                                const BufferAccess& access, bool writes)
+{
+  BEYOND_ENSURE(buffer.index < buffers_.size());
+  const bool reads = !writes || (access.access_mask & ~write_access_mask) != 0;
+
+  std::vector<BufferUse>& uses = passes_.at(pass_index).buffer_uses;
+  const auto it =
+      std::ranges::find_if(uses, [&](const BufferUse& use) { return use.buffer == buffer.index; });
+  if (it == uses.end()) {
+    uses.push_back(
+        BufferUse{.buffer = buffer.index, .access = access, .reads = reads, .writes = writes});
+    return;
+  }
+  it->access.stage_mask |= access.stage_mask;
+  it->access.access_mask |= access.access_mask;
+  it->reads |= reads;
+  it->writes |= writes;
+}
+
+void FrameGraph::cull_passes()
+{
+  // Walks backwards from the outputs. A pass survives if a later surviving pass reads what it
+  // writes
+  std::vector<bool> image_needed(images_.size());
+  std::vector<bool> buffer_needed(buffers_.size());
+  for (usize i = 0; i < images_.size(); ++i) { image_needed[i] = images_[i].is_output; }
+
+  for (Pass& pass : passes_ | std::views::reverse) {
+    const bool contributes =
+        pass.has_side_effect ||
+        std::ranges::any_of(pass.image_uses,
+                            [&](const ImageUse& use) {
+                              return use.writes && image_needed[use.image];
+                            }) ||
+        std::ranges::any_of(pass.buffer_uses, [&](const BufferUse& use) {
+          return use.writes && buffer_needed[use.buffer];
+        });
+    pass.culled = !contributes;
+    if (pass.culled) { continue; }
+
+    for (const ImageUse& use : pass.image_uses) {
+      if (use.reads) { image_needed[use.image] = true; }
+    }
+    for (const BufferUse& use : pass.buffer_uses) {
+      if (use.reads) { buffer_needed[use.buffer] = true; }
+    }
+  }
+}
+
+void FrameGraph::merge_reads()
+{
+  // Walks backwards, so that the first of consecutive reads in the same layout knows about the
+  // following ones. Its barrier then covers all of them
+  std::vector<beyond::optional<ImageAccess>> image_reads(images_.size());
+  std::vector<beyond::optional<BufferAccess>> buffer_reads(buffers_.size());
+  for (Pass& pass : passes_ | std::views::reverse) {
+    if (pass.culled) { continue; }
+
+    for (ImageUse& use : pass.image_uses) {
+      beyond::optional<ImageAccess>& reads = image_reads[use.image];
+      if (use.writes) {
+        reads = beyond::nullopt;
+      } else if (reads.has_value() && reads->layout == use.access.layout) {
+        reads->stage_mask |= use.access.stage_mask;
+        reads->access_mask |= use.access.access_mask;
+      } else {
+        reads = use.access;
+      }
+      use.barrier_access = use.writes ? use.access : *reads;
+    }
+    for (BufferUse& use : pass.buffer_uses) {
+      beyond::optional<BufferAccess>& reads = buffer_reads[use.buffer];
+      if (use.writes) {
+        reads = beyond::nullopt;
+      } else if (reads.has_value()) {
+        reads->stage_mask |= use.access.stage_mask;
+        reads->access_mask |= use.access.access_mask;
+      } else {
+        reads = use.access;
+      }
+      use.barrier_access = use.writes ? use.access : *reads;
+    }
+  }
+}
+
+auto FrameGraph::memory_requirements(const TransientImageDesc& desc) -> VkMemoryRequirements
+{
+  const auto it = std::ranges::find_if(memory_requirements_cache_,
+                                       [&](const auto& entry) { return entry.desc == desc; });
+  if (it != memory_requirements_cache_.end()) { return it->requirements; }
+
+  const VkImageCreateInfo create_info = to_image_create_info(desc);
+  const VkDeviceImageMemoryRequirements requirements_info{
+      .sType = VK_STRUCTURE_TYPE_DEVICE_IMAGE_MEMORY_REQUIREMENTS,
+      .pCreateInfo = &create_info,
+  };
+  VkMemoryRequirements2 requirements{.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2};
+  vkGetDeviceImageMemoryRequirements(context_, &requirements_info, &requirements);
+
+  memory_requirements_cache_.push_back(
+      {.desc = desc, .requirements = requirements.memoryRequirements});
+  return requirements.memoryRequirements;
+}
+
+auto FrameGraph::compile() -> bool
+{
+  ZoneScoped;
+
+  cull_passes();
+
+  u32 pass_index = 0;
+  for (const Pass& pass : passes_) {
+    if (pass.culled) { continue; }
+    for (const ImageUse& use : pass.image_uses) {
+      const u32 transient_index = images_[use.image].transient_index;
+      if (transient_index == not_transient) { continue; }
+      TransientImage& transient_image = transient_images_[transient_index];
+      transient_image.first_pass = std::min(transient_image.first_pass, pass_index);
+      transient_image.last_pass = std::max(transient_image.last_pass, pass_index);
+    }
+    ++pass_index;
+  }
+  stats_.pass_count = beyond::narrow<u32>(passes_.size());
+  stats_.culled_pass_count = beyond::narrow<u32>(passes_.size()) - pass_index;
+
+  merge_reads();
+
+  // Resizes leave stale entries behind
+  std::erase_if(memory_requirements_cache_, [&](const CachedMemoryRequirements& entry) {
+    return std::ranges::none_of(transient_images_, [&](const TransientImage& image) {
+      return image.desc == entry.desc;
+    });
+  });
+
+  std::vector<TransientMemoryRequest> requests;
+  requests.reserve(transient_images_.size());
+  for (const TransientImage& image : transient_images_) {
+    requests.push_back(TransientMemoryRequest{
+        .first_pass = image.first_pass,
+        .last_pass = image.last_pass,
+        .requirements = memory_requirements(image.desc),
+    });
+  }
+  plan_ = plan_transient_memory(requests);
+
+  return !realized_images_match();
+}
+
+auto FrameGraph::realized_images_match() const -> bool
+{
+  return plan_ == realized_plan_ &&
+         std::ranges::equal(transient_images_, realized_images_,
+                            [](const TransientImage& image, const RealizedImage& realized) {
+                              return image.name == realized.name && image.desc == realized.desc;
+                            });
+}
+
+void FrameGraph::realize(DeletionQueue& deletion_queue)
+{
+  ZoneScoped;
+
+  // The frames in flight might still use the previous images
+  std::vector<VkImage> previous_images;
+  for (const RealizedImage& image : realized_images_) { previous_images.push_back(image.image); }
+  deletion_queue.push([images = std::move(previous_images),
+                       memory_blocks = std::exchange(memory_blocks_, {})](vkh::Context& context) {
+    destroy_images_and_memory(context, images, memory_blocks);
+  });
+  realized_images_.clear();
+  realized_plan_ = {};
+
+  static constexpr VmaAllocationCreateInfo allocation_create_info = {
+      .usage = VMA_MEMORY_USAGE_GPU_ONLY,
+      .requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+  };
+  stats_.transient_memory_size = 0;
+  for (const VkMemoryRequirements& block : plan_.blocks) {
+    VmaAllocation allocation = VK_NULL_HANDLE;
+    VmaAllocationInfo allocation_info = {};
+    VK_CHECK(vmaAllocateMemory(context_.allocator(), &block, &allocation_create_info, &allocation,
+                               &allocation_info));
+    context_.memory_usage_tracker().add(vkh::MemoryCategory::render_target,
+                                        allocation_info.size);
+    memory_blocks_.push_back(allocation);
+    stats_.transient_memory_size += block.size;
+  }
+
+  stats_.unaliased_transient_memory_size = 0;
+  for (usize i = 0; i < transient_images_.size(); ++i) {
+    const TransientImage& transient_image = transient_images_[i];
+    const VkImageCreateInfo create_info = to_image_create_info(transient_image.desc);
+    VkImage image = VK_NULL_HANDLE;
+    VK_CHECK(vkCreateImage(context_, &create_info, nullptr, &image));
+    const u32 block_index = plan_.block_indices[i];
+    VK_CHECK(vmaBindImageMemory(context_.allocator(), memory_blocks_[block_index], image));
+    if (vkh::set_debug_name(context_, image, transient_image.name.c_str())) {
+      vkh::report_fail_to_set_debug_name(transient_image.name.c_str());
+    }
+
+    realized_images_.push_back(RealizedImage{
+        .name = transient_image.name,
+        .desc = transient_image.desc,
+        .image = image,
+        .block_index = block_index,
+    });
+    stats_.unaliased_transient_memory_size += memory_requirements(transient_image.desc).size;
+  }
+  realized_plan_ = plan_;
+  stats_.transient_image_count = realized_images_.size();
+
+  static constexpr f64 mib = 1024.0 * 1024.0;
+  SPDLOG_INFO("Frame graph: {} transient images in {:.1f} MiB ({:.1f} MiB without aliasing)",
+              stats_.transient_image_count,
+              static_cast<f64>(stats_.transient_memory_size) / mib,
+              static_cast<f64>(stats_.unaliased_transient_memory_size) / mib);
+}
+
+auto FrameGraph::transient_image(std::string_view name) const -> VkImage
+{
+  const auto it = std::ranges::find_if(
+      realized_images_, [&](const RealizedImage& image) { return image.name == name; });
+  BEYOND_ENSURE(it != realized_images_.end());
+  return it->image;
+}
+
+void FrameGraph::plan_barriers()
+{
+  BEYOND_ENSURE(realized_images_.size() == transient_images_.size());
+
+  std::vector<ResourceState> image_states(images_.size());
+  std::vector<bool> image_touched(images_.size());
+  for (usize i = 0; i < images_.size(); ++i) {
+    ImageResource& image = images_[i];
+    if (image.transient_index != not_transient) {
+      image.image = realized_images_[image.transient_index].image;
+    }
+    image_states[i] = initial_state(image.initial_access.stage_mask,
+                                    image.initial_access.access_mask, image.initial_access.layout);
+  }
+  std::vector<ResourceState> buffer_states(buffers_.size());
+  for (usize i = 0; i < buffers_.size(); ++i) {
+    buffer_states[i] = initial_state(buffers_[i].initial_access.stage_mask,
+                                     buffers_[i].initial_access.access_mask,
+                                     VK_IMAGE_LAYOUT_UNDEFINED);
+  }
+  // Aliased images wait for the previous image in the same memory, and the first ones for the
+  // previous frame
+  std::vector<ResourceState> block_states(
+      realized_plan_.blocks.size(),
+      initial_state(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_NONE,
+                    VK_IMAGE_LAYOUT_UNDEFINED));
+
+  const auto add_image_barrier = [&](u32 image_index, const ImageAccess& access, bool writes) {
+    const ImageResource& image = images_[image_index];
+    ResourceState& state = image_states[image_index];
+    u32 block_index = 0;
+    if (image.transient_index != not_transient) {
+      block_index = realized_plan_.block_indices[image.transient_index];
+      if (!image_touched[image_index]) {
+        state = block_states[block_index];
+        state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+      }
+    }
+    image_touched[image_index] = true;
+
+    const auto dependency =
+        access_resource(state, access.stage_mask, access.access_mask, access.layout, writes);
+    if (image.transient_index != not_transient) { block_states[block_index] = state; }
+    if (!dependency.has_value()) { return; }
+
+    image_barriers_.push_back(vkh::ImageBarrier{
+        .stage_masks = {dependency->src_stage_mask, dependency->dst_stage_mask},
+        .access_masks = {dependency->src_access_mask, dependency->dst_access_mask},
+        .layouts = {dependency->old_layout, dependency->new_layout},
+        .image = image.image,
+        .subresource_range =
+            vkh::SubresourceRange{
+                .aspect_mask = image.aspect_mask,
+                .level_count = VK_REMAINING_MIP_LEVELS,
+                .layer_count = VK_REMAINING_ARRAY_LAYERS,
+            },
+    }
+                                  .to_vk_struct());
+  };
+
+  // Closes the batch of barriers in front of a pass, if it has any
+  u32 first_image_barrier = 0;
+  u32 first_buffer_barrier = 0;
+  const auto end_batch = [&](u32 pass_index) {
+    const auto image_barrier_count =
+        beyond::narrow<u32>(image_barriers_.size()) - first_image_barrier;
+    const auto buffer_barrier_count =
+        beyond::narrow<u32>(buffer_barriers_.size()) - first_buffer_barrier;
+    if (image_barrier_count == 0 && buffer_barrier_count == 0) { return; }
+    barrier_batches_.push_back(FrameGraphBarrierBatch{
+        .pass_index = pass_index,
+        .first_image_barrier = first_image_barrier,
+        .image_barrier_count = image_barrier_count,
+        .first_buffer_barrier = first_buffer_barrier,
+        .buffer_barrier_count = buffer_barrier_count,
+    });
+    first_image_barrier += image_barrier_count;
+    first_buffer_barrier += buffer_barrier_count;
+  };
+
+  image_barriers_.clear();
+  buffer_barriers_.clear();
+  barrier_batches_.clear();
+  for (u32 pass_index = 0; pass_index < passes_.size(); ++pass_index) {
+    const Pass& pass = passes_[pass_index];
+    if (pass.culled) { continue; }
+
+    for (const ImageUse& use : pass.image_uses) {
+      add_image_barrier(use.image, use.barrier_access, use.writes);
+    }
+    for (const BufferUse& use : pass.buffer_uses) {
+      const auto dependency =
+          access_resource(buffer_states[use.buffer], use.barrier_access.stage_mask,
+                          use.barrier_access.access_mask, VK_IMAGE_LAYOUT_UNDEFINED, use.writes);
+      if (!dependency.has_value()) { continue; }
+      buffer_barriers_.push_back(vkh::BufferMemoryBarrier{
+          .stage_masks = {dependency->src_stage_mask, dependency->dst_stage_mask},
+          .access_masks = {dependency->src_access_mask, dependency->dst_access_mask},
+          .buffer = buffers_[use.buffer].buffer,
+          .size = VK_WHOLE_SIZE,
+      }
+                                     .to_vk_struct());
+    }
+    end_batch(pass_index);
+  }
+
+  for (u32 i = 0; i < images_.size(); ++i) {
+    if (images_[i].is_output) { add_image_barrier(i, images_[i].final_access, false); }
+  }
+  end_batch(beyond::narrow<u32>(passes_.size()));
+
+  stats_.barrier_count = beyond::narrow<u32>(image_barriers_.size() + buffer_barriers_.size());
+}
+
+void FrameGraph::execute(VkCommandBuffer cmd)
+{
+  ZoneScoped;
+
+  plan_barriers();
+
+  auto batch = barrier_batches_.begin();
+  const auto record_barriers = [&](u32 pass_index) {
+    if (batch == barrier_batches_.end() || batch->pass_index != pass_index) { return; }
+    vkh::cmd_pipeline_barrier(
+        cmd, {.buffer_memory_barriers = std::span{buffer_barriers_}.subspan(
+                  batch->first_buffer_barrier, batch->buffer_barrier_count),
+              .image_barriers = std::span{image_barriers_}.subspan(batch->first_image_barrier,
+                                                                   batch->image_barrier_count)});
+    ++batch;
+  };
+
+  for (u32 pass_index = 0; pass_index < passes_.size(); ++pass_index) {
+    if (passes_[pass_index].culled) { continue; }
+    record_barriers(pass_index);
+    passes_[pass_index].execute(cmd);
+  }
+  record_barriers(beyond::narrow<u32>(passes_.size()));
+}
+
+} // namespace charlie
@@ -0,0 +1,331 @@
+#ifndef CHARLIE3D_FRAME_GRAPH_HPP
+#define CHARLIE3D_FRAME_GRAPH_HPP
+
+// Records the passes of a frame from the resources they declare to access.
+//
+// The graph gets declared again every frame. Compiling it culls the passes that contribute to no
+// output, and places the transient images into memory: images whose lifetimes do not overlap share
+// the same memory. Executing it records the passes in declaration order, with a single batched
+// barrier in front of each pass that needs one.
+
+#include "../utils/prelude.hpp"
+
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan_core.h>
+
+#include <functional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace vkh {
+class Context;
+}
+
+namespace charlie {
+
+class DeletionQueue;
+
+// How a pass accesses an image. The image is in `layout` during the whole pass
+struct ImageAccess {
+  VkPipelineStageFlags2 stage_mask = VK_PIPELINE_STAGE_2_NONE;
+  VkAccessFlags2 access_mask = VK_ACCESS_2_NONE;
+  VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+};
+
+struct BufferAccess {
+  VkPipelineStageFlags2 stage_mask = VK_PIPELINE_STAGE_2_NONE;
+  VkAccessFlags2 access_mask = VK_ACCESS_2_NONE;
+};
+
+namespace image_access {
+
+// Loaded or cleared
+[[nodiscard]] constexpr auto color_attachment() -> ImageAccess
+{
+  return {.stage_mask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+          .access_mask =
+              VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+          .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+}
+
+[[nodiscard]] constexpr auto depth_attachment() -> ImageAccess
+{
+  return {.stage_mask = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT |
+                        VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+          .access_mask = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                         VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+          .layout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL};
+}
+
+[[nodiscard]] constexpr auto
+sampled(VkPipelineStageFlags2 stage_mask,
+        VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) -> ImageAccess
+{
+  return {.stage_mask = stage_mask,
+          .access_mask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+          .layout = layout};
+}
+
+[[nodiscard]] constexpr auto storage_read(VkPipelineStageFlags2 stage_mask) -> ImageAccess
+{
+  return {.stage_mask = stage_mask,
+          .access_mask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT,
+          .layout = VK_IMAGE_LAYOUT_GENERAL};
+}
+
+[[nodiscard]] constexpr auto storage_write(VkPipelineStageFlags2 stage_mask) -> ImageAccess
+{
+  return {.stage_mask = stage_mask,
+          .access_mask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+          .layout = VK_IMAGE_LAYOUT_GENERAL};
+}
+
+[[nodiscard]] constexpr auto storage_read_write(VkPipelineStageFlags2 stage_mask) -> ImageAccess
+{
+  return {.stage_mask = stage_mask,
+          .access_mask =
+              VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+          .layout = VK_IMAGE_LAYOUT_GENERAL};
+}
+
+} // namespace image_access
+
+struct FrameGraphImage {
+  u32 index = 0;
+};
+
+struct FrameGraphBuffer {
+  u32 index = 0;
+};
+
+struct TransientImageDesc {
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  VkExtent2D extent = {};
+  VkImageUsageFlags usage = 0;
+  u32 mip_levels = 1;
+
+  [[nodiscard]] auto operator==(const TransientImageDesc& other) const -> bool;
+};
+
+// A transient resource to place into memory, used from `first_pass` to `last_pass`. A resource
+// that no pass uses has `last_pass < first_pass`
+struct TransientMemoryRequest {
+  u32 first_pass = 0;
+  u32 last_pass = 0;
+  VkMemoryRequirements requirements = {};
+};
+
+struct TransientMemoryPlan {
+  std::vector<VkMemoryRequirements> blocks;
+  std::vector<u32> block_indices; // The memory block of each request, at offset zero
+
+  [[nodiscard]] auto operator==(const TransientMemoryPlan& other) const -> bool;
+};
+
+// Requests whose pass ranges do not overlap share a block. Larger requests are placed first, so
+// that the smaller ones fit into their blocks. Unused requests go into any compatible block, since
+// their memory is never accessed
+[[nodiscard]] auto plan_transient_memory(std::span<const TransientMemoryRequest> requests)
+    -> TransientMemoryPlan;
+
+struct FrameGraphStats {
+  u32 pass_count = 0;
+  u32 culled_pass_count = 0;
+  u32 barrier_count = 0; // Image and buffer barriers of the last planned frame
+  usize transient_image_count = 0;
+  VkDeviceSize transient_memory_size = 0;
+  VkDeviceSize unaliased_transient_memory_size = 0; // The transient images without aliasing
+};
+
+// The barriers in front of a pass, as ranges of `FrameGraph::image_barriers` and
+// `FrameGraph::buffer_barriers`. The batch after the last pass has the pass count as its index
+struct FrameGraphBarrierBatch {
+  u32 pass_index = 0;
+  u32 first_image_barrier = 0;
+  u32 image_barrier_count = 0;
+  u32 first_buffer_barrier = 0;
+  u32 buffer_barrier_count = 0;
+};
+
+class FrameGraph;
+
+class FrameGraphPassBuilder {
+  FrameGraph* graph_ = nullptr;
+  u32 pass_index_ = 0;
+
+public:
+  FrameGraphPassBuilder(FrameGraph& graph, u32 pass_index) : graph_{&graph}, pass_index_{pass_index}
+  {
+  }
+
+  auto read(FrameGraphImage image, const ImageAccess& access) -> FrameGraphPassBuilder&;
+  // An access that also reads, like loading an attachment, keeps the previous writers alive
+  auto write(FrameGraphImage image, const ImageAccess& access) -> FrameGraphPassBuilder&;
+  auto read(FrameGraphBuffer buffer, const BufferAccess& access) -> FrameGraphPassBuilder&;
+  auto write(FrameGraphBuffer buffer, const BufferAccess& access) -> FrameGraphPassBuilder&;
+
+  // Keeps the pass even if no other pass reads what it writes, e.g. for passes that only write
+  // resources outside of the graph
+  auto side_effect() -> FrameGraphPassBuilder&;
+};
+
+class FrameGraph {
+public:
+  using ExecuteFunction = std::function<void(VkCommandBuffer)>;
+
+  explicit FrameGraph(vkh::Context& context);
+  ~FrameGraph();
+
+  FrameGraph(const FrameGraph&) = delete;
+  auto operator=(const FrameGraph&) & -> FrameGraph& = delete;
+  FrameGraph(FrameGraph&&) noexcept = delete;
+  auto operator=(FrameGraph&&) & noexcept -> FrameGraph& = delete;
+
+  // Starts declaring a new frame. The realized transient images stay alive
+  void reset();
+
+  // `initial_access` is the last access before the frame. An image that starts in the undefined
+  // layout gets discarded
+  auto import_image(std::string name, VkImage image, VkImageAspectFlags aspect_mask,
+                    const ImageAccess& initial_access = {
+                        .stage_mask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT}) -> FrameGraphImage;
+  auto import_buffer(std::string name, VkBuffer buffer,
+                     const BufferAccess& initial_access = {
+                         .stage_mask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT}) -> FrameGraphBuffer;
+  // The content of a transient image does not survive the frame
+  auto create_image(std::string name, const TransientImageDesc& desc) -> FrameGraphImage;
+
+  // The image gets consumed after the frame, e.g. presented. Passes that contribute to it are kept,
+  // and it ends up in `final_access`
+  void set_output(FrameGraphImage image, const ImageAccess& final_access);
+
+  auto add_pass(std::string name, ExecuteFunction execute) -> FrameGraphPassBuilder;
+
+  // Returns whether the transient images need to be realized again, e.g. after a resize or after a
+  // setting changed the passes
+  [[nodiscard]] auto compile() -> bool;
+  // The previous transient images are destroyed through the deletion queue
+  void realize(DeletionQueue& deletion_queue);
+  // Computes the barriers of the compiled passes, which `execute` records
+  void plan_barriers();
+  void execute(VkCommandBuffer cmd);
+
+  // The realized image of a transient image
+  [[nodiscard]] auto transient_image(std::string_view name) const -> VkImage;
+
+  [[nodiscard]] auto stats() const -> const FrameGraphStats& { return stats_; }
+
+  // The batches of the last planned frame. Passes without barriers have no batch
+  [[nodiscard]] auto barrier_batches() const -> std::span<const FrameGraphBarrierBatch>
+  {
+    return barrier_batches_;
+  }
+  [[nodiscard]] auto image_barriers() const -> std::span<const VkImageMemoryBarrier2>
+  {
+    return image_barriers_;
+  }
+  [[nodiscard]] auto buffer_barriers() const -> std::span<const VkBufferMemoryBarrier2>
+  {
+    return buffer_barriers_;
+  }
+
+private:
+  friend class FrameGraphPassBuilder;
+
+  static constexpr u32 not_transient = ~0u;
+
+  struct ImageResource {
+    std::string name;
+    VkImage image = VK_NULL_HANDLE; // Filled in for transient images by `execute`
+    VkImageAspectFlags aspect_mask = 0;
+    ImageAccess initial_access;
+    bool is_output = false;
+    ImageAccess final_access;
+    u32 transient_index = not_transient;
+  };
+
+  struct BufferResource {
+    std::string name;
+    VkBuffer buffer = VK_NULL_HANDLE;
+    BufferAccess initial_access;
+  };
+
+  struct TransientImage {
+    std::string name;
+    TransientImageDesc desc;
+    u32 first_pass = ~0u; // Among the passes that survived culling
+    u32 last_pass = 0;
+  };
+
+  struct ImageUse {
+    u32 image = 0;
+    ImageAccess access;
+    ImageAccess barrier_access; // Also covers the following reads in the same layout
+    bool reads = false;
+    bool writes = false;
+  };
+
+  struct BufferUse {
+    u32 buffer = 0;
+    BufferAccess access;
+    BufferAccess barrier_access; // Also covers the following reads
+    bool reads = false;
+    bool writes = false;
+  };
+
+  struct Pass {
+    std::string name;
+    ExecuteFunction execute;
+    std::vector<ImageUse> image_uses;
+    std::vector<BufferUse> buffer_uses;
+    bool has_side_effect = false;
+    bool culled = false;
+  };
+
+  struct RealizedImage {
+    std::string name;
+    TransientImageDesc desc;
+    VkImage image = VK_NULL_HANDLE;
+    u32 block_index = 0;
+  };
+
+  struct CachedMemoryRequirements {
+    TransientImageDesc desc;
+    VkMemoryRequirements requirements = {};
+  };
+
+  vkh::Context& context_;
+
+  std::vector<ImageResource> images_;
+  std::vector<BufferResource> buffers_;
+  std::vector<TransientImage> transient_images_;
+  std::vector<Pass> passes_;
+
+  TransientMemoryPlan plan_;
+  std::vector<CachedMemoryRequirements> memory_requirements_cache_;
+
+  std::vector<RealizedImage> realized_images_;
+  std::vector<VmaAllocation> memory_blocks_;
+  TransientMemoryPlan realized_plan_;
+
+  std::vector<VkImageMemoryBarrier2> image_barriers_;
+  std::vector<VkBufferMemoryBarrier2> buffer_barriers_;
+  std::vector<FrameGraphBarrierBatch> barrier_batches_;
+
+  FrameGraphStats stats_;
+
+  void add_image_use(u32 pass_index, FrameGraphImage image, const ImageAccess& access, bool writes);
+  void add_buffer_use(u32 pass_index, FrameGraphBuffer buffer, const BufferAccess& access,
+                      bool writes);
+
+  void cull_passes();
+  void merge_reads();
+  [[nodiscard]] auto memory_requirements(const TransientImageDesc& desc) -> VkMemoryRequirements;
+  [[nodiscard]] auto realized_images_match() const -> bool;
+};
+
+} // namespace charlie
+
+#endif // CHARLIE3D_FRAME_GRAPH_HPP
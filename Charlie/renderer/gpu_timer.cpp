@@ -0,0 +1,187 @@
+#include "gpu_timer.hpp"
+
+#include "../vulkan_helpers/context.hpp"
+#include "../vulkan_helpers/debug_utils.hpp"
+#include "../vulkan_helpers/error_handling.hpp"
+
+#include "../utils/smoothed_timing.hpp"
+
+#include <beyond/utils/narrowing.hpp>
+
+#include <array>
+
+#include <fmt/format.h>
+#include <tracy/Tracy.hpp>
+
+namespace charlie {
+
+namespace {
+
+constexpr u32 max_query_count = GPUTimer::max_pass_count * 2;
+
+// The results of a pipeline statistics query are in the bit order of these flags, and so are the
+// members of `GPUPipelineStatistics`
+constexpr VkQueryPipelineStatisticFlags pipeline_statistics =
+    VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+constexpr u32 pipeline_statistic_count = 5;
+
+} // anonymous namespace
+
+GPUTimer::GPUTimer(vkh::Context& context, u32 frames_in_flight)
+    : context_{context}, frames_(frames_in_flight)
+{
+  const VkPhysicalDeviceLimits& limits = context_.gpu_properties().limits;
+  supported_ = limits.timestampComputeAndGraphics == VK_TRUE;
+  pipeline_statistics_supported_ = supported_ && context_.supports_pipeline_statistics_query();
+  timestamp_period_ = limits.timestampPeriod;
+  if (!supported_) { return; }
+
+  for (usize i = 0; i < frames_.size(); ++i) {
+    const VkQueryPoolCreateInfo create_info{
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = max_query_count,
+    };
+    VK_CHECK(vkCreateQueryPool(context_, &create_info, nullptr, &frames_[i].query_pool));
+    VK_CHECK(vkh::set_debug_name(context_, frames_[i].query_pool,
+                                 fmt::format("GPU Timer Query Pool {}", i)));
+
+    if (!pipeline_statistics_supported_) { continue; }
+    const VkQueryPoolCreateInfo statistics_create_info{
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+        .queryCount = max_pass_count,
+        .pipelineStatistics = pipeline_statistics,
+    };
+    VK_CHECK(vkCreateQueryPool(context_, &statistics_create_info, nullptr,
+                               &frames_[i].statistics_query_pool));
+    VK_CHECK(vkh::set_debug_name(context_, frames_[i].statistics_query_pool,
+                                 fmt::format("GPU Timer Statistics Query Pool {}", i)));
+  }
+}
+
+GPUTimer::~GPUTimer()
+{
+  for (const FrameQueries& frame : frames_) {
+    vkDestroyQueryPool(context_, frame.query_pool, nullptr);
+    vkDestroyQueryPool(context_, frame.statistics_query_pool, nullptr);
+  }
+}
+
+void GPUTimer::cmd_begin_frame(VkCommandBuffer cmd, usize frame_index)
+{
+  if (!supported_) { return; }
+  ZoneScoped;
+
+  frame_index_ = frame_index;
+  FrameQueries& frame = frames_[frame_index];
+  read_back(frame);
+
+  frame.pass_names.clear();
+  vkCmdResetQueryPool(cmd, frame.query_pool, 0, max_query_count);
+  if (pipeline_statistics_supported_) {
+    vkCmdResetQueryPool(cmd, frame.statistics_query_pool, 0, max_pass_count);
+  }
+}
+
+auto GPUTimer::cmd_begin_pass(VkCommandBuffer cmd, std::string name) -> u32
+{
+  if (!supported_) { return 0; }
+
+  FrameQueries& frame = frames_[frame_index_];
+  const auto pass_index = beyond::narrow<u32>(frame.pass_names.size());
+  if (pass_index >= max_pass_count) { return pass_index; }
+
+  frame.pass_names.push_back(std::move(name));
+  vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, frame.query_pool,
+                       pass_index * 2);
+
+  // Queries of the same type can't nest
+  if (pipeline_statistics_supported_ && !statistics_pass_index_) {
+    vkCmdBeginQuery(cmd, frame.statistics_query_pool, pass_index, 0);
+    statistics_pass_index_ = pass_index;
+  }
+  return pass_index;
+}
+
+void GPUTimer::cmd_end_pass(VkCommandBuffer cmd, u32 pass_index)
+{
+  if (!supported_ || pass_index >= max_pass_count) { return; }
+
+  FrameQueries& frame = frames_[frame_index_];
+  vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT, frame.query_pool,
+                       pass_index * 2 + 1);
+
+  if (statistics_pass_index_ == pass_index) {
+    vkCmdEndQuery(cmd, frame.statistics_query_pool, pass_index);
+    statistics_pass_index_ = beyond::nullopt;
+  }
+}
+
+void GPUTimer::read_back(FrameQueries& frame)
+{
+  if (frame.pass_names.empty()) { return; }
+
+  // Each query returns its timestamp followed by its availability
+  std::array<u64, max_query_count * 2> results{};
+  const auto query_count = beyond::narrow<u32>(frame.pass_names.size() * 2);
+  const VkResult result = vkGetQueryPoolResults(
+      context_, frame.query_pool, 0, query_count, query_count * 2 * sizeof(u64), results.data(),
+      2 * sizeof(u64), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+  if (result != VK_SUCCESS && result != VK_NOT_READY) { VK_CHECK(result); }
+
+  // Each query returns its statistics followed by its availability. Queries of nested passes were
+  // never begun and stay unavailable
+  constexpr u32 statistics_stride = pipeline_statistic_count + 1;
+  std::array<u64, max_pass_count * statistics_stride> statistics_results{};
+  if (pipeline_statistics_supported_) {
+    const auto pass_count = beyond::narrow<u32>(frame.pass_names.size());
+    const VkResult statistics_result = vkGetQueryPoolResults(
+        context_, frame.statistics_query_pool, 0, pass_count,
+        pass_count * statistics_stride * sizeof(u64), statistics_results.data(),
+        statistics_stride * sizeof(u64),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+    if (statistics_result != VK_SUCCESS && statistics_result != VK_NOT_READY) {
+      VK_CHECK(statistics_result);
+    }
+  }
+
+  timings_.resize(frame.pass_names.size());
+
+  f32 frame_milliseconds = 0;
+  for (usize i = 0; i < frame.pass_names.size(); ++i) {
+    const u64 begin = results[i * 4];
+    const u64 begin_available = results[i * 4 + 1];
+    const u64 end = results[i * 4 + 2];
+    const u64 end_available = results[i * 4 + 3];
+    if (begin_available == 0 || end_available == 0 || end < begin) { continue; }
+
+    const f32 milliseconds = static_cast<f32>(end - begin) * timestamp_period_ * 1e-6f;
+    GPUPassTiming& timing = timings_[i];
+    if (update_smoothed_timing(timing, frame.pass_names[i], milliseconds)) {
+      timing.history = std::vector<f32>(history_length);
+    }
+    timing.history[history_offset_] = milliseconds;
+    frame_milliseconds += milliseconds;
+
+    const u64* statistics = &statistics_results[i * statistics_stride];
+    if (statistics[pipeline_statistic_count] != 0) {
+      timing.statistics = GPUPipelineStatistics{
+          .vertex_shader_invocations = statistics[0],
+          .clipping_invocations = statistics[1],
+          .clipping_primitives = statistics[2],
+          .fragment_shader_invocations = statistics[3],
+          .compute_shader_invocations = statistics[4],
+      };
+    }
+  }
+
+  frame_history_[history_offset_] = frame_milliseconds;
+  history_offset_ = (history_offset_ + 1) % history_length;
+}
+
+} // namespace charlie
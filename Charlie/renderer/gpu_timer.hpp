@@ -0,0 +1,125 @@
+#ifndef CHARLIE3D_GPU_TIMER_HPP
+#define CHARLIE3D_GPU_TIMER_HPP
+
+// Measures the GPU time of render passes with timestamp queries, and counts their shader
+// invocations and primitives with pipeline statistics queries when the device supports them.
+//
+// Each frame in flight has its own query pools. The results of a frame are read back when its frame
+// index gets reused, so the timings lag a few frames behind.
+
+#include "../utils/prelude.hpp"
+
+#include <beyond/types/optional.hpp>
+#include <vulkan/vulkan_core.h>
+
+#include <span>
+#include <string>
+#include <vector>
+
+namespace vkh {
+class Context;
+}
+
+namespace charlie {
+
+// Of the last read back frame only
+struct GPUPipelineStatistics {
+  u64 vertex_shader_invocations = 0;
+  u64 clipping_invocations = 0; // Primitives entering the clipper
+  u64 clipping_primitives = 0;  // Primitives leaving the clipper
+  u64 fragment_shader_invocations = 0;
+  u64 compute_shader_invocations = 0;
+};
+
+struct GPUPassTiming {
+  std::string name;
+  f32 milliseconds = 0;       // Smoothed over a few frames
+  f32 frame_milliseconds = 0; // Of the last read back frame only
+  std::vector<f32> history;   // `GPUTimer::history_length` frames, see `GPUTimer::history_offset`
+  GPUPipelineStatistics statistics;
+};
+
+class GPUTimer {
+public:
+  static constexpr u32 max_pass_count = 32;
+  static constexpr u32 history_length = 120;
+
+  // Ends the pass when going out of scope
+  class Scope {
+    GPUTimer* timer_ = nullptr;
+    VkCommandBuffer cmd_ = VK_NULL_HANDLE;
+    u32 pass_index_ = 0;
+
+  public:
+    Scope(GPUTimer& timer, VkCommandBuffer cmd, u32 pass_index)
+        : timer_{&timer}, cmd_{cmd}, pass_index_{pass_index}
+    {
+    }
+    ~Scope() { timer_->cmd_end_pass(cmd_, pass_index_); }
+
+    Scope(const Scope&) = delete;
+    auto operator=(const Scope&) & -> Scope& = delete;
+    Scope(Scope&&) noexcept = delete;
+    auto operator=(Scope&&) & noexcept -> Scope& = delete;
+  };
+
+  GPUTimer(vkh::Context& context, u32 frames_in_flight);
+  ~GPUTimer();
+
+  GPUTimer(const GPUTimer&) = delete;
+  auto operator=(const GPUTimer&) & -> GPUTimer& = delete;
+  GPUTimer(GPUTimer&&) noexcept = delete;
+  auto operator=(GPUTimer&&) & noexcept -> GPUTimer& = delete;
+
+  // Reads back the timings of the frame that last used `frame_index`, and resets its queries.
+  // Must be called after the GPU finished that frame.
+  void cmd_begin_frame(VkCommandBuffer cmd, usize frame_index);
+
+  // Returns the index to pass to `cmd_end_pass`. Passes beyond `max_pass_count` are not measured.
+  // Must be called outside of rendering. The pipeline statistics of nested passes are counted in
+  // the outermost pass only
+  [[nodiscard]] auto cmd_begin_pass(VkCommandBuffer cmd, std::string name) -> u32;
+  void cmd_end_pass(VkCommandBuffer cmd, u32 pass_index);
+
+  [[nodiscard]] auto scope(VkCommandBuffer cmd, std::string name) -> Scope
+  {
+    return Scope{*this, cmd, cmd_begin_pass(cmd, std::move(name))};
+  }
+
+  [[nodiscard]] auto supported() const -> bool { return supported_; }
+  [[nodiscard]] auto pipeline_statistics_supported() const -> bool
+  {
+    return pipeline_statistics_supported_;
+  }
+  [[nodiscard]] auto timings() const -> const std::vector<GPUPassTiming>& { return timings_; }
+
+  // GPU time of the passes of the last `history_length` frames
+  [[nodiscard]] auto frame_history() const -> std::span<const f32> { return frame_history_; }
+  // The histories are ring buffers, and this is the index of their oldest frame
+  [[nodiscard]] auto history_offset() const -> u32 { return history_offset_; }
+
+private:
+  struct FrameQueries {
+    VkQueryPool query_pool = VK_NULL_HANDLE; // Two queries per pass
+    VkQueryPool statistics_query_pool = VK_NULL_HANDLE;
+    std::vector<std::string> pass_names;
+  };
+
+  vkh::Context& context_;
+  bool supported_ = false;
+  bool pipeline_statistics_supported_ = false;
+  f32 timestamp_period_ = 1; // Nanoseconds per tick
+  std::vector<FrameQueries> frames_;
+  usize frame_index_ = 0;
+  std::vector<GPUPassTiming> timings_;
+  std::vector<f32> frame_history_ = std::vector<f32>(history_length);
+  u32 history_offset_ = 0;
+  // The pass whose pipeline statistics query is active
+  beyond::optional<u32> statistics_pass_index_ = beyond::nullopt;
+
+  void read_back(FrameQueries& frame);
+};
+
+} // namespace charlie
+
+#endif // CHARLIE3D_GPU_TIMER_HPP
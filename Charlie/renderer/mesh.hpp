@@ -20,6 +20,8 @@ struct SubMesh {
   u32 index_offset = 0;
   u32 index_count = 0;
   u32 material_index = 0;
+  u32 meshlet_offset = 0;
+  u32 meshlet_count = 0;
 };
 
 struct Mesh {
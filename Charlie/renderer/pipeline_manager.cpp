@@ -8,6 +8,8 @@
 #include <spdlog/spdlog.h>
 
 #include <algorithm>
+#include <deque>
+#include <vector>
 
 #include <tracy/Tracy.hpp>
 
@@ -126,14 +128,18 @@ auto create_graphics_pipeline_impl(
       .sampleShadingEnable = VK_FALSE,
   };
 
-  const VkPipelineColorBlendAttachmentState& color_blend_attachment = create_info.color_blending;
+  // Every color attachment blends the same way
+  const std::size_t color_attachment_count =
+      create_info.pipeline_rendering_create_info.color_attachment_formats.size();
+  const std::vector<VkPipelineColorBlendAttachmentState> color_blend_attachments(
+      std::max<std::size_t>(color_attachment_count, 1), create_info.color_blending);
 
   const VkPipelineColorBlendStateCreateInfo color_blending{
       .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
       .logicOpEnable = VK_FALSE,
       .logicOp = VK_LOGIC_OP_COPY,
-      .attachmentCount = 1,
-      .pAttachments = &color_blend_attachment,
+      .attachmentCount = beyond::narrow<uint32_t>(color_blend_attachments.size()),
+      .pAttachments = color_blend_attachments.data(),
       .blendConstants = {0.0f, 0.0f, 0.0f, 0.0f},
   };
 
@@ -227,43 +233,54 @@ struct Shaders {
   }
 };
 
+struct OwnedSpecializationInfo {
+  std::vector<VkSpecializationMapEntry> map_entries;
+  std::vector<u8> data;
+  VkSpecializationInfo info = {};
+};
+
 struct PipelineCreateInfoCache {
   std::vector<GraphicsPipelineCreateInfo> graphics_pipeline_create_infos;
   std::vector<ComputePipelineCreateInfo> compute_pipeline_create_infos;
 
+  // The create infos are used again to recreate pipelines on shader reloads, so the cache keeps
+  // copies of the specialization infos that they point to. A deque never moves its elements
+  std::deque<OwnedSpecializationInfo> specialization_infos;
+
+  [[nodiscard]] auto copy_specialization_info(const VkSpecializationInfo* specialization_info)
+      -> const VkSpecializationInfo*
+  {
+    if (specialization_info == nullptr) { return nullptr; }
+
+    OwnedSpecializationInfo& copy = specialization_infos.emplace_back();
+    copy.map_entries.assign(specialization_info->pMapEntries,
+                            specialization_info->pMapEntries + specialization_info->mapEntryCount);
+    const auto* data = static_cast<const u8*>(specialization_info->pData);
+    copy.data.assign(data, data + specialization_info->dataSize);
+    copy.info = VkSpecializationInfo{
+        .mapEntryCount = specialization_info->mapEntryCount,
+        .pMapEntries = copy.map_entries.data(),
+        .dataSize = specialization_info->dataSize,
+        .pData = copy.data.data(),
+    };
+    return &copy.info;
+  }
+
   [[nodiscard]] auto add(GraphicsPipelineCreateInfo create_info) -> GraphicsPipelineHandle
   {
-    beyond::StaticVector<ShaderStageCreateInfo, 6> new_shader_info;
-    for (auto shader_info : create_info.stages) {
-      if (shader_info.p_specialization_info != nullptr) {
-        auto* new_specialization_info = new VkSpecializationInfo{
-            .mapEntryCount = shader_info.p_specialization_info->mapEntryCount,
-            .dataSize = shader_info.p_specialization_info->dataSize,
-        };
-        auto* map_entries = new VkSpecializationMapEntry[new_specialization_info->mapEntryCount];
-        std::copy_n(shader_info.p_specialization_info->pMapEntries,
-                    shader_info.p_specialization_info->mapEntryCount, map_entries);
-        new_specialization_info->pMapEntries = map_entries;
-
-        auto* data = new u8[shader_info.p_specialization_info->dataSize];
-        memcpy(data, shader_info.p_specialization_info->pData,
-               shader_info.p_specialization_info->dataSize);
-        new_specialization_info->pData = data;
-
-        shader_info.p_specialization_info = new_specialization_info;
-      }
-
-      new_shader_info.push_back(shader_info);
+    for (ShaderStageCreateInfo& shader_info : create_info.stages) {
+      shader_info.p_specialization_info =
+          copy_specialization_info(shader_info.p_specialization_info);
     }
 
-    create_info.stages = BEYOND_MOV(new_shader_info);
     graphics_pipeline_create_infos.push_back(create_info);
     return GraphicsPipelineHandle{narrow<u32>(graphics_pipeline_create_infos.size() - 1)};
   }
 
   [[nodiscard]] auto add(ComputePipelineCreateInfo create_info) -> ComputePipelineHandle
   {
-    // TODO: specialization info
+    create_info.stage.p_specialization_info =
+        copy_specialization_info(create_info.stage.p_specialization_info);
 
     compute_pipeline_create_infos.push_back(create_info);
     return ComputePipelineHandle{narrow<u32>(compute_pipeline_create_infos.size() - 1)};
@@ -15,6 +15,14 @@
 #include <beyond/types/optional.hpp>
 #include <beyond/utils/defer.hpp>
 
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <utility>
+
 #include "camera.hpp"
 #include "mesh.hpp"
 
@@ -31,80 +39,125 @@ struct GPUCameraData {
   beyond::Mat4 view;
   beyond::Mat4 proj;
   beyond::Mat4 view_proj;
+  beyond::Mat4 inverse_view_proj;
   beyond::Vec3 position;
 };
 
-void transit_current_swapchain_image_for_rendering(VkCommandBuffer cmd,
-                                                   VkImage current_swapchain_image)
-{
-  ZoneScoped;
+// Specialization constants of mesh.frag.glsl and of the shadow filtering in shadow.h.glsl
+struct ShadingSpecializationConstants {
+  u32 shadow_blocker_search_sample_count = 4; // Each sample gathers 2x2 texels (at most 16)
+  u32 shadow_pcf_sample_count = 8;           // Each sample is a 2x2 comparison (at most 16)
+  VkBool32 shadow_mask_available = VK_FALSE; // Only solid draws are in the depth prepass
+};
 
-  const auto image_memory_barrier_to_render =
-      vkh::ImageBarrier{
-          .stage_masks = {VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
-                          VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT},
-          .access_masks = {VK_ACCESS_2_NONE, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT},
-          .layouts = {VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL},
-          .image = current_swapchain_image,
-          .subresource_range = vkh::SubresourceRange{.aspect_mask = VK_IMAGE_ASPECT_COLOR_BIT},
-      }
-          .to_vk_struct();
-  vkh::cmd_pipeline_barrier(cmd, {.image_barriers = std::array{image_memory_barrier_to_render}});
-}
+constexpr VkSpecializationMapEntry shading_specialization_map_entries[] = {
+    {.constantID = 0,
+     .offset = offsetof(ShadingSpecializationConstants, shadow_blocker_search_sample_count),
+     .size = sizeof(u32)},
+    {.constantID = 1,
+     .offset = offsetof(ShadingSpecializationConstants, shadow_pcf_sample_count),
+     .size = sizeof(u32)},
+    {.constantID = 2,
+     .offset = offsetof(ShadingSpecializationConstants, shadow_mask_available),
+     .size = sizeof(VkBool32)},
+};
 
-void transit_current_swapchain_image_to_present(VkCommandBuffer cmd,
-                                                VkImage current_swapchain_image)
+[[nodiscard]] auto shading_specialization_info(const ShadingSpecializationConstants& constants)
+    -> VkSpecializationInfo
 {
-  ZoneScoped;
+  return VkSpecializationInfo{
+      .mapEntryCount = narrow<u32>(std::size(shading_specialization_map_entries)),
+      .pMapEntries = shading_specialization_map_entries,
+      .dataSize = sizeof(ShadingSpecializationConstants),
+      .pData = &constants,
+  };
+}
 
-  const auto image_memory_barrier_to_present =
-      vkh::ImageBarrier{
-          .stage_masks = {VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
-                          VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT},
-          .access_masks = {VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, VK_ACCESS_2_NONE},
-          .layouts = {VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR},
-          .image = current_swapchain_image,
-          .subresource_range = vkh::SubresourceRange{.aspect_mask = VK_IMAGE_ASPECT_COLOR_BIT},
-      }
-          .to_vk_struct();
-  vkh::cmd_pipeline_barrier(cmd, {.image_barriers = std::array{image_memory_barrier_to_present}});
+// The compute shading passes write the HDR image as a storage image, which B10G11R11 does not
+// have to support
+[[nodiscard]] auto select_hdr_image_format(VkPhysicalDevice physical_device,
+                                           charlie::HDRFormat hdr_format) -> VkFormat
+{
+  if (hdr_format == charlie::HDRFormat::b10g11r11) {
+    VkFormatProperties properties{};
+    vkGetPhysicalDeviceFormatProperties(physical_device, VK_FORMAT_B10G11R11_UFLOAT_PACK32,
+                                        &properties);
+    static constexpr VkFormatFeatureFlags required_features =
+        VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BLEND_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT |
+        VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT;
+    if ((properties.optimalTilingFeatures & required_features) == required_features) {
+      return VK_FORMAT_B10G11R11_UFLOAT_PACK32;
+    }
+    SPDLOG_WARN("B10G11R11 HDR image is not supported, falling back to RGBA16F");
+  }
+  return VK_FORMAT_R16G16B16A16_SFLOAT;
 }
 
+// Transient images of the frame graph
+constexpr std::string_view depth_pyramid_name = "Depth Pyramid";
+constexpr std::string_view shadow_mask_name = "Shadow Mask";
+constexpr std::string_view visibility_buffer_name = "Visibility Buffer";
+constexpr std::string_view gbuffer_base_color_name = "G-Buffer Base Color";
+constexpr std::string_view gbuffer_normal_name = "G-Buffer Normal";
+constexpr std::string_view gbuffer_material_name = "G-Buffer Material";
+
 } // anonymous namespace
 
 namespace charlie {
 
-Renderer::Renderer(Window& window, InputHandler& input_handler)
-    : window_{&window}, resolution_{window.resolution()}, context_{window},
+Renderer::Renderer(Window& window, InputHandler& input_handler, HDRFormat hdr_format)
+    : Renderer{&window, window.resolution(), hdr_format}
+{
+  input_handler.add_listener(std::bind_front(&Renderer::on_input_event, std::ref(*this)));
+}
+
+Renderer::Renderer(Resolution resolution, HDRFormat hdr_format)
+    : Renderer{nullptr, resolution, hdr_format}
+{
+}
+
+Renderer::Renderer(Window* window, Resolution resolution, HDRFormat hdr_format)
+    : window_{window}, resolution_{resolution}, context_{window},
       graphics_queue_{context_.graphics_queue()},
       sampler_cache_{std::make_unique<SamplerCache>(context_.device())},
-      swapchain_{context_, {.extent = to_extent2d(resolution_)}},
+      swapchain_{window != nullptr ? vkh::Swapchain{context_, {.extent = to_extent2d(resolution_)}}
+                                   : vkh::Swapchain{}},
       upload_context_{init_upload_context(context_).expect("Failed to create upload context")},
       frame_deletion_queue_{DeletionQueue{context_}, DeletionQueue{context_}},
       shader_compiler_{std::make_unique<ShaderCompiler>()},
       pipeline_manager_{std::make_unique<PipelineManager>(context_)},
       textures_{std::make_unique<TextureManager>(context_, upload_context_,
-                                                 sampler_cache_->default_sampler())}
+                                                 sampler_cache_->default_sampler(), frame_overlap)},
+      texture_streamer_{std::make_unique<TextureStreamer>(context_, *textures_, frame_overlap)},
+      gpu_timer_{std::make_unique<GPUTimer>(context_, frame_overlap)},
+      frame_graph_{std::make_unique<FrameGraph>(context_)}
 {
+  final_hdr_image_format_ = select_hdr_image_format(context_.physical_device(), hdr_format);
+
   init_depth_image();
   init_final_hdr_image();
+  if (headless()) { init_offscreen_image(); }
 
   shadow_map_renderer_ = std::make_unique<ShadowMapRenderer>(*this, ref(*sampler_cache_));
 
   init_frame_data();
+
+  // The descriptor sets refer to the transient images of the frame graph
+  build_frame_graph(output_image(), output_image_view());
+  if (frame_graph_->compile()) { frame_graph_->realize(); }
+
   init_descriptors();
+  init_depth_pyramid();
   init_pipelines();
 
   shadow_map_renderer_->init_pipeline();
 
-  {
+  if (!headless()) {
     ZoneScopedN("Imgui Render Pass");
 
     imgui_render_pass_ =
-        std::make_unique<ImguiRenderPass>(*this, window.raw_window(), swapchain_.image_format());
+        std::make_unique<ImguiRenderPass>(*this, window->raw_window(), output_image_format());
   }
-
-  input_handler.add_listener(std::bind_front(&Renderer::on_input_event, std::ref(*this)));
 }
 
 auto Renderer::upload_image(const charlie::CPUImage& cpu_image, const ImageUploadInfo& upload_info)
@@ -157,8 +210,10 @@ void Renderer::init_depth_image()
                         vkh::ImageCreateInfo{
                             .format = depth_format,
                             .extent = VkExtent3D{resolution_.width, resolution_.height, 1},
-                            .usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+                            .usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+                                     VK_IMAGE_USAGE_SAMPLED_BIT,
                             .debug_name = "Depth Image",
+                            .category = vkh::MemoryCategory::render_target,
                         })
           .expect("Fail to create depth image");
   depth_image_view_ =
@@ -173,6 +228,254 @@ void Renderer::init_depth_image()
           .expect("Fail to create depth image view");
 }
 
+void Renderer::init_depth_pyramid()
+{
+  ZoneScoped;
+
+  if (depth_pyramid_sampler_ == VK_NULL_HANDLE) {
+    // Linear filtering with a min reduction returns the farthest (reverse-Z) depth of the 2x2 texel
+    // footprint
+    const VkSamplerReductionModeCreateInfo reduction_mode_info{
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_REDUCTION_MODE_CREATE_INFO,
+        .reductionMode = VK_SAMPLER_REDUCTION_MODE_MIN,
+    };
+    const VkSamplerCreateInfo sampler_create_info{
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+        .pNext = &reduction_mode_info,
+        .magFilter = VK_FILTER_LINEAR,
+        .minFilter = VK_FILTER_LINEAR,
+        .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+        .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .minLod = 0.0f,
+        .maxLod = VK_LOD_CLAMP_NONE,
+    };
+    VK_CHECK(vkCreateSampler(context_, &sampler_create_info, nullptr, &depth_pyramid_sampler_));
+  }
+
+  depth_pyramid_ = frame_graph_->transient_image(depth_pyramid_name);
+  depth_pyramid_view_ =
+      vkh::create_image_view(context_,
+                             vkh::ImageViewCreateInfo{
+                                 .image = depth_pyramid_,
+                                 .format = depth_pyramid_format,
+                                 .subresource_range =
+                                     vkh::SubresourceRange{
+                                         .aspect_mask = VK_IMAGE_ASPECT_COLOR_BIT,
+                                         .level_count = depth_pyramid_level_count_,
+                                     },
+                                 .debug_name = "Depth Pyramid View"})
+          .expect("Fail to create depth pyramid view");
+
+  depth_pyramid_level_views_.resize(depth_pyramid_level_count_);
+  depth_pyramid_level_descriptor_sets_.resize(depth_pyramid_level_count_);
+  for (u32 level = 0; level < depth_pyramid_level_count_; ++level) {
+    depth_pyramid_level_views_[level] =
+        vkh::create_image_view(
+            context_,
+            vkh::ImageViewCreateInfo{
+                .image = depth_pyramid_,
+                .format = depth_pyramid_format,
+                .subresource_range =
+                    vkh::SubresourceRange{
+                        .aspect_mask = VK_IMAGE_ASPECT_COLOR_BIT,
+                        .base_mip_level = level,
+                    },
+                .debug_name = fmt::format("Depth Pyramid Level {} View", level)})
+            .expect("Fail to create depth pyramid level view");
+
+    // Each level is reduced from the previous level, and the first level from the depth image
+    const VkDescriptorImageInfo source_image_info =
+        level == 0 ? VkDescriptorImageInfo{.sampler = depth_pyramid_sampler_,
+                                           .imageView = depth_image_view_,
+                                           .imageLayout = VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL}
+                   : VkDescriptorImageInfo{.sampler = depth_pyramid_sampler_,
+                                           .imageView = depth_pyramid_level_views_[level - 1],
+                                           .imageLayout = VK_IMAGE_LAYOUT_GENERAL};
+    const VkDescriptorImageInfo destination_image_info{
+        .imageView = depth_pyramid_level_views_[level],
+        .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+    };
+
+    const auto result =
+        DescriptorBuilder{*descriptor_layout_cache_, *frame_graph_descriptor_allocator_} //
+            .bind_image(0, source_image_info, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                        VK_SHADER_STAGE_COMPUTE_BIT)
+            .bind_image(1, destination_image_info, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                        VK_SHADER_STAGE_COMPUTE_BIT)
+            .build()
+            .value();
+    depth_pyramid_level_descriptor_sets_[level] = result.set;
+    depth_pyramid_level_descriptor_set_layout_ = result.layout;
+  }
+
+  const VkDescriptorImageInfo depth_pyramid_image_info{
+      .sampler = depth_pyramid_sampler_,
+      .imageView = depth_pyramid_view_,
+      .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+  };
+  // Draws are culled in compute shaders, and meshlets in task shaders
+  const auto result =
+      DescriptorBuilder{*descriptor_layout_cache_, *frame_graph_descriptor_allocator_} //
+          .bind_image(0, depth_pyramid_image_info, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                      VK_SHADER_STAGE_COMPUTE_BIT | mesh_shading_shader_stages())
+          .build()
+          .value();
+  depth_pyramid_descriptor_set_ = result.set;
+  depth_pyramid_descriptor_set_layout_ = result.layout;
+}
+
+void Renderer::init_shadow_mask()
+{
+  ZoneScoped;
+
+  shadow_mask_ = frame_graph_->transient_image(shadow_mask_name);
+  shadow_mask_view_ =
+      vkh::create_image_view(
+          context_, vkh::ImageViewCreateInfo{.image = shadow_mask_,
+                                             .format = shadow_mask_format,
+                                             .subresource_range =
+                                                 vkh::SubresourceRange{
+                                                     .aspect_mask = VK_IMAGE_ASPECT_COLOR_BIT,
+                                                 },
+                                             .debug_name = "Shadow Mask View"})
+          .expect("Fail to create shadow mask image view");
+
+  const VkDescriptorImageInfo depth_image_info{
+      .sampler = sampler_cache_->default_blocky_sampler(),
+      .imageView = depth_image_view_,
+      .imageLayout = VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL,
+  };
+  const VkDescriptorImageInfo shadow_mask_image_info{
+      .imageView = shadow_mask_view_,
+      .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+  };
+  const auto result =
+      DescriptorBuilder{*descriptor_layout_cache_, *frame_graph_descriptor_allocator_} //
+          .bind_image(0, depth_image_info, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                      VK_SHADER_STAGE_COMPUTE_BIT)
+          .bind_image(1, shadow_mask_image_info, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                      VK_SHADER_STAGE_COMPUTE_BIT)
+          .build()
+          .value();
+  shadow_mask_descriptor_set_ = result.set;
+  shadow_mask_descriptor_set_layout_ = result.layout;
+}
+
+void Renderer::init_visibility_buffer()
+{
+  ZoneScoped;
+
+  visibility_buffer_image_ = frame_graph_->transient_image(visibility_buffer_name);
+  visibility_buffer_image_view_ =
+      vkh::create_image_view(
+          context_, vkh::ImageViewCreateInfo{.image = visibility_buffer_image_,
+                                             .format = visibility_buffer_format,
+                                             .subresource_range =
+                                                 vkh::SubresourceRange{
+                                                     .aspect_mask = VK_IMAGE_ASPECT_COLOR_BIT,
+                                                 },
+                                             .debug_name = "Visibility Buffer View"})
+          .expect("Fail to create visibility buffer image view");
+
+  const VkDescriptorImageInfo visibility_buffer_image_info{
+      .imageView = visibility_buffer_image_view_,
+      .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+  };
+  const VkDescriptorImageInfo output_image_info{
+      .imageView = final_hdr_image_view_,
+      .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+  };
+  const auto result =
+      DescriptorBuilder{*descriptor_layout_cache_, *frame_graph_descriptor_allocator_} //
+          .bind_image(0, visibility_buffer_image_info, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                      VK_SHADER_STAGE_COMPUTE_BIT)
+          .bind_image(1, output_image_info, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                      VK_SHADER_STAGE_COMPUTE_BIT)
+          .build()
+          .value();
+  visibility_resolve_descriptor_set_ = result.set;
+  visibility_resolve_descriptor_set_layout_ = result.layout;
+}
+
+void Renderer::init_gbuffer()
+{
+  ZoneScoped;
+
+  const auto create_target = [&](VkFormat format, std::string_view name, const char* view_name,
+                                 VkImage& image, VkImageView& view) {
+    image = frame_graph_->transient_image(name);
+    view = vkh::create_image_view(
+               context_,
+               vkh::ImageViewCreateInfo{.image = image,
+                                        .format = format,
+                                        .subresource_range =
+                                            vkh::SubresourceRange{
+                                                .aspect_mask = VK_IMAGE_ASPECT_COLOR_BIT,
+                                            },
+                                        .debug_name = view_name})
+               .expect("Fail to create G-buffer image view");
+  };
+  create_target(gbuffer_base_color_format, gbuffer_base_color_name, "G-Buffer Base Color View",
+                gbuffer_base_color_, gbuffer_base_color_view_);
+  create_target(gbuffer_normal_format, gbuffer_normal_name, "G-Buffer Normal View",
+                gbuffer_normal_, gbuffer_normal_view_);
+  create_target(gbuffer_material_format, gbuffer_material_name, "G-Buffer Material View",
+                gbuffer_material_, gbuffer_material_view_);
+
+  const VkSampler sampler = sampler_cache_->default_blocky_sampler();
+  const VkDescriptorImageInfo depth_image_info{
+      .sampler = sampler,
+      .imageView = depth_image_view_,
+      .imageLayout = VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL,
+  };
+  const VkDescriptorImageInfo base_color_image_info{
+      .sampler = sampler,
+      .imageView = gbuffer_base_color_view_,
+      .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+  };
+  const VkDescriptorImageInfo normal_image_info{
+      .sampler = sampler,
+      .imageView = gbuffer_normal_view_,
+      .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+  };
+  const VkDescriptorImageInfo material_image_info{
+      .sampler = sampler,
+      .imageView = gbuffer_material_view_,
+      .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+  };
+  const VkDescriptorImageInfo output_image_info{
+      .imageView = final_hdr_image_view_,
+      .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+  };
+  const auto result =
+      DescriptorBuilder{*descriptor_layout_cache_, *frame_graph_descriptor_allocator_} //
+          .bind_image(0, depth_image_info, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                      VK_SHADER_STAGE_COMPUTE_BIT)
+          .bind_image(1, base_color_image_info, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                      VK_SHADER_STAGE_COMPUTE_BIT)
+          .bind_image(2, normal_image_info, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                      VK_SHADER_STAGE_COMPUTE_BIT)
+          .bind_image(3, material_image_info, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                      VK_SHADER_STAGE_COMPUTE_BIT)
+          .bind_image(4, output_image_info, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                      VK_SHADER_STAGE_COMPUTE_BIT)
+          .build()
+          .value();
+  deferred_lighting_descriptor_set_ = result.set;
+  deferred_lighting_descriptor_set_layout_ = result.layout;
+}
+
+auto Renderer::shadow_mask_image_info() const -> VkDescriptorImageInfo
+{
+  return {
+      .sampler = sampler_cache_->default_blocky_sampler(),
+      .imageView = shadow_mask_view_,
+      .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+  };
+}
+
 void Renderer::init_final_hdr_image()
 {
   ZoneScoped;
@@ -181,16 +484,18 @@ void Renderer::init_final_hdr_image()
       vkh::create_image(
           context_,
           vkh::ImageCreateInfo{
-              .format = final_hdr_image_format,
+              .format = final_hdr_image_format_,
               .extent = VkExtent3D{resolution_.width, resolution_.height, 1},
-              .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+              .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT |
+                       VK_IMAGE_USAGE_STORAGE_BIT, // Written by the compute shading passes
               .debug_name = "Final HDR Image",
+              .category = vkh::MemoryCategory::render_target,
           })
           .expect("Fail to create final hdr image");
   final_hdr_image_view_ =
       vkh::create_image_view(
           context_, vkh::ImageViewCreateInfo{.image = final_hdr_image_.image,
-                                             .format = final_hdr_image_format,
+                                             .format = final_hdr_image_format_,
                                              .subresource_range =
                                                  vkh::SubresourceRange{
                                                      .aspect_mask = VK_IMAGE_ASPECT_COLOR_BIT,
@@ -199,6 +504,84 @@ void Renderer::init_final_hdr_image()
           .expect("Fail to create final hdr image view");
 }
 
+void Renderer::init_offscreen_image()
+{
+  ZoneScoped;
+
+  offscreen_image_ =
+      vkh::create_image(context_,
+                        vkh::ImageCreateInfo{
+                            .format = offscreen_image_format,
+                            .extent = VkExtent3D{resolution_.width, resolution_.height, 1},
+                            .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                                     VK_IMAGE_USAGE_TRANSFER_SRC_BIT, // Read back to the CPU
+                            .debug_name = "Offscreen Image",
+                            .category = vkh::MemoryCategory::render_target,
+                        })
+          .expect("Fail to create offscreen image");
+  offscreen_image_view_ =
+      vkh::create_image_view(
+          context_, vkh::ImageViewCreateInfo{.image = offscreen_image_.image,
+                                             .format = offscreen_image_format,
+                                             .subresource_range =
+                                                 vkh::SubresourceRange{
+                                                     .aspect_mask = VK_IMAGE_ASPECT_COLOR_BIT,
+                                                 },
+                                             .debug_name = "Offscreen Image View"})
+          .expect("Fail to create offscreen image view");
+}
+
+auto Renderer::settings() const -> RendererSettings
+{
+  return RendererSettings{
+      .occlusion_culling = occlusion_culling_enabled_,
+      .depth_prepass = depth_prepass_enabled_,
+      .shading_path = shading_path_,
+      .mesh_shading = mesh_shading_enabled_,
+      .cluster_culling = cluster_culling_enabled_,
+      .triangle_culling = triangle_culling_enabled_,
+      .auto_exposure = auto_exposure_enabled_,
+      .exposure_compensation = exposure_compensation_,
+      .sunlight_direction = scene_parameters_.sunlight_direction,
+      .sunlight_color = scene_parameters_.sunlight_color,
+      .sunlight_shadow_mode = scene_parameters_.sunlight_shadow_mode,
+      .sunlight_shadow_filtering = scene_parameters_.sunlight_shadow_filtering,
+      .sunlight_shadow_mask = scene_parameters_.sunlight_shadow_mask,
+  };
+}
+
+void Renderer::set_settings(const RendererSettings& settings)
+{
+  occlusion_culling_enabled_ = settings.occlusion_culling;
+  depth_prepass_enabled_ = settings.depth_prepass;
+  shading_path_ = settings.shading_path;
+  mesh_shading_enabled_ = settings.mesh_shading;
+  cluster_culling_enabled_ = settings.cluster_culling;
+  triangle_culling_enabled_ = settings.triangle_culling;
+  auto_exposure_enabled_ = settings.auto_exposure;
+  exposure_compensation_ = settings.exposure_compensation;
+  scene_parameters_.sunlight_direction = settings.sunlight_direction;
+  scene_parameters_.sunlight_color = settings.sunlight_color;
+  scene_parameters_.sunlight_shadow_mode = settings.sunlight_shadow_mode;
+  scene_parameters_.sunlight_shadow_filtering = settings.sunlight_shadow_filtering;
+  scene_parameters_.sunlight_shadow_mask = settings.sunlight_shadow_mask;
+}
+
+auto Renderer::output_image() const -> VkImage
+{
+  return headless() ? offscreen_image_.image : swapchain_.current_image();
+}
+
+auto Renderer::output_image_view() const -> VkImageView
+{
+  return headless() ? offscreen_image_view_ : swapchain_.current_image_view();
+}
+
+auto Renderer::output_image_format() const -> VkFormat
+{
+  return headless() ? offscreen_image_format : swapchain_.image_format();
+}
+
 void Renderer::init_descriptors()
 {
   ZoneScoped;
@@ -206,18 +589,10 @@ void Renderer::init_descriptors()
   descriptor_allocator_ = std::make_unique<DescriptorAllocator>(context_);
   descriptor_layout_cache_ = std::make_unique<DescriptorLayoutCache>(context_.device());
 
-  static constexpr VkDescriptorSetLayoutBinding material_bindings[] = {
-      {.binding = 0,
-       .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-       .descriptorCount = 1,
-       .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT},
-  };
-  material_descriptor_set_layout = descriptor_layout_cache_
-                                       ->create_descriptor_set_layout({
-                                           .p_next = nullptr,
-                                           .bindings = material_bindings,
-                                       })
-                                       .value();
+  // The global descriptor sets sample the shadow mask
+  init_shadow_mask();
+  init_visibility_buffer();
+  init_gbuffer();
 
   const size_t scene_param_buffer_size =
       frame_overlap * context_.align_uniform_buffer_size(sizeof(GPUSceneParameters));
@@ -227,9 +602,48 @@ void Renderer::init_descriptors()
                                                    .usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
                                                    .memory_usage = VMA_MEMORY_USAGE_CPU_TO_GPU,
                                                    .debug_name = "Scene Parameter buffer",
+                                                   .category = vkh::MemoryCategory::scene_data,
                                                })
                                 .value();
 
+  // The light grid has a fixed number of clusters regardless of the resolution
+  light_cluster_buffer_ =
+      vkh::create_buffer(context_,
+                         vkh::BufferCreateInfo{
+                             .size = light_grid_width * light_grid_height * light_grid_depth *
+                                     (max_lights_per_cluster + 1) * sizeof(u32),
+                             .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                      VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                             .memory_usage = VMA_MEMORY_USAGE_GPU_ONLY,
+                             .debug_name = "Light Clusters",
+                             .category = vkh::MemoryCategory::scene_data,
+                         })
+          .value();
+
+  luminance_histogram_buffer_ =
+      vkh::create_buffer(context_,
+                         vkh::BufferCreateInfo{
+                             .size = luminance_histogram_bin_count * sizeof(u32),
+                             .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                      VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                                      VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                             .memory_usage = VMA_MEMORY_USAGE_GPU_ONLY,
+                             .debug_name = "Luminance Histogram",
+                             .category = vkh::MemoryCategory::scene_data,
+                         })
+          .value();
+  exposure_buffer_ =
+      vkh::create_buffer(context_,
+                         vkh::BufferCreateInfo{
+                             .size = 2 * sizeof(f32),
+                             .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                      VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                             .memory_usage = VMA_MEMORY_USAGE_GPU_ONLY,
+                             .debug_name = "Exposure",
+                             .category = vkh::MemoryCategory::scene_data,
+                         })
+          .value();
+
   for (auto i = 0u; i < frame_overlap; ++i) {
     FrameData& frame = frames_[i];
     frame.camera_buffer = vkh::create_buffer(context_,
@@ -238,6 +652,7 @@ void Renderer::init_descriptors()
                                                  .usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
                                                  .memory_usage = VMA_MEMORY_USAGE_CPU_TO_GPU,
                                                  .debug_name = fmt::format("Camera Buffer {}", i),
+                                                 .category = vkh::MemoryCategory::scene_data,
                                              })
                               .value();
 
@@ -248,6 +663,19 @@ void Renderer::init_descriptors()
                                .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
                                .memory_usage = VMA_MEMORY_USAGE_CPU_TO_GPU,
                                .debug_name = fmt::format("Objects Buffer {}", i),
+                               .category = vkh::MemoryCategory::transform,
+                           })
+            .value();
+
+    frame.light_buffer =
+        vkh::create_buffer(context_,
+                           vkh::BufferCreateInfo{
+                               .size = sizeof(GPUPunctualLight) * max_light_count,
+                               .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                               .memory_usage = VMA_MEMORY_USAGE_CPU_TO_GPU,
+                               .debug_name = fmt::format("Light Buffer {}", i),
+                               .category = vkh::MemoryCategory::scene_data,
                            })
             .value();
 
@@ -260,11 +688,22 @@ void Renderer::init_descriptors()
     auto global_descriptor_build_result =
         DescriptorBuilder{*descriptor_layout_cache_, *descriptor_allocator_} //
             .bind_buffer(0, camera_buffer_info, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                         VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT)
+                         VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT |
+                             VK_SHADER_STAGE_COMPUTE_BIT | mesh_shading_shader_stages())
             .bind_buffer(1, scene_buffer_info, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
-                         VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT)
+                         VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT |
+                             VK_SHADER_STAGE_COMPUTE_BIT)
             .bind_image(2, shadow_map_renderer_->shadow_map_image_info(),
-                        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
+                        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                        VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT)
+            .bind_image(3, shadow_map_renderer_->shadow_map_compare_image_info(),
+                        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                        VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT)
+            .bind_image(4, shadow_map_renderer_->blue_noise_image_info(),
+                        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                        VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT)
+            .bind_image(5, shadow_mask_image_info(), VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                        VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT)
             .build()
             .value();
     if (global_descriptor_set_layout == VK_NULL_HANDLE) {
@@ -282,7 +721,8 @@ void Renderer::init_descriptors()
     auto objects_descriptor_build_result =
         DescriptorBuilder{*descriptor_layout_cache_, *descriptor_allocator_} //
             .bind_buffer(0, transform_buffer_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-                         VK_SHADER_STAGE_VERTEX_BIT)
+                         VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT |
+                             mesh_shading_shader_stages())
             .build()
             .value();
     object_descriptor_set_layout = objects_descriptor_build_result.layout;
@@ -295,16 +735,36 @@ void Renderer::init_pipelines()
   ZoneScoped;
 
   init_generate_draws_pipeline();
+  init_cluster_culling_pipeline();
+  init_light_assignment_pipeline();
+  init_depth_pyramid_pipeline();
 
   init_mesh_pipeline();
+  init_depth_prepass_pipeline();
+  init_shadow_mask_pipeline();
+  init_visibility_buffer_pipelines();
+  init_deferred_shading_pipelines();
+  if (mesh_shading_supported()) { init_mesh_shading_pipeline(); }
 
   init_tonemapping_pipeline();
+  init_auto_exposure_pipelines();
 }
 
 struct GenerateDrawsPushConstant {
   VkDeviceAddress draws_buffer_address = 0;
   VkDeviceAddress draws_indirect_buffer_address = 0;
+  VkDeviceAddress draw_count_buffer_address = 0;
+  VkDeviceAddress draw_visibility_buffer_address = 0;
+  VkDeviceAddress mesh_task_buffer_address = 0;
+  VkDeviceAddress draw_slot_buffer_address = 0;
   u32 total_draws_count = 0;
+  u32 solid_draws_count = 0;
+  u32 phase = 0;
+  u32 occlusion_culling_enabled = 0;
+  f32 depth_pyramid_width = 0;
+  f32 depth_pyramid_height = 0;
+  u32 mesh_tasks_enabled = 0;
+  u32 cluster_culling_enabled = 0;
 };
 
 void Renderer::init_generate_draws_pipeline()
@@ -320,8 +780,13 @@ void Renderer::init_generate_draws_pipeline()
       .size = sizeof(GenerateDrawsPushConstant),
   }};
 
+  const VkDescriptorSetLayout set_layouts[] = {
+      global_descriptor_set_layout, object_descriptor_set_layout,
+      depth_pyramid_descriptor_set_layout_};
+
   generate_draws_layout_ = vkh::create_pipeline_layout(context_,
                                                        {
+                                                           .set_layouts = set_layouts,
                                                            .push_constant_ranges = push_constant,
                                                        })
                                .value();
@@ -335,6 +800,112 @@ void Renderer::init_generate_draws_pipeline()
   generate_draws_pipeline_ = pipeline_manager_->create_compute_pipeline(create_info);
 }
 
+// A meshlet of a solid draw
+struct Cluster {
+  u32 draw_index = 0;
+  u32 meshlet_index = 0;
+};
+
+struct ClusterCullingPushConstant {
+  VkDeviceAddress draws_buffer_address = 0;
+  VkDeviceAddress cluster_buffer_address = 0;
+  VkDeviceAddress draws_indirect_buffer_address = 0;
+  VkDeviceAddress draw_slot_buffer_address = 0;
+  VkDeviceAddress cluster_index_buffer_address = 0;
+  VkDeviceAddress meshlet_buffer_address = 0;
+  VkDeviceAddress meshlet_vertex_buffer_address = 0;
+  VkDeviceAddress meshlet_triangle_buffer_address = 0;
+  VkDeviceAddress position_buffer_address = 0;
+  u32 cluster_count = 0;
+  u32 occlusion_culling_enabled = 0; // Only in the late phase
+  f32 depth_pyramid_width = 0;
+  f32 depth_pyramid_height = 0;
+  u32 triangle_culling_enabled = 0;
+};
+
+void Renderer::init_cluster_culling_pipeline()
+{
+  ZoneScoped;
+
+  const ShaderHandle shader =
+      pipeline_manager_->add_shader("cull_clusters.comp.glsl", ShaderStage::compute);
+
+  const VkPushConstantRange push_constant[] = {{
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+      .offset = 0,
+      .size = sizeof(ClusterCullingPushConstant),
+  }};
+
+  // Same sets as the draw generation
+  const VkDescriptorSetLayout set_layouts[] = {
+      global_descriptor_set_layout, object_descriptor_set_layout,
+      depth_pyramid_descriptor_set_layout_};
+
+  cluster_culling_pipeline_layout_ =
+      vkh::create_pipeline_layout(context_,
+                                  {
+                                      .set_layouts = set_layouts,
+                                      .push_constant_ranges = push_constant,
+                                  })
+          .value();
+
+  cluster_culling_pipeline_ = pipeline_manager_->create_compute_pipeline(
+      {.layout = cluster_culling_pipeline_layout_,
+       .stage = {.handle = shader},
+       .debug_name = "Cluster Culling Pipeline"});
+}
+
+void Renderer::init_light_assignment_pipeline()
+{
+  ZoneScoped;
+
+  const ShaderHandle shader =
+      pipeline_manager_->add_shader("assign_lights.comp.glsl", ShaderStage::compute);
+
+  // Everything comes from the camera and the scene data
+  const VkDescriptorSetLayout set_layouts[] = {global_descriptor_set_layout};
+
+  light_assignment_pipeline_layout_ =
+      vkh::create_pipeline_layout(context_, {.set_layouts = set_layouts}).value();
+
+  light_assignment_pipeline_ = pipeline_manager_->create_compute_pipeline(
+      {.layout = light_assignment_pipeline_layout_,
+       .stage = {.handle = shader},
+       .debug_name = "Light Assignment Pipeline"});
+}
+
+void Renderer::init_depth_pyramid_pipeline()
+{
+  ZoneScoped;
+
+  const ShaderHandle shader =
+      pipeline_manager_->add_shader("depth_pyramid.comp.glsl", ShaderStage::compute);
+
+  const VkPushConstantRange push_constant[] = {{
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+      .offset = 0,
+      .size = sizeof(Vec2),
+  }};
+
+  const VkDescriptorSetLayout set_layouts[] = {depth_pyramid_level_descriptor_set_layout_};
+
+  depth_pyramid_pipeline_layout_ =
+      vkh::create_pipeline_layout(context_,
+                                  {
+                                      .set_layouts = set_layouts,
+                                      .push_constant_ranges = push_constant,
+                                  })
+          .value();
+
+  const auto create_info = ComputePipelineCreateInfo{.layout = depth_pyramid_pipeline_layout_,
+                                                     .stage =
+                                                         {
+                                                             .handle = shader,
+                                                         },
+                                                     .debug_name = "Depth Pyramid Pipeline"};
+  depth_pyramid_pipeline_ = pipeline_manager_->create_compute_pipeline(create_info);
+}
+
 void Renderer::init_mesh_pipeline()
 {
   ZoneScoped;
@@ -347,11 +918,11 @@ void Renderer::init_mesh_pipeline()
   {
     ZoneScopedN("Create Pipeline Layout");
     const VkDescriptorSetLayout set_layouts[] = {
-        global_descriptor_set_layout, object_descriptor_set_layout, material_descriptor_set_layout,
+        global_descriptor_set_layout, object_descriptor_set_layout,
         textures_->descriptor_set_layout()};
 
     const VkPushConstantRange push_constant[] = {{
-        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
         .offset = 0,
         .size = sizeof(MeshPushConstant),
     }};
@@ -364,14 +935,21 @@ void Renderer::init_mesh_pipeline()
                                 .value();
   }
 
+  const ShadingSpecializationConstants solid_constants{.shadow_mask_available = VK_TRUE};
+  const ShadingSpecializationConstants transparent_constants{};
+  const VkSpecializationInfo solid_specialization_info =
+      shading_specialization_info(solid_constants);
+  const VkSpecializationInfo transparent_specialization_info =
+      shading_specialization_info(transparent_constants);
+
   auto create_info = charlie::GraphicsPipelineCreateInfo{
       .layout = mesh_pipeline_layout_,
       .pipeline_rendering_create_info =
           vkh::PipelineRenderingCreateInfo{
-              .color_attachment_formats = {final_hdr_image_format},
+              .color_attachment_formats = {final_hdr_image_format_},
               .depth_attachment_format = depth_format,
           },
-      .stages = {{vertex_shader}, {fragment_shader}},
+      .stages = {{vertex_shader}, {fragment_shader, &solid_specialization_info}},
       .rasterization_state = {.cull_mode = VK_CULL_MODE_BACK_BIT},
       .depth_stencil_state =
           {
@@ -384,92 +962,407 @@ void Renderer::init_mesh_pipeline()
 
   mesh_pipeline_ = pipeline_manager_->create_graphics_pipeline(create_info);
 
+  // After a depth prepass, only the closest fragment of each pixel passes and gets shaded
+  create_info.depth_stencil_state.depth_write_enable = VK_FALSE;
+  create_info.depth_stencil_state.depth_compare_op = VK_COMPARE_OP_EQUAL;
+  create_info.debug_name = "Mesh Graphics Pipeline (Depth Equal)";
+  mesh_pipeline_depth_equal_ = pipeline_manager_->create_graphics_pipeline(create_info);
+
+  create_info.depth_stencil_state.depth_write_enable = VK_TRUE;
+  create_info.depth_stencil_state.depth_compare_op = VK_COMPARE_OP_GREATER_OR_EQUAL;
+  create_info.stages[1].p_specialization_info = &transparent_specialization_info;
   create_info.color_blending = vkh::color_blend_attachment_additive();
   create_info.debug_name = "Mesh Graphics Pipeline (Transparent)";
   mesh_pipeline_transparent_ = pipeline_manager_->create_graphics_pipeline(create_info);
 }
 
-void Renderer::init_tonemapping_pipeline()
+void Renderer::init_depth_prepass_pipeline()
 {
   ZoneScoped;
 
   const ShaderHandle vertex_shader =
-      pipeline_manager_->add_shader("fullscreen_tri.vert.glsl", ShaderStage::vertex);
+      pipeline_manager_->add_shader("depth_prepass.vert.glsl", ShaderStage::vertex);
   const ShaderHandle fragment_shader =
-      pipeline_manager_->add_shader("tonemapping.frag.glsl", ShaderStage::fragment);
-
-  const VkDescriptorImageInfo image_info{
-      .sampler = sampler_cache_->default_blocky_sampler(),
-      .imageView = final_hdr_image_view_,
-      .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-  };
-
-  const auto result = DescriptorBuilder{*descriptor_layout_cache_, *descriptor_allocator_} //
-                          .bind_image(0, image_info, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                                      VK_SHADER_STAGE_FRAGMENT_BIT)
-                          .build()
-                          .value();
-
-  final_hdr_image_descriptor_set_ = result.set;
-
-  const VkDescriptorSetLayout set_layouts[] = {result.layout};
+      pipeline_manager_->add_shader("depth_prepass.frag.glsl", ShaderStage::fragment);
 
-  tonemapping_pipeline_layout_ = vkh::create_pipeline_layout(context_,
-                                                             {
-                                                                 .set_layouts = set_layouts,
-                                                             })
-                                     .value();
+  std::vector<VkVertexInputBindingDescription> binding_descriptions = {{
+      .binding = 0,
+      .stride = sizeof(Vec3),
+      .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+  }};
+  std::vector<VkVertexInputAttributeDescription> attribute_descriptions = {
+      {.location = 0, .binding = 0, .format = VK_FORMAT_R32G32B32_SFLOAT, .offset = 0}};
 
-  auto create_info = charlie::GraphicsPipelineCreateInfo{
-      .layout = tonemapping_pipeline_layout_,
+  depth_prepass_pipeline_ = pipeline_manager_->create_graphics_pipeline({
+      .layout = mesh_pipeline_layout_,
       .pipeline_rendering_create_info =
           vkh::PipelineRenderingCreateInfo{
-              .color_attachment_formats = {swapchain_.image_format()},
+              .color_attachment_formats = {},
+              .depth_attachment_format = depth_format,
           },
+      .vertex_input_state_create_info = {.binding_descriptions = binding_descriptions,
+                                         .attribute_descriptions = attribute_descriptions},
       .stages = {{vertex_shader}, {fragment_shader}},
       .rasterization_state = {.cull_mode = VK_CULL_MODE_BACK_BIT},
-      .debug_name = "Tone Mapping Pipeline",
-  };
-  tonemapping_pipeline_ = pipeline_manager_->create_graphics_pipeline(create_info);
+      .depth_stencil_state =
+          {
+              .depth_test_enable = VK_TRUE,
+              .depth_write_enable = VK_TRUE,
+              .depth_compare_op = VK_COMPARE_OP_GREATER_OR_EQUAL,
+          },
+      .debug_name = "Depth Prepass Pipeline",
+  });
 }
 
-void Renderer::update(const charlie::Camera& camera)
+void Renderer::init_shadow_mask_pipeline()
 {
-  ZoneScopedN("Update");
+  ZoneScoped;
 
-  pipeline_manager_->update();
+  const ShaderHandle shader =
+      pipeline_manager_->add_shader("shadow_mask.comp.glsl", ShaderStage::compute);
 
-  textures_->update();
+  const VkDescriptorSetLayout set_layouts[] = {global_descriptor_set_layout,
+                                               shadow_mask_descriptor_set_layout_};
+  shadow_mask_pipeline_layout_ =
+      vkh::create_pipeline_layout(context_, {.set_layouts = set_layouts}).value();
 
-  imgui_render_pass_->pre_render();
+  const ShadingSpecializationConstants constants{};
+  const VkSpecializationInfo specialization_info = shading_specialization_info(constants);
 
-  {
-    // Camera
-    const Mat4 view = camera.view_matrix();
-    const Mat4 projection = camera.proj_matrix();
+  const auto create_info = ComputePipelineCreateInfo{.layout = shadow_mask_pipeline_layout_,
+                                                     .stage =
+                                                         {
+                                                             .handle = shader,
+                                                             .p_specialization_info =
+                                                                 &specialization_info,
+                                                         },
+                                                     .debug_name = "Shadow Mask Pipeline"};
+  shadow_mask_pipeline_ = pipeline_manager_->create_compute_pipeline(create_info);
+}
 
-    const GPUCameraData cam_data = {
-        .view = view,
-        .proj = projection,
-        .view_proj = projection * view,
-        .position = camera.position(),
-    };
+void Renderer::init_visibility_buffer_pipelines()
+{
+  ZoneScoped;
 
-    const vkh::AllocatedBuffer& camera_buffer = current_frame().camera_buffer;
+  const ShaderHandle vertex_shader =
+      pipeline_manager_->add_shader("depth_prepass.vert.glsl", ShaderStage::vertex);
+  const ShaderHandle fragment_shader =
+      pipeline_manager_->add_shader("visibility_buffer.frag.glsl", ShaderStage::fragment);
+
+  std::vector<VkVertexInputBindingDescription> binding_descriptions = {{
+      .binding = 0,
+      .stride = sizeof(Vec3),
+      .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+  }};
+  std::vector<VkVertexInputAttributeDescription> attribute_descriptions = {
+      {.location = 0, .binding = 0, .format = VK_FORMAT_R32G32B32_SFLOAT, .offset = 0}};
+
+  visibility_buffer_pipeline_ = pipeline_manager_->create_graphics_pipeline({
+      .layout = mesh_pipeline_layout_,
+      .pipeline_rendering_create_info =
+          vkh::PipelineRenderingCreateInfo{
+              .color_attachment_formats = {visibility_buffer_format},
+              .depth_attachment_format = depth_format,
+          },
+      .vertex_input_state_create_info = {.binding_descriptions = binding_descriptions,
+                                         .attribute_descriptions = attribute_descriptions},
+      .stages = {{vertex_shader}, {fragment_shader}},
+      .rasterization_state = {.cull_mode = VK_CULL_MODE_BACK_BIT},
+      .depth_stencil_state =
+          {
+              .depth_test_enable = VK_TRUE,
+              .depth_write_enable = VK_TRUE,
+              .depth_compare_op = VK_COMPARE_OP_GREATER_OR_EQUAL,
+          },
+      .debug_name = "Visibility Buffer Pipeline",
+  });
+
+  const ShaderHandle resolve_shader =
+      pipeline_manager_->add_shader("visibility_buffer_resolve.comp.glsl", ShaderStage::compute);
+
+  const VkDescriptorSetLayout set_layouts[] = {
+      global_descriptor_set_layout, object_descriptor_set_layout,
+      textures_->descriptor_set_layout(), visibility_resolve_descriptor_set_layout_};
+  const VkPushConstantRange push_constant[] = {{
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+      .offset = 0,
+      .size = sizeof(MeshPushConstant),
+  }};
+  visibility_resolve_pipeline_layout_ =
+      vkh::create_pipeline_layout(context_,
+                                  {
+                                      .set_layouts = set_layouts,
+                                      .push_constant_ranges = push_constant,
+                                  })
+          .value();
+
+  const ShadingSpecializationConstants constants{.shadow_mask_available = VK_TRUE};
+  const VkSpecializationInfo specialization_info = shading_specialization_info(constants);
+
+  const auto create_info = ComputePipelineCreateInfo{.layout = visibility_resolve_pipeline_layout_,
+                                                     .stage =
+                                                         {
+                                                             .handle = resolve_shader,
+                                                             .p_specialization_info =
+                                                                 &specialization_info,
+                                                         },
+                                                     .debug_name =
+                                                         "Visibility Buffer Resolve Pipeline"};
+  visibility_resolve_pipeline_ = pipeline_manager_->create_compute_pipeline(create_info);
+}
+
+void Renderer::init_deferred_shading_pipelines()
+{
+  ZoneScoped;
+
+  const ShaderHandle vertex_shader =
+      pipeline_manager_->add_shader("mesh.vert.glsl", ShaderStage::vertex);
+  const ShaderHandle fragment_shader =
+      pipeline_manager_->add_shader("gbuffer.frag.glsl", ShaderStage::fragment);
+
+  gbuffer_pipeline_ = pipeline_manager_->create_graphics_pipeline({
+      .layout = mesh_pipeline_layout_,
+      .pipeline_rendering_create_info =
+          vkh::PipelineRenderingCreateInfo{
+              .color_attachment_formats = {final_hdr_image_format_, gbuffer_base_color_format,
+                                           gbuffer_normal_format, gbuffer_material_format},
+              .depth_attachment_format = depth_format,
+          },
+      .stages = {{vertex_shader}, {fragment_shader}},
+      .rasterization_state = {.cull_mode = VK_CULL_MODE_BACK_BIT},
+      .depth_stencil_state =
+          {
+              .depth_test_enable = VK_TRUE,
+              .depth_write_enable = VK_TRUE,
+              .depth_compare_op = VK_COMPARE_OP_GREATER_OR_EQUAL,
+          },
+      .debug_name = "G-Buffer Pipeline",
+  });
+
+  const ShaderHandle lighting_shader =
+      pipeline_manager_->add_shader("deferred_lighting.comp.glsl", ShaderStage::compute);
+
+  const VkDescriptorSetLayout set_layouts[] = {global_descriptor_set_layout,
+                                               deferred_lighting_descriptor_set_layout_};
+  deferred_lighting_pipeline_layout_ =
+      vkh::create_pipeline_layout(context_, {.set_layouts = set_layouts}).value();
+
+  const ShadingSpecializationConstants constants{.shadow_mask_available = VK_TRUE};
+  const VkSpecializationInfo specialization_info = shading_specialization_info(constants);
+
+  deferred_lighting_pipeline_ = pipeline_manager_->create_compute_pipeline(
+      {.layout = deferred_lighting_pipeline_layout_,
+       .stage = {.handle = lighting_shader, .p_specialization_info = &specialization_info},
+       .debug_name = "Deferred Lighting Pipeline"});
+}
+
+void Renderer::init_mesh_shading_pipeline()
+{
+  ZoneScoped;
+
+  const ShaderHandle task_shader =
+      pipeline_manager_->add_shader("meshlet.task.glsl", ShaderStage::task);
+  const ShaderHandle mesh_shader =
+      pipeline_manager_->add_shader("meshlet.mesh.glsl", ShaderStage::mesh);
+  const ShaderHandle fragment_shader =
+      pipeline_manager_->add_shader("mesh.frag.glsl", ShaderStage::fragment);
+
+  // The task shader tests meshlets against the depth pyramid
+  const VkDescriptorSetLayout set_layouts[] = {
+      global_descriptor_set_layout, object_descriptor_set_layout,
+      textures_->descriptor_set_layout(), depth_pyramid_descriptor_set_layout_};
+  const VkPushConstantRange push_constant[] = {{
+      .stageFlags = mesh_shading_shader_stages() | VK_SHADER_STAGE_FRAGMENT_BIT,
+      .offset = 0,
+      .size = sizeof(MeshShadingPushConstant),
+  }};
+  mesh_shading_pipeline_layout_ =
+      vkh::create_pipeline_layout(context_,
+                                  {
+                                      .set_layouts = set_layouts,
+                                      .push_constant_ranges = push_constant,
+                                  })
+          .value();
+
+  // The shadow mask forces the depth prepass on, which turns this path off
+  const ShadingSpecializationConstants constants{};
+  const VkSpecializationInfo specialization_info = shading_specialization_info(constants);
+
+  mesh_shading_pipeline_ = pipeline_manager_->create_graphics_pipeline({
+      .layout = mesh_shading_pipeline_layout_,
+      .pipeline_rendering_create_info =
+          vkh::PipelineRenderingCreateInfo{
+              .color_attachment_formats = {final_hdr_image_format_},
+              .depth_attachment_format = depth_format,
+          },
+      .stages = {{task_shader}, {mesh_shader}, {fragment_shader, &specialization_info}},
+      .rasterization_state = {.cull_mode = VK_CULL_MODE_BACK_BIT},
+      .depth_stencil_state =
+          {
+              .depth_test_enable = VK_TRUE,
+              .depth_write_enable = VK_TRUE,
+              .depth_compare_op = VK_COMPARE_OP_GREATER_OR_EQUAL,
+          },
+      .debug_name = "Mesh Shading Pipeline",
+  });
+}
+
+void Renderer::init_tonemapping_pipeline()
+{
+  ZoneScoped;
+
+  const ShaderHandle vertex_shader =
+      pipeline_manager_->add_shader("fullscreen_tri.vert.glsl", ShaderStage::vertex);
+  const ShaderHandle fragment_shader =
+      pipeline_manager_->add_shader("tonemapping.frag.glsl", ShaderStage::fragment);
+
+  const VkDescriptorImageInfo image_info{
+      .sampler = sampler_cache_->default_blocky_sampler(),
+      .imageView = final_hdr_image_view_,
+      .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+  };
+
+  // Also read by the luminance histogram
+  const auto result =
+      DescriptorBuilder{*descriptor_layout_cache_, *descriptor_allocator_} //
+          .bind_image(0, image_info, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                      VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT)
+          .build()
+          .value();
+
+  final_hdr_image_descriptor_set_ = result.set;
+  final_hdr_image_descriptor_set_layout_ = result.layout;
+
+  const VkDescriptorSetLayout set_layouts[] = {result.layout};
+  const VkPushConstantRange push_constant[] = {{
+      .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+      .offset = 0,
+      .size = sizeof(VkDeviceAddress), // Exposure buffer
+  }};
+
+  tonemapping_pipeline_layout_ = vkh::create_pipeline_layout(context_,
+                                                             {
+                                                                 .set_layouts = set_layouts,
+                                                                 .push_constant_ranges =
+                                                                     push_constant,
+                                                             })
+                                     .value();
+
+  auto create_info = charlie::GraphicsPipelineCreateInfo{
+      .layout = tonemapping_pipeline_layout_,
+      .pipeline_rendering_create_info =
+          vkh::PipelineRenderingCreateInfo{
+              .color_attachment_formats = {output_image_format()},
+          },
+      .stages = {{vertex_shader}, {fragment_shader}},
+      .rasterization_state = {.cull_mode = VK_CULL_MODE_BACK_BIT},
+      .debug_name = "Tone Mapping Pipeline",
+  };
+  tonemapping_pipeline_ = pipeline_manager_->create_graphics_pipeline(create_info);
+}
+
+// The histogram covers the log2 luminance range [min_log_luminance, min_log_luminance + range]
+constexpr f32 min_log_luminance = -10.f;
+constexpr f32 log_luminance_range = 22.f;
+// Speed of the exponential adaptation to the luminance of the current frame, per second
+constexpr f32 exposure_adaptation_speed = 1.5f;
+
+struct LuminanceHistogramPushConstant {
+  VkDeviceAddress histogram_buffer_address = 0;
+  f32 min_log_luminance = 0;
+  f32 inverse_log_luminance_range = 0;
+};
+
+struct AutoExposurePushConstant {
+  VkDeviceAddress histogram_buffer_address = 0;
+  VkDeviceAddress exposure_buffer_address = 0;
+  f32 min_log_luminance = 0;
+  f32 log_luminance_range = 0;
+  f32 pixel_count = 0;
+  f32 adaptation_rate = 0;
+  f32 exposure_compensation = 0;
+  u32 auto_exposure_enabled = 0;
+};
+
+void Renderer::init_auto_exposure_pipelines()
+{
+  ZoneScoped;
+
+  {
+    const ShaderHandle shader =
+        pipeline_manager_->add_shader("luminance_histogram.comp.glsl", ShaderStage::compute);
+
+    const VkDescriptorSetLayout set_layouts[] = {final_hdr_image_descriptor_set_layout_};
+    const VkPushConstantRange push_constant[] = {{
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset = 0,
+        .size = sizeof(LuminanceHistogramPushConstant),
+    }};
+    luminance_histogram_pipeline_layout_ =
+        vkh::create_pipeline_layout(context_,
+                                    {
+                                        .set_layouts = set_layouts,
+                                        .push_constant_ranges = push_constant,
+                                    })
+            .value();
+    luminance_histogram_pipeline_ = pipeline_manager_->create_compute_pipeline(
+        {.layout = luminance_histogram_pipeline_layout_,
+         .stage = {.handle = shader},
+         .debug_name = "Luminance Histogram Pipeline"});
+  }
+
+  {
+    const ShaderHandle shader =
+        pipeline_manager_->add_shader("auto_exposure.comp.glsl", ShaderStage::compute);
+
+    const VkPushConstantRange push_constant[] = {{
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset = 0,
+        .size = sizeof(AutoExposurePushConstant),
+    }};
+    auto_exposure_pipeline_layout_ =
+        vkh::create_pipeline_layout(context_, {.push_constant_ranges = push_constant}).value();
+    auto_exposure_pipeline_ = pipeline_manager_->create_compute_pipeline(
+        {.layout = auto_exposure_pipeline_layout_,
+         .stage = {.handle = shader},
+         .debug_name = "Auto Exposure Pipeline"});
+  }
+}
+
+void Renderer::update(const charlie::Camera& camera)
+{
+  ZoneScopedN("Update");
+  const auto cpu_timer_scope = cpu_timer_.scope("Update");
+
+  pipeline_manager_->update();
+
+  if (imgui_render_pass_ != nullptr) { imgui_render_pass_->pre_render(); }
+
+  {
+    // Camera
+    const Mat4 view = camera.view_matrix();
+    const Mat4 projection = camera.proj_matrix();
+
+    const GPUCameraData cam_data = {
+        .view = view,
+        .proj = projection,
+        .view_proj = projection * view,
+        .inverse_view_proj = beyond::inverse(projection * view),
+        .position = camera.position(),
+    };
+
+    const vkh::AllocatedBuffer& camera_buffer = current_frame().camera_buffer;
 
     void* data = nullptr;
     vmaMapMemory(context_.allocator(), camera_buffer.allocation, &data);
     memcpy(data, &cam_data, sizeof(GPUCameraData));
     vmaUnmapMemory(context_.allocator(), camera_buffer.allocation);
 
-    // Scene data
-    const auto dir = Vec3(scene_parameters_.sunlight_direction.xyz);
-    const Vec3 up =
-        abs(dot(dir, Vec3(0.0, 1.0, 0.0))) > 0.9 ? Vec3(0.0, 0.0, 1.0) : Vec3(0.0, 1.0, 0.0);
+    update_light_parameters(camera);
 
-    // TODO: move this to ShadowMapRenderer
-    scene_parameters_.sunlight_view_proj = beyond::ortho(-20.f, 20.f, 20.f, -20.f, -100.f, 100.f) *
-                                           beyond::look_at(-dir, Vec3(0.0), up);
+    // Scene data
+    shadow_map_renderer_->update(camera, scene_bounds_, scene_parameters_);
+    shadow_map_renderer_->update_caster_transforms(scene_->global_transforms);
 
     char* scene_data = static_cast<char*>(context_.map(scene_parameter_buffer_).value());
     const size_t frame_index = frame_number_ % frame_overlap;
@@ -480,6 +1373,61 @@ void Renderer::update(const charlie::Camera& camera)
   }
 }
 
+void Renderer::update_light_parameters(const charlie::Camera& camera)
+{
+  const u32 light_count =
+      narrow<u32>(std::min(scene_->light_components.size(), usize{max_light_count}));
+
+  // Depth slices end at the farthest corner of the scene, which keeps them thin where geometry is
+  f32 max_distance = camera.z_near * 2.0f;
+  for (u32 i = 0; i < 8; ++i) {
+    const Point3 scene_min = scene_bounds_.min();
+    const Point3 scene_max = scene_bounds_.max();
+    const Vec3 corner{(i & 1) ? scene_max.x : scene_min.x, (i & 2) ? scene_max.y : scene_min.y,
+                      (i & 4) ? scene_max.z : scene_min.z};
+    max_distance = std::max(max_distance, (corner - camera.position()).length());
+  }
+  const f32 slice_near = camera.z_near;
+  const f32 slice_far = std::min(max_distance, camera.z_far);
+  const f32 log_depth_range = std::log2(slice_far / slice_near);
+
+  scene_parameters_.light_buffer_address =
+      vkh::get_buffer_device_address(context_, current_frame().light_buffer);
+  scene_parameters_.light_cluster_buffer_address =
+      vkh::get_buffer_device_address(context_, light_cluster_buffer_);
+  scene_parameters_.light_grid_tile_size =
+      Vec2{static_cast<f32>(resolution_.width) / static_cast<f32>(light_grid_width),
+           static_cast<f32>(resolution_.height) / static_cast<f32>(light_grid_height)};
+  scene_parameters_.light_count = light_count;
+  scene_parameters_.light_grid_slice_scale = static_cast<f32>(light_grid_depth) / log_depth_range;
+  scene_parameters_.light_grid_slice_bias =
+      -static_cast<f32>(light_grid_depth) * std::log2(slice_near) / log_depth_range;
+}
+
+void Renderer::fill_light_buffer()
+{
+  ZoneScopedN("Fill Light Buffer");
+
+  auto* lights = static_cast<GPUPunctualLight*>(context_.map(current_frame().light_buffer).value());
+  u32 light_count = 0;
+  for (const auto& [node_index, light] : scene_->light_components) {
+    if (light_count == max_light_count) { break; }
+
+    const Mat4& transform = scene_->global_transforms.at(node_index);
+    const Vec4 position = transform * Vec4{0, 0, 0, 1};
+    const Vec4 direction = transform * Vec4{0, 0, -1, 0};
+    lights[light_count++] = GPUPunctualLight{
+        .position = Vec3{position.x, position.y, position.z},
+        .range = light.range,
+        .color = light.color,
+        .spot_angle_scale = light.spot_angle_scale,
+        .direction = normalize(Vec3{direction.x, direction.y, direction.z}),
+        .spot_angle_offset = light.spot_angle_offset,
+    };
+  }
+  context_.unmap(current_frame().light_buffer);
+}
+
 void Renderer::render(const charlie::Camera& camera)
 {
   ZoneScopedN("Render");
@@ -492,10 +1440,13 @@ void Renderer::render(const charlie::Camera& camera)
   // wait until the GPU has finished rendering the last frame.
   {
     ZoneScopedN("wait for render fence");
+    const auto cpu_timer_scope = cpu_timer_.scope("Wait For Render Fence");
     VK_CHECK(vkWaitForFences(context_, 1, &frame.render_fence, true, one_second));
   }
 
-  {
+  if (!headless()) {
+    ZoneScopedN("Acquire Swapchain Image");
+    const auto cpu_timer_scope = cpu_timer_.scope("Acquire Swapchain Image");
     const VkResult result = swapchain_.acquire_next_image(frame.present_semaphore);
     if (result == VK_ERROR_OUT_OF_DATE_KHR) { return; }
     VK_CHECK(result);
@@ -506,6 +1457,7 @@ void Renderer::render(const charlie::Camera& camera)
 
   {
     ZoneScopedN("Fill Transform Buffers");
+    const auto cpu_timer_scope = cpu_timer_.scope("Fill Transform Buffers");
     auto* object_transform_data =
         static_cast<Mat4*>(context_.map(current_frame().transform_buffer).value());
     for (usize i = 0; i < scene_->global_transforms.size(); ++i) {
@@ -514,12 +1466,31 @@ void Renderer::render(const charlie::Camera& camera)
     context_.unmap(current_frame().transform_buffer);
   }
 
+  {
+    // The previous frame that used this light buffer has finished
+    const auto cpu_timer_scope = cpu_timer_.scope("Fill Light Buffer");
+    fill_light_buffer();
+  }
+
   current_frame_deletion_queue().flush();
 
+  // The GPU finished the last frame that used this frame index, so its texture feedback and
+  // descriptor set are free to use
+  {
+    const auto cpu_timer_scope = cpu_timer_.scope("Texture Updates");
+    texture_streamer_->update(current_frame_index(), frame_number_,
+                              current_frame_deletion_queue());
+    textures_->update(current_frame_index(), current_frame_deletion_queue());
+  }
+
   VkCommandBuffer cmd = frame.main_command_buffer;
 
-  const auto current_swapchain_image = swapchain_.current_image();
-  const auto current_swapchain_image_view = swapchain_.current_image_view();
+  {
+    const auto cpu_timer_scope = cpu_timer_.scope("Build Frame Graph");
+    build_frame_graph(output_image(), output_image_view());
+    // Settings like the shading path change the passes, and with them the transient images
+    if (frame_graph_->compile()) { realize_frame_graph(); }
+  }
 
   static constexpr VkCommandBufferBeginInfo cmd_begin_info = {
       .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
@@ -527,259 +1498,1251 @@ void Renderer::render(const charlie::Camera& camera)
   };
 
   {
+    ZoneScopedN("Record Commands");
+    const auto cpu_timer_scope = cpu_timer_.scope("Record Commands");
     VK_CHECK(vkBeginCommandBuffer(cmd, &cmd_begin_info));
     TracyVkCollect(frame.tracy_vk_ctx, cmd);
+    gpu_timer_->cmd_begin_frame(cmd, current_frame_index());
+
+    texture_streamer_->cmd_begin_frame(cmd);
+    cmd_upload_dirty_materials(cmd);
 
     {
-      ZoneScopedN("Generate Draws");
-      TracyVkZone(frame.tracy_vk_ctx, cmd, "Generate Draws");
+      TracyVkZone(frame.tracy_vk_ctx, cmd, "Frame Graph");
+      frame_graph_->execute(cmd);
+    }
+
+    VK_CHECK(vkEndCommandBuffer(cmd));
+  }
+
+  {
+    ZoneScopedN("vkQueueSubmit");
+    const auto cpu_timer_scope = cpu_timer_.scope("vkQueueSubmit");
+    static constexpr VkPipelineStageFlags wait_stage =
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    // Without a swapchain, there is no image to acquire or to present
+    const u32 semaphore_count = headless() ? 0 : 1;
+    const VkSubmitInfo submit = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = nullptr,
+        .waitSemaphoreCount = semaphore_count,
+        .pWaitSemaphores = &frame.present_semaphore,
+        .pWaitDstStageMask = &wait_stage,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &cmd,
+        .signalSemaphoreCount = semaphore_count,
+        .pSignalSemaphores = &frame.render_semaphore,
+    };
+
+    VK_CHECK(vkQueueSubmit(graphics_queue_, 1, &submit, frame.render_fence));
+  }
+
+  if (!headless()) { present(); }
+
+  ++frame_number_;
+  cpu_timer_.end_frame();
+}
+
+void Renderer::cmd_tonemap(VkCommandBuffer cmd, VkImageView output_image_view)
+{
+  const auto gpu_timer_scope = gpu_timer_->scope(cmd, "Tonemapping");
+  {
+    // Tonemapping pipeline
+    const VkRenderingAttachmentInfo color_attachments_info{
+        .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+        .imageView = output_image_view,
+        .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+    };
+
+    const VkRenderingInfo render_info{
+        .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+        .renderArea =
+            {
+                .offset = {0, 0},
+                .extent = to_extent2d(resolution()),
+            },
+        .layerCount = 1,
+        .colorAttachmentCount = 1,
+        .pColorAttachments = &color_attachments_info,
+    };
+
+    vkCmdBeginRendering(cmd, &render_info);
+
+    const VkViewport viewport{
+        .x = 0.0f,
+        .y = 0.0f,
+        .width = beyond::narrow<float>(resolution().width),
+        .height = beyond::narrow<float>(resolution().height),
+        .minDepth = 0.0f,
+        .maxDepth = 1.0f,
+    };
+    vkCmdSetViewport(cmd, 0, 1, &viewport);
+    const VkRect2D scissor{.offset = {0, 0}, .extent = to_extent2d(resolution())};
+    vkCmdSetScissor(cmd, 0, 1, &scissor);
+  }
+
+  pipeline_manager_->cmd_bind_pipeline(cmd, tonemapping_pipeline_);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, tonemapping_pipeline_layout_, 0,
+                          1, &final_hdr_image_descriptor_set_, 0, nullptr);
+  const VkDeviceAddress exposure_buffer_address =
+      vkh::get_buffer_device_address(context_, exposure_buffer_);
+  vkCmdPushConstants(cmd, tonemapping_pipeline_layout_, VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+                     sizeof(exposure_buffer_address), &exposure_buffer_address);
+  // Draw a fullscreen triangle
+
+  vkh::cmd_begin_debug_utils_label(cmd, "tonemapping pass", {0.1f, 0.1f, 0.1f, 1.0f});
+  vkCmdDraw(cmd, 3, 1, 0, 0);
+  vkh::cmd_end_debug_utils_label(cmd);
+
+  vkCmdEndRendering(cmd);
+}
+
+void Renderer::build_frame_graph(VkImage output_image, VkImageView output_image_view)
+{
+  ZoneScoped;
+
+  FrameGraph& graph = *frame_graph_;
+  graph.reset();
+
+  // Use a power of two size so that each level exactly halves the previous one
+  depth_pyramid_extent_ = VkExtent2D{.width = std::bit_floor(resolution_.width),
+                                     .height = std::bit_floor(resolution_.height)};
+  depth_pyramid_level_count_ = narrow<u32>(
+      std::bit_width(std::max(depth_pyramid_extent_.width, depth_pyramid_extent_.height)));
+  shadow_mask_extent_ = {(resolution_.width + 1) / 2, (resolution_.height + 1) / 2};
+
+  // The depth image and the final HDR image are used by the whole frame, and get discarded at its
+  // beginning
+  const FrameGraphImage depth = graph.import_image("Depth Image", depth_image_.image,
+                                                   VK_IMAGE_ASPECT_DEPTH_BIT);
+  const FrameGraphImage hdr = graph.import_image("Final HDR Image", final_hdr_image_.image,
+                                                 VK_IMAGE_ASPECT_COLOR_BIT);
+  // The swapchain image gets presented, while the offscreen image gets copied to the CPU
+  const FrameGraphImage output = graph.import_image(
+      headless() ? "Offscreen Image" : "Swapchain Image", output_image, VK_IMAGE_ASPECT_COLOR_BIT);
+  graph.set_output(output, headless()
+                               ? ImageAccess{.stage_mask = VK_PIPELINE_STAGE_2_COPY_BIT,
+                                             .access_mask = VK_ACCESS_2_TRANSFER_READ_BIT,
+                                             .layout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL}
+                               : ImageAccess{.stage_mask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                                             .layout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR});
+
+  // All transient images get declared even if the current settings do not use them, since the
+  // descriptor sets refer to them
+  const FrameGraphImage depth_pyramid =
+      graph.create_image(std::string{depth_pyramid_name},
+                         {.format = depth_pyramid_format,
+                          .extent = depth_pyramid_extent_,
+                          .usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                          .mip_levels = depth_pyramid_level_count_});
+  const FrameGraphImage shadow_mask =
+      graph.create_image(std::string{shadow_mask_name},
+                         {.format = shadow_mask_format,
+                          .extent = shadow_mask_extent_,
+                          .usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT});
+  const FrameGraphImage visibility_buffer = graph.create_image(
+      std::string{visibility_buffer_name},
+      {.format = visibility_buffer_format,
+       .extent = to_extent2d(resolution_),
+       .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT});
+  const auto create_gbuffer_target = [&](std::string_view name, VkFormat format) {
+    return graph.create_image(
+        std::string{name},
+        {.format = format,
+         .extent = to_extent2d(resolution_),
+         .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT});
+  };
+  const FrameGraphImage gbuffer_base_color =
+      create_gbuffer_target(gbuffer_base_color_name, gbuffer_base_color_format);
+  const FrameGraphImage gbuffer_normal =
+      create_gbuffer_target(gbuffer_normal_name, gbuffer_normal_format);
+  const FrameGraphImage gbuffer_material =
+      create_gbuffer_target(gbuffer_material_name, gbuffer_material_format);
+
+  static constexpr VkPipelineStageFlags2 compute_stage = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+  static constexpr VkPipelineStageFlags2 fragment_stage = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+
+  // The shading of the previous frame reads the light clusters, and the exposure of the previous
+  // frame is the starting point of the adaptation
+  const FrameGraphBuffer light_clusters =
+      graph.import_buffer("Light Clusters", light_cluster_buffer_.buffer,
+                          BufferAccess{.stage_mask = fragment_stage | compute_stage});
+  const FrameGraphBuffer exposure =
+      graph.import_buffer("Exposure", exposure_buffer_.buffer,
+                          BufferAccess{.stage_mask = compute_stage | fragment_stage,
+                                       .access_mask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT});
+
+  const auto read_shading_inputs = [&](FrameGraphPassBuilder& pass, VkPipelineStageFlags2 stage,
+                                       bool samples_shadow_mask) {
+    pass.read(light_clusters, BufferAccess{.stage_mask = stage,
+                                           .access_mask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT});
+    if (samples_shadow_mask && shadow_mask_enabled()) {
+      pass.read(shadow_mask, image_access::sampled(stage));
+    }
+  };
+  // Only the late phase tests against the depth pyramid
+  const auto read_depth_pyramid = [&](FrameGraphPassBuilder& pass, DrawPhase phase,
+                                      VkPipelineStageFlags2 stage) {
+    if (phase == DrawPhase::late && occlusion_culling_enabled_) {
+      pass.read(depth_pyramid, image_access::sampled(stage, VK_IMAGE_LAYOUT_GENERAL));
+    }
+  };
 
-      vkh::cmd_begin_debug_utils_label(cmd, "Generate Draws Pass", {0.097f, 0.01f, 0.049f, 1.0f});
+  // The culling passes synchronize the draw buffers on their own
+  const auto add_culling_passes = [&](DrawPhase phase) {
+    const bool early = phase == DrawPhase::early;
+    auto generate_draws =
+        graph.add_pass(early ? "Generate Draws (Early)" : "Generate Draws (Late)",
+                       [this, phase](VkCommandBuffer cmd) { cmd_generate_draws(cmd, phase); });
+    generate_draws.side_effect();
+    read_depth_pyramid(generate_draws, phase, compute_stage);
+
+    if (cluster_culling_enabled()) {
+      auto cull_clusters =
+          graph.add_pass(early ? "Cull Clusters (Early)" : "Cull Clusters (Late)",
+                         [this, phase](VkCommandBuffer cmd) { cmd_cull_clusters(cmd, phase); });
+      cull_clusters.side_effect();
+      read_depth_pyramid(cull_clusters, phase, compute_stage);
+    }
+  };
+
+  const auto add_depth_pyramid_pass = [&]() {
+    if (!occlusion_culling_enabled_) { return; }
+    graph.add_pass("Depth Pyramid", [this](VkCommandBuffer cmd) { cmd_build_depth_pyramid(cmd); })
+        .read(depth, image_access::sampled(compute_stage, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL))
+        .write(depth_pyramid,
+               ImageAccess{.stage_mask = compute_stage,
+                           .access_mask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT |
+                                          VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+                           .layout = VK_IMAGE_LAYOUT_GENERAL});
+  };
+
+  const auto add_shadow_mask_pass = [&]() {
+    if (!shadow_mask_enabled()) { return; }
+    graph.add_pass("Shadow Mask", [this](VkCommandBuffer cmd) { cmd_build_shadow_mask(cmd); })
+        .read(depth, image_access::sampled(compute_stage, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL))
+        .write(shadow_mask, image_access::storage_write(compute_stage));
+  };
+
+  const auto add_mesh_pass = [&](DrawPhase phase) {
+    auto pass = graph.add_pass(phase == DrawPhase::early ? "Mesh Pass (Early)" : "Mesh Pass (Late)",
+                               [this, phase](VkCommandBuffer cmd) { draw_scene(cmd, phase); });
+    pass.write(hdr, image_access::color_attachment())
+        .write(depth, image_access::depth_attachment());
+    // The compute shading passes already sampled the shadow mask for the solid draws
+    read_shading_inputs(pass, fragment_stage,
+                        !visibility_buffer_enabled() && !deferred_shading_enabled());
+    if (mesh_shading_enabled()) { read_depth_pyramid(pass, phase, task_shader_pipeline_stage()); }
+  };
+
+  add_culling_passes(DrawPhase::early);
+  if (scene_parameters_.light_count > 0) {
+    graph.add_pass("Light Assignment", [this](VkCommandBuffer cmd) { cmd_assign_lights(cmd); })
+        .write(light_clusters, BufferAccess{.stage_mask = compute_stage,
+                                            .access_mask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT});
+  }
+  if (scene_parameters_.sunlight_shadow_mode != 0) {
+    // The shadow cascades are sampled across the whole frame, so they stay outside of the graph
+    graph
+        .add_pass("Shadow Maps",
+                  [this](VkCommandBuffer cmd) {
+                    const auto gpu_timer_scope = gpu_timer_->scope(cmd, "Shadow Maps");
+                    shadow_map_renderer_->record_commands(cmd);
+                  })
+        .side_effect();
+  }
+
+  if (visibility_buffer_enabled()) {
+    for (const DrawPhase phase : {DrawPhase::early, DrawPhase::late}) {
+      if (phase == DrawPhase::late) {
+        add_depth_pyramid_pass();
+        add_culling_passes(DrawPhase::late);
+      }
+      graph
+          .add_pass(phase == DrawPhase::early ? "Visibility Buffer (Early)"
+                                              : "Visibility Buffer (Late)",
+                    [this, phase](VkCommandBuffer cmd) { draw_visibility_buffer(cmd, phase); })
+          .write(visibility_buffer, image_access::color_attachment())
+          .write(depth, image_access::depth_attachment());
+    }
+    add_shadow_mask_pass();
+    auto resolve = graph.add_pass("Visibility Buffer Resolve", [this](VkCommandBuffer cmd) {
+      cmd_resolve_visibility_buffer(cmd);
+    });
+    resolve.read(visibility_buffer, image_access::storage_read(compute_stage))
+        .write(hdr, image_access::storage_write(compute_stage));
+    read_shading_inputs(resolve, compute_stage, true);
+    add_mesh_pass(DrawPhase::late); // Only the transparent draws
+  } else if (deferred_shading_enabled()) {
+    // The G-buffer pass replaces the depth prepass, since it also writes the complete depth
+    for (const DrawPhase phase : {DrawPhase::early, DrawPhase::late}) {
+      if (phase == DrawPhase::late) {
+        add_depth_pyramid_pass();
+        add_culling_passes(DrawPhase::late);
+      }
+      graph
+          .add_pass(phase == DrawPhase::early ? "G-Buffer (Early)" : "G-Buffer (Late)",
+                    [this, phase](VkCommandBuffer cmd) { draw_gbuffer(cmd, phase); })
+          .write(hdr, image_access::color_attachment())
+          .write(gbuffer_base_color, image_access::color_attachment())
+          .write(gbuffer_normal, image_access::color_attachment())
+          .write(gbuffer_material, image_access::color_attachment())
+          .write(depth, image_access::depth_attachment());
+    }
+    add_shadow_mask_pass();
+    auto lighting = graph.add_pass("Deferred Lighting", [this](VkCommandBuffer cmd) {
+      cmd_deferred_lighting(cmd);
+    });
+    lighting
+        .read(depth, image_access::sampled(compute_stage, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL))
+        .read(gbuffer_base_color, image_access::sampled(compute_stage))
+        .read(gbuffer_normal, image_access::sampled(compute_stage))
+        .read(gbuffer_material, image_access::sampled(compute_stage))
+        .write(hdr, image_access::storage_read_write(compute_stage));
+    read_shading_inputs(lighting, compute_stage, true);
+    add_mesh_pass(DrawPhase::late); // Only the transparent draws
+  } else if (depth_prepass_enabled()) {
+    // Both culling phases run on the depth prepass, and the shading passes then draw on top of the
+    // complete depth
+    for (const DrawPhase phase : {DrawPhase::early, DrawPhase::late}) {
+      if (phase == DrawPhase::late) {
+        add_depth_pyramid_pass();
+        add_culling_passes(DrawPhase::late);
+      }
+      graph
+          .add_pass(phase == DrawPhase::early ? "Depth Prepass (Early)" : "Depth Prepass (Late)",
+                    [this, phase](VkCommandBuffer cmd) { draw_depth_prepass(cmd, phase); })
+          .write(depth, image_access::depth_attachment());
+    }
+    add_shadow_mask_pass();
+    add_mesh_pass(DrawPhase::early);
+    add_mesh_pass(DrawPhase::late);
+  } else {
+    add_mesh_pass(DrawPhase::early);
+    add_depth_pyramid_pass();
+    add_culling_passes(DrawPhase::late);
+    add_mesh_pass(DrawPhase::late);
+  }
+
+  // Copies the texture feedback that the shading passes wrote, with its own barriers
+  graph
+      .add_pass("Texture Feedback",
+                [this](VkCommandBuffer cmd) {
+                  texture_streamer_->cmd_end_frame(cmd, current_frame_index());
+                })
+      .side_effect();
+
+  graph.add_pass("Auto Exposure", [this](VkCommandBuffer cmd) { cmd_update_exposure(cmd); })
+      .read(hdr, image_access::sampled(compute_stage))
+      .write(exposure, BufferAccess{.stage_mask = compute_stage,
+                                    .access_mask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT |
+                                                   VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT});
+  graph
+      .add_pass("Tonemapping",
+                [this, output_image_view](VkCommandBuffer cmd) {
+                  cmd_tonemap(cmd, output_image_view);
+                })
+      .read(hdr, image_access::sampled(fragment_stage))
+      .read(exposure, BufferAccess{.stage_mask = fragment_stage,
+                                   .access_mask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT})
+      .write(output, image_access::color_attachment());
+
+  // Headless renderers have no GUI
+  if (headless()) { return; }
+  graph
+      .add_pass("ImGui",
+                [this, output_image_view](VkCommandBuffer cmd) {
+                  ZoneScopedN("ImGUI Render Pass");
+                  TracyVkZone(current_frame().tracy_vk_ctx, cmd, "ImGUI Render Pass");
+                  const auto gpu_timer_scope = gpu_timer_->scope(cmd, "ImGui");
+                  imgui_render_pass_->render(cmd, output_image_view);
+                })
+      .write(output, image_access::color_attachment());
+}
+
+void Renderer::realize_frame_graph()
+{
+  ZoneScoped;
+
+  retire_frame_graph_resources(current_frame_deletion_queue());
+  frame_graph_->realize(current_frame_deletion_queue());
+  frame_graph_descriptor_allocator_ = std::make_unique<DescriptorAllocator>(context_);
+
+  init_depth_pyramid();
+  init_shadow_mask();
+  update_global_image_descriptor(5, shadow_mask_image_info());
+  init_visibility_buffer();
+  init_gbuffer();
+}
+
+void Renderer::retire_frame_graph_resources(DeletionQueue& deletion_queue)
+{
+  // The frames in flight might still use the previous views and descriptor sets
+  std::vector<VkImageView> views = std::exchange(depth_pyramid_level_views_, {});
+  views.insert(views.end(), {depth_pyramid_view_, shadow_mask_view_, visibility_buffer_image_view_,
+                             gbuffer_base_color_view_, gbuffer_normal_view_,
+                             gbuffer_material_view_});
+  // Dropping the allocator frees all its descriptor sets at once
+  std::shared_ptr<DescriptorAllocator> descriptor_allocator =
+      std::move(frame_graph_descriptor_allocator_);
+  deletion_queue.push(
+      [views = std::move(views),
+       descriptor_allocator = std::move(descriptor_allocator)](vkh::Context& context) {
+        for (VkImageView view : views) { vkDestroyImageView(context, view, nullptr); }
+      });
+}
+
+void Renderer::cmd_generate_draws(VkCommandBuffer cmd, DrawPhase phase)
+{
+  ZoneScopedN("Generate Draws");
+  const auto& frame = current_frame();
+  TracyVkZone(frame.tracy_vk_ctx, cmd, "Generate Draws");
+  const auto gpu_timer_scope = gpu_timer_->scope(
+      cmd, phase == DrawPhase::early ? "Generate Draws (Early)" : "Generate Draws (Late)");
+
+  vkh::cmd_begin_debug_utils_label(cmd, phase == DrawPhase::early ? "Generate Draws Pass (Early)"
+                                                                  : "Generate Draws Pass (Late)",
+                                   {0.097f, 0.01f, 0.049f, 1.0f});
+
+  if (phase == DrawPhase::early) {
+    // The previous frame might still read the indirect buffers, and its late phase wrote the
+    // visibilities that we are about to read. Then reset the draw counts
+    const VkMemoryBarrier2 previous_frame_barrier{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+        .srcStageMask = VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT |
+                        VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT |
+                        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | task_shader_pipeline_stage(),
+        .srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+        .dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+        .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT |
+                         VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT,
+    };
+    vkh::cmd_pipeline_barrier(cmd, {.memory_barriers = std::array{previous_frame_barrier}});
+
+    vkCmdFillBuffer(cmd, draw_count_buffer_, 0, VK_WHOLE_SIZE, 0);
+
+    const auto clear_barrier =
+        vkh::BufferMemoryBarrier{
+            .stage_masks = {VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+                            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT},
+            .access_masks = {VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                             VK_ACCESS_2_SHADER_STORAGE_READ_BIT |
+                                 VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT},
+            .buffer = draw_count_buffer_.buffer,
+            .size = VK_WHOLE_SIZE,
+        }
+            .to_vk_struct();
+    vkh::cmd_pipeline_barrier(cmd, {.buffer_memory_barriers = std::array{clear_barrier}});
+  } else {
+    // The early phase read the visibilities that the late phase overwrites
+    const auto visibility_barrier =
+        vkh::BufferMemoryBarrier{
+            .stage_masks = {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT},
+            .access_masks = {VK_ACCESS_2_NONE, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT},
+            .buffer = draw_visibility_buffer_.buffer,
+            .size = VK_WHOLE_SIZE,
+        }
+            .to_vk_struct();
+    vkh::cmd_pipeline_barrier(cmd, {.buffer_memory_barriers = std::array{visibility_barrier}});
+  }
+
+  const GenerateDrawsPushConstant push_constant{
+      .draws_buffer_address = vkh::get_buffer_device_address(context_, draws_buffer_),
+      .draws_indirect_buffer_address =
+          vkh::get_buffer_device_address(context_, draws_indirect_buffer_),
+      .draw_count_buffer_address = vkh::get_buffer_device_address(context_, draw_count_buffer_),
+      .draw_visibility_buffer_address =
+          vkh::get_buffer_device_address(context_, draw_visibility_buffer_),
+      .mesh_task_buffer_address =
+          mesh_shading_enabled() ? vkh::get_buffer_device_address(context_, mesh_task_buffer_) : 0,
+      .draw_slot_buffer_address =
+          cluster_culling_enabled() ? vkh::get_buffer_device_address(context_, draw_slot_buffer_)
+                                    : 0,
+      .total_draws_count = total_draw_count_,
+      .solid_draws_count = solid_draw_count_,
+      .phase = phase == DrawPhase::early ? 0u : 1u,
+      .occlusion_culling_enabled = occlusion_culling_enabled_ ? 1u : 0u,
+      .depth_pyramid_width = static_cast<f32>(depth_pyramid_extent_.width),
+      .depth_pyramid_height = static_cast<f32>(depth_pyramid_extent_.height),
+      .mesh_tasks_enabled = mesh_shading_enabled() ? 1u : 0u,
+      .cluster_culling_enabled = cluster_culling_enabled() ? 1u : 0u,
+  };
+  vkCmdPushConstants(cmd, generate_draws_layout_, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                     sizeof(GenerateDrawsPushConstant), &push_constant);
+
+  const u32 uniform_offset =
+      narrow<u32>(context_.align_uniform_buffer_size(sizeof(GPUSceneParameters))) *
+      narrow<u32>(current_frame_index());
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, generate_draws_layout_, 0, 1,
+                          &frame.global_descriptor_set, 1, &uniform_offset);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, generate_draws_layout_, 1, 1,
+                          &frame.object_descriptor_set, 0, nullptr);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, generate_draws_layout_, 2, 1,
+                          &depth_pyramid_descriptor_set_, 0, nullptr);
+
+  pipeline_manager_->cmd_bind_pipeline(cmd, generate_draws_pipeline_);
+
+  static constexpr u32 local_group_size = 256;
+  vkCmdDispatch(cmd, total_draw_count_ / local_group_size + 1, 1, 1);
+
+  vkh::cmd_end_debug_utils_label(cmd);
+
+  {
+    const auto indirect_barrier = [](const vkh::AllocatedBuffer& buffer) {
+      return vkh::BufferMemoryBarrier{
+          .stage_masks = {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                          VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT},
+          .access_masks = {VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                           VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT},
+          .buffer = buffer.buffer,
+          .size = VK_WHOLE_SIZE,
+      }
+          .to_vk_struct();
+    };
+    vkh::cmd_pipeline_barrier(cmd, {.buffer_memory_barriers =
+                                        std::array{indirect_barrier(draws_indirect_buffer_),
+                                                   indirect_barrier(draw_count_buffer_)}});
+  }
+
+  if (mesh_shading_enabled()) {
+    // Task shaders also read the draw index of their command
+    const auto task_barrier =
+        vkh::BufferMemoryBarrier{
+            .stage_masks = {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                            VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT |
+                                VK_PIPELINE_STAGE_2_TASK_SHADER_BIT_EXT},
+            .access_masks = {VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                             VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT |
+                                 VK_ACCESS_2_SHADER_STORAGE_READ_BIT},
+            .buffer = mesh_task_buffer_.buffer,
+            .size = VK_WHOLE_SIZE,
+        }
+            .to_vk_struct();
+    vkh::cmd_pipeline_barrier(cmd, {.buffer_memory_barriers = std::array{task_barrier}});
+  }
+}
+
+void Renderer::cmd_cull_clusters(VkCommandBuffer cmd, DrawPhase phase)
+{
+  ZoneScopedN("Cull Clusters");
+  const auto& frame = current_frame();
+  TracyVkZone(frame.tracy_vk_ctx, cmd, "Cull Clusters");
+  const auto gpu_timer_scope = gpu_timer_->scope(
+      cmd, phase == DrawPhase::early ? "Cluster Culling (Early)" : "Cluster Culling (Late)");
+
+  vkh::cmd_begin_debug_utils_label(cmd, phase == DrawPhase::early ? "Cluster Culling Pass (Early)"
+                                                                  : "Cluster Culling Pass (Late)",
+                                   {0.097f, 0.21f, 0.049f, 1.0f});
+
+  {
+    // Accumulate into the commands that the draw generation just wrote. The early phase might
+    // still read the cluster indices, though the late phase never overwrites the ranges it draws
+    const VkMemoryBarrier2 generate_draws_barrier{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+        .srcStageMask =
+            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT,
+        .srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+        .dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+    };
+    vkh::cmd_pipeline_barrier(cmd, {.memory_barriers = std::array{generate_draws_barrier}});
+  }
+
+  // The early phase draws what was visible last frame, so only the late phase tests clusters
+  // against the depth pyramid
+  const ClusterCullingPushConstant push_constant{
+      .draws_buffer_address = vkh::get_buffer_device_address(context_, draws_buffer_),
+      .cluster_buffer_address = vkh::get_buffer_device_address(context_, cluster_buffer_),
+      .draws_indirect_buffer_address =
+          vkh::get_buffer_device_address(context_, draws_indirect_buffer_),
+      .draw_slot_buffer_address = vkh::get_buffer_device_address(context_, draw_slot_buffer_),
+      .cluster_index_buffer_address =
+          vkh::get_buffer_device_address(context_, cluster_index_buffer_),
+      .meshlet_buffer_address =
+          vkh::get_buffer_device_address(context_, scene_mesh_buffers.meshlet_buffer),
+      .meshlet_vertex_buffer_address =
+          vkh::get_buffer_device_address(context_, scene_mesh_buffers.meshlet_vertex_buffer),
+      .meshlet_triangle_buffer_address =
+          vkh::get_buffer_device_address(context_, scene_mesh_buffers.meshlet_triangle_buffer),
+      .position_buffer_address =
+          vkh::get_buffer_device_address(context_, scene_mesh_buffers.position_buffer),
+      .cluster_count = cluster_count_,
+      .occlusion_culling_enabled =
+          occlusion_culling_enabled_ && phase == DrawPhase::late ? 1u : 0u,
+      .depth_pyramid_width = static_cast<f32>(depth_pyramid_extent_.width),
+      .depth_pyramid_height = static_cast<f32>(depth_pyramid_extent_.height),
+      .triangle_culling_enabled = triangle_culling_enabled_ ? 1u : 0u,
+  };
+  vkCmdPushConstants(cmd, cluster_culling_pipeline_layout_, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                     sizeof(ClusterCullingPushConstant), &push_constant);
+
+  const u32 uniform_offset =
+      narrow<u32>(context_.align_uniform_buffer_size(sizeof(GPUSceneParameters))) *
+      narrow<u32>(current_frame_index());
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cluster_culling_pipeline_layout_, 0,
+                          1, &frame.global_descriptor_set, 1, &uniform_offset);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cluster_culling_pipeline_layout_, 1,
+                          1, &frame.object_descriptor_set, 0, nullptr);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cluster_culling_pipeline_layout_, 2,
+                          1, &depth_pyramid_descriptor_set_, 0, nullptr);
+
+  pipeline_manager_->cmd_bind_pipeline(cmd, cluster_culling_pipeline_);
+
+  // One workgroup per cluster, wrapped into rows to stay within the workgroup count limit
+  const u32 max_group_count_x = context_.gpu_properties().limits.maxComputeWorkGroupCount[0];
+  const u32 group_count_x = std::min(cluster_count_, max_group_count_x);
+  vkCmdDispatch(cmd, group_count_x, (cluster_count_ + group_count_x - 1) / group_count_x, 1);
+
+  vkh::cmd_end_debug_utils_label(cmd);
+
+  const VkMemoryBarrier2 draw_barrier{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+      .srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+      .srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+      .dstStageMask = VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT,
+      .dstAccessMask = VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_INDEX_READ_BIT,
+  };
+  vkh::cmd_pipeline_barrier(cmd, {.memory_barriers = std::array{draw_barrier}});
+}
+
+void Renderer::cmd_assign_lights(VkCommandBuffer cmd)
+{
+  ZoneScopedN("Assign Lights");
+  const auto& frame = current_frame();
+  TracyVkZone(frame.tracy_vk_ctx, cmd, "Assign Lights");
+  const auto gpu_timer_scope = gpu_timer_->scope(cmd, "Light Assignment");
+
+  vkh::cmd_begin_debug_utils_label(cmd, "Light Assignment Pass", {0.5f, 0.45f, 0.1f, 1.0f});
+
+  const u32 uniform_offset =
+      narrow<u32>(context_.align_uniform_buffer_size(sizeof(GPUSceneParameters))) *
+      narrow<u32>(current_frame_index());
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, light_assignment_pipeline_layout_,
+                          0, 1, &frame.global_descriptor_set, 1, &uniform_offset);
+  pipeline_manager_->cmd_bind_pipeline(cmd, light_assignment_pipeline_);
+
+  static constexpr u32 local_group_size = 64;
+  static constexpr u32 cluster_count = light_grid_width * light_grid_height * light_grid_depth;
+  vkCmdDispatch(cmd, (cluster_count + local_group_size - 1) / local_group_size, 1, 1);
+
+  vkh::cmd_end_debug_utils_label(cmd);
+}
+
+void Renderer::cmd_build_depth_pyramid(VkCommandBuffer cmd)
+{
+  ZoneScoped;
+  TracyVkZone(current_frame().tracy_vk_ctx, cmd, "Depth Pyramid");
+  const auto gpu_timer_scope = gpu_timer_->scope(cmd, "Depth Pyramid");
+  vkh::cmd_begin_debug_utils_label(cmd, "Depth Pyramid Pass", {0.5f, 0.5f, 0.5f, 1.0f});
+
+  pipeline_manager_->cmd_bind_pipeline(cmd, depth_pyramid_pipeline_);
+
+  static constexpr u32 local_group_size = 16;
+  for (u32 level = 0; level < depth_pyramid_level_count_; ++level) {
+    const u32 level_width = std::max(depth_pyramid_extent_.width >> level, 1u);
+    const u32 level_height = std::max(depth_pyramid_extent_.height >> level, 1u);
+
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, depth_pyramid_pipeline_layout_, 0,
+                            1, &depth_pyramid_level_descriptor_sets_[level], 0, nullptr);
+    const Vec2 level_size{static_cast<f32>(level_width), static_cast<f32>(level_height)};
+    vkCmdPushConstants(cmd, depth_pyramid_pipeline_layout_, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                       sizeof(Vec2), &level_size);
+    vkCmdDispatch(cmd, (level_width + local_group_size - 1) / local_group_size,
+                  (level_height + local_group_size - 1) / local_group_size, 1);
+
+    // The next level reads this level. The frame graph synchronizes the late culling with the
+    // whole pyramid
+    if (level + 1 < depth_pyramid_level_count_) {
+      const auto level_barrier =
+          vkh::ImageBarrier{
+              .stage_masks = {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                              VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT},
+              .access_masks = {VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                               VK_ACCESS_2_SHADER_SAMPLED_READ_BIT},
+              .layouts = {VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL},
+              .image = depth_pyramid_,
+              .subresource_range = vkh::SubresourceRange{.aspect_mask = VK_IMAGE_ASPECT_COLOR_BIT,
+                                                         .base_mip_level = level},
+          }
+              .to_vk_struct();
+      vkh::cmd_pipeline_barrier(cmd, {.image_barriers = std::array{level_barrier}});
+    }
+  }
+
+  vkh::cmd_end_debug_utils_label(cmd);
+}
+
+void Renderer::cmd_build_shadow_mask(VkCommandBuffer cmd)
+{
+  ZoneScoped;
+  TracyVkZone(current_frame().tracy_vk_ctx, cmd, "Shadow Mask");
+  const auto gpu_timer_scope = gpu_timer_->scope(cmd, "Shadow Mask");
+  vkh::cmd_begin_debug_utils_label(cmd, "Shadow Mask Pass", {0.2f, 0.2f, 0.4f, 1.0f});
+
+  pipeline_manager_->cmd_bind_pipeline(cmd, shadow_mask_pipeline_);
+
+  const u32 uniform_offset =
+      beyond::narrow<u32>(context_.align_uniform_buffer_size(sizeof(GPUSceneParameters))) *
+      beyond::narrow<u32>(current_frame_index());
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, shadow_mask_pipeline_layout_, 0, 1,
+                          &current_frame().global_descriptor_set, 1, &uniform_offset);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, shadow_mask_pipeline_layout_, 1, 1,
+                          &shadow_mask_descriptor_set_, 0, nullptr);
+
+  static constexpr u32 local_group_size = 8;
+  vkCmdDispatch(cmd, (shadow_mask_extent_.width + local_group_size - 1) / local_group_size,
+                (shadow_mask_extent_.height + local_group_size - 1) / local_group_size, 1);
+
+  vkh::cmd_end_debug_utils_label(cmd);
+}
+
+auto Renderer::read_back_offscreen_image() -> CPUImage
+{
+  ZoneScoped;
+
+  BEYOND_ENSURE(headless());
+
+  // The last frame leaves the offscreen image in the transfer source layout
+  context_.wait_idle();
+
+  constexpr u32 components = 4;
+  const usize size = usize{resolution_.width} * resolution_.height * components;
+  vkh::AllocatedBuffer readback_buffer =
+      vkh::create_buffer(context_, vkh::BufferCreateInfo{
+                                       .size = size,
+                                       .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                       .memory_usage = VMA_MEMORY_USAGE_GPU_TO_CPU,
+                                       .debug_name = "Offscreen Image Readback Buffer",
+                                       .category = vkh::MemoryCategory::staging,
+                                   })
+          .value();
+
+  immediate_submit(context_, upload_context_, [&](VkCommandBuffer cmd) {
+    const VkBufferImageCopy region{
+        .imageSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .layerCount = 1},
+        .imageExtent = VkExtent3D{resolution_.width, resolution_.height, 1},
+    };
+    vkCmdCopyImageToBuffer(cmd, offscreen_image_.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           readback_buffer.buffer, 1, &region);
+  });
+
+  CPUImage image{
+      .name = "Offscreen Image",
+      .width = resolution_.width,
+      .height = resolution_.height,
+      .components = components,
+      .data = std::make_unique<uint8_t[]>(size),
+  };
+  VK_CHECK(vmaInvalidateAllocation(context_.allocator(), readback_buffer.allocation, 0,
+                                   VK_WHOLE_SIZE));
+  std::memcpy(image.data.get(), context_.map(readback_buffer).value(), size);
+  context_.unmap(readback_buffer);
+  vkh::destroy_buffer(context_, readback_buffer);
+
+  return image;
+}
+
+void Renderer::present()
+{
+  ZoneScopedN("vkQueuePresentKHR");
+  const auto cpu_timer_scope = cpu_timer_.scope("vkQueuePresentKHR");
 
-      const GenerateDrawsPushConstant push_constant{
-          .draws_buffer_address = vkh::get_buffer_device_address(context_, draws_buffer_),
-          .draws_indirect_buffer_address =
-              vkh::get_buffer_device_address(context_, draws_indirect_buffer_),
-          .total_draws_count = total_draw_count_,
-      };
-      vkCmdPushConstants(cmd, generate_draws_layout_, VK_SHADER_STAGE_COMPUTE_BIT, 0,
-                         sizeof(GenerateDrawsPushConstant), &push_constant);
+  const auto& frame = current_frame();
+
+  VkSwapchainKHR swapchain = swapchain_.get();
+  const std::uint32_t image_index = swapchain_.current_image_index();
+
+  const VkPresentInfoKHR present_info = {
+      .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+      .pNext = nullptr,
+      .waitSemaphoreCount = 1,
+      .pWaitSemaphores = &frame.render_semaphore,
+      .swapchainCount = 1,
+      .pSwapchains = &swapchain,
+      .pImageIndices = &image_index,
+  };
+
+  const VkResult result = vkQueuePresentKHR(graphics_queue_, &present_info);
+  if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
+    // Supress
+    return;
+  }
+  VK_CHECK(result);
+}
+
+[[nodiscard]] auto Renderer::upload_mesh_buffer(const CPUMeshBuffers& buffers,
+                                                std::string_view name) -> MeshBuffers
+{
+  ZoneScoped;
+
+  static constexpr auto vertex_buffer_usage =
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+
+  vkh::AllocatedBuffer position_buffer =
+      upload_buffer(context_, upload_context_, buffers.positions,
+                    VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | vertex_buffer_usage,
+                    vkh::MemoryCategory::geometry, fmt::format("{} Vertex Position", name))
+          .value();
+  vkh::AllocatedBuffer vertex_buffer =
+      upload_buffer(context_, upload_context_, buffers.vertices, vertex_buffer_usage,
+                    vkh::MemoryCategory::geometry, fmt::format("{} Vertex", name))
+          .value();
+  vkh::AllocatedBuffer index_buffer =
+      upload_buffer(context_, upload_context_, buffers.indices,
+                    VK_BUFFER_USAGE_INDEX_BUFFER_BIT | vertex_buffer_usage,
+                    vkh::MemoryCategory::geometry, fmt::format("{} Index", name))
+          .value();
+
+  MeshBuffers mesh_buffers{
+      .position_buffer = position_buffer,
+      .vertex_buffer = vertex_buffer,
+      .index_buffer = index_buffer,
+  };
+
+  if (!buffers.meshlets.empty()) {
+    mesh_buffers.meshlet_buffer =
+        upload_buffer(context_, upload_context_, buffers.meshlets, vertex_buffer_usage,
+                      vkh::MemoryCategory::geometry, fmt::format("{} Meshlet", name))
+            .value();
+    mesh_buffers.meshlet_vertex_buffer =
+        upload_buffer(context_, upload_context_, buffers.meshlet_vertices, vertex_buffer_usage,
+                      vkh::MemoryCategory::geometry, fmt::format("{} Meshlet Vertex", name))
+            .value();
+    mesh_buffers.meshlet_triangle_buffer =
+        upload_buffer(context_, upload_context_, buffers.meshlet_triangles, vertex_buffer_usage,
+                      vkh::MemoryCategory::geometry, fmt::format("{} Meshlet Triangle", name))
+            .value();
+  }
+
+  return mesh_buffers;
+}
+
+auto Renderer::add_mesh(const CPUMesh& cpu_mesh) -> MeshHandle
+{
+  std::vector<SubMesh> submeshes;
+  submeshes.reserve(cpu_mesh.submeshes.size());
+  for (const auto& submesh : cpu_mesh.submeshes) {
+    submeshes.push_back(SubMesh{.vertex_offset = submesh.vertex_offset,
+                                .index_offset = submesh.index_offset,
+                                .index_count = submesh.index_count,
+                                .material_index = submesh.material_index.value(),
+                                .meshlet_offset = submesh.meshlet_offset,
+                                .meshlet_count = submesh.meshlet_count});
+  }
+
+  return meshes_.insert(Mesh{
+      .submeshes = std::move(submeshes),
+      .aabb = cpu_mesh.aabb,
+  });
+}
+
+auto Renderer::mesh_push_constant() -> MeshPushConstant
+{
+  return MeshPushConstant{
+      .position_buffer_address =
+          vkh::get_buffer_device_address(context_, scene_mesh_buffers.position_buffer),
+      .vertex_buffer_address =
+          vkh::get_buffer_device_address(context_, scene_mesh_buffers.vertex_buffer),
+      .draws_buffer_address = vkh::get_buffer_device_address(context_, draws_buffer_),
+      .texture_feedback_buffer_address = texture_streamer_->feedback_buffer_address(),
+      .material_buffer_address = material_buffer_address_,
+      .index_buffer_address =
+          vkh::get_buffer_device_address(context_, scene_mesh_buffers.index_buffer),
+  };
+}
+
+void Renderer::cmd_bind_mesh_resources(VkCommandBuffer cmd)
+{
+  const VkViewport viewport{
+      .x = 0.0f,
+      .y = beyond::narrow<float>(resolution().height),
+      .width = beyond::narrow<float>(resolution().width),
+      .height = -beyond::narrow<float>(resolution().height),
+      .minDepth = 0.0f,
+      .maxDepth = 1.0f,
+  };
+  vkCmdSetViewport(cmd, 0, 1, &viewport);
+  const VkRect2D scissor{.offset = {0, 0}, .extent = to_extent2d(resolution())};
+  vkCmdSetScissor(cmd, 0, 1, &scissor);
 
-      pipeline_manager_->cmd_bind_pipeline(cmd, generate_draws_pipeline_);
+  const size_t frame_index = frame_number_ % frame_overlap;
+
+  // bind descriptor sets
+  const u32 uniform_offset =
+      beyond::narrow<u32>(context_.align_uniform_buffer_size(sizeof(GPUSceneParameters))) *
+      beyond::narrow<u32>(frame_index);
+
+  VkDescriptorSet texture_descriptor_set = textures_->descriptor_set(frame_index);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, mesh_pipeline_layout_, 0, 1,
+                          &current_frame().global_descriptor_set, 1, &uniform_offset);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, mesh_pipeline_layout_, 1, 1,
+                          &current_frame().object_descriptor_set, 0, nullptr);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, mesh_pipeline_layout_, 2, 1,
+                          &texture_descriptor_set, 0, nullptr);
+
+  // Vertex and index buffers. Only the depth-only passes read positions from a vertex stream. The
+  // solid draws read the surviving triangles of the cluster culling
+  static constexpr VkDeviceSize vertex_offset = 0;
+  vkCmdBindVertexBuffers(cmd, 0, 1, &scene_mesh_buffers.position_buffer.buffer, &vertex_offset);
+  vkCmdBindIndexBuffer(cmd,
+                       cluster_culling_enabled() ? cluster_index_buffer_.buffer
+                                                 : scene_mesh_buffers.index_buffer.buffer,
+                       0, VK_INDEX_TYPE_UINT32);
+
+  const MeshPushConstant push_constant = mesh_push_constant();
+  vkCmdPushConstants(cmd, mesh_pipeline_layout_,
+                     VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+                     sizeof(MeshPushConstant), &push_constant);
+}
+
+void Renderer::cmd_draw_solid_geometry(VkCommandBuffer cmd, DrawPhase phase,
+                                       GraphicsPipelineHandle pipeline,
+                                       std::span<const VkRenderingAttachmentInfo> color_attachments)
+{
+  // The late phase keeps rendering on top of the early phase
+  const VkAttachmentLoadOp load_op =
+      phase == DrawPhase::early ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD;
 
-      static constexpr u32 local_group_size = 256;
-      vkCmdDispatch(cmd, total_draw_count_ / local_group_size + 1, 1, 1);
+  const VkRenderingAttachmentInfo depth_attachments_info{
+      .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+      .imageView = depth_image_view_,
+      .imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+      .loadOp = load_op,
+      .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+      .clearValue = VkClearValue{.depthStencil = {.depth = 0.f}},
+  };
+
+  const VkRenderingInfo render_info{
+      .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+      .renderArea =
+          {
+              .offset = {0, 0},
+              .extent = to_extent2d(resolution()),
+          },
+      .layerCount = 1,
+      .colorAttachmentCount = narrow<u32>(color_attachments.size()),
+      .pColorAttachments = color_attachments.data(),
+      .pDepthAttachment = &depth_attachments_info,
+  };
 
-      vkh::cmd_end_debug_utils_label(cmd);
+  vkCmdBeginRendering(cmd, &render_info);
 
-      {
-        const auto barrier =
-            vkh::BufferMemoryBarrier{
-                .stage_masks = {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
-                                VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT},
-                .access_masks = {VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT},
-                .buffer = draws_indirect_buffer_.buffer,
-                .offset = 0,
-                .size = total_draw_count_ * sizeof(VkDrawIndexedIndirectCommand),
-            }
-                .to_vk_struct();
-
-        vkh::cmd_pipeline_barrier(cmd, {.buffer_memory_barriers = std::array{barrier}});
-      }
-    }
+  cmd_bind_mesh_resources(cmd);
 
-    {
-      TracyVkZone(frame.tracy_vk_ctx, cmd, "Swapchain");
+  // Early and late solid draws live in separate regions with separate counts
+  static constexpr auto command_stride = sizeof(VkDrawIndexedIndirectCommand);
+  const usize draw_buffer_offset =
+      phase == DrawPhase::early ? 0 : solid_draw_count_ * command_stride;
+  const usize count_buffer_offset = phase == DrawPhase::early ? 0 : sizeof(u32);
+  pipeline_manager_->cmd_bind_pipeline(cmd, pipeline);
+  vkCmdDrawIndexedIndirectCount(cmd, draws_indirect_buffer_, draw_buffer_offset,
+                                draw_count_buffer_, count_buffer_offset, solid_draw_count_,
+                                command_stride);
 
-      transit_current_swapchain_image_for_rendering(cmd, current_swapchain_image);
+  vkCmdEndRendering(cmd);
+}
 
-      if (scene_parameters_.sunlight_shadow_mode != 0) {
-        shadow_map_renderer_->record_commands(cmd);
-      }
+void Renderer::cmd_draw_mesh_tasks(VkCommandBuffer cmd, DrawPhase phase)
+{
+  const size_t frame_index = current_frame_index();
+  const u32 uniform_offset =
+      beyond::narrow<u32>(context_.align_uniform_buffer_size(sizeof(GPUSceneParameters))) *
+      beyond::narrow<u32>(frame_index);
+  VkDescriptorSet texture_descriptor_set = textures_->descriptor_set(frame_index);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, mesh_shading_pipeline_layout_, 0,
+                          1, &current_frame().global_descriptor_set, 1, &uniform_offset);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, mesh_shading_pipeline_layout_, 1,
+                          1, &current_frame().object_descriptor_set, 0, nullptr);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, mesh_shading_pipeline_layout_, 2,
+                          1, &texture_descriptor_set, 0, nullptr);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, mesh_shading_pipeline_layout_, 3,
+                          1, &depth_pyramid_descriptor_set_, 0, nullptr);
+
+  // Early and late task commands live in separate regions with separate counts. The task shader
+  // indexes its command with gl_DrawID, so it gets the address of the region
+  static constexpr auto command_stride = sizeof(MeshTaskCommand);
+  const usize draw_buffer_offset =
+      phase == DrawPhase::early ? 0 : solid_draw_count_ * command_stride;
+  const usize count_buffer_offset = phase == DrawPhase::early ? 0 : sizeof(u32);
+
+  // The early phase draws what was visible last frame, so only the late phase tests meshlets
+  // against the depth pyramid
+  const MeshShadingPushConstant push_constant{
+      .mesh = mesh_push_constant(),
+      .meshlet_buffer_address =
+          vkh::get_buffer_device_address(context_, scene_mesh_buffers.meshlet_buffer),
+      .meshlet_vertex_buffer_address =
+          vkh::get_buffer_device_address(context_, scene_mesh_buffers.meshlet_vertex_buffer),
+      .meshlet_triangle_buffer_address =
+          vkh::get_buffer_device_address(context_, scene_mesh_buffers.meshlet_triangle_buffer),
+      .mesh_task_buffer_address =
+          vkh::get_buffer_device_address(context_, mesh_task_buffer_) + draw_buffer_offset,
+      .depth_pyramid_width = static_cast<f32>(depth_pyramid_extent_.width),
+      .depth_pyramid_height = static_cast<f32>(depth_pyramid_extent_.height),
+      .occlusion_culling_enabled =
+          occlusion_culling_enabled_ && phase == DrawPhase::late ? 1u : 0u,
+  };
+  vkCmdPushConstants(cmd, mesh_shading_pipeline_layout_,
+                     mesh_shading_shader_stages() | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+                     sizeof(MeshShadingPushConstant), &push_constant);
+
+  pipeline_manager_->cmd_bind_pipeline(cmd, mesh_shading_pipeline_);
+  vkh::cmd_begin_debug_utils_label(cmd, "solid meshlets pass", {0.084f, 0.235f, 0.394f, 1.0f});
+  vkCmdDrawMeshTasksIndirectCountEXT(cmd, mesh_task_buffer_, draw_buffer_offset,
+                                     draw_count_buffer_, count_buffer_offset, solid_draw_count_,
+                                     command_stride);
+  vkh::cmd_end_debug_utils_label(cmd);
+}
 
-      {
-        // Prepare final HDR image
-        const auto image_memory_barrier_to_render =
-            vkh::ImageBarrier{
-                .stage_masks = {VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
-                                VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT},
-                .access_masks = {VK_ACCESS_2_NONE, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT},
-                .layouts = {VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL},
-                .image = final_hdr_image_.image,
-                .subresource_range =
-                    vkh::SubresourceRange{.aspect_mask = VK_IMAGE_ASPECT_COLOR_BIT},
-            }
-                .to_vk_struct();
-        vkh::cmd_pipeline_barrier(cmd,
-                                  {.image_barriers = std::array{image_memory_barrier_to_render}});
-      }
-      draw_scene(cmd);
-      {
-        // Transit final hdr image to sample
-        const auto image_memory_barrier_to_sample =
-            vkh::ImageBarrier{
-                .stage_masks = {VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
-                                VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT},
-                .access_masks = {VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
-                                 VK_ACCESS_2_SHADER_SAMPLED_READ_BIT},
-                .layouts = {VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-                            VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL},
-                .image = final_hdr_image_.image,
-                .subresource_range =
-                    vkh::SubresourceRange{.aspect_mask = VK_IMAGE_ASPECT_COLOR_BIT},
-            }
-                .to_vk_struct();
-        vkh::cmd_pipeline_barrier(cmd,
-                                  {.image_barriers = std::array{image_memory_barrier_to_sample}});
-      }
+void Renderer::draw_depth_prepass(VkCommandBuffer cmd, DrawPhase phase)
+{
+  ZoneScopedN("Depth Prepass");
+  TracyVkZone(current_frame().tracy_vk_ctx, cmd, "Depth Prepass");
+  const auto gpu_timer_scope = gpu_timer_->scope(
+      cmd, phase == DrawPhase::early ? "Depth Prepass (Early)" : "Depth Prepass (Late)");
+
+  vkh::cmd_begin_debug_utils_label(cmd, "depth prepass", {0.3f, 0.3f, 0.3f, 1.0f});
+  cmd_draw_solid_geometry(cmd, phase, depth_prepass_pipeline_, {});
+  vkh::cmd_end_debug_utils_label(cmd);
+}
 
-      {
-        // Tonemapping pipeline
-        const VkRenderingAttachmentInfo color_attachments_info{
-            .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
-            .imageView = current_swapchain_image_view,
-            .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-            .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-            .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-        };
-
-        const VkRenderingInfo render_info{
-            .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
-            .renderArea =
-                {
-                    .offset = {0, 0},
-                    .extent = to_extent2d(resolution()),
-                },
-            .layerCount = 1,
-            .colorAttachmentCount = 1,
-            .pColorAttachments = &color_attachments_info,
-        };
-
-        vkCmdBeginRendering(cmd, &render_info);
-
-        const VkViewport viewport{
-            .x = 0.0f,
-            .y = 0.0f,
-            .width = beyond::narrow<float>(resolution().width),
-            .height = beyond::narrow<float>(resolution().height),
-            .minDepth = 0.0f,
-            .maxDepth = 1.0f,
-        };
-        vkCmdSetViewport(cmd, 0, 1, &viewport);
-        const VkRect2D scissor{.offset = {0, 0}, .extent = to_extent2d(resolution())};
-        vkCmdSetScissor(cmd, 0, 1, &scissor);
-      }
+void Renderer::draw_visibility_buffer(VkCommandBuffer cmd, DrawPhase phase)
+{
+  ZoneScopedN("Visibility Buffer Pass");
+  TracyVkZone(current_frame().tracy_vk_ctx, cmd, "Visibility Buffer Pass");
+  const auto gpu_timer_scope = gpu_timer_->scope(
+      cmd, phase == DrawPhase::early ? "Visibility Buffer (Early)" : "Visibility Buffer (Late)");
+
+  const VkAttachmentLoadOp load_op =
+      phase == DrawPhase::early ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD;
+  const VkRenderingAttachmentInfo visibility_attachment_info{
+      .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+      .imageView = visibility_buffer_image_view_,
+      .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+      .loadOp = load_op,
+      .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+      .clearValue = VkClearValue{.color = {.uint32 = {~0u, 0, 0, 0}}}, // VISIBILITY_EMPTY
+  };
 
-      pipeline_manager_->cmd_bind_pipeline(cmd, tonemapping_pipeline_);
-      vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, tonemapping_pipeline_layout_, 0,
-                              1, &final_hdr_image_descriptor_set_, 0, nullptr);
-      // Draw a fullscreen triangle
+  vkh::cmd_begin_debug_utils_label(cmd, "visibility buffer pass", {0.2f, 0.4f, 0.2f, 1.0f});
+  cmd_draw_solid_geometry(cmd, phase, visibility_buffer_pipeline_,
+                          std::span{&visibility_attachment_info, 1});
+  vkh::cmd_end_debug_utils_label(cmd);
+}
 
-      vkh::cmd_begin_debug_utils_label(cmd, "tonemapping pass", {0.1f, 0.1f, 0.1f, 1.0f});
-      vkCmdDraw(cmd, 3, 1, 0, 0);
-      vkh::cmd_end_debug_utils_label(cmd);
+void Renderer::cmd_resolve_visibility_buffer(VkCommandBuffer cmd)
+{
+  ZoneScopedN("Visibility Buffer Resolve");
+  TracyVkZone(current_frame().tracy_vk_ctx, cmd, "Visibility Buffer Resolve");
+  const auto gpu_timer_scope = gpu_timer_->scope(cmd, "Visibility Buffer Resolve");
+  vkh::cmd_begin_debug_utils_label(cmd, "visibility buffer resolve", {0.2f, 0.6f, 0.2f, 1.0f});
 
-      vkCmdEndRendering(cmd);
+  pipeline_manager_->cmd_bind_pipeline(cmd, visibility_resolve_pipeline_);
 
-      {
-        ZoneScopedN("ImGUI Render Pass");
-        TracyVkZone(frame.tracy_vk_ctx, cmd, "ImGUI Render Pass");
-        imgui_render_pass_->render(cmd, current_swapchain_image_view);
-      }
+  const u32 uniform_offset =
+      beyond::narrow<u32>(context_.align_uniform_buffer_size(sizeof(GPUSceneParameters))) *
+      beyond::narrow<u32>(current_frame_index());
+  VkDescriptorSet texture_descriptor_set = textures_->descriptor_set(current_frame_index());
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, visibility_resolve_pipeline_layout_,
+                          0, 1, &current_frame().global_descriptor_set, 1, &uniform_offset);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, visibility_resolve_pipeline_layout_,
+                          1, 1, &current_frame().object_descriptor_set, 0, nullptr);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, visibility_resolve_pipeline_layout_,
+                          2, 1, &texture_descriptor_set, 0, nullptr);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, visibility_resolve_pipeline_layout_,
+                          3, 1, &visibility_resolve_descriptor_set_, 0, nullptr);
+
+  const MeshPushConstant push_constant = mesh_push_constant();
+  vkCmdPushConstants(cmd, visibility_resolve_pipeline_layout_, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                     sizeof(MeshPushConstant), &push_constant);
 
-      transit_current_swapchain_image_to_present(cmd, current_swapchain_image);
-    }
+  static constexpr u32 local_group_size = 8;
+  vkCmdDispatch(cmd, (resolution_.width + local_group_size - 1) / local_group_size,
+                (resolution_.height + local_group_size - 1) / local_group_size, 1);
 
-    VK_CHECK(vkEndCommandBuffer(cmd));
-  }
+  vkh::cmd_end_debug_utils_label(cmd);
+}
 
-  {
-    ZoneScopedN("vkQueueSubmit");
-    static constexpr VkPipelineStageFlags wait_stage =
-        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    const VkSubmitInfo submit = {
-        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .pNext = nullptr,
-        .waitSemaphoreCount = 1,
-        .pWaitSemaphores = &frame.present_semaphore,
-        .pWaitDstStageMask = &wait_stage,
-        .commandBufferCount = 1,
-        .pCommandBuffers = &cmd,
-        .signalSemaphoreCount = 1,
-        .pSignalSemaphores = &frame.render_semaphore,
+void Renderer::draw_gbuffer(VkCommandBuffer cmd, DrawPhase phase)
+{
+  ZoneScopedN("G-Buffer Pass");
+  TracyVkZone(current_frame().tracy_vk_ctx, cmd, "G-Buffer Pass");
+  const auto gpu_timer_scope =
+      gpu_timer_->scope(cmd, phase == DrawPhase::early ? "G-Buffer (Early)" : "G-Buffer (Late)");
+
+  const VkAttachmentLoadOp load_op =
+      phase == DrawPhase::early ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD;
+  const auto attachment_info = [&](VkImageView view, VkClearColorValue clear_color) {
+    return VkRenderingAttachmentInfo{
+        .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+        .imageView = view,
+        .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        .loadOp = load_op,
+        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+        .clearValue = VkClearValue{.color = clear_color},
     };
+  };
+  // The lighting pass skips the pixels without depth, so they keep the clear color of the mesh pass
+  const VkRenderingAttachmentInfo color_attachments[] = {
+      attachment_info(final_hdr_image_view_, {.float32 = {1.0f, 1.0f, 1.0f, 1.0f}}),
+      attachment_info(gbuffer_base_color_view_, {}),
+      attachment_info(gbuffer_normal_view_, {}),
+      attachment_info(gbuffer_material_view_, {}),
+  };
 
-    VK_CHECK(vkQueueSubmit(graphics_queue_, 1, &submit, frame.render_fence));
-  }
-
-  present();
-
-  ++frame_number_;
+  vkh::cmd_begin_debug_utils_label(cmd, "G-buffer pass", {0.3f, 0.2f, 0.4f, 1.0f});
+  cmd_draw_solid_geometry(cmd, phase, gbuffer_pipeline_, color_attachments);
+  vkh::cmd_end_debug_utils_label(cmd);
 }
 
-void Renderer::present()
+void Renderer::cmd_deferred_lighting(VkCommandBuffer cmd)
 {
-  ZoneScopedN("vkQueuePresentKHR");
+  ZoneScopedN("Deferred Lighting");
+  TracyVkZone(current_frame().tracy_vk_ctx, cmd, "Deferred Lighting");
+  const auto gpu_timer_scope = gpu_timer_->scope(cmd, "Deferred Lighting");
+  vkh::cmd_begin_debug_utils_label(cmd, "deferred lighting", {0.4f, 0.3f, 0.6f, 1.0f});
 
-  const auto& frame = current_frame();
+  pipeline_manager_->cmd_bind_pipeline(cmd, deferred_lighting_pipeline_);
 
-  VkSwapchainKHR swapchain = swapchain_.get();
-  const std::uint32_t image_index = swapchain_.current_image_index();
+  const u32 uniform_offset =
+      beyond::narrow<u32>(context_.align_uniform_buffer_size(sizeof(GPUSceneParameters))) *
+      beyond::narrow<u32>(current_frame_index());
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, deferred_lighting_pipeline_layout_,
+                          0, 1, &current_frame().global_descriptor_set, 1, &uniform_offset);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, deferred_lighting_pipeline_layout_,
+                          1, 1, &deferred_lighting_descriptor_set_, 0, nullptr);
 
-  const VkPresentInfoKHR present_info = {
-      .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
-      .pNext = nullptr,
-      .waitSemaphoreCount = 1,
-      .pWaitSemaphores = &frame.render_semaphore,
-      .swapchainCount = 1,
-      .pSwapchains = &swapchain,
-      .pImageIndices = &image_index,
-  };
+  static constexpr u32 local_group_size = 8;
+  vkCmdDispatch(cmd, (resolution_.width + local_group_size - 1) / local_group_size,
+                (resolution_.height + local_group_size - 1) / local_group_size, 1);
 
-  const VkResult result = vkQueuePresentKHR(graphics_queue_, &present_info);
-  if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
-    // Supress
-    return;
-  }
-  VK_CHECK(result);
+  vkh::cmd_end_debug_utils_label(cmd);
 }
 
-[[nodiscard]] auto Renderer::upload_mesh_buffer(const CPUMeshBuffers& buffers,
-                                                std::string_view name) -> MeshBuffers
+void Renderer::cmd_update_exposure(VkCommandBuffer cmd)
 {
-  ZoneScoped;
+  ZoneScopedN("Auto Exposure");
+  TracyVkZone(current_frame().tracy_vk_ctx, cmd, "Auto Exposure");
+  const auto gpu_timer_scope = gpu_timer_->scope(cmd, "Auto Exposure");
+  vkh::cmd_begin_debug_utils_label(cmd, "auto exposure", {0.6f, 0.6f, 0.2f, 1.0f});
 
-  static constexpr auto vertex_buffer_usage =
-      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+  {
+    // The exposure pass of the previous frame might still read the histogram
+    const auto histogram_barrier =
+        vkh::BufferMemoryBarrier{
+            .stage_masks = {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                            VK_PIPELINE_STAGE_2_TRANSFER_BIT},
+            .access_masks = {VK_ACCESS_2_NONE, VK_ACCESS_2_TRANSFER_WRITE_BIT},
+            .buffer = luminance_histogram_buffer_.buffer,
+            .size = VK_WHOLE_SIZE,
+        }
+            .to_vk_struct();
+    vkh::cmd_pipeline_barrier(cmd, {.buffer_memory_barriers = std::array{histogram_barrier}});
+  }
+  vkCmdFillBuffer(cmd, luminance_histogram_buffer_, 0, VK_WHOLE_SIZE, 0);
+  {
+    const auto histogram_barrier =
+        vkh::BufferMemoryBarrier{
+            .stage_masks = {VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+                            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT},
+            .access_masks = {VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                             VK_ACCESS_2_SHADER_STORAGE_READ_BIT |
+                                 VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT},
+            .buffer = luminance_histogram_buffer_.buffer,
+            .size = VK_WHOLE_SIZE,
+        }
+            .to_vk_struct();
+    vkh::cmd_pipeline_barrier(cmd, {.buffer_memory_barriers = std::array{histogram_barrier}});
+  }
 
-  vkh::AllocatedBuffer position_buffer =
-      upload_buffer(context_, upload_context_, buffers.positions,
-                    VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | vertex_buffer_usage,
-                    fmt::format("{} Vertex Position", name))
-          .value();
-  vkh::AllocatedBuffer vertex_buffer =
-      upload_buffer(context_, upload_context_, buffers.vertices, vertex_buffer_usage,
-                    fmt::format("{} Vertex", name))
-          .value();
-  vkh::AllocatedBuffer index_buffer =
-      upload_buffer(context_, upload_context_, buffers.indices, VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-                    fmt::format("{} Index", name))
-          .value();
+  const VkDeviceAddress histogram_buffer_address =
+      vkh::get_buffer_device_address(context_, luminance_histogram_buffer_);
 
-  return MeshBuffers{
-      .position_buffer = position_buffer,
-      .vertex_buffer = vertex_buffer,
-      .index_buffer = index_buffer,
-  };
-}
+  {
+    pipeline_manager_->cmd_bind_pipeline(cmd, luminance_histogram_pipeline_);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            luminance_histogram_pipeline_layout_, 0, 1,
+                            &final_hdr_image_descriptor_set_, 0, nullptr);
+    const LuminanceHistogramPushConstant push_constant{
+        .histogram_buffer_address = histogram_buffer_address,
+        .min_log_luminance = min_log_luminance,
+        .inverse_log_luminance_range = 1.f / log_luminance_range,
+    };
+    vkCmdPushConstants(cmd, luminance_histogram_pipeline_layout_, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                       sizeof(push_constant), &push_constant);
 
-auto Renderer::add_mesh(const CPUMesh& cpu_mesh) -> MeshHandle
-{
-  std::vector<SubMesh> submeshes;
-  submeshes.reserve(cpu_mesh.submeshes.size());
-  for (const auto& submesh : cpu_mesh.submeshes) {
-    submeshes.push_back(SubMesh{.vertex_offset = submesh.vertex_offset,
-                                .index_offset = submesh.index_offset,
-                                .index_count = submesh.index_count,
-                                .material_index = submesh.material_index.value()});
+    static constexpr u32 local_group_size = 16;
+    vkCmdDispatch(cmd, (resolution_.width + local_group_size - 1) / local_group_size,
+                  (resolution_.height + local_group_size - 1) / local_group_size, 1);
   }
 
-  return meshes_.insert(Mesh{
-      .submeshes = std::move(submeshes),
-      .aabb = cpu_mesh.aabb,
-  });
+  {
+    const auto histogram_barrier =
+        vkh::BufferMemoryBarrier{
+            .stage_masks = {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT},
+            .access_masks = {VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                             VK_ACCESS_2_SHADER_STORAGE_READ_BIT},
+            .buffer = luminance_histogram_buffer_.buffer,
+            .size = VK_WHOLE_SIZE,
+        }
+            .to_vk_struct();
+    vkh::cmd_pipeline_barrier(cmd, {.buffer_memory_barriers = std::array{histogram_barrier}});
+  }
+
+  {
+    const auto current_time = std::chrono::steady_clock::now();
+    const auto frame_time =
+        fixed_time_step_ ? *fixed_time_step_ : current_time - previous_frame_time_;
+    const f32 delta_seconds = std::chrono::duration<f32>(frame_time).count();
+    previous_frame_time_ = current_time;
+    const f32 adaptation_rate =
+        exposure_adapted_ ? 1.f - std::exp(-delta_seconds * exposure_adaptation_speed) : 1.f;
+    exposure_adapted_ = true;
+
+    pipeline_manager_->cmd_bind_pipeline(cmd, auto_exposure_pipeline_);
+    const AutoExposurePushConstant push_constant{
+        .histogram_buffer_address = histogram_buffer_address,
+        .exposure_buffer_address = vkh::get_buffer_device_address(context_, exposure_buffer_),
+        .min_log_luminance = min_log_luminance,
+        .log_luminance_range = log_luminance_range,
+        .pixel_count = static_cast<f32>(resolution_.width) * static_cast<f32>(resolution_.height),
+        .adaptation_rate = adaptation_rate,
+        .exposure_compensation = exposure_compensation_,
+        .auto_exposure_enabled = auto_exposure_enabled_ ? 1u : 0u,
+    };
+    vkCmdPushConstants(cmd, auto_exposure_pipeline_layout_, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                       sizeof(push_constant), &push_constant);
+    vkCmdDispatch(cmd, 1, 1, 1);
+  }
+
+  vkh::cmd_end_debug_utils_label(cmd);
 }
 
-void Renderer::draw_scene(VkCommandBuffer cmd)
+void Renderer::draw_scene(VkCommandBuffer cmd, DrawPhase phase)
 {
   ZoneScopedN("Mesh Render Pass");
   TracyVkZone(current_frame().tracy_vk_ctx, cmd, "Mesh Render Pass");
+  const auto gpu_timer_scope = gpu_timer_->scope(
+      cmd, phase == DrawPhase::early ? "Mesh Pass (Early)" : "Mesh Pass (Late)");
+
+  // The late phase keeps rendering on top of the early phase
+  const VkAttachmentLoadOp load_op =
+      phase == DrawPhase::early ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD;
+  // The depth prepass, the visibility buffer pass or the G-buffer pass already filled the depth
+  const VkAttachmentLoadOp depth_load_op =
+      depth_prepass_enabled() || visibility_buffer_enabled() || deferred_shading_enabled()
+          ? VK_ATTACHMENT_LOAD_OP_LOAD
+          : load_op;
 
   const VkRenderingAttachmentInfo color_attachments_info{
       .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
       .imageView = final_hdr_image_view_,
       .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-      .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+      .loadOp = load_op,
       .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
       .clearValue = VkClearValue{.color = {.float32 = {1.0f, 1.0f, 1.0f, 1.0f}}},
   };
@@ -788,7 +2751,7 @@ void Renderer::draw_scene(VkCommandBuffer cmd)
       .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
       .imageView = depth_image_view_,
       .imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
-      .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+      .loadOp = depth_load_op,
       .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
       .clearValue = VkClearValue{.depthStencil = {.depth = 0.f}},
   };
@@ -808,65 +2771,43 @@ void Renderer::draw_scene(VkCommandBuffer cmd)
 
   vkCmdBeginRendering(cmd, &render_info);
 
-  const VkViewport viewport{
-      .x = 0.0f,
-      .y = beyond::narrow<float>(resolution().height),
-      .width = beyond::narrow<float>(resolution().width),
-      .height = -beyond::narrow<float>(resolution().height),
-      .minDepth = 0.0f,
-      .maxDepth = 1.0f,
-  };
-  vkCmdSetViewport(cmd, 0, 1, &viewport);
-  const VkRect2D scissor{.offset = {0, 0}, .extent = to_extent2d(resolution())};
-  vkCmdSetScissor(cmd, 0, 1, &scissor);
-
-  const size_t frame_index = frame_number_ % frame_overlap;
-
-  // bind descriptor sets
-  const u32 uniform_offset =
-      beyond::narrow<u32>(context_.align_uniform_buffer_size(sizeof(GPUSceneParameters))) *
-      beyond::narrow<u32>(frame_index);
-
-  VkDescriptorSet texture_descriptor_set = textures_->descriptor_set();
-  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, mesh_pipeline_layout_, 0, 1,
-                          &current_frame().global_descriptor_set, 1, &uniform_offset);
-  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, mesh_pipeline_layout_, 1, 1,
-                          &current_frame().object_descriptor_set, 0, nullptr);
-  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, mesh_pipeline_layout_, 2, 1,
-                          &material_descriptor_set_, 0, nullptr);
-  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, mesh_pipeline_layout_, 3, 1,
-                          &texture_descriptor_set, 0, nullptr);
-
-  // Vertex and index buffers
-  vkCmdBindIndexBuffer(cmd, scene_mesh_buffers.index_buffer.buffer, 0, VK_INDEX_TYPE_UINT32);
-
-  const MeshPushConstant push_constant{
-      .position_buffer_address =
-          vkh::get_buffer_device_address(context_, scene_mesh_buffers.position_buffer),
-      .vertex_buffer_address =
-          vkh::get_buffer_device_address(context_, scene_mesh_buffers.vertex_buffer),
-      .draws_buffer_address = vkh::get_buffer_device_address(context_, draws_buffer_),
-  };
-  vkCmdPushConstants(cmd, mesh_pipeline_layout_, VK_SHADER_STAGE_VERTEX_BIT, 0,
-                     sizeof(MeshPushConstant), &push_constant);
-
-  // draw solid objects
-  {
-    pipeline_manager_->cmd_bind_pipeline(cmd, mesh_pipeline_);
+  cmd_bind_mesh_resources(cmd);
+
+  static constexpr auto command_stride = sizeof(VkDrawIndexedIndirectCommand);
+
+  // draw solid objects. The visibility buffer resolve or the deferred lighting pass already shaded
+  // them
+  if (mesh_shading_enabled()) {
+    cmd_draw_mesh_tasks(cmd, phase);
+  } else if (!visibility_buffer_enabled() && !deferred_shading_enabled()) {
+    // Early and late solid draws live in separate regions with separate counts
+    const usize draw_buffer_offset =
+        phase == DrawPhase::early ? 0 : solid_draw_count_ * command_stride;
+    const usize count_buffer_offset = phase == DrawPhase::early ? 0 : sizeof(u32);
+    pipeline_manager_->cmd_bind_pipeline(
+        cmd, depth_prepass_enabled() ? mesh_pipeline_depth_equal_ : mesh_pipeline_);
     vkh::cmd_begin_debug_utils_label(cmd, "solid objects pass", {0.084f, 0.135f, 0.394f, 1.0f});
-    vkCmdDrawIndexedIndirect(cmd, draws_indirect_buffer_, 0, solid_draw_count_,
-                             sizeof(VkDrawIndexedIndirectCommand));
+    vkCmdDrawIndexedIndirectCount(cmd, draws_indirect_buffer_, draw_buffer_offset,
+                                  draw_count_buffer_, count_buffer_offset, solid_draw_count_,
+                                  command_stride);
     vkh::cmd_end_debug_utils_label(cmd);
   }
 
-  // Draw transparent objects
-  if (transparent_draw_count_ > 0) {
+  // Draw transparent objects after all the solid objects
+  if (phase == DrawPhase::late && transparent_draw_count_ > 0) {
+    // The mesh shading pipeline layout disturbed the bindings of the mesh pipelines
+    if (mesh_shading_enabled()) { cmd_bind_mesh_resources(cmd); }
+    // Transparent draws are not cluster culled
+    if (cluster_culling_enabled()) {
+      vkCmdBindIndexBuffer(cmd, scene_mesh_buffers.index_buffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+    }
     {
-      const auto draw_buffer_offset = solid_draw_count_ * sizeof(VkDrawIndexedIndirectCommand);
+      const auto draw_buffer_offset = 2 * solid_draw_count_ * command_stride;
       pipeline_manager_->cmd_bind_pipeline(cmd, mesh_pipeline_transparent_);
       vkh::cmd_begin_debug_utils_label(cmd, "transparent objects pass", {1.0f, 0.9f, 0.9f, 1.0f});
-      vkCmdDrawIndexedIndirect(cmd, draws_indirect_buffer_, draw_buffer_offset,
-                               transparent_draw_count_, sizeof(VkDrawIndexedIndirectCommand));
+      vkCmdDrawIndexedIndirectCount(cmd, draws_indirect_buffer_, draw_buffer_offset,
+                                    draw_count_buffer_, 2 * sizeof(u32), transparent_draw_count_,
+                                    command_stride);
       vkh::cmd_end_debug_utils_label(cmd);
     }
   }
@@ -878,20 +2819,63 @@ Renderer::~Renderer()
 {
   vkDeviceWaitIdle(context_);
 
+  retire_frame_graph_resources(current_frame_deletion_queue());
+  // Some deleters refer to the texture manager
+  for (DeletionQueue& deletion_queue : frame_deletion_queue_) { deletion_queue.flush(); }
+
   imgui_render_pass_ = nullptr;
 
+  if (headless()) {
+    vkDestroyImageView(context_, offscreen_image_view_, nullptr);
+    vkh::destroy_image(context_, offscreen_image_);
+  }
+
   vkh::destroy_buffer(context_, scene_mesh_buffers.vertex_buffer);
   vkh::destroy_buffer(context_, scene_mesh_buffers.position_buffer);
   vkh::destroy_buffer(context_, scene_mesh_buffers.index_buffer);
+  vkh::destroy_buffer(context_, scene_mesh_buffers.meshlet_buffer);
+  vkh::destroy_buffer(context_, scene_mesh_buffers.meshlet_vertex_buffer);
+  vkh::destroy_buffer(context_, scene_mesh_buffers.meshlet_triangle_buffer);
   scene_ = nullptr;
 
+  texture_streamer_ = nullptr;
   textures_ = nullptr;
+  gpu_timer_ = nullptr;
+
+  vkh::destroy_buffer(context_, material_buffer_);
+  vkh::destroy_buffer(context_, draws_buffer_);
+  vkh::destroy_buffer(context_, draws_indirect_buffer_);
+  vkh::destroy_buffer(context_, draw_count_buffer_);
+  vkh::destroy_buffer(context_, draw_visibility_buffer_);
+  vkh::destroy_buffer(context_, mesh_task_buffer_);
+  vkh::destroy_buffer(context_, cluster_buffer_);
+  vkh::destroy_buffer(context_, draw_slot_buffer_);
+  vkh::destroy_buffer(context_, cluster_index_buffer_);
+  vkh::destroy_buffer(context_, light_cluster_buffer_);
+  vkh::destroy_buffer(context_, luminance_histogram_buffer_);
+  vkh::destroy_buffer(context_, exposure_buffer_);
 
   vkDestroyCommandPool(context_, upload_context_.command_pool, nullptr);
   vkDestroyFence(context_, upload_context_.fence, nullptr);
 
   vkDestroyPipelineLayout(context_, tonemapping_pipeline_layout_, nullptr);
+  vkDestroyPipelineLayout(context_, luminance_histogram_pipeline_layout_, nullptr);
+  vkDestroyPipelineLayout(context_, auto_exposure_pipeline_layout_, nullptr);
   vkDestroyPipelineLayout(context_, mesh_pipeline_layout_, nullptr);
+  vkDestroyPipelineLayout(context_, mesh_shading_pipeline_layout_, nullptr);
+  vkDestroyPipelineLayout(context_, depth_pyramid_pipeline_layout_, nullptr);
+  vkDestroyPipelineLayout(context_, generate_draws_layout_, nullptr);
+  vkDestroyPipelineLayout(context_, cluster_culling_pipeline_layout_, nullptr);
+  vkDestroyPipelineLayout(context_, light_assignment_pipeline_layout_, nullptr);
+
+  vkDestroySampler(context_, depth_pyramid_sampler_, nullptr);
+
+  vkDestroyPipelineLayout(context_, shadow_mask_pipeline_layout_, nullptr);
+
+  vkDestroyPipelineLayout(context_, visibility_resolve_pipeline_layout_, nullptr);
+
+  vkDestroyPipelineLayout(context_, deferred_lighting_pipeline_layout_, nullptr);
+  frame_graph_ = nullptr;
 
   vkDestroyImageView(context_, depth_image_view_, nullptr);
   vkh::destroy_image(context_, depth_image_);
@@ -906,6 +2890,7 @@ Renderer::~Renderer()
     TracyVkDestroy(frame.tracy_vk_ctx);
 
     vkh::destroy_buffer(context_, frame.camera_buffer);
+    vkh::destroy_buffer(context_, frame.light_buffer);
 
     vkDestroyFence(context_, frame.render_fence, nullptr);
     vkDestroySemaphore(context_, frame.render_semaphore, nullptr);
@@ -916,6 +2901,18 @@ Renderer::~Renderer()
   sampler_cache_ = nullptr;
 }
 
+auto Renderer::mesh_shading_shader_stages() const -> VkShaderStageFlags
+{
+  return mesh_shading_supported() ? VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT
+                                  : VkShaderStageFlags{0};
+}
+
+auto Renderer::task_shader_pipeline_stage() const -> VkPipelineStageFlags2
+{
+  return mesh_shading_supported() ? VK_PIPELINE_STAGE_2_TASK_SHADER_BIT_EXT
+                                  : VK_PIPELINE_STAGE_2_NONE;
+}
+
 void Renderer::on_input_event(const Event& event, const InputStates& /*states*/)
 {
   std::visit(
@@ -949,17 +2946,24 @@ void Renderer::resize()
   vkh::destroy_image(context_, final_hdr_image_);
   init_final_hdr_image();
 
+  // The transient images follow the resolution, and the descriptor sets that refer to them also
+  // refer to the depth image and the final HDR image
+  build_frame_graph(output_image(), output_image_view());
+  static_cast<void>(frame_graph_->compile());
+  realize_frame_graph();
+
   const VkDescriptorImageInfo image_info{
       .sampler = sampler_cache_->default_blocky_sampler(),
       .imageView = final_hdr_image_view_,
       .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
   };
 
-  const auto result = DescriptorBuilder{*descriptor_layout_cache_, *descriptor_allocator_} //
-                          .bind_image(0, image_info, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                                      VK_SHADER_STAGE_FRAGMENT_BIT)
-                          .build()
-                          .value();
+  const auto result =
+      DescriptorBuilder{*descriptor_layout_cache_, *descriptor_allocator_} //
+          .bind_image(0, image_info, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                      VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT)
+          .build()
+          .value();
 
   final_hdr_image_descriptor_set_ = result.set;
 }
@@ -979,7 +2983,7 @@ auto Renderer::add_material(const CPUMaterial& material_info) -> u32
   const u32 emissive_texture_index =
       material_info.emissive_texture_index.value_or(default_white_index);
 
-  materials_.push_back(Material{
+  const Material material{
       .base_color_factor = material_info.base_color_factor,
       .albedo_texture_index = albedo_texture_index,
       .normal_texture_index = normal_texture_index,
@@ -991,33 +2995,174 @@ auto Renderer::add_material(const CPUMaterial& material_info) -> u32
       .roughness_factor = material_info.roughness_factor,
       .alpha_cutoff =
           material_info.alpha_mode == AlphaMode::mask ? material_info.alpha_cutoff : 0.0f,
-  });
+  };
 
-  material_alpha_modes_.push_back(material_info.alpha_mode);
+  u32 material_index = 0;
+  if (free_material_indices_.empty()) {
+    materials_.push_back(material);
+    material_alpha_modes_.push_back(material_info.alpha_mode);
+    material_index = narrow<u32>(materials_.size() - 1);
+  } else {
+    material_index = free_material_indices_.back();
+    free_material_indices_.pop_back();
+    materials_.at(material_index) = material;
+    material_alpha_modes_.at(material_index) = material_info.alpha_mode;
+  }
   BEYOND_ASSERT(materials_.size() == material_alpha_modes_.size());
 
-  return narrow<u32>(materials_.size() - 1);
+  mark_materials_dirty(material_index, material_index + 1);
+  const u32 texture_indices[] = {albedo_texture_index, normal_texture_index,
+                                 metallic_roughness_texture_index, occlusion_texture_index,
+                                 emissive_texture_index};
+  texture_streamer_->register_material(material_index, texture_indices);
+
+  return material_index;
 }
 
-void Renderer::upload_materials()
+void Renderer::remove_material(u32 index)
 {
-  material_buffer_ = upload_buffer(context_, upload_context_, materials_,
-                                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, "Materials")
-                         .value();
-
-  const VkDescriptorBufferInfo material_buffer_info = {
-      .buffer = material_buffer_,
-      .offset = 0,
-      .range = materials_.size() * sizeof(Material),
+  // The textures of the material might be gone, so point it to the default textures in case
+  // anything still reads it
+  const u32 default_white_index = textures_->default_white_texture_index();
+  materials_.at(index) = Material{
+      .albedo_texture_index = default_white_index,
+      .normal_texture_index = textures_->default_normal_texture_index(),
+      .metallic_roughness_texture_index = default_white_index,
+      .occlusion_texture_index = default_white_index,
+      .emissive_texture_index = default_white_index,
   };
+  material_alpha_modes_.at(index) = AlphaMode::opaque;
+  mark_materials_dirty(index, index + 1);
+  texture_streamer_->register_material(index, {});
 
-  auto result = DescriptorBuilder{*descriptor_layout_cache_, *descriptor_allocator_} //
-                    .bind_buffer(0, material_buffer_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-                                 VK_SHADER_STAGE_FRAGMENT_BIT)
-                    .build()
-                    .value();
-  BEYOND_ENSURE(material_descriptor_set_layout == result.layout);
-  material_descriptor_set_ = result.set;
+  // Frames in flight may still draw with the material, so the index can't be reused yet
+  current_frame_deletion_queue().push(
+      [this, index](vkh::Context& /*context*/) { free_material_indices_.push_back(index); });
+}
+
+void Renderer::update_material(u32 index, const Material& material)
+{
+  materials_.at(index) = material;
+  mark_materials_dirty(index, index + 1);
+}
+
+void Renderer::mark_materials_dirty(usize begin, usize end)
+{
+  if (dirty_materials_begin_ == dirty_materials_end_) {
+    dirty_materials_begin_ = begin;
+    dirty_materials_end_ = end;
+  } else {
+    dirty_materials_begin_ = std::min(dirty_materials_begin_, begin);
+    dirty_materials_end_ = std::max(dirty_materials_end_, end);
+  }
+}
+
+void Renderer::cmd_upload_dirty_materials(VkCommandBuffer cmd)
+{
+  if (dirty_materials_begin_ == dirty_materials_end_) { return; }
+
+  ZoneScoped;
+
+  if (materials_.size() > material_buffer_capacity_) {
+    // The previous frame might still read the old buffer
+    if (material_buffer_.buffer != VK_NULL_HANDLE) {
+      current_frame_deletion_queue().push([buffer = material_buffer_](vkh::Context& context) {
+        vkh::destroy_buffer(context, buffer);
+      });
+    }
+
+    static constexpr usize min_material_buffer_capacity = 256;
+    material_buffer_capacity_ =
+        std::max({materials_.size(), material_buffer_capacity_ * 2, min_material_buffer_capacity});
+    material_buffer_ =
+        vkh::create_buffer(context_,
+                           vkh::BufferCreateInfo{
+                               .size = material_buffer_capacity_ * sizeof(Material),
+                               .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                        VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                                        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                               .memory_usage = VMA_MEMORY_USAGE_GPU_ONLY,
+                               .debug_name = "Materials",
+                               .category = vkh::MemoryCategory::scene_data,
+                           })
+            .value();
+    material_buffer_address_ = vkh::get_buffer_device_address(context_, material_buffer_);
+    mark_materials_dirty(0, materials_.size());
+  }
+
+  const auto dirty_materials = std::span{materials_}.subspan(
+      dirty_materials_begin_, dirty_materials_end_ - dirty_materials_begin_);
+  const usize offset = dirty_materials_begin_ * sizeof(Material);
+  const usize size = dirty_materials.size_bytes();
+  dirty_materials_begin_ = dirty_materials_end_ = 0;
+
+  vkh::AllocatedBuffer staging_buffer =
+      vkh::create_buffer(context_, vkh::BufferCreateInfo{
+                                       .size = size,
+                                       .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                       .memory_usage = VMA_MEMORY_USAGE_CPU_ONLY,
+                                       .debug_name = "Material Staging Buffer",
+                                       .category = vkh::MemoryCategory::staging,
+                                   })
+          .value();
+  void* staging_data = context_.map(staging_buffer).value();
+  std::memcpy(staging_data, dirty_materials.data(), size);
+  context_.unmap(staging_buffer);
+  current_frame_deletion_queue().push([staging_buffer](vkh::Context& context) {
+    vkh::destroy_buffer(context, staging_buffer);
+  });
+
+  // The previous frame might still read the materials that we are about to overwrite, either in
+  // the forward pass or in the visibility buffer resolve
+  const auto before_copy =
+      vkh::BufferMemoryBarrier{
+          .stage_masks = {VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT |
+                              VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                          VK_PIPELINE_STAGE_2_TRANSFER_BIT},
+          .access_masks = {VK_ACCESS_2_NONE, VK_ACCESS_2_TRANSFER_WRITE_BIT},
+          .buffer = material_buffer_.buffer,
+          .offset = offset,
+          .size = size,
+      }
+          .to_vk_struct();
+  vkh::cmd_pipeline_barrier(cmd, {.buffer_memory_barriers = std::array{before_copy}});
+
+  const VkBufferCopy copy_region{.srcOffset = 0, .dstOffset = offset, .size = size};
+  vkCmdCopyBuffer(cmd, staging_buffer, material_buffer_, 1, &copy_region);
+
+  const auto after_copy =
+      vkh::BufferMemoryBarrier{
+          .stage_masks = {VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+                          VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT |
+                              VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT},
+          .access_masks = {VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT},
+          .buffer = material_buffer_.buffer,
+          .offset = offset,
+          .size = size,
+      }
+          .to_vk_struct();
+  vkh::cmd_pipeline_barrier(cmd, {.buffer_memory_barriers = std::array{after_copy}});
+}
+
+void Renderer::update_global_image_descriptor(u32 binding, const VkDescriptorImageInfo& image_info)
+{
+  for (const FrameData& frame : frames_) {
+    const VkWriteDescriptorSet write{
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = frame.global_descriptor_set,
+        .dstBinding = binding,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .pImageInfo = &image_info,
+    };
+    vkUpdateDescriptorSets(context_, 1, &write, 0, nullptr);
+  }
+}
+
+void Renderer::update_shadow_map_descriptors()
+{
+  update_global_image_descriptor(2, shadow_map_renderer_->shadow_map_image_info());
+  update_global_image_descriptor(3, shadow_map_renderer_->shadow_map_compare_image_info());
 }
 
 auto Renderer::add_texture(Texture texture) -> u32
@@ -1028,6 +3173,12 @@ auto Renderer::add_texture(Texture texture) -> u32
 void Renderer::set_scene(std::unique_ptr<Scene> scene)
 {
   BEYOND_ENSURE(scene != nullptr);
+  if (scene_ != nullptr) {
+    for (const u32 material : scene_->materials) { remove_material(material); }
+    for (const StreamedImageHandle image : scene_->images) {
+      texture_streamer_->remove_image(image, current_frame_deletion_queue());
+    }
+  }
   scene_ = std::move(scene);
 
   populate_scene_draw_buffers();
@@ -1038,9 +3189,26 @@ void Renderer::populate_scene_draw_buffers()
   ZoneScoped;
   std::vector<Draw> draws;
 
+  static constexpr auto infinity = std::numeric_limits<float>::infinity();
+  Point3 scene_min{infinity, infinity, infinity};
+  Point3 scene_max{-infinity, -infinity, -infinity};
+
   for (const auto [node_index, render_component] : scene_->render_components) {
     const Mesh& mesh = meshes_.try_get(render_component.mesh).expect("Cannot find mesh by handle!");
 
+    const Mat4& transform = scene_->global_transforms.at(node_index);
+    const Point3 mesh_min = mesh.aabb.min();
+    const Point3 mesh_max = mesh.aabb.max();
+    for (u32 i = 0; i < 8; ++i) {
+      const Vec4 corner{(i & 1) ? mesh_max.x : mesh_min.x, (i & 2) ? mesh_max.y : mesh_min.y,
+                        (i & 4) ? mesh_max.z : mesh_min.z, 1.f};
+      const Vec4 world_corner = transform * corner;
+      for (usize axis = 0; axis < 3; ++axis) {
+        scene_min.elem[axis] = std::min(scene_min.elem[axis], world_corner.elem[axis]);
+        scene_max.elem[axis] = std::max(scene_max.elem[axis], world_corner.elem[axis]);
+      }
+    }
+
     for (const auto& submesh : mesh.submeshes) {
       draws.push_back(Draw{
           .vertex_offset = submesh.vertex_offset,
@@ -1048,6 +3216,10 @@ void Renderer::populate_scene_draw_buffers()
           .index_offset = submesh.index_offset,
           .material_index = submesh.material_index,
           .node_index = node_index,
+          .aabb_min = mesh.aabb.min(),
+          .aabb_max = mesh.aabb.max(),
+          .meshlet_offset = submesh.meshlet_offset,
+          .meshlet_count = submesh.meshlet_count,
       });
     }
   }
@@ -1058,32 +3230,133 @@ void Renderer::populate_scene_draw_buffers()
     return alpha_mode != AlphaMode::blend;
   });
   total_draw_count_ = narrow<u32>(draws.size());
+  shadow_map_renderer_->invalidate_cache();
+  scene_bounds_ = draws.empty() ? beyond::AABB3{Point3{}, Point3{}}
+                                : beyond::AABB3{scene_min, scene_max};
   solid_draw_count_ = narrow<u32>(pivot - draws.begin());
   transparent_draw_count_ = narrow<u32>(draws.end() - pivot);
 
+  // Each solid draw owns a range of the cluster culled index buffer as large as its index range
+  std::vector<Cluster> clusters;
+  u32 cluster_index_count = 0;
+  for (u32 i = 0; i < solid_draw_count_; ++i) {
+    Draw& draw = draws[i];
+    draw.cluster_index_offset = cluster_index_count;
+    cluster_index_count += draw.index_count;
+    for (u32 j = 0; j < draw.meshlet_count; ++j) {
+      clusters.push_back(Cluster{.draw_index = i, .meshlet_index = draw.meshlet_offset + j});
+    }
+  }
+  cluster_count_ = narrow<u32>(clusters.size());
+
+  // The all ones texel marks empty pixels, so the last draw index is not usable
+  static constexpr u32 max_visibility_draw_count = (1u << (32 - visibility_triangle_bits)) - 1;
+  static constexpr u32 max_visibility_triangle_count = 1u << visibility_triangle_bits;
+  visibility_buffer_supported_ =
+      total_draw_count_ <= max_visibility_draw_count &&
+      std::ranges::all_of(draws, [](const Draw& draw) {
+        return draw.index_count / 3 <= max_visibility_triangle_count;
+      });
+
   current_frame_deletion_queue().push(
-      [draws_buffer = draws_buffer_,
-       draw_indirect_buffer = draws_indirect_buffer_](vkh::Context& context) {
+      [draws_buffer = draws_buffer_, draw_indirect_buffer = draws_indirect_buffer_,
+       draw_count_buffer = draw_count_buffer_, draw_visibility_buffer = draw_visibility_buffer_,
+       mesh_task_buffer = mesh_task_buffer_, cluster_buffer = cluster_buffer_,
+       draw_slot_buffer = draw_slot_buffer_,
+       cluster_index_buffer = cluster_index_buffer_](vkh::Context& context) {
         vkh::destroy_buffer(context, draws_buffer);
         vkh::destroy_buffer(context, draw_indirect_buffer);
+        vkh::destroy_buffer(context, draw_count_buffer);
+        vkh::destroy_buffer(context, draw_visibility_buffer);
+        vkh::destroy_buffer(context, mesh_task_buffer);
+        vkh::destroy_buffer(context, cluster_buffer);
+        vkh::destroy_buffer(context, draw_slot_buffer);
+        vkh::destroy_buffer(context, cluster_index_buffer);
       });
 
   draws_buffer_ =
       upload_buffer(context_, upload_context_, draws,
                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-                    "Draws")
+                    vkh::MemoryCategory::draw, "Draws")
           .value();
 
+  // Solid draws might be emitted by either the early or the late phase, so they get two regions
   draws_indirect_buffer_ =
       vkh::create_buffer(
           context_,
-          vkh::BufferCreateInfo{.size = draws.size() * sizeof(VkDrawIndexedIndirectCommand),
+          vkh::BufferCreateInfo{.size = (2 * solid_draw_count_ + transparent_draw_count_) *
+                                        sizeof(VkDrawIndexedIndirectCommand),
                                 .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
                                          VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
                                          VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
                                 .memory_usage = VMA_MEMORY_USAGE_GPU_ONLY,
-                                .debug_name = "Draw Indirect"})
+                                .debug_name = "Draw Indirect",
+                                .category = vkh::MemoryCategory::draw})
           .value();
+
+  draw_count_buffer_ =
+      vkh::create_buffer(context_,
+                         vkh::BufferCreateInfo{.size = 3 * sizeof(u32),
+                                               .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                                        VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                                                        VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                                                        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                                               .memory_usage = VMA_MEMORY_USAGE_GPU_ONLY,
+                                               .debug_name = "Draw Count",
+                                               .category = vkh::MemoryCategory::draw})
+          .value();
+
+  // Nothing is considered visible in the first frame, so the late phase draws everything that
+  // passes the occlusion test
+  draw_visibility_buffer_ =
+      upload_buffer(context_, upload_context_, std::vector<u32>(draws.size(), 0),
+                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                    vkh::MemoryCategory::draw, "Draw Visibility")
+          .value();
+
+  if (mesh_shading_supported()) {
+    mesh_task_buffer_ =
+        vkh::create_buffer(context_,
+                           vkh::BufferCreateInfo{.size = 2 * solid_draw_count_ *
+                                                         sizeof(MeshTaskCommand),
+                                                 .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                                          VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                                                          VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                                                 .memory_usage = VMA_MEMORY_USAGE_GPU_ONLY,
+                                                 .debug_name = "Mesh Task Commands",
+                                                 .category = vkh::MemoryCategory::draw})
+            .value();
+  }
+
+  cluster_buffer_ = {};
+  draw_slot_buffer_ = {};
+  cluster_index_buffer_ = {};
+  if (cluster_count_ > 0) {
+    cluster_buffer_ = upload_buffer(context_, upload_context_, clusters,
+                                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                                    vkh::MemoryCategory::geometry, "Clusters")
+                          .value();
+    draw_slot_buffer_ =
+        vkh::create_buffer(context_,
+                           vkh::BufferCreateInfo{.size = solid_draw_count_ * sizeof(u32),
+                                                 .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                                          VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                                                 .memory_usage = VMA_MEMORY_USAGE_GPU_ONLY,
+                                                 .debug_name = "Draw Slots",
+                                                 .category = vkh::MemoryCategory::draw})
+            .value();
+    cluster_index_buffer_ =
+        vkh::create_buffer(context_,
+                           vkh::BufferCreateInfo{.size = cluster_index_count * sizeof(u32),
+                                                 .usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+                                                          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                                          VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                                                 .memory_usage = VMA_MEMORY_USAGE_GPU_ONLY,
+                                                 .debug_name = "Cluster Indices",
+                                                 .category = vkh::MemoryCategory::geometry})
+            .value();
+  }
 }
 
 } // namespace charlie
@@ -1,6 +1,8 @@
 #pragma once
 
+#include "../asset_handling/cpu_image.hpp"
 #include "../asset_handling/cpu_mesh.hpp"
+#include "../utils/cpu_timer.hpp"
 #include "../utils/prelude.hpp"
 #include "../vulkan_helpers/buffer.hpp"
 #include "../vulkan_helpers/context.hpp"
@@ -13,19 +15,24 @@
 
 #include <beyond/container/slot_map.hpp>
 #include <beyond/math/matrix.hpp>
+#include <beyond/types/optional.hpp>
 #include <beyond/utils/function_ref.hpp>
 #include <beyond/utils/ref.hpp>
 
 #include "../asset_handling/cpu_scene.hpp"
 #include "deletion_queue.hpp"
+#include "frame_graph.hpp"
+#include "gpu_timer.hpp"
 #include "mesh.hpp"
 #include "pipeline_manager.hpp"
 #include "render_pass.hpp"
 #include "sampler_cache.hpp"
 #include "scene.hpp"
+#include "texture_streamer.hpp"
 #include "textures.hpp"
 #include "uploader.hpp"
 
+#include <chrono>
 #include <memory>
 #include <span>
 #include <unordered_map>
@@ -42,6 +49,17 @@ namespace charlie {
 // TODO: find better way to allocate object buffer
 constexpr usize max_object_count = 10000000;
 
+// Clustered lighting. Punctual lights are assigned to a froxel grid every frame, and shading only
+// iterates the lights of its cluster. Must match light_data.h.glsl
+inline constexpr u32 max_light_count = 16384;
+inline constexpr u32 light_grid_width = 16;
+inline constexpr u32 light_grid_height = 9;
+inline constexpr u32 light_grid_depth = 24; // Exponential depth slices
+inline constexpr u32 max_lights_per_cluster = 127;
+
+// Auto exposure. Must match exposure.h.glsl
+inline constexpr u32 luminance_histogram_bin_count = 256;
+
 class DescriptorAllocator;
 class DescriptorLayoutCache;
 
@@ -68,8 +86,31 @@ struct Draw {
   u32 material_index = 0;
   u32 node_index = static_cast<u32>(~0); // Index of the node in scene graph. Used to look up
                                          // information such as the transformations and mesh AABB
+  Point3 aabb_min;                       // Local space bounding box of the mesh, used for culling
+  Point3 aabb_max;
+  // Range in the meshlet buffer, used by the mesh shading path and the cluster culling
+  u32 meshlet_offset = 0;
+  u32 meshlet_count = 0;
+  u32 cluster_index_offset = 0; // First index of a solid draw in the cluster culled index buffer
 };
 
+struct GPUPunctualLight {
+  Vec3 position; // World space
+  f32 range = 0;
+  Vec3 color; // Premultiplied by the intensity
+  f32 spot_angle_scale = 0;
+  Vec3 direction; // Where spot lights point to
+  f32 spot_angle_offset = 1;
+};
+
+// Task shader dispatch of a draw in the mesh shading path. Each task workgroup culls
+// `task_group_meshlet_count` meshlets of the draw
+struct MeshTaskCommand {
+  VkDrawMeshTasksIndirectCommandEXT command = {};
+  u32 draw_index = 0;
+};
+inline constexpr u32 task_group_meshlet_count = 32; // Must match draw_data.h.glsl
+
 constexpr unsigned int frame_overlap = 2;
 struct FrameData {
   VkSemaphore present_semaphore{}, render_semaphore{};
@@ -82,6 +123,7 @@ struct FrameData {
   VkDescriptorSet global_descriptor_set{};
 
   vkh::AllocatedBuffer transform_buffer{}; // model matrix for each scene graph node
+  vkh::AllocatedBuffer light_buffer{};     // Punctual lights of the scene
   VkDescriptorSet object_descriptor_set{};
 
   tracy::VkCtx* tracy_vk_ctx = nullptr;
@@ -94,10 +136,35 @@ struct FrameData {
 
 class Camera;
 
+// Two-phase occlusion culling. The early phase draws objects that were visible last frame, and the
+// late phase draws the rest of the objects that pass the test against the depth pyramid built from
+// the early phase
+enum class DrawPhase { early, late };
+
+// How the solid draws get shaded
+enum class ShadingPath {
+  forward,          // The mesh pass shades fragments as they are rasterized
+  visibility_buffer, // A thin pass stores the visible triangle of each pixel, and a compute pass
+                     // shades each pixel once
+  deferred // The solid draws write their material parameters into a G-buffer, and a compute pass
+           // lights each pixel once
+};
+
+// Format of the HDR image that the scene is shaded into and that tone mapping reads
+enum class HDRFormat {
+  b10g11r11, // 4 bytes per pixel without alpha. Falls back to rgba16f without storage support
+  rgba16f,   // 8 bytes per pixel
+};
+
+// Bits of a visibility buffer texel that store the triangle index within a draw. The rest store the
+// draw index. Must match visibility_buffer.h.glsl
+inline constexpr u32 visibility_triangle_bits = 18;
+
 struct GPUSceneParameters {
   Vec4 sunlight_direction = {0, -1, -1, 0.1f}; // w is used for ambient strength
   Vec4 sunlight_color = {1, 1, 1, 5};          // w for sunlight intensity
-  Mat4 sunlight_view_proj;
+  Mat4 sunlight_view_proj[max_shadow_cascade_count]; // One per shadow cascade
+  Vec4 sunlight_cascade_splits;                       // View space depth where each cascade ends
 
   // Shadow mode
   // 0: no shadow
@@ -105,12 +172,61 @@ struct GPUSceneParameters {
   // 2: shadow map pcf
   // 3: shadow map PCSS
   u32 sunlight_shadow_mode = 3;
+  u32 sunlight_cascade_count = 0;
+  // Filtering of PCF and PCSS
+  // 0: manual depth fetches with hashed rotations
+  // 1: hardware comparison and gather with blue noise rotations
+  u32 sunlight_shadow_filtering = 1;
+  // 1: solid draws read the sun visibility from a half resolution screen-space shadow mask
+  u32 sunlight_shadow_mask = 0;
+
+  // Clustered punctual lights, updated every frame
+  VkDeviceAddress light_buffer_address = 0;
+  VkDeviceAddress light_cluster_buffer_address = 0;
+  Vec2 light_grid_tile_size; // In pixels
+  u32 light_count = 0;
+  // The depth slice of view space depth d is log2(d) * scale + bias
+  f32 light_grid_slice_scale = 0;
+  f32 light_grid_slice_bias = 0;
+};
+
+// The GUI settings that change what gets rendered. Camera paths record them every frame
+struct RendererSettings {
+  bool occlusion_culling = true;
+  bool depth_prepass = false;
+  ShadingPath shading_path = ShadingPath::forward;
+  bool mesh_shading = true;
+  bool cluster_culling = true;
+  bool triangle_culling = true;
+  bool auto_exposure = true;
+  f32 exposure_compensation = 0;
+  Vec4 sunlight_direction = {0, -1, -1, 0.1f}; // w is used for ambient strength
+  Vec4 sunlight_color = {1, 1, 1, 5};          // w for sunlight intensity
+  u32 sunlight_shadow_mode = 3;
+  u32 sunlight_shadow_filtering = 1;
+  u32 sunlight_shadow_mask = 0;
 };
 
 struct MeshPushConstant {
   VkDeviceAddress position_buffer_address = 0;
   VkDeviceAddress vertex_buffer_address = 0;
   VkDeviceAddress draws_buffer_address = 0;
+  VkDeviceAddress texture_feedback_buffer_address = 0;
+  VkDeviceAddress material_buffer_address = 0;
+  VkDeviceAddress index_buffer_address = 0;
+};
+
+// Starts with the mesh push constants, so the mesh shading pipeline shares the fragment shader
+// with the mesh pipelines
+struct MeshShadingPushConstant {
+  MeshPushConstant mesh;
+  VkDeviceAddress meshlet_buffer_address = 0;
+  VkDeviceAddress meshlet_vertex_buffer_address = 0;
+  VkDeviceAddress meshlet_triangle_buffer_address = 0;
+  VkDeviceAddress mesh_task_buffer_address = 0; // Task commands of the current phase
+  f32 depth_pyramid_width = 0;
+  f32 depth_pyramid_height = 0;
+  u32 occlusion_culling_enabled = 0; // Only in the late phase
 };
 
 // Buffers for mesh data
@@ -118,11 +234,19 @@ struct MeshBuffers {
   vkh::AllocatedBuffer position_buffer;
   vkh::AllocatedBuffer vertex_buffer;
   vkh::AllocatedBuffer index_buffer;
+
+  // Only uploaded if the meshes have meshlets
+  vkh::AllocatedBuffer meshlet_buffer;
+  vkh::AllocatedBuffer meshlet_vertex_buffer;
+  vkh::AllocatedBuffer meshlet_triangle_buffer;
 };
 
 class Renderer {
 public:
-  explicit Renderer(Window& window, InputHandler& input_handler);
+  explicit Renderer(Window& window, InputHandler& input_handler,
+                    HDRFormat hdr_format = HDRFormat::b10g11r11);
+  // Renders into an offscreen image instead of a swapchain, without a window and without the GUI
+  explicit Renderer(Resolution resolution, HDRFormat hdr_format = HDRFormat::b10g11r11);
   ~Renderer();
   Renderer(const Renderer&) = delete;
   auto operator=(const Renderer&) & -> Renderer& = delete;
@@ -137,10 +261,15 @@ public:
 
   void populate_scene_draw_buffers();
 
-  void draw_scene(VkCommandBuffer cmd);
+  void draw_scene(VkCommandBuffer cmd, DrawPhase phase);
 
   [[nodiscard]] auto resolution() const noexcept -> Resolution { return resolution_; }
 
+  [[nodiscard]] auto headless() const noexcept -> bool { return window_ == nullptr; }
+
+  // Copies the offscreen image of the last rendered frame to the CPU. Only for headless renderers
+  [[nodiscard]] auto read_back_offscreen_image() -> CPUImage;
+
   [[nodiscard]] BEYOND_FORCE_INLINE auto current_frame_index() const noexcept -> usize
   {
     return frame_number_ % frame_overlap;
@@ -177,7 +306,12 @@ public:
   // Adds a texture and returns its index
   [[nodiscard]] auto add_texture(Texture texture) -> u32;
   [[nodiscard]] auto add_material(const CPUMaterial& material_info) -> u32;
-  void upload_materials();
+
+  [[nodiscard]] auto material(u32 index) const -> const Material& { return materials_.at(index); }
+  // Edit an existing material. Only the changed range of materials is uploaded in the next frame
+  void update_material(u32 index, const Material& material);
+  // The index gets reused by a later `add_material` once the frames in flight are done with it
+  void remove_material(u32 index);
 
   void resize();
 
@@ -185,17 +319,107 @@ public:
 
   VkDescriptorSetLayout global_descriptor_set_layout = VK_NULL_HANDLE;
   VkDescriptorSetLayout object_descriptor_set_layout = VK_NULL_HANDLE;
-  VkDescriptorSetLayout material_descriptor_set_layout = VK_NULL_HANDLE;
 
   [[nodiscard]] auto pipeline_manager() -> PipelineManager& { return *pipeline_manager_; }
 
-  [[nodiscard]] auto draws_buffer() const -> VkBuffer { return draws_indirect_buffer_.buffer; }
+  [[nodiscard]] auto texture_streamer() -> TextureStreamer& { return *texture_streamer_; }
+
+  // All draws of the scene before culling. Solid draws come first
+  [[nodiscard]] auto draws_buffer() const -> const vkh::AllocatedBuffer& { return draws_buffer_; }
   [[nodiscard]] auto solid_draw_count() const -> u32 { return solid_draw_count_; };
 
+  [[nodiscard]] auto settings() const -> RendererSettings;
+  void set_settings(const RendererSettings& settings);
+
+  // Advances time dependent effects like the exposure adaptation by a fixed step instead of the
+  // wall clock time, so that replays render the same frames
+  void set_fixed_time_step(beyond::optional<std::chrono::steady_clock::duration> time_step)
+  {
+    fixed_time_step_ = time_step;
+  }
+
+  [[nodiscard]] auto occlusion_culling_enabled() const -> bool
+  {
+    return occlusion_culling_enabled_;
+  }
+  void set_occlusion_culling_enabled(bool enabled) { occlusion_culling_enabled_ = enabled; }
+
+  [[nodiscard]] auto shadow_mask_enabled() const -> bool
+  {
+    return scene_parameters_.sunlight_shadow_mode != 0 &&
+           scene_parameters_.sunlight_shadow_mask != 0;
+  }
+  // The shadow mask needs the depth of the whole frame before shading, so it forces the prepass on
+  [[nodiscard]] auto depth_prepass_enabled() const -> bool
+  {
+    return depth_prepass_enabled_ || shadow_mask_enabled();
+  }
+  void set_depth_prepass_enabled(bool enabled) { depth_prepass_enabled_ = enabled; }
+
+  [[nodiscard]] auto shading_path() const -> ShadingPath { return shading_path_; }
+  void set_shading_path(ShadingPath path) { shading_path_ = path; }
+  [[nodiscard]] auto visibility_buffer_supported() const -> bool
+  {
+    return visibility_buffer_supported_;
+  }
+  // Falls back to forward shading if the scene does not fit into the visibility buffer bits
+  [[nodiscard]] auto visibility_buffer_enabled() const -> bool
+  {
+    return shading_path_ == ShadingPath::visibility_buffer && visibility_buffer_supported_;
+  }
+  [[nodiscard]] auto deferred_shading_enabled() const -> bool
+  {
+    return shading_path_ == ShadingPath::deferred;
+  }
+
+  [[nodiscard]] auto mesh_shading_supported() const -> bool
+  {
+    return context_.supports_mesh_shader();
+  }
+  // Task shaders cull meshlets and mesh shaders emit the surviving triangles of the solid draws.
+  // Only replaces the indexed draws of the forward path without a depth prepass, since the
+  // prepass needs the exact same vertex positions
+  [[nodiscard]] auto mesh_shading_enabled() const -> bool
+  {
+    return mesh_shading_enabled_ && mesh_shading_supported() && !visibility_buffer_enabled() &&
+           !deferred_shading_enabled() && !depth_prepass_enabled();
+  }
+  void set_mesh_shading_enabled(bool enabled) { mesh_shading_enabled_ = enabled; }
+
+  // A compute pass culls the meshlets of the visible solid draws, and optionally their triangles,
+  // and compacts the surviving triangles into a separate index buffer. The visibility buffer
+  // resolve needs the original index ranges, and the mesh shading path culls meshlets on its own
+  [[nodiscard]] auto cluster_culling_enabled() const -> bool
+  {
+    return cluster_culling_enabled_ && cluster_count_ > 0 && !mesh_shading_enabled() &&
+           !visibility_buffer_enabled();
+  }
+  void set_cluster_culling_enabled(bool enabled) { cluster_culling_enabled_ = enabled; }
+  // Back-facing and zero-area triangles of the visible clusters
+  [[nodiscard]] auto triangle_culling_enabled() const -> bool
+  {
+    return triangle_culling_enabled_;
+  }
+  void set_triangle_culling_enabled(bool enabled) { triangle_culling_enabled_ = enabled; }
+
+  // The format in use, after the fallback
+  [[nodiscard]] auto hdr_format() const -> HDRFormat
+  {
+    return final_hdr_image_format_ == VK_FORMAT_B10G11R11_UFLOAT_PACK32 ? HDRFormat::b10g11r11
+                                                                        : HDRFormat::rgba16f;
+  }
+
+  // The frame ends with `render`, so the stages that the application measures before calling
+  // `render` count towards the frame that it renders
+  [[nodiscard]] auto cpu_timer() -> CPUTimer& { return cpu_timer_; }
+  [[nodiscard]] auto cpu_timer() const -> const CPUTimer& { return cpu_timer_; }
+  [[nodiscard]] auto gpu_timer() const -> const GPUTimer& { return *gpu_timer_; }
+  [[nodiscard]] auto frame_graph() const -> const FrameGraph& { return *frame_graph_; }
+
   MeshBuffers scene_mesh_buffers;
 
 private:
-  Window* window_ = nullptr;
+  Window* window_ = nullptr; // Null for headless renderers
   Resolution resolution_;
   vkh::Context context_;
   VkQueue graphics_queue_{};
@@ -205,15 +429,74 @@ private:
   vkh::Swapchain swapchain_;
   UploadContext upload_context_;
 
+  // Takes the place of the swapchain image for headless renderers
+  static constexpr VkFormat offscreen_image_format = VK_FORMAT_R8G8B8A8_SRGB;
+  vkh::AllocatedImage offscreen_image_;
+  VkImageView offscreen_image_view_ = VK_NULL_HANDLE;
+
   static constexpr VkFormat depth_format = VK_FORMAT_D32_SFLOAT;
   vkh::AllocatedImage depth_image_;
   VkImageView depth_image_view_ = {};
 
+  // Hierarchical depth for occlusion culling. Each texel holds the farthest depth of the region it
+  // covers. Level 0 is the depth image downsampled to a power of two size. The depth pyramid, the
+  // visibility buffer, the G-buffer and the shadow mask are transient images of the frame graph
+  static constexpr VkFormat depth_pyramid_format = VK_FORMAT_R32_SFLOAT;
+  VkImage depth_pyramid_ = VK_NULL_HANDLE;
+  VkExtent2D depth_pyramid_extent_ = {};
+  u32 depth_pyramid_level_count_ = 0;
+  VkImageView depth_pyramid_view_ = VK_NULL_HANDLE; // All levels, used by culling
+  std::vector<VkImageView> depth_pyramid_level_views_;
+  VkSampler depth_pyramid_sampler_ = VK_NULL_HANDLE; // Min reduction sampler
+  std::vector<VkDescriptorSet> depth_pyramid_level_descriptor_sets_; // For building each level
+  VkDescriptorSetLayout depth_pyramid_level_descriptor_set_layout_ = VK_NULL_HANDLE;
+  VkDescriptorSet depth_pyramid_descriptor_set_ = VK_NULL_HANDLE; // For culling
+  VkDescriptorSetLayout depth_pyramid_descriptor_set_layout_ = VK_NULL_HANDLE;
+  bool occlusion_culling_enabled_ = true;
+  bool depth_prepass_enabled_ = false;
+  ShadingPath shading_path_ = ShadingPath::forward;
+  bool visibility_buffer_supported_ = true; // False if the scene overflows the visibility bits
+  bool mesh_shading_enabled_ = true;
+  bool cluster_culling_enabled_ = true;
+  bool triangle_culling_enabled_ = true;
+
+  // Draw and triangle index of the closest solid surface at each pixel
+  static constexpr VkFormat visibility_buffer_format = VK_FORMAT_R32_UINT;
+  VkImage visibility_buffer_image_ = VK_NULL_HANDLE;
+  VkImageView visibility_buffer_image_view_ = VK_NULL_HANDLE;
+  VkDescriptorSet visibility_resolve_descriptor_set_ = VK_NULL_HANDLE;
+  VkDescriptorSetLayout visibility_resolve_descriptor_set_layout_ = VK_NULL_HANDLE;
+
+  // Material parameters of the closest solid surface at each pixel for deferred shading. The
+  // emission goes straight into the final HDR image, and positions come from the depth image
+  static constexpr VkFormat gbuffer_base_color_format = VK_FORMAT_R8G8B8A8_SRGB; // AO in alpha
+  static constexpr VkFormat gbuffer_normal_format = VK_FORMAT_R16G16_SFLOAT;     // Octahedral
+  static constexpr VkFormat gbuffer_material_format = VK_FORMAT_R8G8_UNORM; // Metallic, roughness
+  VkImage gbuffer_base_color_ = VK_NULL_HANDLE;
+  VkImageView gbuffer_base_color_view_ = VK_NULL_HANDLE;
+  VkImage gbuffer_normal_ = VK_NULL_HANDLE;
+  VkImageView gbuffer_normal_view_ = VK_NULL_HANDLE;
+  VkImage gbuffer_material_ = VK_NULL_HANDLE;
+  VkImageView gbuffer_material_view_ = VK_NULL_HANDLE;
+  VkDescriptorSet deferred_lighting_descriptor_set_ = VK_NULL_HANDLE;
+  VkDescriptorSetLayout deferred_lighting_descriptor_set_layout_ = VK_NULL_HANDLE;
+
+  // Sun visibility of every other pixel, computed from the depth prepass. R is the visibility and G
+  // the view space depth used for bilateral upsampling
+  static constexpr VkFormat shadow_mask_format = VK_FORMAT_R16G16_SFLOAT;
+  VkImage shadow_mask_ = VK_NULL_HANDLE;
+  VkExtent2D shadow_mask_extent_ = {};
+  VkImageView shadow_mask_view_ = VK_NULL_HANDLE;
+  VkDescriptorSet shadow_mask_descriptor_set_ = VK_NULL_HANDLE;
+  VkDescriptorSetLayout shadow_mask_descriptor_set_layout_ = VK_NULL_HANDLE;
+
   usize frame_number_ = 0;
   FrameData frames_[frame_overlap];
   DeletionQueue frame_deletion_queue_[frame_overlap];
 
   std::unique_ptr<charlie::DescriptorAllocator> descriptor_allocator_;
+  // Holds the descriptor sets that refer to transient images, replaced on each realize
+  std::unique_ptr<charlie::DescriptorAllocator> frame_graph_descriptor_allocator_;
   std::unique_ptr<charlie::DescriptorLayoutCache> descriptor_layout_cache_;
 
   std::unique_ptr<class ShaderCompiler> shader_compiler_;
@@ -224,26 +507,76 @@ private:
   VkPipelineLayout generate_draws_layout_ = VK_NULL_HANDLE;
   ComputePipelineHandle generate_draws_pipeline_;
 
+  VkPipelineLayout cluster_culling_pipeline_layout_ = VK_NULL_HANDLE;
+  ComputePipelineHandle cluster_culling_pipeline_;
+
+  VkPipelineLayout light_assignment_pipeline_layout_ = VK_NULL_HANDLE;
+  ComputePipelineHandle light_assignment_pipeline_;
+
+  VkPipelineLayout depth_pyramid_pipeline_layout_ = VK_NULL_HANDLE;
+  ComputePipelineHandle depth_pyramid_pipeline_;
+
   VkPipelineLayout mesh_pipeline_layout_ = VK_NULL_HANDLE;
   GraphicsPipelineHandle mesh_pipeline_;
   GraphicsPipelineHandle mesh_pipeline_transparent_;
+  GraphicsPipelineHandle mesh_pipeline_depth_equal_; // Solid draws after a depth prepass
+  GraphicsPipelineHandle depth_prepass_pipeline_;
+  GraphicsPipelineHandle visibility_buffer_pipeline_;
+  GraphicsPipelineHandle gbuffer_pipeline_;
+
+  VkPipelineLayout mesh_shading_pipeline_layout_ = VK_NULL_HANDLE;
+  GraphicsPipelineHandle mesh_shading_pipeline_;
+
+  VkPipelineLayout visibility_resolve_pipeline_layout_ = VK_NULL_HANDLE;
+  ComputePipelineHandle visibility_resolve_pipeline_;
+
+  VkPipelineLayout deferred_lighting_pipeline_layout_ = VK_NULL_HANDLE;
+  ComputePipelineHandle deferred_lighting_pipeline_;
+
+  VkPipelineLayout shadow_mask_pipeline_layout_ = VK_NULL_HANDLE;
+  ComputePipelineHandle shadow_mask_pipeline_;
 
   VkPipelineLayout tonemapping_pipeline_layout_ = VK_NULL_HANDLE;
   GraphicsPipelineHandle tonemapping_pipeline_;
 
-  static constexpr VkFormat final_hdr_image_format = VK_FORMAT_R32G32B32A32_SFLOAT;
+  VkFormat final_hdr_image_format_ = VK_FORMAT_UNDEFINED;
   vkh::AllocatedImage final_hdr_image_;
   VkImageView final_hdr_image_view_ = VK_NULL_HANDLE;
   VkDescriptorSet final_hdr_image_descriptor_set_ = VK_NULL_HANDLE;
+  VkDescriptorSetLayout final_hdr_image_descriptor_set_layout_ = VK_NULL_HANDLE;
+
+  // Histogram based auto exposure. The histogram is rebuilt every frame, and the exposure buffer
+  // keeps the adapted luminance across frames
+  VkPipelineLayout luminance_histogram_pipeline_layout_ = VK_NULL_HANDLE;
+  ComputePipelineHandle luminance_histogram_pipeline_;
+  VkPipelineLayout auto_exposure_pipeline_layout_ = VK_NULL_HANDLE;
+  ComputePipelineHandle auto_exposure_pipeline_;
+  vkh::AllocatedBuffer luminance_histogram_buffer_;
+  vkh::AllocatedBuffer exposure_buffer_;
+  bool auto_exposure_enabled_ = true;
+  f32 exposure_compensation_ = 0; // In stops
+  bool exposure_adapted_ = false; // The first frame jumps straight to its luminance
+  std::chrono::steady_clock::time_point previous_frame_time_;
+  beyond::optional<std::chrono::steady_clock::duration> fixed_time_step_;
 
   beyond::SlotMap<MeshHandle, Mesh> meshes_;
   std::vector<Material> materials_;
   std::vector<AlphaMode> material_alpha_modes_;
+  std::vector<u32> free_material_indices_;
 
+  // Persistent material buffer. Grows on demand, and only the dirty range of materials is uploaded
+  // each frame
   vkh::AllocatedBuffer material_buffer_;
-  VkDescriptorSet material_descriptor_set_ = VK_NULL_HANDLE;
+  VkDeviceAddress material_buffer_address_ = 0;
+  usize material_buffer_capacity_ = 0;
+  usize dirty_materials_begin_ = 0;
+  usize dirty_materials_end_ = 0;
 
   std::unique_ptr<TextureManager> textures_;
+  std::unique_ptr<TextureStreamer> texture_streamer_;
+  CPUTimer cpu_timer_;
+  std::unique_ptr<GPUTimer> gpu_timer_;
+  std::unique_ptr<FrameGraph> frame_graph_;
 
   VkDescriptorSetLayout draws_descriptor_set_layout_ = VK_NULL_HANDLE;
   VkDescriptorSet draws_descriptor_set_ = VK_NULL_HANDLE;
@@ -251,8 +584,28 @@ private:
   u32 total_draw_count_ = 0;
   u32 solid_draw_count_ = 0;
   u32 transparent_draw_count_ = 0;
+  beyond::AABB3 scene_bounds_{Point3{}, Point3{}}; // World space bounds of all draws
   vkh::AllocatedBuffer draws_buffer_; // Initial scene draws
+  // Draws that pass culling, in three compacted regions: solid draws of the early phase start at 0,
+  // solid draws of the late phase start at `solid_draw_count_`, and transparent draws start at
+  // `2 * solid_draw_count_`
   vkh::AllocatedBuffer draws_indirect_buffer_;
+  vkh::AllocatedBuffer draw_count_buffer_; // Draw counts of the three regions after culling
+  vkh::AllocatedBuffer draw_visibility_buffer_; // Occlusion culling result of the last frame
+  // Task shader dispatches of the visible solid draws, in the same regions as the solid draws of
+  // `draws_indirect_buffer_`. Only exists if mesh shaders are supported
+  vkh::AllocatedBuffer mesh_task_buffer_;
+
+  // Compute cluster culling. A cluster is a meshlet of a solid draw
+  u32 cluster_count_ = 0;
+  vkh::AllocatedBuffer cluster_buffer_;
+  // Indirect command that the current phase emitted for each solid draw, or ~0
+  vkh::AllocatedBuffer draw_slot_buffer_;
+  // Surviving triangles of each solid draw, starting at its `cluster_index_offset`
+  vkh::AllocatedBuffer cluster_index_buffer_;
+
+  // Light count and light indices of each cluster of the light grid
+  vkh::AllocatedBuffer light_cluster_buffer_;
 
   std::unique_ptr<Scene> scene_;
 
@@ -261,20 +614,101 @@ private:
 
   std::unique_ptr<FrameGraphRenderPass> imgui_render_pass_ = nullptr;
 
+  Renderer(Window* window, Resolution resolution, HDRFormat hdr_format);
+
   void update(const charlie::Camera& camera);
+  // Sets the light count and the light grid parameters. The light buffer itself can only be
+  // filled after waiting for the render fence, by `fill_light_buffer`
+  void update_light_parameters(const charlie::Camera& camera);
+  void fill_light_buffer();
 
   void init_frame_data();
   void init_final_hdr_image();
+  void init_offscreen_image();
   void init_depth_image();
+  void init_depth_pyramid();
+  void init_shadow_mask();
+  void init_visibility_buffer();
+  void init_gbuffer();
   void init_descriptors();
   void init_pipelines();
 
+  // Declares the passes of the frame for the current settings
+  void build_frame_graph(VkImage output_image, VkImageView output_image_view);
+  // Re-creates the transient images of the frame graph, and the views and descriptor sets that
+  // refer to them
+  void realize_frame_graph();
+  // Hands the views and descriptor sets that refer to the transient images to a deletion queue
+  void retire_frame_graph_resources(DeletionQueue& deletion_queue);
+
   void init_generate_draws_pipeline();
+  void init_cluster_culling_pipeline();
+  void init_light_assignment_pipeline();
+  void init_depth_pyramid_pipeline();
   void init_mesh_pipeline();
+  void init_depth_prepass_pipeline();
+  void init_shadow_mask_pipeline();
+  void init_visibility_buffer_pipelines();
+  void init_deferred_shading_pipelines();
+  void init_mesh_shading_pipeline();
   void init_tonemapping_pipeline();
+  void init_auto_exposure_pipelines();
+
+  void cmd_generate_draws(VkCommandBuffer cmd, DrawPhase phase);
+  // Fills the index counts of the solid draw commands that `cmd_generate_draws` emitted
+  void cmd_cull_clusters(VkCommandBuffer cmd, DrawPhase phase);
+  // Assigns the punctual lights to the clusters of the light grid
+  void cmd_assign_lights(VkCommandBuffer cmd);
+  void cmd_build_depth_pyramid(VkCommandBuffer cmd);
+  void cmd_build_shadow_mask(VkCommandBuffer cmd);
+  void cmd_resolve_visibility_buffer(VkCommandBuffer cmd);
+  // Builds the luminance histogram of the final HDR image and updates the exposure buffer
+  void cmd_update_exposure(VkCommandBuffer cmd);
+  // Tone maps the final HDR image into the output image
+  void cmd_tonemap(VkCommandBuffer cmd, VkImageView output_image_view);
+  void cmd_deferred_lighting(VkCommandBuffer cmd);
+
+  [[nodiscard]] auto mesh_push_constant() -> MeshPushConstant;
+  // Viewport, descriptor sets, vertex and index buffers and push constants shared by the passes
+  // that draw the scene meshes
+  void cmd_bind_mesh_resources(VkCommandBuffer cmd);
+  // Renders the solid draws of a phase with the given pipeline. Clears the attachments in the
+  // early phase
+  void cmd_draw_solid_geometry(VkCommandBuffer cmd, DrawPhase phase,
+                               GraphicsPipelineHandle pipeline,
+                               std::span<const VkRenderingAttachmentInfo> color_attachments);
+  // Draws the visible meshlets of the solid draws of a phase. Must be inside the mesh pass
+  void cmd_draw_mesh_tasks(VkCommandBuffer cmd, DrawPhase phase);
+  // Renders the solid draws of a phase into the depth image only
+  void draw_depth_prepass(VkCommandBuffer cmd, DrawPhase phase);
+  // Renders the solid draws of a phase into the depth image and the visibility buffer
+  void draw_visibility_buffer(VkCommandBuffer cmd, DrawPhase phase);
+  // Renders the solid draws of a phase into the depth image, the G-buffer and the emission into
+  // the final HDR image
+  void draw_gbuffer(VkCommandBuffer cmd, DrawPhase phase);
+
+  [[nodiscard]] auto shadow_mask_image_info() const -> VkDescriptorImageInfo;
+
+  // The image that a frame ends in: the current swapchain image, or the offscreen image
+  [[nodiscard]] auto output_image() const -> VkImage;
+  [[nodiscard]] auto output_image_view() const -> VkImageView;
+  [[nodiscard]] auto output_image_format() const -> VkFormat;
+
+  // The task and mesh shader stages if they are supported, or none. Pipeline stages and descriptor
+  // bindings must not name them otherwise
+  [[nodiscard]] auto mesh_shading_shader_stages() const -> VkShaderStageFlags;
+  [[nodiscard]] auto task_shader_pipeline_stage() const -> VkPipelineStageFlags2;
 
   void on_input_event(const Event& event, const InputStates& states);
 
+  // Point the global descriptor sets to the current shadow map image
+  void update_shadow_map_descriptors();
+  void update_global_image_descriptor(u32 binding, const VkDescriptorImageInfo& image_info);
+
+  void mark_materials_dirty(usize begin, usize end);
+  // Copy the dirty materials to the GPU material buffer, growing it when needed
+  void cmd_upload_dirty_materials(VkCommandBuffer cmd);
+
   void present();
 };
 
@@ -1,6 +1,7 @@
 #include "scene.hpp"
 
 #include "../asset_handling/gltf_loader.hpp"
+#include "../asset_handling/meshlet_builder.hpp"
 #include "../asset_handling/obj_loader.hpp"
 
 #include "../utils/asset_path.hpp"
@@ -16,10 +17,36 @@
 #include <tracy/Tracy.hpp>
 
 #include <fmt/chrono.h>
+#include <algorithm>
+#include <cmath>
 #include <latch>
 
 namespace charlie {
 
+namespace {
+
+// Lights without a range are cut off where their intensity drops below this, so that they only
+// get assigned to the clusters they visibly affect
+constexpr f32 light_cutoff_intensity = 0.01f;
+
+[[nodiscard]] auto to_light_component(const CPULight& light) -> LightComponent
+{
+  const f32 max_color = std::max({light.color.x, light.color.y, light.color.z});
+  const f32 range = light.range.value_or(
+      std::sqrt(std::max(light.intensity * max_color, 0.0f) / light_cutoff_intensity));
+
+  LightComponent component{.color = light.color * light.intensity, .range = range};
+  if (light.type == LightType::spot) {
+    const f32 cos_outer = std::cos(light.outer_cone_angle);
+    const f32 cos_inner = std::cos(light.inner_cone_angle);
+    component.spot_angle_scale = 1.0f / std::max(0.001f, cos_inner - cos_outer);
+    component.spot_angle_offset = -cos_outer * component.spot_angle_scale;
+  }
+  return component;
+}
+
+} // anonymous namespace
+
 [[nodiscard]] auto load_cpu_scene(std::string_view filename) -> CPUScene
 {
   ZoneScoped;
@@ -43,29 +70,32 @@ namespace charlie {
 {
   ZoneScoped;
 
-  std::vector<VkImage> images(cpu_scene.images.size(), VK_NULL_HANDLE);
-  std::vector<VkImageView> image_views(cpu_scene.images.size(), VK_NULL_HANDLE);
+  TextureStreamer& texture_streamer = renderer.texture_streamer();
+
+  std::vector<StreamedImageHandle> images(cpu_scene.images.size());
   {
     ZoneScopedN("Upload images");
 
-    for (usize i = 0; i < cpu_scene.images.size(); ++i) {
-      const CPUImage& cpu_image = cpu_scene.images[i];
-      const u32 mip_levels =
-          static_cast<u32>(
-              std::floor(narrow<f64>(std::log2(std::max(cpu_image.width, cpu_image.height))))) +
-          1;
-
-      images[i] = renderer.upload_image(cpu_image, {.mip_levels = mip_levels});
-
-      VkImageView image_view =
-          vkh::create_image_view(
-              renderer.context(),
-              {.image = images[i],
-               .format = VK_FORMAT_R8G8B8A8_SRGB,
-               .subresource_range = vkh::SubresourceRange{.aspect_mask = VK_IMAGE_ASPECT_COLOR_BIT,
-                                                          .level_count = mip_levels}})
-              .value();
-      image_views[i] = image_view;
+    // Only the small mips are uploaded here. The texture streamer brings in the detailed ones when
+    // they are visible
+    const auto upload = [&](usize i) {
+      images[i] =
+          texture_streamer.add_image(std::move(cpu_scene.images[i]), VK_FORMAT_R8G8B8A8_SRGB);
+    };
+
+    if (renderer.context().supports_host_image_copy()) {
+      // Host image copies don't need the queue, so images (and their CPU-side mipmap generation)
+      // can be uploaded in parallel
+      std::latch upload_latch{narrow<ptrdiff_t>(cpu_scene.images.size())};
+      for (usize i = 0; i < cpu_scene.images.size(); ++i) {
+        background_thread_pool().async([&, i]() {
+          upload(i);
+          upload_latch.count_down();
+        });
+      }
+      upload_latch.wait();
+    } else {
+      for (usize i = 0; i < cpu_scene.images.size(); ++i) { upload(i); }
     }
   }
 
@@ -73,12 +103,11 @@ namespace charlie {
   std::vector<uint32_t> texture_indices_map(cpu_scene.textures.size());
   {
     ZoneScopedN("Add textures");
-    std::ranges::transform(
-        cpu_scene.textures, texture_indices_map.begin(), [&](const CPUTexture& cpu_texture) {
-          VkImage image = images.at(cpu_texture.image_index);
-          VkImageView image_view = image_views.at(cpu_texture.image_index);
-          return renderer.add_texture(Texture{.image = image, .image_view = image_view});
-        });
+    std::ranges::transform(cpu_scene.textures, texture_indices_map.begin(),
+                           [&](const CPUTexture& cpu_texture) {
+                             return texture_streamer.add_texture(
+                                 images.at(cpu_texture.image_index));
+                           });
   }
   const auto lookup_texture_index = [&](u32 local_index) {
     return texture_indices_map.at(local_index);
@@ -93,13 +122,17 @@ namespace charlie {
       charlie::offset_material_texture_index(ref(material), lookup_texture_index);
       material_index_map[narrow<usize>(i)] = renderer.add_material(material);
     }
-
-    renderer.upload_materials();
   }
   // Offset material indices
   offset_material_indices(ref(cpu_scene),
                           [&](u32 i) { return narrow<u32>(material_index_map[i]); });
 
+  {
+    // Meshlets are the clusters of both the mesh shading path and the compute cluster culling
+    ZoneScopedN("Build meshlets");
+    build_meshlets(cpu_scene.buffers, cpu_scene.meshes);
+  }
+
   std::vector<MeshHandle> mesh_storage;
   {
     ZoneScopedN("Adds mesh");
@@ -117,12 +150,25 @@ namespace charlie {
     }
   }
 
+  // The sun is the only directional light
+  std::unordered_map<uint32_t, LightComponent> light_components;
+  for (u32 i = 0; i < cpu_scene.nodes.light_indices.size(); ++i) {
+    if (const i32 light_index = cpu_scene.nodes.light_indices[i]; light_index >= 0) {
+      const CPULight& light = cpu_scene.lights.at(static_cast<usize>(light_index));
+      if (light.type == LightType::directional) { continue; }
+      light_components.insert({i, to_light_component(light)});
+    }
+  }
+
   auto mesh_buffers = renderer.upload_mesh_buffer(cpu_scene.buffers, "Scene");
   renderer.current_frame_deletion_queue().push(
       [buffers = renderer.scene_mesh_buffers](vkh::Context& context) {
-        vkDestroyBuffer(context, buffers.position_buffer, nullptr);
-        vkDestroyBuffer(context, buffers.vertex_buffer, nullptr);
-        vkDestroyBuffer(context, buffers.index_buffer, nullptr);
+        vkh::destroy_buffer(context, buffers.position_buffer);
+        vkh::destroy_buffer(context, buffers.vertex_buffer);
+        vkh::destroy_buffer(context, buffers.index_buffer);
+        vkh::destroy_buffer(context, buffers.meshlet_buffer);
+        vkh::destroy_buffer(context, buffers.meshlet_vertex_buffer);
+        vkh::destroy_buffer(context, buffers.meshlet_triangle_buffer);
       });
   renderer.scene_mesh_buffers = mesh_buffers;
 
@@ -132,6 +178,9 @@ namespace charlie {
       .global_transforms = std::move(cpu_scene.nodes.global_transforms),
       .names = std::move(cpu_scene.nodes.names),
       .render_components = std::move(render_components),
+      .light_components = std::move(light_components),
+      .images = std::move(images),
+      .materials = std::move(material_index_map),
   };
 }
 
@@ -10,6 +10,7 @@
 #include <vector>
 
 #include "mesh.hpp"
+#include "texture_streamer.hpp"
 
 #include <vulkan/vulkan_core.h>
 
@@ -30,6 +31,16 @@ struct RenderComponent {
   MeshHandle mesh;
 };
 
+// A point or spot light at the origin of its node. Spot lights point down the -Z axis of the node
+struct LightComponent {
+  Vec3 color;     // Premultiplied by the intensity
+  f32 range = 0;  // Distance where the light falls off to zero
+  // Angular attenuation of spot lights is saturate(cos_angle * scale + offset). Point lights have a
+  // scale of 0 and an offset of 1
+  f32 spot_angle_scale = 0;
+  f32 spot_angle_offset = 1;
+};
+
 // Runtime scene representation
 // This is an ECS-like structure where each scene node is represented as an index
 struct Scene {
@@ -40,6 +51,13 @@ struct Scene {
   std::vector<std::string> names;
 
   std::unordered_map<u32, RenderComponent> render_components;
+  std::unordered_map<u32, LightComponent> light_components;
+
+  // Images (and the textures that sample them) owned by the scene. Released when the scene is
+  // replaced
+  std::vector<StreamedImageHandle> images;
+  // Indices of the materials owned by the scene. Released when the scene is replaced
+  std::vector<u32> materials;
 
   [[nodiscard]] auto node_count() const -> u32
   {
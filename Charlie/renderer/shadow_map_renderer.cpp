@@ -1,14 +1,105 @@
 #include "shadow_map_renderer.hpp"
+#include "../asset_handling/cpu_image.hpp"
+#include "../vulkan_helpers/bda.hpp"
 #include "../vulkan_helpers/context.hpp"
 #include "../vulkan_helpers/debug_utils.hpp"
 #include "../vulkan_helpers/pipeline_barrier.hpp"
 
+#include "camera.hpp"
 #include "renderer.hpp"
 #include "sampler_cache.hpp"
 
+#include <beyond/math/transform.hpp>
+
+#include <fmt/format.h>
+#include <imgui.h>
+
 #include <tracy/Tracy.hpp>
 #include <tracy/TracyVulkan.hpp>
 
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+// Orthographic projection that maps the view space depth range [near, far] (in front of a view that
+// looks down -z) to [0, 1]
+[[nodiscard]] auto ortho_projection(f32 left, f32 right, f32 bottom, f32 top, f32 near, f32 far)
+    -> Mat4
+{
+  // clang-format off
+  return Mat4 {
+      2.f / (right - left), 0, 0, -(right + left) / (right - left),
+      0, 2.f / (top - bottom), 0, -(top + bottom) / (top - bottom),
+      0, 0, -1.f / (far - near), -near / (far - near),
+      0, 0, 0, 1
+  };
+  // clang-format on
+}
+
+// Generates a tileable blue noise texture with the void-and-cluster method. Pixels are ranked by
+// repeatedly picking the largest void, i.e. the pixel with the lowest gaussian energy from the
+// pixels that are already ranked. The rank becomes the value of the pixel
+[[nodiscard]] auto generate_blue_noise(u32 size) -> charlie::CPUImage
+{
+  ZoneScoped;
+
+  const usize pixel_count = usize{size} * size;
+
+  // Energy that a ranked pixel contributes at each (toroidal) offset
+  static constexpr f32 sigma = 1.9f;
+  std::vector<f32> kernel(pixel_count);
+  for (u32 y = 0; y < size; ++y) {
+    for (u32 x = 0; x < size; ++x) {
+      const auto dx = static_cast<f32>(std::min(x, size - x));
+      const auto dy = static_cast<f32>(std::min(y, size - y));
+      kernel[y * size + x] = std::exp(-(dx * dx + dy * dy) / (2.f * sigma * sigma));
+    }
+  }
+
+  std::vector<f32> energy(pixel_count, 0.f);
+  std::vector<bool> is_ranked(pixel_count, false);
+
+  charlie::CPUImage image{
+      .name = "Blue Noise",
+      .width = size,
+      .height = size,
+      .components = 4,
+      .data = std::make_unique_for_overwrite<uint8_t[]>(pixel_count * 4),
+  };
+
+  for (usize rank = 0; rank < pixel_count; ++rank) {
+    usize void_index = 0;
+    f32 min_energy = std::numeric_limits<f32>::max();
+    for (usize i = 0; i < pixel_count; ++i) {
+      if (!is_ranked[i] && energy[i] < min_energy) {
+        min_energy = energy[i];
+        void_index = i;
+      }
+    }
+    is_ranked[void_index] = true;
+
+    const auto value = static_cast<uint8_t>(rank * 256 / pixel_count);
+    std::fill_n(image.data.get() + void_index * 4, 4, value);
+
+    const auto void_x = narrow<u32>(void_index % size);
+    const auto void_y = narrow<u32>(void_index / size);
+    for (u32 y = 0; y < size; ++y) {
+      const u32 offset_y = (y + size - void_y) % size;
+      for (u32 x = 0; x < size; ++x) {
+        energy[y * size + x] += kernel[offset_y * size + (x + size - void_x) % size];
+      }
+    }
+  }
+
+  return image;
+}
+
+} // anonymous namespace
+
 namespace charlie {
 
 ShadowMapRenderer::ShadowMapRenderer(Renderer& renderer, Ref<SamplerCache> sampler_cache)
@@ -18,49 +109,289 @@ ShadowMapRenderer::ShadowMapRenderer(Renderer& renderer, Ref<SamplerCache> sampl
 
   vkh::Context& context = renderer.context();
 
+  init_shadow_map_image();
+
+  const VkSamplerCreateInfo sampler_info = {.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+                                            .magFilter = VK_FILTER_LINEAR,
+                                            .minFilter = VK_FILTER_LINEAR,
+                                            .mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
+                                            .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+                                            .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+                                            .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+                                            .borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE};
+  shadow_map_sampler_ = sampler_cache->create_sampler(sampler_info);
+  VK_CHECK(vkh::set_debug_name(context, shadow_map_sampler_, "Shadow Map Sampler"));
+
+  // Returns the bilinearly filtered result of comparing a reference depth against four texels
+  VkSamplerCreateInfo compare_sampler_info = sampler_info;
+  compare_sampler_info.compareEnable = VK_TRUE;
+  compare_sampler_info.compareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+  shadow_map_compare_sampler_ = sampler_cache->create_sampler(compare_sampler_info);
+  VK_CHECK(vkh::set_debug_name(context, shadow_map_compare_sampler_,
+                               "Shadow Map Comparison Sampler"));
+
+  {
+    const CPUImage blue_noise = generate_blue_noise(blue_noise_size_);
+    blue_noise_image_ = renderer.upload_image(blue_noise, {.format = VK_FORMAT_R8G8B8A8_UNORM});
+    blue_noise_image_view_ =
+        vkh::create_image_view(
+            context,
+            {.image = blue_noise_image_,
+             .format = VK_FORMAT_R8G8B8A8_UNORM,
+             .subresource_range = vkh::SubresourceRange{.aspect_mask = VK_IMAGE_ASPECT_COLOR_BIT},
+             .debug_name = "Blue Noise Image View"})
+            .value();
+    blue_noise_sampler_ = sampler_cache->default_blocky_sampler();
+  }
+
+  draw_count_buffer_ =
+      vkh::create_buffer(context, vkh::BufferCreateInfo{
+                                      .size = max_shadow_cascade_count * sizeof(u32),
+                                      .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                               VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                                               VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                                               VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                                      .memory_usage = VMA_MEMORY_USAGE_GPU_ONLY,
+                                      .debug_name = "Shadow Draw Count",
+                                      .category = vkh::MemoryCategory::shadow_map,
+                                  })
+          .value();
+}
+
+ShadowMapRenderer::~ShadowMapRenderer()
+{
+  vkh::Context& context = renderer_.context();
+
+  vkDestroyPipelineLayout(context, shadow_map_pipeline_layout_, nullptr);
+  vkDestroyPipelineLayout(context, generate_draws_pipeline_layout_, nullptr);
+
+  vkh::destroy_buffer(context, draws_indirect_buffer_);
+  vkh::destroy_buffer(context, draw_count_buffer_);
+
+  vkDestroyImageView(context, blue_noise_image_view_, nullptr);
+  destroy_shadow_map_image();
+}
+
+void ShadowMapRenderer::init_shadow_map_image()
+{
+  vkh::Context& context = renderer_.context();
+
   shadow_map_image_ =
       vkh::create_image(
           context,
           vkh::ImageCreateInfo{
               .format = shadow_map_format_,
-              .extent = VkExtent3D{shadow_map_width_, shadow_map_height_, 1},
+              .extent = VkExtent3D{shadow_map_resolution_, shadow_map_resolution_, 1},
               .usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+              .array_layers = cascade_count_,
               .debug_name = "Shadow Map Image",
+              .category = vkh::MemoryCategory::shadow_map,
           })
           .expect("Fail to create shadow map image");
   shadow_map_image_view_ =
       vkh::create_image_view(
           context, vkh::ImageViewCreateInfo{.image = shadow_map_image_.image,
+                                            .view_type = VK_IMAGE_VIEW_TYPE_2D_ARRAY,
                                             .format = shadow_map_format_,
                                             .subresource_range =
                                                 vkh::SubresourceRange{
                                                     .aspect_mask = VK_IMAGE_ASPECT_DEPTH_BIT,
+                                                    .layer_count = cascade_count_,
                                                 },
                                             .debug_name = "Shadow Map Image View"})
           .expect("Fail to create shadow map image view");
 
-  const VkSamplerCreateInfo sampler_info = {.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
-                                            .magFilter = VK_FILTER_LINEAR,
-                                            .minFilter = VK_FILTER_LINEAR,
-                                            .mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
-                                            .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
-                                            .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
-                                            .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
-                                            .borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE};
-  shadow_map_sampler_ = sampler_cache->create_sampler(sampler_info);
-  VK_CHECK(vkh::set_debug_name(context, shadow_map_sampler_, "Shadow Map Sampler"));
+  cascade_image_views_.resize(cascade_count_);
+  for (u32 cascade = 0; cascade < cascade_count_; ++cascade) {
+    cascade_image_views_[cascade] =
+        vkh::create_image_view(
+            context,
+            vkh::ImageViewCreateInfo{.image = shadow_map_image_.image,
+                                     .format = shadow_map_format_,
+                                     .subresource_range =
+                                         vkh::SubresourceRange{
+                                             .aspect_mask = VK_IMAGE_ASPECT_DEPTH_BIT,
+                                             .base_array_layer = cascade,
+                                         },
+                                     .debug_name = fmt::format("Shadow Cascade {} View", cascade)})
+            .expect("Fail to create shadow cascade image view");
+  }
 }
 
-ShadowMapRenderer::~ShadowMapRenderer()
+void ShadowMapRenderer::destroy_shadow_map_image()
 {
   vkh::Context& context = renderer_.context();
 
-  vkDestroyPipelineLayout(context, shadow_map_pipeline_layout_, nullptr);
-
+  for (VkImageView view : cascade_image_views_) { vkDestroyImageView(context, view, nullptr); }
+  cascade_image_views_.clear();
   vkDestroyImageView(context, shadow_map_image_view_, nullptr);
   vkh::destroy_image(context, shadow_map_image_);
 }
 
+void ShadowMapRenderer::update(const Camera& camera, const beyond::AABB3& scene_bounds,
+                               GPUSceneParameters& scene_parameters)
+{
+  ZoneScoped;
+
+  const Vec3 light_direction = normalize(Vec3(scene_parameters.sunlight_direction.xyz));
+  const Vec3 up = abs(dot(light_direction, Vec3(0.0, 1.0, 0.0))) > 0.9 ? Vec3(0.0, 0.0, 1.0)
+                                                                        : Vec3(0.0, 1.0, 0.0);
+  // Only rotates into the light space, so that cascades can be snapped to texels in it
+  const Mat4 light_view = beyond::look_at(Vec3(0.0), light_direction, up);
+
+  // All cascades extend to the light-facing side of the scene, so that casters outside of the
+  // cascade can still cast shadows into it
+  f32 scene_min_light_depth = std::numeric_limits<f32>::max();
+  const Point3 scene_min = scene_bounds.min();
+  const Point3 scene_max = scene_bounds.max();
+  for (u32 i = 0; i < 8; ++i) {
+    const Vec4 corner{(i & 1) ? scene_max.x : scene_min.x, (i & 2) ? scene_max.y : scene_min.y,
+                      (i & 4) ? scene_max.z : scene_min.z, 1.f};
+    scene_min_light_depth = std::min(scene_min_light_depth, -(light_view * corner).z);
+  }
+
+  const Mat4 inverse_view = beyond::inverse(camera.view_matrix());
+  const f32 z_near = camera.z_near;
+  const f32 z_far = std::min(camera.z_far, shadow_distance_);
+  // Squared tangent of the angle between the view direction and the frustum corners
+  const f32 tan_half_fovy = tan(camera.fovy * 0.5f);
+  const f32 corner_tan2 =
+      tan_half_fovy * tan_half_fovy * (1.f + camera.aspect_ratio * camera.aspect_ratio);
+
+  f32 split_near = z_near;
+  for (u32 cascade = 0; cascade < cascade_count_; ++cascade) {
+    // Practical split scheme: blend logarithmic and uniform splits
+    const f32 p = static_cast<f32>(cascade + 1) / static_cast<f32>(cascade_count_);
+    const f32 log_split = z_near * std::pow(z_far / z_near, p);
+    const f32 uniform_split = z_near + (z_far - z_near) * p;
+    const f32 split_far = std::lerp(uniform_split, log_split, split_lambda_);
+
+    // Fit a bounding sphere to the frustum slice. Its size doesn't change when the camera rotates
+    const f32 center_depth =
+        std::min((split_near + split_far) * 0.5f * (1.f + corner_tan2), split_far);
+    const f32 far_offset = split_far - center_depth;
+    f32 radius = std::sqrt(far_offset * far_offset + corner_tan2 * split_far * split_far);
+    // Quantize the radius, so that floating point errors don't change the texel size
+    radius = std::ceil(radius * 16.f) / 16.f;
+
+    const Vec4 center = light_view * (inverse_view * Vec4{0.f, 0.f, -center_depth, 1.f});
+
+    // Snap the cascade to texels, so that shadow edges don't shimmer when the camera moves
+    const f32 texel_size = 2.f * radius / static_cast<f32>(shadow_map_resolution_);
+    const f32 center_x = std::floor(center.x / texel_size) * texel_size;
+    const f32 center_y = std::floor(center.y / texel_size) * texel_size;
+    const f32 center_light_depth = -center.z;
+
+    const f32 near = std::min(scene_min_light_depth, center_light_depth - radius);
+    const f32 far = center_light_depth + radius;
+
+    cascade_view_proj_[cascade] = ortho_projection(center_x - radius, center_x + radius,
+                                                   center_y - radius, center_y + radius, near,
+                                                   far) *
+                                  light_view;
+    scene_parameters.sunlight_view_proj[cascade] = cascade_view_proj_[cascade];
+    scene_parameters.sunlight_cascade_splits.elem[cascade] = split_far;
+
+    split_near = split_far;
+  }
+  scene_parameters.sunlight_cascade_count = cascade_count_;
+}
+
+void ShadowMapRenderer::update_caster_transforms(std::span<const Mat4> transforms)
+{
+  ZoneScoped;
+
+  if (transforms.size() == caster_transforms_.size() &&
+      std::memcmp(transforms.data(), caster_transforms_.data(), transforms.size_bytes()) == 0) {
+    return;
+  }
+  caster_transforms_.assign(transforms.begin(), transforms.end());
+  invalidate_cache();
+}
+
+auto ShadowMapRenderer::find_dirty_cascades() -> u32
+{
+  const u32 all_cascades_mask = (1u << cascade_count_) - 1;
+  if (!cache_enabled_) { return all_cascades_mask; }
+
+  u32 dirty_mask = 0;
+  for (u32 cascade = 0; cascade < cascade_count_; ++cascade) {
+    // The view projection also covers changes of the light direction and the scene bounds
+    const bool is_valid = (valid_cascade_mask_ & (1u << cascade)) != 0 &&
+                          std::memcmp(&rendered_view_proj_[cascade], &cascade_view_proj_[cascade],
+                                      sizeof(Mat4)) == 0;
+    if (!is_valid) { dirty_mask |= 1u << cascade; }
+  }
+  return dirty_mask;
+}
+
+auto ShadowMapRenderer::draw_gui() -> bool
+{
+  int cascade_count = narrow<int>(cascade_count_);
+  ImGui::SliderInt("Cascade Count", &cascade_count, 1, narrow<int>(max_shadow_cascade_count));
+
+  static constexpr const char* resolution_names[] = {"512", "1024", "2048", "4096"};
+  static constexpr u32 min_resolution = 512;
+  int resolution_index = std::countr_zero(shadow_map_resolution_ / min_resolution);
+  ImGui::Combo("Cascade Resolution", &resolution_index, resolution_names,
+               narrow<int>(std::size(resolution_names)));
+
+  ImGui::SliderFloat("Shadow Distance", &shadow_distance_, 10.f, 10000.f, "%.0f",
+                     ImGuiSliderFlags_Logarithmic | ImGuiSliderFlags_AlwaysClamp);
+  ImGui::SliderFloat("Split Lambda", &split_lambda_, 0.f, 1.f, "%.2f",
+                     ImGuiSliderFlags_AlwaysClamp);
+  if (ImGui::IsItemHovered()) {
+    ImGui::SetTooltip("Blend between uniform (0) and logarithmic (1) cascade splits");
+  }
+
+  static constexpr float mib = 1024.f * 1024.f;
+  const auto texel_count = static_cast<float>(shadow_map_resolution_) *
+                           static_cast<float>(shadow_map_resolution_) *
+                           static_cast<float>(cascade_count_);
+  ImGui::LabelText("Shadow Map Memory", "%.1f MiB",
+                   texel_count * static_cast<float>(sizeof(f32)) / mib);
+
+  if (ImGui::Checkbox("Cache Shadow Maps", &cache_enabled_)) { invalidate_cache(); }
+  if (ImGui::IsItemHovered()) {
+    ImGui::SetTooltip("Only re-render cascades whose light view or shadow casters changed");
+  }
+  ImGui::LabelText("Rendered Cascades", "%u / %u", last_rendered_cascade_count_, cascade_count_);
+  const double hit_rate = cascade_cache_lookups_ == 0
+                              ? 0.0
+                              : static_cast<double>(cascade_cache_hits_) /
+                                    static_cast<double>(cascade_cache_lookups_);
+  ImGui::LabelText("Cache Hits", "%llu (%.1f%%)",
+                   static_cast<unsigned long long>(cascade_cache_hits_), hit_rate * 100.0);
+
+  const auto new_cascade_count = narrow<u32>(cascade_count);
+  const u32 new_resolution = min_resolution << resolution_index;
+  if (new_cascade_count == cascade_count_ && new_resolution == shadow_map_resolution_) {
+    return false;
+  }
+
+  renderer_.context().wait_idle();
+  cascade_count_ = new_cascade_count;
+  shadow_map_resolution_ = new_resolution;
+  destroy_shadow_map_image();
+  init_shadow_map_image();
+  invalidate_cache();
+  return true;
+}
+
+struct ShadowGenerateDrawsPushConstant {
+  VkDeviceAddress draws_buffer_address = 0;
+  VkDeviceAddress draws_indirect_buffer_address = 0;
+  VkDeviceAddress draw_count_buffer_address = 0;
+  u32 solid_draw_count = 0;
+  u32 cascade_mask = 0;
+  u32 cull_to_view_frustum = 0;
+};
+
+struct ShadowPushConstant {
+  VkDeviceAddress draws_buffer_address = 0; // To look up the transform of a draw
+  u32 cascade_index = 0;
+};
+
 void ShadowMapRenderer::init_pipeline()
 {
   vkh::Context& context = renderer_.context();
@@ -73,9 +404,44 @@ void ShadowMapRenderer::init_pipeline()
   const VkDescriptorSetLayout set_layouts[] = {renderer_.global_descriptor_set_layout,
                                                renderer_.object_descriptor_set_layout};
 
+  {
+    const ShaderHandle compute_shader = renderer_.pipeline_manager().add_shader(
+        "generate_shadow_draws.comp.glsl", ShaderStage::compute);
+
+    const VkPushConstantRange push_constant[] = {{
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset = 0,
+        .size = sizeof(ShadowGenerateDrawsPushConstant),
+    }};
+
+    generate_draws_pipeline_layout_ =
+        vkh::create_pipeline_layout(context,
+                                    {
+                                        .set_layouts = set_layouts,
+                                        .push_constant_ranges = push_constant,
+                                    })
+            .value();
+
+    generate_draws_pipeline_ = renderer_.pipeline_manager().create_compute_pipeline(
+        ComputePipelineCreateInfo{.layout = generate_draws_pipeline_layout_,
+                                  .stage =
+                                      {
+                                          .handle = compute_shader,
+                                      },
+                                  .debug_name = "Generate Shadow Draws Pipeline"});
+  }
+
+  const VkPushConstantRange push_constant[] = {{
+      .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+      .offset = 0,
+      .size = sizeof(ShadowPushConstant),
+  }};
+
   shadow_map_pipeline_layout_ = vkh::create_pipeline_layout(context,
                                                             {
                                                                 .set_layouts = set_layouts,
+                                                                .push_constant_ranges =
+                                                                    push_constant,
                                                             })
                                     .value();
 
@@ -110,62 +476,164 @@ void ShadowMapRenderer::init_pipeline()
   });
 }
 
+void ShadowMapRenderer::cmd_generate_draws(VkCommandBuffer cmd, u32 cascade_mask)
+{
+  ZoneScopedN("Generate Shadow Draws");
+  TracyVkZone(renderer_.current_frame().tracy_vk_ctx, cmd, "Generate Shadow Draws");
+  vkh::Context& context = renderer_.context();
+
+  const u32 solid_draw_count = renderer_.solid_draw_count();
+  if (draws_indirect_buffer_.buffer == VK_NULL_HANDLE ||
+      solid_draw_count * cascade_count_ > draws_indirect_capacity_) {
+    // The previous frame might still draw with the old buffer
+    if (draws_indirect_buffer_.buffer != VK_NULL_HANDLE) {
+      renderer_.current_frame_deletion_queue().push(
+          [buffer = draws_indirect_buffer_](vkh::Context& context) {
+            vkh::destroy_buffer(context, buffer);
+          });
+    }
+    draws_indirect_capacity_ = std::max(solid_draw_count * cascade_count_, 1u);
+    draws_indirect_buffer_ =
+        vkh::create_buffer(context,
+                           vkh::BufferCreateInfo{
+                               .size = narrow<VkDeviceSize>(draws_indirect_capacity_) *
+                                       sizeof(VkDrawIndexedIndirectCommand),
+                               .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                        VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                                        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                               .memory_usage = VMA_MEMORY_USAGE_GPU_ONLY,
+                               .debug_name = "Shadow Draw Indirect",
+                               .category = vkh::MemoryCategory::shadow_map,
+                           })
+            .value();
+  }
+
+  vkh::cmd_begin_debug_utils_label(cmd, "Generate Shadow Draws Pass",
+                                   {0.097f, 0.01f, 0.049f, 1.0f});
+
+  {
+    // The previous frame might still read the draw count. Then reset it
+    const VkMemoryBarrier2 previous_frame_barrier{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+        .srcStageMask = VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+        .srcAccessMask = VK_ACCESS_2_NONE,
+        .dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+        .dstAccessMask = VK_ACCESS_2_NONE,
+    };
+    vkh::cmd_pipeline_barrier(cmd, {.memory_barriers = std::array{previous_frame_barrier}});
+
+    vkCmdFillBuffer(cmd, draw_count_buffer_, 0, VK_WHOLE_SIZE, 0);
+
+    const auto clear_barrier =
+        vkh::BufferMemoryBarrier{
+            .stage_masks = {VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+                            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT},
+            .access_masks = {VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                             VK_ACCESS_2_SHADER_STORAGE_READ_BIT |
+                                 VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT},
+            .buffer = draw_count_buffer_.buffer,
+            .size = VK_WHOLE_SIZE,
+        }
+            .to_vk_struct();
+    vkh::cmd_pipeline_barrier(cmd, {.buffer_memory_barriers = std::array{clear_barrier}});
+  }
+
+  const ShadowGenerateDrawsPushConstant push_constant{
+      .draws_buffer_address = vkh::get_buffer_device_address(context, renderer_.draws_buffer()),
+      .draws_indirect_buffer_address =
+          vkh::get_buffer_device_address(context, draws_indirect_buffer_),
+      .draw_count_buffer_address = vkh::get_buffer_device_address(context, draw_count_buffer_),
+      .solid_draw_count = solid_draw_count,
+      .cascade_mask = cascade_mask,
+      .cull_to_view_frustum = cache_enabled_ ? 0u : 1u,
+  };
+  vkCmdPushConstants(cmd, generate_draws_pipeline_layout_, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                     sizeof(ShadowGenerateDrawsPushConstant), &push_constant);
+
+  const u32 uniform_offset =
+      narrow<u32>(context.align_uniform_buffer_size(sizeof(GPUSceneParameters))) *
+      narrow<u32>(renderer_.current_frame_index());
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, generate_draws_pipeline_layout_, 0,
+                          1, &renderer_.current_frame().global_descriptor_set, 1, &uniform_offset);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, generate_draws_pipeline_layout_, 1,
+                          1, &renderer_.current_frame().object_descriptor_set, 0, nullptr);
+
+  renderer_.pipeline_manager().cmd_bind_pipeline(cmd, generate_draws_pipeline_);
+
+  static constexpr u32 local_group_size = 256;
+  vkCmdDispatch(cmd, solid_draw_count / local_group_size + 1, cascade_count_, 1);
+
+  vkh::cmd_end_debug_utils_label(cmd);
+
+  const auto indirect_barrier = [](const vkh::AllocatedBuffer& buffer) {
+    return vkh::BufferMemoryBarrier{
+        .stage_masks = {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                        VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT},
+        .access_masks = {VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                         VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT},
+        .buffer = buffer.buffer,
+        .size = VK_WHOLE_SIZE,
+    }
+        .to_vk_struct();
+  };
+  vkh::cmd_pipeline_barrier(
+      cmd, {.buffer_memory_barriers = std::array{indirect_barrier(draws_indirect_buffer_),
+                                                 indirect_barrier(draw_count_buffer_)}});
+}
+
 void ShadowMapRenderer::record_commands(VkCommandBuffer cmd)
 {
+  const u32 dirty_mask = find_dirty_cascades();
+  last_rendered_cascade_count_ = narrow<u32>(std::popcount(dirty_mask));
+  cascade_cache_lookups_ += cascade_count_;
+  cascade_cache_hits_ += cascade_count_ - last_rendered_cascade_count_;
+  // Every cascade is still valid, so the whole pass can be skipped
+  if (dirty_mask == 0) { return; }
+
+  cmd_generate_draws(cmd, dirty_mask);
+
   ZoneScopedN("Shadow Render Pass");
   TracyVkZone(renderer_.current_frame().tracy_vk_ctx, cmd, "Shadow Render Pass");
   vkh::Context& context = renderer_.context();
 
-  const u32 draw_count = renderer_.solid_draw_count();
-
-  vkh::cmd_pipeline_barrier(
-      cmd, {.image_barriers = std::array{
-                vkh::ImageBarrier{.stage_masks = {VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
-                                                  VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT},
-                                  .access_masks = {VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
-                                                   VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT},
-                                  .layouts = {VK_IMAGE_LAYOUT_UNDEFINED,
-                                              VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL},
-                                  .image = shadow_map_image_.image,
-                                  .subresource_range =
-                                      vkh::SubresourceRange{
-                                          .aspect_mask = VK_IMAGE_ASPECT_DEPTH_BIT,
-                                      }}
-                    .to_vk_struct() //
-            }});
-
-  const VkRenderingAttachmentInfo depth_attachments_info{
-      .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
-      .imageView = shadow_map_image_view_,
-      .imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
-      .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-      .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-      .clearValue = VkClearValue{.depthStencil = {.depth = 1.f}},
+  // Only the dirty cascades are transitioned, the others stay readable
+  const auto cascade_barriers = [&](const vkh::ImageBarrier& barrier) {
+    std::array<VkImageMemoryBarrier2, max_shadow_cascade_count> barriers{};
+    usize barrier_count = 0;
+    for (u32 cascade = 0; cascade < cascade_count_; ++cascade) {
+      if ((dirty_mask & (1u << cascade)) == 0) { continue; }
+      vkh::ImageBarrier cascade_barrier = barrier;
+      cascade_barrier.subresource_range = vkh::SubresourceRange{
+          .aspect_mask = VK_IMAGE_ASPECT_DEPTH_BIT,
+          .base_array_layer = cascade,
+      };
+      barriers[barrier_count++] = cascade_barrier.to_vk_struct();
+    }
+    vkh::cmd_pipeline_barrier(cmd, {.image_barriers = std::span{barriers.data(), barrier_count}});
   };
 
+  cascade_barriers(
+      vkh::ImageBarrier{.stage_masks = {VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT |
+                                            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                                        VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT},
+                        .access_masks = {VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+                                         VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT},
+                        .layouts = {VK_IMAGE_LAYOUT_UNDEFINED,
+                                    VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL},
+                        .image = shadow_map_image_.image});
+
   const VkOffset2D offset = {0, 0};
-  const VkExtent2D extent{.width = shadow_map_width_, .height = shadow_map_height_};
+  const VkExtent2D extent{.width = shadow_map_resolution_, .height = shadow_map_resolution_};
   const VkRect2D render_area{.offset = offset, .extent = extent};
 
-  const VkRenderingInfo render_info = {
-      .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
-      .renderArea = render_area,
-      .layerCount = 1,
-      .pDepthAttachment = &depth_attachments_info,
-  };
-
-  vkCmdBeginRendering(cmd, &render_info);
-
   const VkViewport viewport{
       .x = 0.0f,
       .y = 0.0f,
-      .width = narrow<f32>(shadow_map_width_),
-      .height = narrow<f32>(shadow_map_height_),
+      .width = static_cast<f32>(shadow_map_resolution_),
+      .height = static_cast<f32>(shadow_map_resolution_),
       .minDepth = 0.0f,
       .maxDepth = 1.0f,
   };
-  vkCmdSetViewport(cmd, 0, 1, &viewport);
-  vkCmdSetScissor(cmd, 0, 1, &render_area);
 
   // Bind scene data
   const size_t frame_index = renderer_.current_frame_index();
@@ -173,42 +641,80 @@ void ShadowMapRenderer::record_commands(VkCommandBuffer cmd)
       narrow<u32>(context.align_uniform_buffer_size(sizeof(GPUSceneParameters))) *
       narrow<u32>(frame_index);
 
-  renderer_.pipeline_manager().cmd_bind_pipeline(cmd, shadow_map_pipeline_);
-
-  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, shadow_map_pipeline_layout_, 0, 1,
-                          &renderer_.current_frame().global_descriptor_set, 1, &uniform_offset);
-
-  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, shadow_map_pipeline_layout_, 1, 1,
-                          &renderer_.current_frame().object_descriptor_set, 0, nullptr);
-
-  static constexpr VkDeviceSize vertex_offset = 0;
-  vkCmdBindVertexBuffers(cmd, 0, 1, &renderer_.scene_mesh_buffers.position_buffer.buffer,
-                         &vertex_offset);
-  vkCmdBindIndexBuffer(cmd, renderer_.scene_mesh_buffers.index_buffer.buffer, 0,
-                       VK_INDEX_TYPE_UINT32);
-
-  vkh::cmd_begin_debug_utils_label(cmd, "shadow mapping pass", {0.5, 0.5, 0.5, 1.0});
-  vkCmdDrawIndexedIndirect(cmd, renderer_.draws_buffer(), 0, draw_count,
-                           sizeof(VkDrawIndexedIndirectCommand));
-  vkh::cmd_end_debug_utils_label(cmd);
-
-  vkCmdEndRendering(cmd);
-
-  vkh::cmd_pipeline_barrier(
-      cmd, {.image_barriers = std::array{
-                vkh::ImageBarrier{.stage_masks = {VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
-                                                  VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT},
-                                  .access_masks = {VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
-                                                   VK_ACCESS_2_SHADER_SAMPLED_READ_BIT},
-                                  .layouts = {VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
-                                              VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
-                                  .image = shadow_map_image_.image,
-                                  .subresource_range =
-                                      vkh::SubresourceRange{
-                                          .aspect_mask = VK_IMAGE_ASPECT_DEPTH_BIT,
-                                      }}
-                    .to_vk_struct() //
-            }});
+  const VkDeviceAddress draws_buffer_address =
+      vkh::get_buffer_device_address(context, renderer_.draws_buffer());
+  const u32 solid_draw_count = renderer_.solid_draw_count();
+
+  for (u32 cascade = 0; cascade < cascade_count_; ++cascade) {
+    if ((dirty_mask & (1u << cascade)) == 0) { continue; }
+
+    const VkRenderingAttachmentInfo depth_attachments_info{
+        .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+        .imageView = cascade_image_views_[cascade],
+        .imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+        .clearValue = VkClearValue{.depthStencil = {.depth = 1.f}},
+    };
+
+    const VkRenderingInfo render_info = {
+        .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+        .renderArea = render_area,
+        .layerCount = 1,
+        .pDepthAttachment = &depth_attachments_info,
+    };
+
+    vkCmdBeginRendering(cmd, &render_info);
+
+    vkCmdSetViewport(cmd, 0, 1, &viewport);
+    vkCmdSetScissor(cmd, 0, 1, &render_area);
+
+    renderer_.pipeline_manager().cmd_bind_pipeline(cmd, shadow_map_pipeline_);
+
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, shadow_map_pipeline_layout_, 0,
+                            1, &renderer_.current_frame().global_descriptor_set, 1,
+                            &uniform_offset);
+
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, shadow_map_pipeline_layout_, 1,
+                            1, &renderer_.current_frame().object_descriptor_set, 0, nullptr);
+
+    static constexpr VkDeviceSize vertex_offset = 0;
+    vkCmdBindVertexBuffers(cmd, 0, 1, &renderer_.scene_mesh_buffers.position_buffer.buffer,
+                           &vertex_offset);
+    vkCmdBindIndexBuffer(cmd, renderer_.scene_mesh_buffers.index_buffer.buffer, 0,
+                         VK_INDEX_TYPE_UINT32);
+
+    const ShadowPushConstant push_constant{
+        .draws_buffer_address = draws_buffer_address,
+        .cascade_index = cascade,
+    };
+    vkCmdPushConstants(cmd, shadow_map_pipeline_layout_, VK_SHADER_STAGE_VERTEX_BIT, 0,
+                       sizeof(ShadowPushConstant), &push_constant);
+
+    vkh::cmd_begin_debug_utils_label(cmd, "shadow mapping pass", {0.5, 0.5, 0.5, 1.0});
+    const VkDeviceSize draw_buffer_offset =
+        narrow<VkDeviceSize>(cascade) * solid_draw_count * sizeof(VkDrawIndexedIndirectCommand);
+    vkCmdDrawIndexedIndirectCount(cmd, draws_indirect_buffer_, draw_buffer_offset,
+                                  draw_count_buffer_, cascade * sizeof(u32), solid_draw_count,
+                                  sizeof(VkDrawIndexedIndirectCommand));
+    vkh::cmd_end_debug_utils_label(cmd);
+
+    vkCmdEndRendering(cmd);
+
+    rendered_view_proj_[cascade] = cascade_view_proj_[cascade];
+  }
+  valid_cascade_mask_ |= dirty_mask;
+
+  cascade_barriers(
+      // Sampled by the mesh pass and the shadow mask
+      vkh::ImageBarrier{.stage_masks = {VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+                                        VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT |
+                                            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT},
+                        .access_masks = {VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                                         VK_ACCESS_2_SHADER_SAMPLED_READ_BIT},
+                        .layouts = {VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+                                    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+                        .image = shadow_map_image_.image});
 }
 
-} // namespace charlie
\ No newline at end of file
+} // namespace charlie
@@ -2,36 +2,85 @@
 #define CHARLIE3D_SHADOW_MAP_RENDERER_HPP
 
 #include "../utils/prelude.hpp"
+#include "../vulkan_helpers/buffer.hpp"
 #include "../vulkan_helpers/image.hpp"
 #include "pipeline_manager.hpp"
 #include "render_pass.hpp"
 
+#include <beyond/geometry/aabb3.hpp>
 #include <beyond/utils/copy_move.hpp>
 
+#include <array>
+#include <span>
+#include <vector>
+
 namespace vkh {
 class Context;
 }
 
 namespace charlie {
 
+class Camera;
 class Renderer;
 class SamplerCache;
+struct GPUSceneParameters;
+
+// Must match MAX_SHADOW_CASCADE_COUNT in scene_data.h.glsl
+inline constexpr u32 max_shadow_cascade_count = 4;
 
-// Implements host-side code for shadow mapping
+// Implements host-side code for cascaded shadow mapping of the sun
 class ShadowMapRenderer {
   Renderer& renderer_;
 
-  static constexpr uint32_t shadow_map_width_ = 4096;
-  static constexpr uint32_t shadow_map_height_ = 4096;
+  u32 cascade_count_ = 3;
+  u32 shadow_map_resolution_ = 2048; // Width and height of each cascade
+  f32 shadow_distance_ = 200.0f;    // Shadows are only rendered up to this distance from the camera
+  f32 split_lambda_ = 0.8f; // Blend between uniform (0) and logarithmic (1) cascade splits
 
   static constexpr VkFormat shadow_map_format_ = VK_FORMAT_D32_SFLOAT;
-  vkh::AllocatedImage shadow_map_image_;
-  VkImageView shadow_map_image_view_;
+  vkh::AllocatedImage shadow_map_image_; // One layer per cascade
+  VkImageView shadow_map_image_view_ = VK_NULL_HANDLE; // Array view of all cascades
+  std::vector<VkImageView> cascade_image_views_;       // Rendered into, one per cascade
   VkSampler shadow_map_sampler_ = VK_NULL_HANDLE;
+  VkSampler shadow_map_compare_sampler_ = VK_NULL_HANDLE; // Hardware depth comparison
+
+  // Tiled blue noise that rotates the filter kernels. The image is owned by the texture manager
+  static constexpr u32 blue_noise_size_ = 64;
+  VkImage blue_noise_image_ = VK_NULL_HANDLE;
+  VkImageView blue_noise_image_view_ = VK_NULL_HANDLE;
+  VkSampler blue_noise_sampler_ = VK_NULL_HANDLE;
 
   VkPipelineLayout shadow_map_pipeline_layout_ = VK_NULL_HANDLE;
   GraphicsPipelineHandle shadow_map_pipeline_;
 
+  // Solid draws that pass the light frustum culling of each cascade (and, without caching, can
+  // cast shadows into the view frustum). Each cascade has its own region of `solid_draw_count`
+  // commands
+  VkPipelineLayout generate_draws_pipeline_layout_ = VK_NULL_HANDLE;
+  ComputePipelineHandle generate_draws_pipeline_;
+  vkh::AllocatedBuffer draws_indirect_buffer_;
+  vkh::AllocatedBuffer draw_count_buffer_; // One count per cascade
+  u32 draws_indirect_capacity_ = 0;
+
+  // Cascades are kept across frames and only re-rendered when their light view projection or the
+  // shadow casters change
+  bool cache_enabled_ = true;
+  std::array<Mat4, max_shadow_cascade_count> cascade_view_proj_{};  // Computed in update()
+  std::array<Mat4, max_shadow_cascade_count> rendered_view_proj_{}; // Stored in the shadow map
+  u32 valid_cascade_mask_ = 0; // Bit i is set if cascade i holds the shadow of the current casters
+  std::vector<Mat4> caster_transforms_; // Transforms that the valid cascades got rendered with
+  u64 cascade_cache_hits_ = 0;
+  u64 cascade_cache_lookups_ = 0;
+  u32 last_rendered_cascade_count_ = 0;
+
+  void init_shadow_map_image();
+  void destroy_shadow_map_image();
+
+  // Returns a mask of the cascades that need to be rendered this frame
+  [[nodiscard]] auto find_dirty_cascades() -> u32;
+
+  void cmd_generate_draws(VkCommandBuffer cmd, u32 cascade_mask);
+
 public:
   explicit ShadowMapRenderer(Renderer& renderer, Ref<SamplerCache> sampler_cache);
   ~ShadowMapRenderer();
@@ -51,6 +100,39 @@ public:
     };
   }
 
+  // The same image as `shadow_map_image_info`, but with a depth comparison sampler
+  [[nodiscard]] auto shadow_map_compare_image_info() const -> VkDescriptorImageInfo
+  {
+    return {
+        .sampler = shadow_map_compare_sampler_,
+        .imageView = shadow_map_image_view_,
+        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    };
+  }
+
+  [[nodiscard]] auto blue_noise_image_info() const -> VkDescriptorImageInfo
+  {
+    return {
+        .sampler = blue_noise_sampler_,
+        .imageView = blue_noise_image_view_,
+        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    };
+  }
+
+  // Fit the cascades to the camera frustum and the scene bounds, and write the cascade view
+  // projections and splits into the scene parameters
+  void update(const Camera& camera, const beyond::AABB3& scene_bounds,
+              GPUSceneParameters& scene_parameters);
+
+  // Invalidates the cached cascades if any transform changed since they got rendered
+  void update_caster_transforms(std::span<const Mat4> transforms);
+
+  // Forces all cascades to be re-rendered, e.g. when the set of draws changes
+  void invalidate_cache() { valid_cascade_mask_ = 0; }
+
+  // Returns true if the shadow map image got recreated, so that descriptors need to be updated
+  [[nodiscard]] auto draw_gui() -> bool;
+
   void record_commands(VkCommandBuffer cmd);
 };
 
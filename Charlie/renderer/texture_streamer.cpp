@@ -0,0 +1,604 @@
+#include "texture_streamer.hpp"
+#include "textures.hpp"
+
+#include "../vulkan_helpers/bda.hpp"
+#include "../vulkan_helpers/error_handling.hpp"
+#include "../vulkan_helpers/initializers.hpp"
+#include "../vulkan_helpers/pipeline_barrier.hpp"
+
+#include <beyond/utils/assert.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include <fmt/format.h>
+#include <tracy/Tracy.hpp>
+
+namespace charlie {
+
+namespace {
+
+[[nodiscard]] auto mip_chain_size(std::span<const CPUImage> mips) -> VkDeviceSize
+{
+  VkDeviceSize size = 0;
+  for (const CPUImage& mip : mips) { size += VkDeviceSize{mip.width} * mip.height * 4; }
+  return size;
+}
+
+constexpr u32 initial_feedback_capacity = 256;
+
+[[nodiscard]] auto create_mip_chain_view(vkh::Context& context, const vkh::AllocatedImage& image,
+                                         VkFormat format, u32 mip_count,
+                                         std::string_view name) -> VkImageView
+{
+  return vkh::create_image_view(context,
+                                {.image = image.image,
+                                 .format = format,
+                                 .subresource_range =
+                                     vkh::SubresourceRange{.aspect_mask = VK_IMAGE_ASPECT_COLOR_BIT,
+                                                           .level_count = mip_count},
+                                 .debug_name = fmt::format("{} Image View", name)})
+      .value();
+}
+
+} // anonymous namespace
+
+TextureStreamer::TextureStreamer(vkh::Context& context, TextureManager& textures,
+                                 u32 frames_in_flight)
+    : context_{context}, textures_{textures}, readback_buffers_(frames_in_flight),
+      readback_valid_(frames_in_flight, false)
+{
+  reserve_feedback(initial_feedback_capacity, nullptr);
+}
+
+TextureStreamer::~TextureStreamer()
+{
+  for (StreamedImage& image : images_) {
+    if (image.mips.empty()) { continue; }
+    vkDestroyImageView(context_, image.image_view, nullptr);
+    vkh::destroy_image(context_, image.image);
+  }
+  vkh::destroy_buffer(context_, feedback_buffer_);
+  for (const vkh::AllocatedBuffer& buffer : readback_buffers_) {
+    vkh::destroy_buffer(context_, buffer);
+  }
+}
+
+auto TextureStreamer::add_image(CPUImage&& cpu_image, VkFormat format) -> StreamedImageHandle
+{
+  ZoneScoped;
+
+  BEYOND_ENSURE(cpu_image.width != 0 && cpu_image.height != 0);
+
+  StreamedImage image{.format = format};
+  {
+    ZoneScopedN("Generate mip chain");
+    const bool is_srgb = format == VK_FORMAT_R8G8B8A8_SRGB;
+    image.mips.push_back(std::move(cpu_image));
+    while (image.mips.back().width > 1 || image.mips.back().height > 1) {
+      image.mips.push_back(generate_next_mip(image.mips.back(), is_srgb));
+    }
+  }
+
+  // Start with only the small mips, and let the feedback decide what else is needed
+  const auto mip_count = narrow<u32>(image.mips.size());
+  u32 min_resident_mip = 0;
+  while (min_resident_mip + 1 < mip_count &&
+         std::max(image.mips[min_resident_mip].width, image.mips[min_resident_mip].height) >
+             min_resident_size) {
+    ++min_resident_mip;
+  }
+  image.min_resident_mip = min_resident_mip;
+  image.requested_mip = min_resident_mip;
+  image.resident_mip = min_resident_mip;
+  image.image =
+      textures_.upload_mip_chain(std::span{image.mips}.subspan(min_resident_mip), format);
+  image.image_view = create_mip_chain_view(context_, image.image, format,
+                                           mip_count - min_resident_mip, image.mips[0].name);
+  image.gpu_size = image.image.allocation_info.size;
+
+  std::scoped_lock lock{images_mutex_};
+  resident_bytes_ += image.gpu_size;
+  if (not free_image_indices_.empty()) {
+    const u32 index = free_image_indices_.back();
+    free_image_indices_.pop_back();
+    images_[index] = std::move(image);
+    return StreamedImageHandle{index};
+  }
+  images_.push_back(std::move(image));
+  return StreamedImageHandle{narrow<u32>(images_.size() - 1)};
+}
+
+auto TextureStreamer::add_texture(StreamedImageHandle handle) -> u32
+{
+  StreamedImage& image = images_.at(handle.index);
+  const u32 texture_index =
+      textures_.add_texture(Texture{.image = image.image.image, .image_view = image.image_view});
+  image.textures.push_back(texture_index);
+
+  if (texture_to_image_.size() <= texture_index) {
+    texture_to_image_.resize(texture_index + 1, ~0u);
+  }
+  texture_to_image_[texture_index] = handle.index;
+
+  return texture_index;
+}
+
+void TextureStreamer::remove_image(StreamedImageHandle handle, DeletionQueue& deletion_queue)
+{
+  std::scoped_lock lock{images_mutex_};
+
+  StreamedImage& image = images_.at(handle.index);
+  BEYOND_ENSURE(not image.mips.empty());
+
+  for (const u32 texture_index : image.textures) {
+    textures_.remove_texture(texture_index, deletion_queue);
+    texture_to_image_.at(texture_index) = ~0u;
+  }
+  for (auto& material_images : material_to_images_) { std::erase(material_images, handle.index); }
+
+  retire_image(image, deletion_queue);
+
+  image = StreamedImage{};
+  free_image_indices_.push_back(handle.index);
+}
+
+void TextureStreamer::register_material(u32 material_index, std::span<const u32> texture_indices)
+{
+  if (material_to_images_.size() <= material_index) {
+    material_to_images_.resize(material_index + 1);
+  }
+
+  auto& images = material_to_images_[material_index];
+  images.clear();
+  for (const u32 texture_index : texture_indices) {
+    if (texture_index < texture_to_image_.size() && texture_to_image_[texture_index] != ~0u) {
+      images.push_back(texture_to_image_[texture_index]);
+    }
+  }
+}
+
+void TextureStreamer::reserve_feedback(u32 material_count, DeletionQueue* deletion_queue)
+{
+  if (material_count <= feedback_capacity_) { return; }
+
+  if (feedback_buffer_.buffer != VK_NULL_HANDLE) {
+    BEYOND_ENSURE(deletion_queue != nullptr);
+    deletion_queue->push([feedback_buffer = feedback_buffer_,
+                          readback_buffers = readback_buffers_](vkh::Context& context) {
+      vkh::destroy_buffer(context, feedback_buffer);
+      for (const vkh::AllocatedBuffer& buffer : readback_buffers) {
+        vkh::destroy_buffer(context, buffer);
+      }
+    });
+  }
+
+  feedback_capacity_ =
+      std::max({material_count, feedback_capacity_ * 2, initial_feedback_capacity});
+  const usize size = feedback_capacity_ * sizeof(u32);
+
+  feedback_buffer_ =
+      vkh::create_buffer(context_, {.size = size,
+                                    .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                             VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                                             VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                                             VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                                    .memory_usage = VMA_MEMORY_USAGE_GPU_ONLY,
+                                    .debug_name = "Texture Feedback Buffer",
+                                    .category = vkh::MemoryCategory::texture})
+          .value();
+  feedback_buffer_address_ = vkh::get_buffer_device_address(context_, feedback_buffer_);
+
+  for (usize i = 0; i < readback_buffers_.size(); ++i) {
+    readback_buffers_[i] =
+        vkh::create_buffer(context_,
+                           {.size = size,
+                            .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                            .memory_usage = VMA_MEMORY_USAGE_GPU_TO_CPU,
+                            .debug_name = fmt::format("Texture Feedback Readback Buffer {}", i),
+                            .category = vkh::MemoryCategory::staging})
+            .value();
+  }
+  std::ranges::fill(readback_valid_, false);
+}
+
+void TextureStreamer::cmd_begin_frame(VkCommandBuffer cmd)
+{
+  cmd_transfer_images(cmd);
+
+  vkCmdFillBuffer(cmd, feedback_buffer_, 0, VK_WHOLE_SIZE, 0);
+
+  const auto barrier =
+      vkh::BufferMemoryBarrier{
+          .stage_masks = {VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+                          VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT |
+                              VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT},
+          .access_masks = {VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                           VK_ACCESS_2_SHADER_STORAGE_READ_BIT |
+                               VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT},
+          .buffer = feedback_buffer_.buffer,
+          .size = VK_WHOLE_SIZE,
+      }
+          .to_vk_struct();
+  vkh::cmd_pipeline_barrier(cmd, {.buffer_memory_barriers = std::array{barrier}});
+}
+
+void TextureStreamer::cmd_end_frame(VkCommandBuffer cmd, usize frame_index)
+{
+  const vkh::AllocatedBuffer& readback_buffer = readback_buffers_.at(frame_index);
+
+  const auto to_transfer =
+      vkh::BufferMemoryBarrier{
+          .stage_masks = {VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT |
+                              VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                          VK_PIPELINE_STAGE_2_TRANSFER_BIT},
+          .access_masks = {VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_ACCESS_2_TRANSFER_READ_BIT},
+          .buffer = feedback_buffer_.buffer,
+          .size = VK_WHOLE_SIZE,
+      }
+          .to_vk_struct();
+  vkh::cmd_pipeline_barrier(cmd, {.buffer_memory_barriers = std::array{to_transfer}});
+
+  const VkBufferCopy copy{.size = feedback_capacity_ * sizeof(u32)};
+  vkCmdCopyBuffer(cmd, feedback_buffer_, readback_buffer, 1, &copy);
+
+  const auto to_host =
+      vkh::BufferMemoryBarrier{
+          .stage_masks = {VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_PIPELINE_STAGE_2_HOST_BIT},
+          .access_masks = {VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_ACCESS_2_HOST_READ_BIT},
+          .buffer = readback_buffer.buffer,
+          .size = VK_WHOLE_SIZE,
+      }
+          .to_vk_struct();
+  vkh::cmd_pipeline_barrier(cmd, {.buffer_memory_barriers = std::array{to_host}});
+
+  readback_valid_.at(frame_index) = true;
+}
+
+void TextureStreamer::read_feedback(usize frame_index, usize frame_number)
+{
+  ZoneScoped;
+
+  if (not readback_valid_.at(frame_index)) { return; }
+
+  vkh::AllocatedBuffer& readback_buffer = readback_buffers_.at(frame_index);
+  VK_CHECK(vmaInvalidateAllocation(context_.allocator(), readback_buffer.allocation, 0,
+                                   VK_WHOLE_SIZE));
+  const u32* densities = context_.map<u32>(readback_buffer).value();
+
+  const usize material_count =
+      std::min(usize{feedback_capacity_}, material_to_images_.size());
+  for (usize material_index = 0; material_index < material_count; ++material_index) {
+    // The shader writes the density plus one, and zero means not on screen. A material can be on
+    // screen with a density of zero, e.g. when it is far away
+    if (densities[material_index] == 0) { continue; }
+    const u32 density = densities[material_index] - 1;
+
+    for (const u32 image_index : material_to_images_[material_index]) {
+      StreamedImage& image = images_[image_index];
+
+      // The mip chain goes down to 1x1, so the most detailed mip has 2^(mip_count - 1) texels
+      // along its longest side
+      const auto most_detailed_density = narrow<u32>(image.mips.size() - 1);
+      const u32 requested_mip = std::min(
+          density >= most_detailed_density ? 0 : most_detailed_density - density,
+          image.min_resident_mip);
+
+      if (image.last_requested_frame != frame_number) {
+        image.requested_mip = requested_mip;
+        image.last_requested_frame = frame_number;
+      } else {
+        image.requested_mip = std::min(image.requested_mip, requested_mip);
+      }
+    }
+  }
+
+  context_.unmap(readback_buffer);
+}
+
+auto TextureStreamer::compute_budget() const -> VkDeviceSize
+{
+  VmaBudget budgets[VK_MAX_MEMORY_HEAPS] = {};
+  vmaGetHeapBudgets(context_.allocator(), budgets);
+
+  const VkPhysicalDeviceMemoryProperties* memory_properties = nullptr;
+  vmaGetMemoryProperties(context_.allocator(), &memory_properties);
+
+  VkDeviceSize heap_budget = 0;
+  VkDeviceSize heap_usage = 0;
+  for (u32 i = 0; i < memory_properties->memoryHeapCount; ++i) {
+    if (memory_properties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+      heap_budget += budgets[i].budget;
+      heap_usage += budgets[i].usage;
+    }
+  }
+
+  // Everything that is not streamed textures competes for the same budget
+  const VkDeviceSize other_usage = heap_usage > resident_bytes_ ? heap_usage - resident_bytes_ : 0;
+  VkDeviceSize budget = heap_budget > other_usage ? heap_budget - other_usage : 0;
+  // Leave some headroom for render targets and transient allocations
+  budget = budget / 10 * 9;
+
+  if (budget_limit_ != 0) { budget = std::min(budget, budget_limit_); }
+  return budget;
+}
+
+auto TextureStreamer::make_resident(StreamedImage& image, u32 mip, DeletionQueue& deletion_queue)
+    -> VkDeviceSize
+{
+  ZoneScoped;
+
+  const auto mip_count = narrow<u32>(image.mips.size());
+  const std::string image_debug_name = fmt::format("{} Image", image.mips[0].name);
+  const vkh::AllocatedImage new_image =
+      vkh::create_image(context_, vkh::ImageCreateInfo{
+                                      .format = image.format,
+                                      .extent = {.width = image.mips[mip].width,
+                                                 .height = image.mips[mip].height,
+                                                 .depth = 1},
+                                      .usage = VK_IMAGE_USAGE_SAMPLED_BIT |
+                                               VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                                               VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                                      .mip_levels = mip_count - mip,
+                                      .debug_name = image_debug_name,
+                                      .category = vkh::MemoryCategory::texture,
+                                  })
+          .value();
+
+  ImageTransfer transfer{
+      .old_image = image.image.image,
+      .old_mip_count = mip_count - image.resident_mip,
+      .new_image = new_image.image,
+      .new_mip_count = mip_count - mip,
+  };
+
+  // The mips that both images hold never leave the GPU
+  for (u32 level = std::max(mip, image.resident_mip); level < mip_count; ++level) {
+    transfer.image_copies.push_back(VkImageCopy{
+        .srcSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                           .mipLevel = level - image.resident_mip,
+                           .baseArrayLayer = 0,
+                           .layerCount = 1},
+        .dstSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                           .mipLevel = level - mip,
+                           .baseArrayLayer = 0,
+                           .layerCount = 1},
+        .extent = {.width = image.mips[level].width,
+                   .height = image.mips[level].height,
+                   .depth = 1},
+    });
+  }
+
+  const VkDeviceSize uploaded_bytes =
+      mip < image.resident_mip
+          ? mip_chain_size(std::span{image.mips}.subspan(mip, image.resident_mip - mip))
+          : 0;
+  if (uploaded_bytes != 0) {
+    const vkh::AllocatedBuffer staging_buffer =
+        vkh::create_buffer(context_, {.size = uploaded_bytes,
+                                      .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                      .memory_usage = VMA_MEMORY_USAGE_CPU_ONLY,
+                                      .debug_name = "Texture Streaming Staging Buffer",
+                                      .category = vkh::MemoryCategory::staging})
+            .value();
+    auto* data = context_.map<std::byte>(staging_buffer).value();
+    VkDeviceSize offset = 0;
+    for (u32 level = mip; level < image.resident_mip; ++level) {
+      const CPUImage& cpu_mip = image.mips[level];
+      const VkDeviceSize size = VkDeviceSize{cpu_mip.width} * cpu_mip.height * 4;
+      std::memcpy(data + offset, cpu_mip.data.get(), size);
+      transfer.buffer_copies.push_back(VkBufferImageCopy{
+          .bufferOffset = offset,
+          .imageSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                               .mipLevel = level - mip,
+                               .baseArrayLayer = 0,
+                               .layerCount = 1},
+          .imageExtent = {.width = cpu_mip.width, .height = cpu_mip.height, .depth = 1},
+      });
+      offset += size;
+    }
+    context_.unmap(staging_buffer);
+    deletion_queue.push([staging_buffer](vkh::Context& context) {
+      vkh::destroy_buffer(context, staging_buffer);
+    });
+    transfer.staging_buffer = staging_buffer.buffer;
+  }
+  pending_transfers_.push_back(std::move(transfer));
+
+  // The transfer reads from the old image before the deletion queue gets flushed again
+  retire_image(image, deletion_queue);
+
+  image.image = new_image;
+  image.image_view =
+      create_mip_chain_view(context_, new_image, image.format, mip_count - mip, image.mips[0].name);
+  image.gpu_size = new_image.allocation_info.size;
+  image.resident_mip = mip;
+  resident_bytes_ += image.gpu_size;
+
+  for (const u32 texture_index : image.textures) {
+    Texture texture = textures_.texture(texture_index);
+    texture.image = image.image.image;
+    texture.image_view = image.image_view;
+    textures_.update_texture(texture_index, texture);
+  }
+
+  return uploaded_bytes;
+}
+
+void TextureStreamer::retire_image(const StreamedImage& image, DeletionQueue& deletion_queue)
+{
+  retiring_bytes_ += image.gpu_size;
+  deletion_queue.push([this, image = image.image, image_view = image.image_view,
+                       size = image.gpu_size](vkh::Context& context) mutable {
+    vkDestroyImageView(context, image_view, nullptr);
+    vkh::destroy_image(context, image);
+
+    std::scoped_lock lock{images_mutex_};
+    resident_bytes_ -= size;
+    retiring_bytes_ -= size;
+  });
+}
+
+void TextureStreamer::cmd_transfer_images(VkCommandBuffer cmd)
+{
+  if (pending_transfers_.empty()) { return; }
+
+  ZoneScoped;
+
+  // The previous frame might still sample the old images
+  std::vector<VkImageMemoryBarrier2> barriers;
+  barriers.reserve(pending_transfers_.size() * 2);
+  for (const ImageTransfer& transfer : pending_transfers_) {
+    barriers.push_back(
+        vkh::ImageBarrier{
+            .stage_masks = {VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT |
+                                VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                            VK_PIPELINE_STAGE_2_TRANSFER_BIT},
+            .access_masks = {VK_ACCESS_2_NONE, VK_ACCESS_2_TRANSFER_READ_BIT},
+            .layouts = {VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL},
+            .image = transfer.old_image,
+            .subresource_range = vkh::SubresourceRange{.aspect_mask = VK_IMAGE_ASPECT_COLOR_BIT,
+                                                       .level_count = transfer.old_mip_count}}
+            .to_vk_struct());
+    barriers.push_back(
+        vkh::ImageBarrier{
+            .stage_masks = {VK_PIPELINE_STAGE_2_NONE, VK_PIPELINE_STAGE_2_TRANSFER_BIT},
+            .access_masks = {VK_ACCESS_2_NONE, VK_ACCESS_2_TRANSFER_WRITE_BIT},
+            .layouts = {VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL},
+            .image = transfer.new_image,
+            .subresource_range = vkh::SubresourceRange{.aspect_mask = VK_IMAGE_ASPECT_COLOR_BIT,
+                                                       .level_count = transfer.new_mip_count}}
+            .to_vk_struct());
+  }
+  vkh::cmd_pipeline_barrier(cmd, {.image_barriers = barriers});
+
+  for (const ImageTransfer& transfer : pending_transfers_) {
+    if (not transfer.image_copies.empty()) {
+      vkCmdCopyImage(cmd, transfer.old_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                     transfer.new_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                     narrow<u32>(transfer.image_copies.size()), transfer.image_copies.data());
+    }
+    if (not transfer.buffer_copies.empty()) {
+      vkCmdCopyBufferToImage(cmd, transfer.staging_buffer, transfer.new_image,
+                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                             narrow<u32>(transfer.buffer_copies.size()),
+                             transfer.buffer_copies.data());
+    }
+  }
+
+  barriers.clear();
+  for (const ImageTransfer& transfer : pending_transfers_) {
+    barriers.push_back(
+        vkh::ImageBarrier{
+            .stage_masks = {VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+                            VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT |
+                                VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT},
+            .access_masks = {VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_ACCESS_2_SHADER_READ_BIT},
+            .layouts = {VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+            .image = transfer.new_image,
+            .subresource_range = vkh::SubresourceRange{.aspect_mask = VK_IMAGE_ASPECT_COLOR_BIT,
+                                                       .level_count = transfer.new_mip_count}}
+            .to_vk_struct());
+  }
+  vkh::cmd_pipeline_barrier(cmd, {.image_barriers = barriers});
+
+  pending_transfers_.clear();
+}
+
+void TextureStreamer::update(usize frame_index, usize frame_number, DeletionQueue& deletion_queue)
+{
+  ZoneScoped;
+
+  std::scoped_lock lock{images_mutex_};
+
+  reserve_feedback(narrow<u32>(material_to_images_.size()), &deletion_queue);
+  read_feedback(frame_index, frame_number);
+
+  const VkDeviceSize budget = compute_budget();
+  // Replaced images stay allocated until the frames in flight are done with them. Evictions only
+  // pay off once that happens, while new images have to fit next to the replaced ones right away
+  const auto live_bytes = [&]() { return resident_bytes_ - retiring_bytes_; };
+
+  const auto desired_mip = [&](const StreamedImage& image) {
+    const bool is_stale = frame_number - image.last_requested_frame > eviction_delay_frames;
+    return is_stale ? image.min_resident_mip : image.requested_mip;
+  };
+
+  // Images that hold more detail than needed, least recently requested first
+  std::vector<u32> eviction_candidates;
+  // Images that need more detail, the ones missing the most mips first
+  std::vector<u32> streaming_candidates;
+  for (u32 i = 0; i < images_.size(); ++i) {
+    const StreamedImage& image = images_[i];
+    if (image.mips.empty()) { continue; }
+    const u32 desired = desired_mip(image);
+    if (image.resident_mip < desired) {
+      eviction_candidates.push_back(i);
+    } else if (image.resident_mip > desired) {
+      streaming_candidates.push_back(i);
+    }
+  }
+  std::ranges::sort(eviction_candidates, [&](u32 lhs, u32 rhs) {
+    return images_[lhs].last_requested_frame > images_[rhs].last_requested_frame;
+  }); // Popped from the back
+  std::ranges::sort(streaming_candidates, [&](u32 lhs, u32 rhs) {
+    return images_[lhs].resident_mip - desired_mip(images_[lhs]) >
+           images_[rhs].resident_mip - desired_mip(images_[rhs]);
+  });
+
+  u32 evicted_count = 0;
+  const auto evict_one = [&]() {
+    if (eviction_candidates.empty()) { return false; }
+    StreamedImage& image = images_[eviction_candidates.back()];
+    eviction_candidates.pop_back();
+
+    static_cast<void>(make_resident(image, desired_mip(image), deletion_queue));
+    ++evicted_count;
+    return true;
+  };
+
+  // The budget can shrink, for example when another application allocates memory
+  while (live_bytes() > budget && evict_one()) {}
+
+  VkDeviceSize uploaded_bytes = 0;
+  for (const u32 image_index : streaming_candidates) {
+    if (uploaded_bytes >= max_upload_bytes_per_frame) { break; }
+
+    StreamedImage& image = images_[image_index];
+
+    // Fall back to a less detailed mip if the desired one does not fit in the budget
+    u32 target_mip = desired_mip(image);
+    for (; target_mip < image.resident_mip; ++target_mip) {
+      const VkDeviceSize new_size = mip_chain_size(std::span{image.mips}.subspan(target_mip));
+      while (live_bytes() - image.gpu_size + new_size > budget && evict_one()) {}
+      if (live_bytes() - image.gpu_size + new_size <= budget) { break; }
+    }
+    if (target_mip >= image.resident_mip) { continue; }
+    // Otherwise wait for the replaced images to be freed
+    if (resident_bytes_ + mip_chain_size(std::span{image.mips}.subspan(target_mip)) > budget) {
+      continue;
+    }
+
+    uploaded_bytes += make_resident(image, target_mip, deletion_queue);
+  }
+
+  stats_ = TextureStreamingStats{
+      .image_count = images_.size() - free_image_indices_.size(),
+      .resident_bytes = resident_bytes_,
+      .budget_bytes = budget,
+      .uploaded_bytes_last_frame = uploaded_bytes,
+      .evicted_image_count_last_frame = evicted_count,
+  };
+  for (const StreamedImage& image : images_) {
+    if (image.mips.empty()) { continue; }
+    if (image.resident_mip == 0) { ++stats_.fully_resident_image_count; }
+    if (image.resident_mip > desired_mip(image)) { ++stats_.pending_image_count; }
+  }
+}
+
+} // namespace charlie
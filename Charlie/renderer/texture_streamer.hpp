@@ -0,0 +1,165 @@
+#ifndef CHARLIE3D_TEXTURE_STREAMER_HPP
+#define CHARLIE3D_TEXTURE_STREAMER_HPP
+
+// Texture streaming on top of the TextureManager.
+//
+// Images are kept on the CPU with a full mip chain, and only a subset of the chain is resident on
+// the GPU. When an image is added, only its small mips are uploaded. The mesh shader then writes
+// the texel density each material needs (derived from UV derivatives) into a feedback buffer. We
+// read that buffer back a few frames later, stream in more detailed mips of the textures that need
+// them, and evict mips that are no longer needed when we run out of the memory budget.
+//
+// A residency change replaces the image. The mips that the old and the new image share are copied
+// on the GPU, and only the missing detailed mips are uploaded. Both happen in the frame command
+// buffer, and the old image is released through the deletion queue.
+
+#include "../asset_handling/cpu_image.hpp"
+#include "../utils/prelude.hpp"
+#include "../vulkan_helpers/buffer.hpp"
+#include "../vulkan_helpers/image.hpp"
+
+#include "deletion_queue.hpp"
+
+#include <mutex>
+#include <span>
+#include <vector>
+
+namespace charlie {
+
+class TextureManager;
+
+struct StreamedImageHandle {
+  u32 index = ~0u;
+};
+
+struct TextureStreamingStats {
+  usize image_count = 0;
+  usize fully_resident_image_count = 0; // Images that have their most detailed mip on the GPU
+  usize pending_image_count = 0;        // Images that need more detailed mips than they have
+  VkDeviceSize resident_bytes = 0;
+  VkDeviceSize budget_bytes = 0;
+  VkDeviceSize uploaded_bytes_last_frame = 0;
+  u32 evicted_image_count_last_frame = 0;
+};
+
+class TextureStreamer {
+public:
+  // Mips no larger than this are always resident
+  static constexpr u32 min_resident_size = 64;
+  // Cap of bytes uploaded per frame, to avoid stalls when a lot of textures become visible at once
+  static constexpr VkDeviceSize max_upload_bytes_per_frame = 64ull * 1024 * 1024;
+  // An image that has not been requested for that many frames may lose its detailed mips
+  static constexpr usize eviction_delay_frames = 120;
+
+  TextureStreamer(vkh::Context& context, TextureManager& textures, u32 frames_in_flight);
+  ~TextureStreamer();
+
+  TextureStreamer(const TextureStreamer&) = delete;
+  auto operator=(const TextureStreamer&) & -> TextureStreamer& = delete;
+  TextureStreamer(TextureStreamer&&) noexcept = delete;
+  auto operator=(TextureStreamer&&) & noexcept -> TextureStreamer& = delete;
+
+  // Add an RGBA8 image. Generates the CPU mip chain and uploads the smallest mips.
+  // Thread-safe.
+  [[nodiscard]] auto add_image(CPUImage&& image, VkFormat format) -> StreamedImageHandle;
+
+  // Adds a bindless texture that samples a streamed image and returns its index
+  [[nodiscard]] auto add_texture(StreamedImageHandle image) -> u32;
+
+  // Remove an image and the bindless textures that sample it. The GPU resources are released
+  // through the deletion queue
+  void remove_image(StreamedImageHandle image, DeletionQueue& deletion_queue);
+
+  // Let the streamer know which textures a material samples, so that the feedback of the material
+  // can be attributed to the images
+  void register_material(u32 material_index, std::span<const u32> texture_indices);
+
+  // Reads back the feedback of the frame that last used `frame_index`, and streams mips in and out
+  // accordingly. Must be called after the GPU finished that frame.
+  void update(usize frame_index, usize frame_number, DeletionQueue& deletion_queue);
+
+  // Record the residency changes of the last update, and clear the feedback buffer before the
+  // scene is rendered
+  void cmd_begin_frame(VkCommandBuffer cmd);
+  // Copy the feedback of this frame into the readback buffer of `frame_index`
+  void cmd_end_frame(VkCommandBuffer cmd, usize frame_index);
+
+  [[nodiscard]] auto feedback_buffer_address() const -> VkDeviceAddress
+  {
+    return feedback_buffer_address_;
+  }
+
+  [[nodiscard]] auto stats() const -> const TextureStreamingStats& { return stats_; }
+
+  // A user limit on top of the budget reported by the driver. 0 means no limit
+  [[nodiscard]] auto budget_limit() const -> VkDeviceSize { return budget_limit_; }
+  void set_budget_limit(VkDeviceSize limit) { budget_limit_ = limit; }
+
+private:
+  struct StreamedImage {
+    std::vector<CPUImage> mips; // mips[0] is the most detailed level. Empty if removed
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    u32 min_resident_mip = 0; // Mips from here are always resident
+
+    u32 resident_mip = 0;  // The most detailed mip that is resident on the GPU
+    u32 requested_mip = 0; // The most detailed mip requested by the feedback
+    usize last_requested_frame = 0;
+
+    vkh::AllocatedImage image;
+    VkImageView image_view = VK_NULL_HANDLE;
+    VkDeviceSize gpu_size = 0;
+
+    std::vector<u32> textures; // Bindless textures that sample this image
+  };
+
+  // Fills a new image of a residency change from the old image and a staging buffer
+  struct ImageTransfer {
+    VkImage old_image = VK_NULL_HANDLE;
+    u32 old_mip_count = 0;
+    VkImage new_image = VK_NULL_HANDLE;
+    u32 new_mip_count = 0;
+    std::vector<VkImageCopy> image_copies;
+    VkBuffer staging_buffer = VK_NULL_HANDLE;
+    std::vector<VkBufferImageCopy> buffer_copies;
+  };
+
+  vkh::Context& context_;
+  TextureManager& textures_;
+
+  std::mutex images_mutex_;
+  std::vector<StreamedImage> images_;
+  std::vector<u32> free_image_indices_;
+  std::vector<u32> texture_to_image_;                    // Indexed by texture index
+  std::vector<std::vector<u32>> material_to_images_;     // Indexed by material index
+
+  // Feedback from the GPU: the highest texel density (in log2 texels per UV unit) each material
+  // was sampled with, plus one. Zero means that the material was not sampled
+  u32 feedback_capacity_ = 0;
+  vkh::AllocatedBuffer feedback_buffer_;
+  VkDeviceAddress feedback_buffer_address_ = 0;
+  std::vector<vkh::AllocatedBuffer> readback_buffers_; // One per frame in flight
+  std::vector<bool> readback_valid_;
+
+  // Includes the replaced images that wait in a deletion queue
+  VkDeviceSize resident_bytes_ = 0;
+  VkDeviceSize retiring_bytes_ = 0;
+  std::vector<ImageTransfer> pending_transfers_;
+  VkDeviceSize budget_limit_ = 0;
+  TextureStreamingStats stats_;
+
+  void reserve_feedback(u32 material_count, DeletionQueue* deletion_queue);
+  void read_feedback(usize frame_index, usize frame_number);
+  [[nodiscard]] auto compute_budget() const -> VkDeviceSize;
+
+  // Replace the image by one that holds mips [mip, mip_count), and point all of its textures to it.
+  // Returns the bytes to upload
+  [[nodiscard]] auto make_resident(StreamedImage& image, u32 mip, DeletionQueue& deletion_queue)
+      -> VkDeviceSize;
+  // Release the GPU image, which counts as resident until the deletion queue destroys it
+  void retire_image(const StreamedImage& image, DeletionQueue& deletion_queue);
+  void cmd_transfer_images(VkCommandBuffer cmd);
+};
+
+} // namespace charlie
+
+#endif // CHARLIE3D_TEXTURE_STREAMER_HPP
@@ -3,26 +3,56 @@
 #include "../vulkan_helpers/initializers.hpp"
 #include "uploader.hpp"
 
-#include <beyond/container/static_vector.hpp>
-
 #include <tracy/Tracy.hpp>
 
+#include <algorithm>
+
 namespace charlie {
 
+namespace {
+
+[[nodiscard]] auto query_max_bindless_texture_count(VkPhysicalDevice physical_device) -> u32
+{
+  VkPhysicalDeviceVulkan12Properties properties12{
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES,
+  };
+  VkPhysicalDeviceProperties2 properties{
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+      .pNext = &properties12,
+  };
+  vkGetPhysicalDeviceProperties2(physical_device, &properties);
+
+  const u32 device_limit = std::min({properties12.maxDescriptorSetUpdateAfterBindSampledImages,
+                                     properties12.maxDescriptorSetUpdateAfterBindSamplers,
+                                     properties12.maxPerStageDescriptorUpdateAfterBindSampledImages,
+                                     properties12.maxPerStageDescriptorUpdateAfterBindSamplers});
+  // Leave some room for the non-bindless samplers in the same pipeline layouts
+  static constexpr u32 reserved_sampler_count = 64;
+  BEYOND_ENSURE(device_limit > reserved_sampler_count);
+  return std::min(max_bindless_texture_count, device_limit - reserved_sampler_count);
+}
+
+} // anonymous namespace
+
 TextureManager::TextureManager(vkh::Context& context, UploadContext& upload_context,
-                               VkSampler default_sampler)
-    : context_{context}, upload_context_{upload_context}, default_sampler_{default_sampler}
+                               VkSampler default_sampler, u32 frames_in_flight)
+    : context_{context}, upload_context_{upload_context}, default_sampler_{default_sampler},
+      frames_in_flight_{frames_in_flight}
 {
-  static constexpr VkDescriptorSetLayoutBinding texture_bindings[] = {
+  BEYOND_ENSURE(frames_in_flight > 0 && frames_in_flight <= 32);
+
+  max_texture_count_ = query_max_bindless_texture_count(context_.physical_device());
+
+  const VkDescriptorSetLayoutBinding texture_bindings[] = {
       // Image sampler binding
       {.binding = bindless_texture_binding,
        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-       .descriptorCount = max_bindless_texture_count,
-       .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT}};
+       .descriptorCount = max_texture_count_,
+       .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT}};
 
   static constexpr VkDescriptorBindingFlags bindless_flags =
-      VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
-      VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT; // VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT
+      VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+      VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT;
   static constexpr VkDescriptorBindingFlags binding_flags[] = {bindless_flags};
 
   VkDescriptorSetLayoutBindingFlagsCreateInfo layout_binding_flags_create_info{
@@ -31,38 +61,17 @@ TextureManager::TextureManager(vkh::Context& context, UploadContext& upload_cont
       .pBindingFlags = binding_flags,
   };
 
-  {
-    vkh::DescriptorSetLayoutCreateInfo bindless_texture_descriptor_set_layout_create_info{
-        .p_next = &layout_binding_flags_create_info,
-        .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
-        .bindings = texture_bindings,
-        .debug_name = "Material Descriptor Set Layout",
-    };
-
-    static constexpr VkDescriptorPoolSize pool_sizes_bindless[] = {
-        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, max_bindless_texture_count},
-    };
-    bindless_texture_set_layout_ = vkh::create_descriptor_set_layout(
-                                       context_, bindless_texture_descriptor_set_layout_create_info)
-                                       .value();
-    VkDescriptorPoolCreateInfo descriptor_pool_create_info{
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-        .flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
-        .maxSets = max_bindless_texture_count * beyond::size(pool_sizes_bindless),
-        .poolSizeCount = beyond::size(pool_sizes_bindless),
-        .pPoolSizes = pool_sizes_bindless,
-    };
-    VK_CHECK(vkCreateDescriptorPool(context_, &descriptor_pool_create_info, nullptr,
-                                    &bindless_texture_descriptor_pool_));
+  vkh::DescriptorSetLayoutCreateInfo bindless_texture_descriptor_set_layout_create_info{
+      .p_next = &layout_binding_flags_create_info,
+      .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
+      .bindings = texture_bindings,
+      .debug_name = "Bindless Texture Descriptor Set Layout",
+  };
+  bindless_texture_set_layout_ = vkh::create_descriptor_set_layout(
+                                     context_, bindless_texture_descriptor_set_layout_create_info)
+                                     .value();
 
-    const VkDescriptorSetAllocateInfo alloc_info = {
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-        .descriptorPool = bindless_texture_descriptor_pool_,
-        .descriptorSetCount = 1,
-        .pSetLayouts = &bindless_texture_set_layout_};
-
-    VK_CHECK(vkAllocateDescriptorSets(context_, &alloc_info, &bindless_texture_descriptor_set_));
-  }
+  allocate_descriptor_sets(std::min(initial_bindless_texture_capacity, max_texture_count_));
 
   // Add default textures
   {
@@ -124,47 +133,172 @@ TextureManager::TextureManager(vkh::Context& context, UploadContext& upload_cont
 
 TextureManager::~TextureManager()
 {
-  for (auto texture : textures_) { vkDestroyImageView(context_, texture.image_view, nullptr); }
+  // Only the image views of the default textures are owned by the texture manager
+  vkDestroyImageView(context_, textures_.at(default_white_texture_index_).image_view, nullptr);
+  vkDestroyImageView(context_, textures_.at(default_normal_texture_index_).image_view, nullptr);
   for (auto image : images_) { vkh::destroy_image(context_, image); }
+
+  vkDestroyDescriptorPool(context_, bindless_texture_descriptor_pool_, nullptr);
+  vkDestroyDescriptorSetLayout(context_, bindless_texture_set_layout_, nullptr);
+}
+
+void TextureManager::allocate_descriptor_sets(u32 capacity)
+{
+  ZoneScoped;
+
+  const VkDescriptorPoolSize pool_sizes_bindless[] = {
+      {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, capacity * frames_in_flight_},
+  };
+  bindless_texture_descriptor_pool_ =
+      vkh::create_descriptor_pool(context_,
+                                  {.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
+                                   .max_sets = frames_in_flight_,
+                                   .pool_sizes = pool_sizes_bindless,
+                                   .debug_name = "Bindless Texture Descriptor Pool"})
+          .value();
+
+  const std::vector<VkDescriptorSetLayout> set_layouts(frames_in_flight_,
+                                                       bindless_texture_set_layout_);
+  const std::vector<u32> descriptor_counts(frames_in_flight_, capacity);
+  const VkDescriptorSetVariableDescriptorCountAllocateInfo variable_count_info{
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO,
+      .descriptorSetCount = frames_in_flight_,
+      .pDescriptorCounts = descriptor_counts.data(),
+  };
+  const VkDescriptorSetAllocateInfo alloc_info = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+      .pNext = &variable_count_info,
+      .descriptorPool = bindless_texture_descriptor_pool_,
+      .descriptorSetCount = frames_in_flight_,
+      .pSetLayouts = set_layouts.data()};
+
+  bindless_texture_descriptor_sets_.resize(frames_in_flight_);
+  VK_CHECK(
+      vkAllocateDescriptorSets(context_, &alloc_info, bindless_texture_descriptor_sets_.data()));
+  texture_capacity_ = capacity;
+
+  // The new sets are empty
+  textures_to_update_.clear();
+  for (u32 i = 0; i < textures_.size(); ++i) {
+    if (textures_[i].image_view == VK_NULL_HANDLE) { continue; }
+    textures_to_update_.push_back(TextureUpdate{
+        .index = i,
+        .pending_frames = all_frames_mask(),
+    });
+  }
 }
 
 auto TextureManager::add_texture(Texture texture) -> u32
 {
   if (texture.sampler == VK_NULL_HANDLE) { texture.sampler = default_sampler_; };
-
-  textures_.push_back(texture);
-  const u32 texture_index = narrow<u32>(textures_.size() - 1);
+  BEYOND_ENSURE(texture.image_view != VK_NULL_HANDLE);
+
+  u32 texture_index = 0;
+  if (free_texture_indices_.empty()) {
+    BEYOND_ENSURE_MSG(textures_.size() < max_texture_count_, "Too many bindless textures!");
+    textures_.push_back(texture);
+    texture_index = narrow<u32>(textures_.size() - 1);
+  } else {
+    texture_index = free_texture_indices_.back();
+    free_texture_indices_.pop_back();
+    textures_.at(texture_index) = texture;
+  }
 
   textures_to_update_.push_back(TextureUpdate{
       .index = texture_index,
+      .pending_frames = all_frames_mask(),
   });
 
   return texture_index;
 }
 
+void TextureManager::remove_texture(u32 index, DeletionQueue& deletion_queue)
+{
+  BEYOND_ENSURE(index != default_white_texture_index_ && index != default_normal_texture_index_);
+  BEYOND_ENSURE(textures_.at(index).image_view != VK_NULL_HANDLE);
+
+  textures_.at(index) = Texture{};
+  std::erase_if(textures_to_update_,
+                [index](const TextureUpdate& update) { return update.index == index; });
+
+  // Frames in flight may still sample the old descriptor, so the index can't be reused yet
+  deletion_queue.push(
+      [this, index](vkh::Context& /*context*/) { free_texture_indices_.push_back(index); });
+}
+
+void TextureManager::update_texture(u32 index, Texture texture)
+{
+  if (texture.sampler == VK_NULL_HANDLE) { texture.sampler = default_sampler_; }
+
+  textures_.at(index) = texture;
+  textures_to_update_.push_back(TextureUpdate{
+      .index = index,
+      .pending_frames = all_frames_mask(),
+  });
+}
+
 [[nodiscard]] auto TextureManager::upload_image(const charlie::CPUImage& cpu_image,
                                                 const ImageUploadInfo& upload_info) -> VkImage
 {
   ZoneScoped;
 
-  auto image = charlie::upload_image(context_, upload_context_, cpu_image, upload_info);
+  const vkh::AllocatedImage image = [&]() {
+    if (can_upload_image_from_host(context_, upload_info)) {
+      return upload_image_from_host(context_, cpu_image, upload_info);
+    }
+    std::scoped_lock lock{staging_upload_mutex_};
+    return charlie::upload_image(context_, upload_context_, cpu_image, upload_info);
+  }();
 
+  std::scoped_lock lock{images_mutex_};
   return images_.emplace_back(image).image;
 }
 
-void TextureManager::update()
+auto TextureManager::upload_mip_chain(std::span<const charlie::CPUImage> mips, VkFormat format)
+    -> vkh::AllocatedImage
 {
   ZoneScoped;
 
-  beyond::StaticVector<VkDescriptorImageInfo, max_bindless_texture_count> image_infos;
-  beyond::StaticVector<VkWriteDescriptorSet, max_bindless_texture_count> descriptor_writes;
+  if (can_upload_image_from_host(context_, {.format = format})) {
+    return upload_image_mip_chain_from_host(context_, mips, format);
+  }
+  std::scoped_lock lock{staging_upload_mutex_};
+  return upload_image_mip_chain(context_, upload_context_, mips, format);
+}
+
+void TextureManager::update(usize frame_index, DeletionQueue& deletion_queue)
+{
+  ZoneScoped;
+
+  if (textures_.size() > texture_capacity_) {
+    // Grow the descriptor sets. The old sets might still be used by the frames in flight
+    deletion_queue.push(
+        [descriptor_pool = bindless_texture_descriptor_pool_](vkh::Context& context) {
+          vkDestroyDescriptorPool(context, descriptor_pool, nullptr);
+        });
+    allocate_descriptor_sets(std::min(
+        std::max(texture_capacity_ * 2, narrow<u32>(textures_.size())), max_texture_count_));
+  }
+
+  const VkDescriptorSet descriptor_set = bindless_texture_descriptor_sets_.at(frame_index);
+  const u32 frame_bit = 1u << frame_index;
+
+  std::vector<VkDescriptorImageInfo> image_infos;
+  std::vector<VkWriteDescriptorSet> descriptor_writes;
+  image_infos.reserve(textures_to_update_.size());
+  descriptor_writes.reserve(textures_to_update_.size());
+
+  for (TextureUpdate& texture_to_update : textures_to_update_) {
+    if (not(texture_to_update.pending_frames & frame_bit)) { continue; }
+    texture_to_update.pending_frames &= ~frame_bit;
 
-  for (const TextureUpdate& texture_to_update : textures_to_update_) {
     const Texture& texture = textures_.at(texture_to_update.index);
 
     BEYOND_ENSURE(texture.sampler != nullptr);
     BEYOND_ENSURE(texture.image_view != nullptr);
 
+    // Later updates of the same index overwrite the earlier ones, so it is fine to write the
+    // current state of the texture multiple times
     VkDescriptorImageInfo& image_info = image_infos.emplace_back(
         VkDescriptorImageInfo{.sampler = texture.sampler,
                               .imageView = texture.image_view,
@@ -172,7 +306,7 @@ void TextureManager::update()
 
     descriptor_writes.push_back(VkWriteDescriptorSet{
         .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-        .dstSet = bindless_texture_descriptor_set_,
+        .dstSet = descriptor_set,
         .dstBinding = bindless_texture_binding,
         .dstArrayElement = texture_to_update.index,
         .descriptorCount = 1,
@@ -180,9 +314,11 @@ void TextureManager::update()
         .pImageInfo = &image_info,
     });
   }
-  textures_to_update_.clear();
+  std::erase_if(textures_to_update_,
+                [](const TextureUpdate& update) { return update.pending_frames == 0; });
 
-  vkUpdateDescriptorSets(context_, descriptor_writes.size(), descriptor_writes.data(), 0, nullptr);
+  vkUpdateDescriptorSets(context_, narrow<u32>(descriptor_writes.size()), descriptor_writes.data(),
+                         0, nullptr);
 }
 
 } // namespace charlie
@@ -5,11 +5,19 @@
 
 #include "../utils/prelude.hpp"
 #include "../vulkan_helpers/image.hpp"
+#include "deletion_queue.hpp"
 #include "uploader.hpp"
 
+#include <mutex>
+#include <span>
+#include <vector>
+
 namespace charlie {
 
-static constexpr uint32_t max_bindless_texture_count = 1024;
+// The bindless texture table starts with this many slots and grows on demand
+static constexpr uint32_t initial_bindless_texture_capacity = 1024;
+// Upper bound of the variable-count bindless binding. Further limited by the device
+static constexpr uint32_t max_bindless_texture_count = 1u << 20;
 static constexpr uint32_t bindless_texture_binding = 10;
 
 // A texture is a combination of image and sampler
@@ -30,35 +38,68 @@ class TextureManager {
 
   VkDescriptorSetLayout bindless_texture_set_layout_ = VK_NULL_HANDLE;
   VkDescriptorPool bindless_texture_descriptor_pool_ = VK_NULL_HANDLE;
-  VkDescriptorSet bindless_texture_descriptor_set_ = VK_NULL_HANDLE;
-
+  // One set per frame in flight, so that a texture can be replaced while the previous frame is
+  // still using the old one
+  std::vector<VkDescriptorSet> bindless_texture_descriptor_sets_;
+  u32 max_texture_count_ = 0; // The descriptor count of the bindless binding in the set layout
+  u32 texture_capacity_ = 0;  // The descriptor count of the currently allocated sets
+
+  std::mutex images_mutex_;
+  std::mutex staging_upload_mutex_; // Staging uploads share the same command pool and fence
   std::vector<vkh::AllocatedImage> images_;
-  std::vector<Texture> textures_;
+  std::vector<Texture> textures_; // Removed textures have null image views
+  std::vector<u32> free_texture_indices_;
   struct TextureUpdate {
     uint32_t index = 0xdeadbeef; // Index
+    uint32_t pending_frames = 0; // Bit mask of the descriptor sets that still need this write
   };
   std::vector<TextureUpdate> textures_to_update_;
+  u32 frames_in_flight_ = 1;
+
+  [[nodiscard]] auto all_frames_mask() const -> u32 { return (1u << frames_in_flight_) - 1; }
+
+  // Allocate a descriptor set of `capacity` textures for each frame in flight, and queue writes of
+  // all the live textures into them
+  void allocate_descriptor_sets(u32 capacity);
 
 public:
-  TextureManager(vkh::Context& context, UploadContext& upload_context, VkSampler default_sampler);
+  TextureManager(vkh::Context& context, UploadContext& upload_context, VkSampler default_sampler,
+                 u32 frames_in_flight);
   ~TextureManager();
 
-  // Add a texture and returns its index
+  // Add a texture and returns its index. Indices of removed textures are reused.
+  // The texture manager does not take the ownership of the image view.
   [[nodiscard]] auto add_texture(Texture texture) -> u32;
 
+  // Remove a texture. Its index becomes available again once the frames in flight that may still
+  // sample it are finished.
+  void remove_texture(u32 index, DeletionQueue& deletion_queue);
+
+  [[nodiscard]] auto texture(u32 index) const -> const Texture& { return textures_.at(index); }
+
+  // Points an existing texture index to a new image. The caller keeps the ownership of the image
+  void update_texture(u32 index, Texture texture);
+
+  // Upload an image to the GPU. Uses VK_EXT_host_image_copy when possible and falls back to a
+  // staging buffer otherwise. Thread-safe.
   [[nodiscard]] auto upload_image(const charlie::CPUImage& cpu_image,
                                   const ImageUploadInfo& upload_info) -> VkImage;
 
+  // Upload a precomputed mip chain. Unlike `upload_image`, the returned image is owned by the
+  // caller. Thread-safe.
+  [[nodiscard]] auto upload_mip_chain(std::span<const charlie::CPUImage> mips,
+                                      VkFormat format) -> vkh::AllocatedImage;
+
   // Returns the bindless texture descriptor set layout
   [[nodiscard]] auto descriptor_set_layout() const -> VkDescriptorSetLayout
   {
     return bindless_texture_set_layout_;
   }
 
-  // Returns the bindless texture descriptor set
-  [[nodiscard]] auto descriptor_set() const -> VkDescriptorSet
+  // Returns the bindless texture descriptor set of a frame in flight
+  [[nodiscard]] auto descriptor_set(usize frame_index) const -> VkDescriptorSet
   {
-    return bindless_texture_descriptor_set_;
+    return bindless_texture_descriptor_sets_.at(frame_index);
   }
 
   [[nodiscard]] auto default_white_texture_index() const -> u32
@@ -71,8 +112,16 @@ public:
     return default_normal_texture_index_;
   }
 
-  // upload queued textures to the GPU
-  void update();
+  [[nodiscard]] auto texture_count() const -> usize
+  {
+    return textures_.size() - free_texture_indices_.size();
+  }
+  [[nodiscard]] auto texture_capacity() const -> u32 { return texture_capacity_; }
+
+  // Write queued texture changes into the descriptor set of `frame_index`, and grow the descriptor
+  // sets when they can't hold all textures anymore.
+  // Must be called after the GPU finished the previous frame that used this set.
+  void update(usize frame_index, DeletionQueue& deletion_queue);
 
   TextureManager(const TextureManager&) = delete;
   auto operator=(const TextureManager&) & -> TextureManager& = delete;
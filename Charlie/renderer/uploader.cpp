@@ -10,6 +10,8 @@
 
 #include <tracy/Tracy.hpp>
 
+#include <vector>
+
 namespace charlie {
 
 static void cmd_generate_mipmap(VkCommandBuffer cmd, VkImage image, Resolution image_resolution,
@@ -127,6 +129,7 @@ void immediate_submit(vkh::Context& context, const UploadContext& upload_context
 
 auto upload_buffer(vkh::Context& context, const UploadContext& upload_context,
                    std::span<const std::byte> data, VkBufferUsageFlags usage,
+                   vkh::MemoryCategory category,
                    beyond::ZStringView debug_name) -> vkh::Expected<vkh::AllocatedBuffer>
 {
   const auto size = beyond::narrow<uint32_t>(data.size());
@@ -136,14 +139,16 @@ auto upload_buffer(vkh::Context& context, const UploadContext& upload_context,
   return vkh::create_buffer(context, {.size = size,
                                       .usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
                                       .memory_usage = VMA_MEMORY_USAGE_GPU_ONLY,
-                                      .debug_name = fmt::format("{} Buffer", debug_name)})
+                                      .debug_name = fmt::format("{} Buffer", debug_name),
+                                      .category = category})
       .and_then([=, &context, &upload_context](vkh::AllocatedBuffer gpu_buffer) {
         auto staging_buffer = vkh::create_buffer_from_data(
                                   context,
                                   {.size = size,
                                    .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
                                    .memory_usage = VMA_MEMORY_USAGE_CPU_TO_GPU,
-                                   .debug_name = fmt::format("{} Staging Buffer", debug_name)},
+                                   .debug_name = fmt::format("{} Staging Buffer", debug_name),
+                                   .category = vkh::MemoryCategory::staging},
                                   data)
                                   .value();
         BEYOND_DEFER(vkh::destroy_buffer(context, staging_buffer));
@@ -179,7 +184,8 @@ auto upload_image(vkh::Context& context, const UploadContext& upload_context,
       vkh::create_buffer(context, vkh::BufferCreateInfo{.size = image_size,
                                                         .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
                                                         .memory_usage = VMA_MEMORY_USAGE_CPU_ONLY,
-                                                        .debug_name = staging_buffer_debug_name})
+                                                        .debug_name = staging_buffer_debug_name,
+                                                        .category = vkh::MemoryCategory::staging})
           .value();
   BEYOND_DEFER(vkh::destroy_buffer(context, staging_buffer));
 
@@ -208,6 +214,7 @@ auto upload_image(vkh::Context& context, const UploadContext& upload_context,
                                                          VK_IMAGE_USAGE_TRANSFER_DST_BIT,
                                                 .mip_levels = mip_levels,
                                                 .debug_name = image_debug_name,
+                                                .category = vkh::MemoryCategory::texture,
                                             });
 
     if (not image.has_value()) {
@@ -283,4 +290,249 @@ auto upload_image(vkh::Context& context, const UploadContext& upload_context,
   return allocated_image;
 }
 
-} // namespace charlie
\ No newline at end of file
+// Streamed textures copy their resident mips into the replacing image on the GPU
+static constexpr VkImageUsageFlags host_upload_image_usage =
+    VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+    VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT;
+
+auto can_upload_image_from_host(vkh::Context& context, const ImageUploadInfo& upload_info) -> bool
+{
+  if (not context.supports_host_image_copy()) { return false; }
+
+  VkFormatProperties3 format_properties3{.sType = VK_STRUCTURE_TYPE_FORMAT_PROPERTIES_3};
+  VkFormatProperties2 format_properties{.sType = VK_STRUCTURE_TYPE_FORMAT_PROPERTIES_2,
+                                        .pNext = &format_properties3};
+  vkGetPhysicalDeviceFormatProperties2(context.physical_device(), upload_info.format,
+                                       &format_properties);
+  if (not(format_properties3.optimalTilingFeatures &
+          VK_FORMAT_FEATURE_2_HOST_IMAGE_TRANSFER_BIT_EXT)) {
+    return false;
+  }
+
+  // Some implementations disable compression for images with host transfer usage. Fall back to
+  // the staging buffer path in that case.
+  VkHostImageCopyDevicePerformanceQueryEXT performance_query{
+      .sType = VK_STRUCTURE_TYPE_HOST_IMAGE_COPY_DEVICE_PERFORMANCE_QUERY_EXT,
+  };
+  VkImageFormatProperties2 image_format_properties{
+      .sType = VK_STRUCTURE_TYPE_IMAGE_FORMAT_PROPERTIES_2,
+      .pNext = &performance_query,
+  };
+  const VkPhysicalDeviceImageFormatInfo2 image_format_info{
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_FORMAT_INFO_2,
+      .format = upload_info.format,
+      .type = VK_IMAGE_TYPE_2D,
+      .tiling = VK_IMAGE_TILING_OPTIMAL,
+      .usage = host_upload_image_usage,
+  };
+  if (vkGetPhysicalDeviceImageFormatProperties2(context.physical_device(), &image_format_info,
+                                                &image_format_properties) != VK_SUCCESS) {
+    return false;
+  }
+
+  return performance_query.optimalDeviceAccess == VK_TRUE;
+}
+
+auto upload_image_from_host(vkh::Context& context, const charlie::CPUImage& cpu_image,
+                            const ImageUploadInfo& upload_info) -> vkh::AllocatedImage
+{
+  ZoneScoped;
+
+  BEYOND_ENSURE(cpu_image.width != 0 && cpu_image.height != 0);
+
+  // Unlike the staging path, we can't blit on the host, so the mip chain is built on the CPU
+  const bool is_srgb = upload_info.format == VK_FORMAT_R8G8B8A8_SRGB;
+  std::vector<CPUImage> mips;
+  mips.reserve(upload_info.mip_levels);
+  mips.push_back(CPUImage{.name = cpu_image.name,
+                          .width = cpu_image.width,
+                          .height = cpu_image.height,
+                          .components = cpu_image.components});
+  for (u32 i = 1; i < upload_info.mip_levels; ++i) {
+    mips.push_back(generate_next_mip(i == 1 ? cpu_image : mips.back(), is_srgb));
+  }
+  // Borrow the most detailed level instead of copying it
+  mips[0].data.reset(cpu_image.data.get());
+  BEYOND_DEFER(static_cast<void>(mips[0].data.release()));
+
+  return upload_image_mip_chain_from_host(context, mips, upload_info.format);
+}
+
+auto upload_image_mip_chain_from_host(vkh::Context& context,
+                                      std::span<const charlie::CPUImage> mips,
+                                      VkFormat format) -> vkh::AllocatedImage
+{
+  ZoneScoped;
+
+  BEYOND_ENSURE(not mips.empty());
+  const CPUImage& cpu_image = mips.front();
+  const u32 mip_levels = narrow<u32>(mips.size());
+
+  const auto image_debug_name =
+      !cpu_image.name.empty() ? fmt::format("{} Image", cpu_image.name) : "Image";
+  vkh::AllocatedImage allocated_image = [&]() {
+    auto image = vkh::create_image(context, vkh::ImageCreateInfo{
+                                                .format = format,
+                                                .extent =
+                                                    {
+                                                        .width = cpu_image.width,
+                                                        .height = cpu_image.height,
+                                                        .depth = 1,
+                                                    },
+                                                .usage = host_upload_image_usage,
+                                                .mip_levels = mip_levels,
+                                                .debug_name = image_debug_name,
+                                                .category = vkh::MemoryCategory::texture,
+                                            });
+
+    if (not image.has_value()) {
+      beyond::panic(fmt::format("Failed to create image: {}", vkh::to_string(image.error())));
+    }
+
+    return image.value();
+  }();
+
+  const VkHostImageLayoutTransitionInfoEXT transition_info{
+      .sType = VK_STRUCTURE_TYPE_HOST_IMAGE_LAYOUT_TRANSITION_INFO_EXT,
+      .image = allocated_image.image,
+      .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+      .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+      .subresourceRange = vkh::SubresourceRange{.aspect_mask = VK_IMAGE_ASPECT_COLOR_BIT,
+                                                .level_count = mip_levels},
+  };
+  VK_CHECK(vkTransitionImageLayoutEXT(context, 1, &transition_info));
+
+  std::vector<VkMemoryToImageCopyEXT> regions;
+  regions.reserve(mip_levels);
+  for (u32 level = 0; level < mip_levels; ++level) {
+    const CPUImage& mip = mips[level];
+    regions.push_back(VkMemoryToImageCopyEXT{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_TO_IMAGE_COPY_EXT,
+        .pHostPointer = mip.data.get(),
+        .imageSubresource =
+            {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .mipLevel = level,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+        .imageExtent = {.width = mip.width, .height = mip.height, .depth = 1},
+    });
+  }
+
+  const VkCopyMemoryToImageInfoEXT copy_info{
+      .sType = VK_STRUCTURE_TYPE_COPY_MEMORY_TO_IMAGE_INFO_EXT,
+      .dstImage = allocated_image.image,
+      .dstImageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+      .regionCount = narrow<u32>(regions.size()),
+      .pRegions = regions.data(),
+  };
+  VK_CHECK(vkCopyMemoryToImageEXT(context, &copy_info));
+
+  return allocated_image;
+}
+
+auto upload_image_mip_chain(vkh::Context& context, const UploadContext& upload_context,
+                            std::span<const charlie::CPUImage> mips,
+                            VkFormat format) -> vkh::AllocatedImage
+{
+  ZoneScoped;
+
+  BEYOND_ENSURE(not mips.empty());
+  const CPUImage& cpu_image = mips.front();
+  const u32 mip_levels = narrow<u32>(mips.size());
+
+  std::vector<VkBufferImageCopy> copy_regions;
+  copy_regions.reserve(mip_levels);
+  VkDeviceSize staging_buffer_size = 0;
+  for (u32 level = 0; level < mip_levels; ++level) {
+    const CPUImage& mip = mips[level];
+    copy_regions.push_back(VkBufferImageCopy{
+        .bufferOffset = staging_buffer_size,
+        .imageSubresource =
+            {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .mipLevel = level,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+        .imageExtent = {.width = mip.width, .height = mip.height, .depth = 1},
+    });
+    staging_buffer_size += VkDeviceSize{mip.width} * mip.height * 4;
+  }
+
+  auto staging_buffer =
+      vkh::create_buffer(context, vkh::BufferCreateInfo{.size = staging_buffer_size,
+                                                        .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                                        .memory_usage = VMA_MEMORY_USAGE_CPU_ONLY,
+                                                        .debug_name = "Mip Chain Staging Buffer",
+                                                        .category = vkh::MemoryCategory::staging})
+          .value();
+  BEYOND_DEFER(vkh::destroy_buffer(context, staging_buffer));
+
+  auto* data = context.map<std::byte>(staging_buffer).value();
+  for (u32 level = 0; level < mip_levels; ++level) {
+    const CPUImage& mip = mips[level];
+    memcpy(data + copy_regions[level].bufferOffset, mip.data.get(),
+           std::size_t{mip.width} * mip.height * 4);
+  }
+  context.unmap(staging_buffer);
+
+  const auto image_debug_name =
+      !cpu_image.name.empty() ? fmt::format("{} Image", cpu_image.name) : "Image";
+  vkh::AllocatedImage allocated_image = [&]() {
+    auto image = vkh::create_image(
+        context, vkh::ImageCreateInfo{
+                     .format = format,
+                     .extent = {.width = cpu_image.width, .height = cpu_image.height, .depth = 1},
+                     .usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                              VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                     .mip_levels = mip_levels,
+                     .debug_name = image_debug_name,
+                     .category = vkh::MemoryCategory::texture,
+                 });
+
+    if (not image.has_value()) {
+      beyond::panic(fmt::format("Failed to create image: {}", vkh::to_string(image.error())));
+    }
+
+    return image.value();
+  }();
+
+  immediate_submit(context, upload_context, [&](VkCommandBuffer cmd) {
+    const auto range =
+        vkh::SubresourceRange{.aspect_mask = VK_IMAGE_ASPECT_COLOR_BIT, .level_count = mip_levels};
+
+    vkh::cmd_pipeline_barrier(
+        cmd, {.image_barriers = std::array{
+                  vkh::ImageBarrier{
+                      .stage_masks = {VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                                      VK_PIPELINE_STAGE_2_TRANSFER_BIT},
+                      .access_masks = {VK_ACCESS_2_NONE, VK_ACCESS_2_TRANSFER_WRITE_BIT},
+                      .layouts = {VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL},
+                      .image = allocated_image.image,
+                      .subresource_range = range}
+                      .to_vk_struct() //
+              }});
+
+    vkCmdCopyBufferToImage(cmd, staging_buffer.buffer, allocated_image.image,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mip_levels, copy_regions.data());
+
+    vkh::cmd_pipeline_barrier(
+        cmd, {.image_barriers = std::array{
+                  vkh::ImageBarrier{.stage_masks = {VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+                                                    VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT},
+                                    .access_masks = {VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                                                     VK_ACCESS_2_SHADER_READ_BIT},
+                                    .layouts = {VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+                                    .image = allocated_image.image,
+                                    .subresource_range = range}
+                      .to_vk_struct() //
+              }});
+  });
+
+  return allocated_image;
+}
+
+} // namespace charlie
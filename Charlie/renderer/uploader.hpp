@@ -34,16 +34,17 @@ void immediate_submit(vkh::Context& context, const UploadContext& upload_context
 
 auto upload_buffer(vkh::Context& context, const UploadContext& upload_context,
                    std::span<const std::byte> data, VkBufferUsageFlags usage,
+                   vkh::MemoryCategory category,
                    beyond::ZStringView debug_name = "") -> vkh::Expected<vkh::AllocatedBuffer>;
 
 template <class Container>
 auto upload_buffer(vkh::Context& context, const UploadContext& upload_context,
-                   const Container& buffer, VkBufferUsageFlags usage,
+                   const Container& buffer, VkBufferUsageFlags usage, vkh::MemoryCategory category,
                    beyond::ZStringView debug_name = "") -> vkh::Expected<vkh::AllocatedBuffer>
   requires(std::contiguous_iterator<typename Container::iterator>)
 {
   return charlie::upload_buffer(context, upload_context, std::as_bytes(std::span{buffer}), usage,
-                                debug_name);
+                                category, debug_name);
 }
 
 [[nodiscard]]
@@ -51,6 +52,31 @@ auto upload_image(vkh::Context& context, const UploadContext& upload_context,
                   const charlie::CPUImage& cpu_image,
                   const ImageUploadInfo& upload_info) -> vkh::AllocatedImage;
 
+// Whether an image with `upload_info` can be uploaded through VK_EXT_host_image_copy without
+// hurting its device access performance
+[[nodiscard]] auto can_upload_image_from_host(vkh::Context& context,
+                                              const ImageUploadInfo& upload_info) -> bool;
+
+// Uploads an image with vkCopyMemoryToImageEXT. Mipmaps are generated on the CPU.
+// This does not touch any queue, so it is safe to call from multiple threads as long as
+// `can_upload_image_from_host` returns true.
+[[nodiscard]]
+auto upload_image_from_host(vkh::Context& context, const charlie::CPUImage& cpu_image,
+                            const ImageUploadInfo& upload_info) -> vkh::AllocatedImage;
+
+// Uploads an image from a precomputed mip chain, where `mips[0]` becomes the most detailed level
+// of the GPU image. The image can be the source of transfers
+[[nodiscard]]
+auto upload_image_mip_chain(vkh::Context& context, const UploadContext& upload_context,
+                            std::span<const charlie::CPUImage> mips,
+                            VkFormat format) -> vkh::AllocatedImage;
+
+// Same as `upload_image_mip_chain`, but through VK_EXT_host_image_copy
+[[nodiscard]]
+auto upload_image_mip_chain_from_host(vkh::Context& context,
+                                      std::span<const charlie::CPUImage> mips,
+                                      VkFormat format) -> vkh::AllocatedImage;
+
 } // namespace charlie
 
 #endif // CHARLIE3D_UPLOADER_HPP
@@ -175,6 +175,8 @@ auto ShaderCompiler::compile_shader_from_file(beyond::ZStringView shader_path,
 
   shaderc::CompileOptions compile_options{};
   compile_options.SetGenerateDebugInfo();
+  // Mesh shaders need SPIR-V 1.4
+  compile_options.SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_3);
 
   std::vector<IncludeData> includes;
 
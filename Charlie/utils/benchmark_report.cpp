@@ -0,0 +1,312 @@
+#include "benchmark_report.hpp"
+#include "command_line.hpp"
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <numeric>
+#include <sstream>
+
+namespace charlie {
+
+namespace {
+
+constexpr std::string_view csv_header = "category,name,mean_ms,p50_ms,p95_ms,p99_ms,max_ms";
+
+template <typename Samples>
+void add_sample(std::vector<Samples>& samples, std::string_view name, f64 milliseconds)
+{
+  auto itr = std::ranges::find(samples, name, &Samples::name);
+  if (itr == samples.end()) {
+    samples.push_back({.name = std::string{name}});
+    itr = std::prev(samples.end());
+  }
+  itr->milliseconds.push_back(milliseconds);
+}
+
+[[nodiscard]] auto json_escape(std::string_view str) -> std::string
+{
+  std::string result;
+  result.reserve(str.size());
+  for (const char c : str) {
+    switch (c) {
+    case '"': result += "\\\""; break;
+    case '\\': result += "\\\\"; break;
+    case '\n': result += "\\n"; break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20) {
+        fmt::format_to(std::back_inserter(result), "\\u{:04x}", static_cast<int>(c));
+      } else {
+        result += c;
+      }
+    }
+  }
+  return result;
+}
+
+// Commas would split the CSV fields
+[[nodiscard]] auto csv_field(std::string_view str) -> std::string
+{
+  std::string result{str};
+  std::ranges::replace(result, ',', ';');
+  return result;
+}
+
+[[nodiscard]] auto format_json_statistics(const TimingStatistics& statistics) -> std::string
+{
+  return fmt::format(R"({{"mean_ms": {:.4f}, "p50_ms": {:.4f}, "p95_ms": {:.4f}, )"
+                     R"("p99_ms": {:.4f}, "max_ms": {:.4f}}})",
+                     statistics.mean, statistics.p50, statistics.p95, statistics.p99,
+                     statistics.max);
+}
+
+void format_json_timings(std::string& out, std::string_view key,
+                         std::span<const NamedTimingStatistics> timings)
+{
+  fmt::format_to(std::back_inserter(out), "  \"{}\": [", key);
+  for (usize i = 0; i < timings.size(); ++i) {
+    fmt::format_to(std::back_inserter(out), "{}\n    {{\"name\": \"{}\", \"statistics\": {}}}",
+                   i == 0 ? "" : ",", json_escape(timings[i].name),
+                   format_json_statistics(timings[i].statistics));
+  }
+  out += timings.empty() ? "]" : "\n  ]";
+}
+
+void format_json_memory(std::string& out, std::span<const NamedMemoryUsage> memory)
+{
+  out += "  \"memory\": [";
+  for (usize i = 0; i < memory.size(); ++i) {
+    fmt::format_to(std::back_inserter(out), "{}\n    {{\"name\": \"{}\", \"mib\": {:.4f}}}",
+                   i == 0 ? "" : ",", json_escape(memory[i].name), memory[i].mebibytes);
+  }
+  out += memory.empty() ? "]" : "\n  ]";
+}
+
+void format_csv_row(std::string& out, std::string_view category, std::string_view name,
+                    const TimingStatistics& statistics)
+{
+  fmt::format_to(std::back_inserter(out), "{},{},{:.4f},{:.4f},{:.4f},{:.4f},{:.4f}\n", category,
+                 csv_field(name), statistics.mean, statistics.p50, statistics.p95,
+                 statistics.p99, statistics.max);
+}
+
+[[nodiscard]] auto split_csv_line(const std::string& line) -> std::vector<std::string>
+{
+  std::vector<std::string> fields;
+  std::istringstream stream{line};
+  std::string field;
+  while (std::getline(stream, field, ',')) { fields.push_back(field); }
+  return fields;
+}
+
+[[nodiscard]] auto find_timing(std::span<const NamedTimingStatistics> timings,
+                               std::string_view name) -> const TimingStatistics*
+{
+  const auto itr = std::ranges::find(timings, name, &NamedTimingStatistics::name);
+  return itr == timings.end() ? nullptr : &itr->statistics;
+}
+
+} // anonymous namespace
+
+auto compute_timing_statistics(std::span<const f64> milliseconds) -> TimingStatistics
+{
+  if (milliseconds.empty()) { return {}; }
+
+  std::vector<f64> sorted(milliseconds.begin(), milliseconds.end());
+  std::ranges::sort(sorted);
+
+  const auto percentile = [&](f64 p) {
+    const auto rank = static_cast<usize>(std::ceil(p / 100.0 * static_cast<f64>(sorted.size())));
+    return sorted[std::clamp<usize>(rank, 1, sorted.size()) - 1];
+  };
+
+  return TimingStatistics{
+      .mean = std::accumulate(sorted.begin(), sorted.end(), 0.0) / static_cast<f64>(sorted.size()),
+      .p50 = percentile(50),
+      .p95 = percentile(95),
+      .p99 = percentile(99),
+      .max = sorted.back(),
+  };
+}
+
+void BenchmarkRecorder::add_cpu_stage(std::string_view name, f64 milliseconds)
+{
+  add_sample(cpu_stages_, name, milliseconds);
+}
+
+void BenchmarkRecorder::add_gpu_pass(std::string_view name, f64 milliseconds)
+{
+  add_sample(gpu_passes_, name, milliseconds);
+}
+
+auto BenchmarkRecorder::report() const -> BenchmarkReport
+{
+  const auto to_statistics = [](std::span<const Samples> samples) {
+    std::vector<NamedTimingStatistics> result;
+    result.reserve(samples.size());
+    for (const Samples& sample : samples) {
+      result.push_back({.name = sample.name,
+                        .statistics = compute_timing_statistics(sample.milliseconds)});
+    }
+    return result;
+  };
+
+  return BenchmarkReport{
+      .frame_count = frame_count(),
+      .frame_time = compute_timing_statistics(frame_times_),
+      .cpu_stages = to_statistics(cpu_stages_),
+      .gpu_passes = to_statistics(gpu_passes_),
+  };
+}
+
+auto format_benchmark_report_json(const BenchmarkReport& report) -> std::string
+{
+  std::string out = "{\n";
+  fmt::format_to(std::back_inserter(out), "  \"scene\": \"{}\",\n", json_escape(report.scene));
+  fmt::format_to(std::back_inserter(out), "  \"warm_up_frame_count\": {},\n",
+                 report.warm_up_frame_count);
+  fmt::format_to(std::back_inserter(out), "  \"frame_count\": {},\n", report.frame_count);
+  fmt::format_to(std::back_inserter(out), "  \"scene_load_ms\": {:.4f},\n",
+                 report.scene_load_milliseconds);
+  fmt::format_to(std::back_inserter(out), "  \"frame_time\": {},\n",
+                 format_json_statistics(report.frame_time));
+  format_json_timings(out, "cpu_stages", report.cpu_stages);
+  out += ",\n";
+  format_json_timings(out, "gpu_passes", report.gpu_passes);
+  out += ",\n";
+  format_json_memory(out, report.memory);
+  out += "\n}\n";
+  return out;
+}
+
+auto format_benchmark_report_csv(const BenchmarkReport& report) -> std::string
+{
+  std::string out;
+  fmt::format_to(std::back_inserter(out), "# scene: {}\n", report.scene);
+  fmt::format_to(std::back_inserter(out), "# warm-up frames: {}\n", report.warm_up_frame_count);
+  fmt::format_to(std::back_inserter(out), "# frames: {}\n", report.frame_count);
+  out += csv_header;
+  out += '\n';
+
+  const f64 load = report.scene_load_milliseconds;
+  format_csv_row(out, "load", "scene", {load, load, load, load, load});
+  format_csv_row(out, "frame", "frame", report.frame_time);
+  for (const auto& [name, statistics] : report.cpu_stages) {
+    format_csv_row(out, "cpu", name, statistics);
+  }
+  for (const auto& [name, statistics] : report.gpu_passes) {
+    format_csv_row(out, "gpu", name, statistics);
+  }
+  for (const auto& [name, mebibytes] : report.memory) {
+    format_csv_row(out, "memory", name, {mebibytes, mebibytes, mebibytes, mebibytes, mebibytes});
+  }
+  return out;
+}
+
+auto parse_benchmark_report_csv(std::string_view text) -> beyond::optional<BenchmarkReport>
+{
+  std::istringstream stream{std::string{text}};
+
+  BenchmarkReport report;
+  bool has_header = false;
+  std::string line;
+  while (std::getline(stream, line)) {
+    if (line.empty() || line.starts_with('#')) { continue; }
+    if (!has_header) {
+      if (line != csv_header) { return beyond::nullopt; }
+      has_header = true;
+      continue;
+    }
+
+    const std::vector<std::string> fields = split_csv_line(line);
+    if (fields.size() != 7) { return beyond::nullopt; }
+    f64 values[5] = {};
+    for (usize i = 0; i < 5; ++i) {
+      const auto value = parse_f64(fields[i + 2]);
+      if (!value) { return beyond::nullopt; }
+      values[i] = *value;
+    }
+    const TimingStatistics statistics{values[0], values[1], values[2], values[3], values[4]};
+
+    const std::string& category = fields[0];
+    if (category == "load") {
+      report.scene_load_milliseconds = statistics.mean;
+    } else if (category == "frame") {
+      report.frame_time = statistics;
+    } else if (category == "cpu") {
+      report.cpu_stages.push_back({.name = fields[1], .statistics = statistics});
+    } else if (category == "gpu") {
+      report.gpu_passes.push_back({.name = fields[1], .statistics = statistics});
+    } else if (category == "memory") {
+      report.memory.push_back({.name = fields[1], .mebibytes = statistics.mean});
+    } else {
+      return beyond::nullopt;
+    }
+  }
+
+  if (!has_header) { return beyond::nullopt; }
+  return report;
+}
+
+auto save_benchmark_report(const BenchmarkReport& report, const std::filesystem::path& path)
+    -> bool
+{
+  std::ofstream file{path};
+  if (!file) {
+    SPDLOG_ERROR("Failed to create benchmark report {}", path.string());
+    return false;
+  }
+  file << (path.extension() == ".json" ? format_benchmark_report_json(report)
+                                       : format_benchmark_report_csv(report));
+  return static_cast<bool>(file);
+}
+
+auto load_benchmark_report(const std::filesystem::path& path) -> beyond::optional<BenchmarkReport>
+{
+  std::ifstream file{path};
+  if (!file) {
+    SPDLOG_ERROR("Failed to open benchmark report {}", path.string());
+    return beyond::nullopt;
+  }
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+
+  auto report = parse_benchmark_report_csv(buffer.str());
+  if (!report) { SPDLOG_ERROR("{} is not a CSV benchmark report", path.string()); }
+  return report;
+}
+
+auto find_benchmark_regressions(const BenchmarkReport& report, const BenchmarkReport& baseline,
+                                const BenchmarkThresholds& thresholds) -> std::vector<std::string>
+{
+  std::vector<std::string> regressions;
+  const auto check = [&](std::string_view name, f64 current, f64 base) {
+    const f64 limit =
+        std::max(base * (1.0 + thresholds.max_regression), base + thresholds.min_regression_ms);
+    if (current > limit) {
+      regressions.push_back(fmt::format("{}: {:.3f} ms -> {:.3f} ms", name, base, current));
+    }
+  };
+
+  check("frame time p50", report.frame_time.p50, baseline.frame_time.p50);
+  check("frame time p95", report.frame_time.p95, baseline.frame_time.p95);
+  check("frame time p99", report.frame_time.p99, baseline.frame_time.p99);
+  check("scene load", report.scene_load_milliseconds, baseline.scene_load_milliseconds);
+  for (const auto& [name, statistics] : report.cpu_stages) {
+    if (const TimingStatistics* base = find_timing(baseline.cpu_stages, name)) {
+      check(fmt::format("CPU {}", name), statistics.mean, base->mean);
+    }
+  }
+  for (const auto& [name, statistics] : report.gpu_passes) {
+    if (const TimingStatistics* base = find_timing(baseline.gpu_passes, name)) {
+      check(fmt::format("GPU {}", name), statistics.mean, base->mean);
+    }
+  }
+  return regressions;
+}
+
+} // namespace charlie
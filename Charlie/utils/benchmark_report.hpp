@@ -0,0 +1,106 @@
+#ifndef CHARLIE3D_BENCHMARK_REPORT_HPP
+#define CHARLIE3D_BENCHMARK_REPORT_HPP
+
+// Timing statistics and memory usage of a benchmark run, and their comparison against the report of
+// a baseline run.
+
+#include "prelude.hpp"
+
+#include <beyond/types/optional.hpp>
+
+#include <filesystem>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace charlie {
+
+// In milliseconds
+struct TimingStatistics {
+  f64 mean = 0;
+  f64 p50 = 0;
+  f64 p95 = 0;
+  f64 p99 = 0;
+  f64 max = 0;
+};
+
+// Nearest-rank percentiles. All zero without samples
+[[nodiscard]] auto compute_timing_statistics(std::span<const f64> milliseconds)
+    -> TimingStatistics;
+
+struct NamedTimingStatistics {
+  std::string name;
+  TimingStatistics statistics;
+};
+
+struct NamedMemoryUsage {
+  std::string name;
+  f64 mebibytes = 0;
+};
+
+struct BenchmarkReport {
+  std::string scene;
+  u32 warm_up_frame_count = 0;
+  u32 frame_count = 0;
+  f64 scene_load_milliseconds = 0;
+  TimingStatistics frame_time;
+  std::vector<NamedTimingStatistics> cpu_stages;
+  std::vector<NamedTimingStatistics> gpu_passes;
+  std::vector<NamedMemoryUsage> memory; // At the end of the run
+};
+
+// Collects the samples of the measured frames
+class BenchmarkRecorder {
+public:
+  void add_frame_time(f64 milliseconds) { frame_times_.push_back(milliseconds); }
+  void add_cpu_stage(std::string_view name, f64 milliseconds);
+  void add_gpu_pass(std::string_view name, f64 milliseconds);
+
+  [[nodiscard]] auto frame_count() const -> u32 { return narrow<u32>(frame_times_.size()); }
+
+  // Fills in the timings. The caller fills in the rest
+  [[nodiscard]] auto report() const -> BenchmarkReport;
+
+private:
+  struct Samples {
+    std::string name;
+    std::vector<f64> milliseconds;
+  };
+
+  std::vector<f64> frame_times_;
+  std::vector<Samples> cpu_stages_; // In the order they first appeared
+  std::vector<Samples> gpu_passes_;
+};
+
+[[nodiscard]] auto format_benchmark_report_json(const BenchmarkReport& report) -> std::string;
+// One row per timing, and one per memory usage with the MiB in every column. The run information
+// is in comment lines starting with '#'
+[[nodiscard]] auto format_benchmark_report_csv(const BenchmarkReport& report) -> std::string;
+// Only reads back the timings and the memory usage
+[[nodiscard]] auto parse_benchmark_report_csv(std::string_view text)
+    -> beyond::optional<BenchmarkReport>;
+
+// Writes JSON for a path ending in ".json", and CSV otherwise
+[[nodiscard]] auto save_benchmark_report(const BenchmarkReport& report,
+                                         const std::filesystem::path& path) -> bool;
+// Baselines are CSV reports
+[[nodiscard]] auto load_benchmark_report(const std::filesystem::path& path)
+    -> beyond::optional<BenchmarkReport>;
+
+struct BenchmarkThresholds {
+  f64 max_regression = 0.1;     // Relative to the baseline
+  f64 min_regression_ms = 0.05; // Smaller differences are noise
+};
+
+// Describes each timing that got slower than the thresholds allow: the p50, p95 and p99 frame
+// times, the scene load time, and the mean time of each CPU stage and GPU pass. Timings that only
+// one of the reports has are skipped. The memory usage is informational and never compared
+[[nodiscard]] auto find_benchmark_regressions(const BenchmarkReport& report,
+                                              const BenchmarkReport& baseline,
+                                              const BenchmarkThresholds& thresholds)
+    -> std::vector<std::string>;
+
+} // namespace charlie
+
+#endif // CHARLIE3D_BENCHMARK_REPORT_HPP
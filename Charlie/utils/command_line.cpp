@@ -0,0 +1,27 @@
+#include "command_line.hpp"
+
+#include <charconv>
+#include <sstream>
+#include <string>
+
+namespace charlie {
+
+auto parse_u32(std::string_view str) -> beyond::optional<u32>
+{
+  u32 value = 0;
+  const auto [ptr, error] = std::from_chars(str.data(), str.data() + str.size(), value);
+  if (error != std::errc{} || ptr != str.data() + str.size()) { return beyond::nullopt; }
+  return value;
+}
+
+auto parse_f64(std::string_view str) -> beyond::optional<f64>
+{
+  // Not std::from_chars, which some standard libraries don't implement for floating point
+  std::istringstream stream{std::string{str}};
+  f64 value = 0;
+  stream >> value;
+  if (stream.fail() || !stream.eof()) { return beyond::nullopt; }
+  return value;
+}
+
+} // namespace charlie
@@ -0,0 +1,20 @@
+#ifndef CHARLIE3D_COMMAND_LINE_HPP
+#define CHARLIE3D_COMMAND_LINE_HPP
+
+// Parsing of command line argument values
+
+#include "prelude.hpp"
+
+#include <beyond/types/optional.hpp>
+
+#include <string_view>
+
+namespace charlie {
+
+// Returns nullopt unless the whole string is a number
+[[nodiscard]] auto parse_u32(std::string_view str) -> beyond::optional<u32>;
+[[nodiscard]] auto parse_f64(std::string_view str) -> beyond::optional<f64>;
+
+} // namespace charlie
+
+#endif // CHARLIE3D_COMMAND_LINE_HPP
@@ -0,0 +1,31 @@
+#include "cpu_timer.hpp"
+#include "smoothed_timing.hpp"
+
+#include <algorithm>
+
+namespace charlie {
+
+void CPUTimer::add_stage(std::string_view name, Clock::duration duration)
+{
+  const auto stage = std::ranges::find(current_frame_stages_, name,
+                                       &std::pair<std::string_view, Clock::duration>::first);
+  if (stage != current_frame_stages_.end()) {
+    stage->second += duration;
+  } else {
+    current_frame_stages_.emplace_back(name, duration);
+  }
+}
+
+void CPUTimer::end_frame()
+{
+  timings_.resize(current_frame_stages_.size());
+  for (usize i = 0; i < current_frame_stages_.size(); ++i) {
+    const auto& [name, duration] = current_frame_stages_[i];
+    const f32 milliseconds = std::chrono::duration<f32, std::milli>(duration).count();
+    update_smoothed_timing(timings_[i], name, milliseconds);
+  }
+
+  current_frame_stages_.clear();
+}
+
+} // namespace charlie
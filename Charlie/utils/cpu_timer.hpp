@@ -0,0 +1,65 @@
+#ifndef CHARLIE3D_CPU_TIMER_HPP
+#define CHARLIE3D_CPU_TIMER_HPP
+
+// Measures the CPU time of the stages of a frame.
+//
+// Unlike the Tracy zones that the stages usually sit next to, the timings are available in the
+// application, e.g. for the Stats window and for benchmark reports. A stage that runs several times
+// in a frame adds up.
+
+#include "prelude.hpp"
+
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace charlie {
+
+struct CPUStageTiming {
+  std::string name;
+  f32 milliseconds = 0;       // Smoothed over a few frames
+  f32 frame_milliseconds = 0; // Of the last frame only
+};
+
+class CPUTimer {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  // Ends the stage when going out of scope
+  class Scope {
+    CPUTimer* timer_ = nullptr;
+    std::string_view name_;
+    Clock::time_point start_;
+
+  public:
+    Scope(CPUTimer& timer, std::string_view name)
+        : timer_{&timer}, name_{name}, start_{Clock::now()}
+    {
+    }
+    ~Scope() { timer_->add_stage(name_, Clock::now() - start_); }
+
+    Scope(const Scope&) = delete;
+    auto operator=(const Scope&) & -> Scope& = delete;
+    Scope(Scope&&) noexcept = delete;
+    auto operator=(Scope&&) & noexcept -> Scope& = delete;
+  };
+
+  // The name must outlive the frame, e.g. a string literal
+  [[nodiscard]] auto scope(std::string_view name) -> Scope { return Scope{*this, name}; }
+  void add_stage(std::string_view name, Clock::duration duration);
+
+  // Publishes the stages recorded since the previous call
+  void end_frame();
+
+  [[nodiscard]] auto timings() const -> const std::vector<CPUStageTiming>& { return timings_; }
+
+private:
+  std::vector<std::pair<std::string_view, Clock::duration>> current_frame_stages_;
+  std::vector<CPUStageTiming> timings_;
+};
+
+} // namespace charlie
+
+#endif // CHARLIE3D_CPU_TIMER_HPP
@@ -0,0 +1,34 @@
+#ifndef CHARLIE3D_SMOOTHED_TIMING_HPP
+#define CHARLIE3D_SMOOTHED_TIMING_HPP
+
+// Exponential smoothing of the per-frame timings of the CPU and GPU timers
+
+#include "prelude.hpp"
+
+#include <string>
+#include <string_view>
+
+namespace charlie {
+
+// Weight of the newest frame in the smoothed timings
+inline constexpr f32 timing_smoothing_factor = 0.1f;
+
+// Adds the newest frame to a timing with the `name`, `milliseconds` and `frame_milliseconds`
+// members. The list of timings changes when the render path changes, so a timing whose name
+// differs starts over from its default state. Returns whether it started over
+template <typename Timing>
+auto update_smoothed_timing(Timing& timing, std::string_view name, f32 milliseconds) -> bool
+{
+  const bool started_over = timing.name != name;
+  if (started_over) {
+    timing = Timing{.name = std::string{name}, .milliseconds = milliseconds};
+  } else {
+    timing.milliseconds += (milliseconds - timing.milliseconds) * timing_smoothing_factor;
+  }
+  timing.frame_milliseconds = milliseconds;
+  return started_over;
+}
+
+} // namespace charlie
+
+#endif // CHARLIE3D_SMOOTHED_TIMING_HPP
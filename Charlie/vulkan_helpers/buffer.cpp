@@ -20,6 +20,9 @@ auto create_buffer(vkh::Context& context,
   VKH_TRY(vmaCreateBuffer(context.allocator(), &vk_buffer_create_info, &vma_alloc_info,
                           &allocated_buffer.buffer, &allocated_buffer.allocation,
                           &allocated_buffer.allocation_info));
+  allocated_buffer.category = buffer_create_info.category;
+  context.memory_usage_tracker().add(allocated_buffer.category,
+                                     allocated_buffer.allocation_info.size);
 
   if (not buffer_create_info.debug_name.empty() &&
       set_debug_name(context, allocated_buffer.buffer, buffer_create_info.debug_name)) {
@@ -43,6 +46,9 @@ auto create_buffer_from_data(vkh::Context& context, const BufferCreateInfo& buff
 
 void destroy_buffer(vkh::Context& context, AllocatedBuffer buffer)
 {
+  if (buffer.allocation != VK_NULL_HANDLE) {
+    context.memory_usage_tracker().remove(buffer.category, buffer.allocation_info.size);
+  }
   vmaDestroyBuffer(context.allocator(), buffer.buffer, buffer.allocation);
 }
 
@@ -6,6 +6,7 @@
 #include "beyond/utils/assert.hpp"
 
 #include "error_handling.hpp"
+#include "memory_usage.hpp"
 
 #include <span>
 
@@ -18,12 +19,14 @@ struct BufferCreateInfo {
   VkBufferUsageFlags usage = 0;
   VmaMemoryUsage memory_usage = VMA_MEMORY_USAGE_UNKNOWN;
   beyond::ZStringView debug_name;
+  MemoryCategory category = MemoryCategory::other;
 };
 
 struct [[nodiscard]] AllocatedBuffer {
   VkBuffer buffer = VK_NULL_HANDLE;
   VmaAllocation allocation = VK_NULL_HANDLE;
   VmaAllocationInfo allocation_info = {};
+  MemoryCategory category = MemoryCategory::other;
 
   explicit(false) operator VkBuffer() const
   {
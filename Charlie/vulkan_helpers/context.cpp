@@ -11,6 +11,9 @@
 
 #include <SDL_vulkan.h>
 
+#include <algorithm>
+#include <vector>
+
 #include <tracy/Tracy.hpp>
 
 #include <vulkan/vk_enum_string_helper.h>
@@ -41,20 +44,43 @@ namespace {
   return 0;
 }
 
+// Host image copies can only write into the layouts listed by the implementation. We upload
+// straight into SHADER_READ_ONLY_OPTIMAL, so the extension is only useful if it is one of them.
+[[nodiscard]] auto can_host_copy_to_shader_read_only(VkPhysicalDevice physical_device) -> bool
+{
+  VkPhysicalDeviceHostImageCopyPropertiesEXT host_image_copy_properties{
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_PROPERTIES_EXT,
+  };
+  VkPhysicalDeviceProperties2 properties{
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+      .pNext = &host_image_copy_properties,
+  };
+  vkGetPhysicalDeviceProperties2(physical_device, &properties);
+
+  std::vector<VkImageLayout> copy_dst_layouts(host_image_copy_properties.copyDstLayoutCount);
+  host_image_copy_properties.pCopyDstLayouts = copy_dst_layouts.data();
+  vkGetPhysicalDeviceProperties2(physical_device, &properties);
+
+  return std::ranges::find(copy_dst_layouts, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) !=
+         copy_dst_layouts.end();
+}
+
 } // namespace
 
 namespace vkh {
 
-Context::Context(charlie::Window& window)
+Context::Context(charlie::Window* window)
 {
   ZoneScoped;
 
   VK_CHECK(volkInitialize());
 
-  auto instance_ret = []() {
+  const bool headless = window == nullptr;
+  auto instance_ret = [&]() {
     ZoneScopedN("vkCreateInstance");
     return vkb::InstanceBuilder{}
         .require_api_version(1, 3, 0)
+        .set_headless(headless)
         .set_debug_callback(debug_callback)
         .enable_extension(VK_EXT_DEBUG_UTILS_EXTENSION_NAME)
         .build();
@@ -66,34 +92,40 @@ Context::Context(charlie::Window& window)
 
   volkLoadInstance(instance_);
 
-  {
+  if (!headless) {
     ZoneScopedN("SDL_Vulkan_CreateSurface");
-    if (SDL_FALSE == SDL_Vulkan_CreateSurface(window.raw_window(), instance_, &surface_)) {
+    if (SDL_FALSE == SDL_Vulkan_CreateSurface(window->raw_window(), instance_, &surface_)) {
       beyond::panic(SDL_GetError());
     }
   }
 
   vkb::PhysicalDeviceSelector phys_device_selector(instance_ret.value());
+  if (!headless) { phys_device_selector.set_surface(surface_); }
 
   auto phys_device_ret = [&]() {
     ZoneScopedN("Select physical device");
     const char* required_extensions[] = {VK_KHR_SHADER_NON_SEMANTIC_INFO_EXTENSION_NAME,
                                          VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME};
-    return phys_device_selector.set_surface(surface_)
-        .allow_any_gpu_device_type(false)
+    return phys_device_selector
+        .allow_any_gpu_device_type(headless)
         .prefer_gpu_device_type(vkb::PreferredDeviceType::discrete)
         .add_required_extensions(beyond::size(required_extensions), required_extensions)
         .set_required_features({
             .multiDrawIndirect = true,
             .fillModeNonSolid = true,
+            .shaderStorageImageReadWithoutFormat = true,
+            .shaderStorageImageWriteWithoutFormat = true,
         })
         .set_required_features_11({.shaderDrawParameters = true})
         .set_required_features_12({
+            .drawIndirectCount = true,
             .descriptorIndexing = true,
             .shaderSampledImageArrayNonUniformIndexing = true,
             .descriptorBindingSampledImageUpdateAfterBind = true,
             .descriptorBindingPartiallyBound = true,
+            .descriptorBindingVariableDescriptorCount = true,
             .runtimeDescriptorArray = true,
+            .samplerFilterMinmax = true,
             .scalarBlockLayout = true,
             .bufferDeviceAddress = true,
         })
@@ -109,6 +141,45 @@ Context::Context(charlie::Window& window)
 
   SPDLOG_INFO("Physical device name: {}", vkb_physical_device.name);
 
+  {
+    // Optional: upload textures directly from host memory without a staging buffer
+    static constexpr VkPhysicalDeviceHostImageCopyFeaturesEXT host_image_copy_features{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_FEATURES_EXT,
+        .hostImageCopy = VK_TRUE,
+    };
+    // Only enable the extension if the upload path can use it
+    host_image_copy_supported_ =
+        vkb_physical_device.is_extension_present(VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME) &&
+        vkb_physical_device.are_extension_features_present(host_image_copy_features) &&
+        can_host_copy_to_shader_read_only(physical_device_);
+    if (host_image_copy_supported_) {
+      vkb_physical_device.enable_extension_if_present(VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME);
+      vkb_physical_device.enable_extension_features_if_present(host_image_copy_features);
+    }
+    SPDLOG_INFO("Host image copy: {}", host_image_copy_supported_ ? "enabled" : "unsupported");
+
+    // Optional: query the real memory budget of each heap (used by texture streaming)
+    memory_budget_supported_ =
+        vkb_physical_device.enable_extension_if_present(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+    // Optional: render meshlets with task and mesh shaders
+    static constexpr VkPhysicalDeviceMeshShaderFeaturesEXT mesh_shader_features{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT,
+        .taskShader = VK_TRUE,
+        .meshShader = VK_TRUE,
+    };
+    mesh_shader_supported_ =
+        vkb_physical_device.enable_extension_if_present(VK_EXT_MESH_SHADER_EXTENSION_NAME) &&
+        vkb_physical_device.enable_extension_features_if_present(mesh_shader_features);
+    SPDLOG_INFO("Mesh shader: {}", mesh_shader_supported_ ? "enabled" : "unsupported");
+
+    // Optional: count the shader invocations and primitives of each pass for profiling
+    pipeline_statistics_query_supported_ =
+        vkb_physical_device.enable_features_if_present({.pipelineStatisticsQuery = VK_TRUE});
+    SPDLOG_INFO("Pipeline statistics query: {}",
+                pipeline_statistics_query_supported_ ? "enabled" : "unsupported");
+  }
+
   const vkb::DeviceBuilder device_builder{vkb_physical_device};
   const auto device_ret = [&]() {
     ZoneScopedN("vkCreateDevice");
@@ -129,7 +200,7 @@ Context::Context(charlie::Window& window)
   //  transfer_queue_family_index_ =
   //      vkb_device.get_queue_index(vkb::QueueType::transfer).value();
 
-  present_queue_ = vkb_device.get_queue(vkb::QueueType::present).value();
+  if (!headless) { present_queue_ = vkb_device.get_queue(vkb::QueueType::present).value(); }
 
   const VmaVulkanFunctions vma_vulkan_func{
       .vkGetPhysicalDeviceProperties = vkGetPhysicalDeviceProperties,
@@ -149,10 +220,14 @@ Context::Context(charlie::Window& window)
       .vkCreateImage = vkCreateImage,
       .vkDestroyImage = vkDestroyImage,
       .vkCmdCopyBuffer = vkCmdCopyBuffer,
+      .vkGetPhysicalDeviceMemoryProperties2KHR = vkGetPhysicalDeviceMemoryProperties2,
   };
 
+  VmaAllocatorCreateFlags allocator_flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
+  if (memory_budget_supported_) { allocator_flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT; }
+
   const VmaAllocatorCreateInfo allocator_create_info{
-      .flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT,
+      .flags = allocator_flags,
       .physicalDevice = physical_device_,
       .device = device_,
       .pVulkanFunctions = &vma_vulkan_func,
@@ -163,6 +238,7 @@ Context::Context(charlie::Window& window)
     ZoneScopedN("vmaCreateAllocator");
     VK_CHECK(vmaCreateAllocator(&allocator_create_info, &allocator_));
   }
+  memory_usage_tracker_ = std::make_unique<MemoryUsageTracker>();
 } // namespace vkh
 
 Context::~Context()
@@ -172,7 +248,8 @@ Context::~Context()
   vmaDestroyAllocator(allocator_);
 
   vkDestroyDevice(device_, nullptr);
-  vkDestroySurfaceKHR(instance_, surface_, nullptr);
+  // The surface functions are not loaded for headless instances
+  if (surface_ != VK_NULL_HANDLE) { vkDestroySurfaceKHR(instance_, surface_, nullptr); }
   vkb::destroy_debug_utils_messenger(instance_, debug_messenger_, nullptr);
   vkDestroyInstance(instance_, nullptr);
 }
@@ -190,7 +267,13 @@ Context::Context(vkh::Context&& other) noexcept
       graphics_queue_family_index_{std::exchange(other.graphics_queue_family_index_, {})},
       compute_queue_family_index_{std::exchange(other.compute_queue_family_index_, {})},
       transfer_queue_family_index_{std::exchange(other.transfer_queue_family_index_, {})},
-      allocator_{std::exchange(other.allocator_, {})}
+      allocator_{std::exchange(other.allocator_, {})},
+      memory_usage_tracker_{std::move(other.memory_usage_tracker_)},
+      host_image_copy_supported_{std::exchange(other.host_image_copy_supported_, {})},
+      memory_budget_supported_{std::exchange(other.memory_budget_supported_, {})},
+      mesh_shader_supported_{std::exchange(other.mesh_shader_supported_, {})},
+      pipeline_statistics_query_supported_{
+          std::exchange(other.pipeline_statistics_query_supported_, {})}
 {
 }
 
@@ -211,6 +294,12 @@ auto Context::operator=(Context&& other) & noexcept -> Context&
     compute_queue_family_index_ = std::exchange(other.compute_queue_family_index_, {});
     transfer_queue_family_index_ = std::exchange(other.transfer_queue_family_index_, {});
     allocator_ = std::exchange(other.allocator_, {});
+    memory_usage_tracker_ = std::move(other.memory_usage_tracker_);
+    host_image_copy_supported_ = std::exchange(other.host_image_copy_supported_, {});
+    memory_budget_supported_ = std::exchange(other.memory_budget_supported_, {});
+    mesh_shader_supported_ = std::exchange(other.mesh_shader_supported_, {});
+    pipeline_statistics_query_supported_ =
+        std::exchange(other.pipeline_statistics_query_supported_, {});
   }
   return *this;
 }
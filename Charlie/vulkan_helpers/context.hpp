@@ -8,9 +8,11 @@
 #include "beyond/utils/narrowing.hpp"
 
 #include <cstdint>
+#include <memory>
 
 #include "../window/window.hpp"
 #include "error_handling.hpp"
+#include "memory_usage.hpp"
 
 namespace vkh {
 
@@ -32,10 +34,20 @@ class Context {
   uint32_t transfer_queue_family_index_ = 0;
 
   VmaAllocator allocator_{};
+  std::unique_ptr<MemoryUsageTracker> memory_usage_tracker_;
+
+  // Optional device capabilities
+  bool host_image_copy_supported_ = false;
+  bool memory_budget_supported_ = false;
+  bool mesh_shader_supported_ = false;
+  bool pipeline_statistics_query_supported_ = false;
 
 public:
   Context() = default;
-  explicit Context(charlie::Window& window);
+  explicit Context(charlie::Window& window) : Context{&window} {}
+  // Without a window, there is no surface and no present queue. CPU implementations like lavapipe
+  // are then accepted, so that it also runs on machines without a GPU or a display
+  explicit Context(charlie::Window* window);
   ~Context();
 
   Context(const Context&) = delete;
@@ -54,6 +66,11 @@ public:
 
   [[nodiscard]] BEYOND_FORCE_INLINE auto surface() noexcept -> VkSurfaceKHR { return surface_; }
 
+  [[nodiscard]] BEYOND_FORCE_INLINE auto headless() const noexcept -> bool
+  {
+    return surface_ == VK_NULL_HANDLE;
+  }
+
   [[nodiscard]] BEYOND_FORCE_INLINE auto physical_device() noexcept -> VkPhysicalDevice
   {
     return physical_device_;
@@ -98,12 +115,43 @@ public:
 
   [[nodiscard]] BEYOND_FORCE_INLINE auto allocator() noexcept -> VmaAllocator { return allocator_; }
 
+  // Updated by the buffer and image helpers of vkh
+  [[nodiscard]] BEYOND_FORCE_INLINE auto memory_usage_tracker() noexcept -> MemoryUsageTracker&
+  {
+    return *memory_usage_tracker_;
+  }
+
   [[nodiscard]] BEYOND_FORCE_INLINE auto gpu_properties() const noexcept
       -> const VkPhysicalDeviceProperties&
   {
     return gpu_properties_;
   }
 
+  // Whether VK_EXT_host_image_copy is enabled and can copy into SHADER_READ_ONLY_OPTIMAL images
+  [[nodiscard]] BEYOND_FORCE_INLINE auto supports_host_image_copy() const noexcept -> bool
+  {
+    return host_image_copy_supported_;
+  }
+
+  // Whether VK_EXT_memory_budget is enabled. If not, VMA estimates the budget from the heap sizes
+  [[nodiscard]] BEYOND_FORCE_INLINE auto supports_memory_budget() const noexcept -> bool
+  {
+    return memory_budget_supported_;
+  }
+
+  // Whether VK_EXT_mesh_shader is enabled with both task and mesh shaders
+  [[nodiscard]] BEYOND_FORCE_INLINE auto supports_mesh_shader() const noexcept -> bool
+  {
+    return mesh_shader_supported_;
+  }
+
+  // Whether pipeline statistics queries are enabled
+  [[nodiscard]] BEYOND_FORCE_INLINE auto supports_pipeline_statistics_query() const noexcept
+      -> bool
+  {
+    return pipeline_statistics_query_supported_;
+  }
+
   // Calculate required alignment based on minimum device offset alignment
   // Snippet from https://github.com/SaschaWillems/Vulkan/tree/master/examples/dynamicuniformbuffer
   [[nodiscard]] auto align_uniform_buffer_size(size_t original_size) -> size_t
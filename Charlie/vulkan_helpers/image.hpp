@@ -9,6 +9,7 @@
 #include <span>
 
 #include "error_handling.hpp"
+#include "memory_usage.hpp"
 #include "required_field.hpp"
 
 namespace vkh {
@@ -19,6 +20,7 @@ struct AllocatedImage {
   VkImage image = {};
   VmaAllocation allocation = {};
   VmaAllocationInfo allocation_info = {};
+  MemoryCategory category = MemoryCategory::other;
 
   explicit(false) operator VkImage() { return image; } // NOLINT(google-explicit-constructor)
 };
@@ -39,6 +41,7 @@ struct ImageCreateInfo {
   std::span<uint32_t> queue_fimily_indices;
   VkImageLayout initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
   beyond::ZStringView debug_name;
+  MemoryCategory category = MemoryCategory::other;
 };
 
 auto create_image(vkh::Context& context,
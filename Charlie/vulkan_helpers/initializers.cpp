@@ -133,6 +133,8 @@ auto create_image(vkh::Context& context,
   AllocatedImage image;
   VKH_TRY(vmaCreateImage(context.allocator(), &vk_image_create_info, &image_alloc_info,
                          &image.image, &image.allocation, &image.allocation_info));
+  image.category = image_create_info.category;
+  context.memory_usage_tracker().add(image.category, image.allocation_info.size);
 
   if (set_debug_name(context, image.image, image_create_info.debug_name)) {
     report_fail_to_set_debug_name(image_create_info.debug_name);
@@ -143,6 +145,9 @@ auto create_image(vkh::Context& context,
 
 void destroy_image(Context& context, AllocatedImage& image)
 {
+  if (image.allocation != VK_NULL_HANDLE) {
+    context.memory_usage_tracker().remove(image.category, image.allocation_info.size);
+  }
   vmaDestroyImage(context.allocator(), image.image, image.allocation);
 }
 
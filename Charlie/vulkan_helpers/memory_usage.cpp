@@ -0,0 +1,78 @@
+#include "memory_usage.hpp"
+#include "context.hpp"
+
+#include <beyond/utils/panic.hpp>
+
+namespace vkh {
+
+auto to_string(MemoryCategory category) -> const char*
+{
+  switch (category) {
+  case MemoryCategory::other: return "Other";
+  case MemoryCategory::texture: return "Textures";
+  case MemoryCategory::geometry: return "Geometry";
+  case MemoryCategory::transform: return "Transforms";
+  case MemoryCategory::draw: return "Draws";
+  case MemoryCategory::scene_data: return "Scene Data";
+  case MemoryCategory::shadow_map: return "Shadow Maps";
+  case MemoryCategory::render_target: return "Render Targets";
+  case MemoryCategory::staging: return "Staging";
+  }
+  beyond::panic("Unknown memory category");
+}
+
+void MemoryUsageTracker::add(MemoryCategory category, VkDeviceSize bytes)
+{
+  const auto index = static_cast<std::size_t>(category);
+  bytes_[index].fetch_add(bytes, std::memory_order_relaxed);
+  allocation_counts_[index].fetch_add(1, std::memory_order_relaxed);
+}
+
+void MemoryUsageTracker::remove(MemoryCategory category, VkDeviceSize bytes)
+{
+  const auto index = static_cast<std::size_t>(category);
+  bytes_[index].fetch_sub(bytes, std::memory_order_relaxed);
+  allocation_counts_[index].fetch_sub(1, std::memory_order_relaxed);
+}
+
+auto MemoryUsageTracker::usage(MemoryCategory category) const -> MemoryCategoryUsage
+{
+  const auto index = static_cast<std::size_t>(category);
+  return MemoryCategoryUsage{
+      .bytes = bytes_[index].load(std::memory_order_relaxed),
+      .allocation_count = allocation_counts_[index].load(std::memory_order_relaxed),
+  };
+}
+
+auto query_memory_report(Context& context) -> MemoryReport
+{
+  MemoryReport report;
+  for (std::size_t i = 0; i < memory_category_count; ++i) {
+    report.categories[i] = context.memory_usage_tracker().usage(static_cast<MemoryCategory>(i));
+  }
+
+  // Unlike vmaCalculateStatistics, this does not walk over every allocation
+  VmaBudget budgets[VK_MAX_MEMORY_HEAPS] = {};
+  vmaGetHeapBudgets(context.allocator(), budgets);
+
+  const VkPhysicalDeviceMemoryProperties* memory_properties = nullptr;
+  vmaGetMemoryProperties(context.allocator(), &memory_properties);
+  report.heaps.reserve(memory_properties->memoryHeapCount);
+  for (std::uint32_t i = 0; i < memory_properties->memoryHeapCount; ++i) {
+    const VmaBudget& budget = budgets[i];
+    report.heaps.push_back(MemoryHeapUsage{
+        .device_local =
+            (memory_properties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0,
+        .usage = budget.usage,
+        .budget = budget.budget,
+        .statistics = budget.statistics,
+    });
+    report.total.blockCount += budget.statistics.blockCount;
+    report.total.allocationCount += budget.statistics.allocationCount;
+    report.total.blockBytes += budget.statistics.blockBytes;
+    report.total.allocationBytes += budget.statistics.allocationBytes;
+  }
+  return report;
+}
+
+} // namespace vkh
@@ -0,0 +1,68 @@
+#ifndef CHARLIE3D_VULKAN_HELPER_MEMORY_USAGE_HPP
+#define CHARLIE3D_VULKAN_HELPER_MEMORY_USAGE_HPP
+
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan_core.h>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace vkh {
+
+class Context;
+
+// What an allocation is used for. Every buffer and image allocation is tagged with one
+enum class MemoryCategory : std::uint8_t {
+  other,
+  texture,       // Scene textures, including the streaming feedback
+  geometry,      // Vertices, indices, meshlets and clusters
+  transform,     // Per-object transforms
+  draw,          // Draw commands and the culling state of draws
+  scene_data,    // Materials, lights, cameras and other parameters
+  shadow_map,    // Shadow maps and their draws
+  render_target, // Screen sized images, including the transient images of the frame graph
+  staging,       // Uploads and read backs
+};
+inline constexpr std::size_t memory_category_count = 9;
+
+[[nodiscard]] auto to_string(MemoryCategory category) -> const char*;
+
+struct MemoryCategoryUsage {
+  VkDeviceSize bytes = 0;
+  std::uint32_t allocation_count = 0;
+};
+
+// Per-category totals of the live allocations. Thread-safe
+class MemoryUsageTracker {
+  std::array<std::atomic<VkDeviceSize>, memory_category_count> bytes_{};
+  std::array<std::atomic<std::uint32_t>, memory_category_count> allocation_counts_{};
+
+public:
+  void add(MemoryCategory category, VkDeviceSize bytes);
+  void remove(MemoryCategory category, VkDeviceSize bytes);
+
+  [[nodiscard]] auto usage(MemoryCategory category) const -> MemoryCategoryUsage;
+};
+
+struct MemoryHeapUsage {
+  bool device_local = false;
+  VkDeviceSize usage = 0;  // Of the whole process, as reported by VK_EXT_memory_budget
+  VkDeviceSize budget = 0; // Estimated from the heap size without VK_EXT_memory_budget
+  VmaStatistics statistics = {}; // Of the VMA allocations in this heap
+};
+
+struct MemoryReport {
+  std::array<MemoryCategoryUsage, memory_category_count> categories = {};
+  VmaStatistics total = {}; // Of all VMA allocations
+  std::vector<MemoryHeapUsage> heaps;
+};
+
+// Cheap enough to call every frame
+[[nodiscard]] auto query_memory_report(Context& context) -> MemoryReport;
+
+} // namespace vkh
+
+#endif // CHARLIE3D_VULKAN_HELPER_MEMORY_USAGE_HPP
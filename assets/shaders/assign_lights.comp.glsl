@@ -0,0 +1,84 @@
+#version 460
+
+#include "prelude.h.glsl"
+#include "camera_data.h.glsl"
+#include "scene_data.h.glsl"
+#include "light_data.h.glsl"
+
+#define LIGHT_BATCH_SIZE 64
+
+// View space bounding spheres of the current batch of lights
+shared vec4 light_spheres[LIGHT_BATCH_SIZE];
+
+// View space bounding box of a cluster. Tiles start at the top of the screen, where NDC y is 1
+void light_cluster_bounds(uvec3 cell, out vec3 aabb_min, out vec3 aabb_max) {
+    vec2 grid_size = vec2(LIGHT_GRID_WIDTH, LIGHT_GRID_HEIGHT);
+    vec2 ndc_min = vec2(cell.x, grid_size.y - float(cell.y + 1)) / grid_size * 2.0 - 1.0;
+    vec2 ndc_max = vec2(cell.x + 1, grid_size.y - float(cell.y)) / grid_size * 2.0 - 1.0;
+
+    float near = light_grid_slice_depth(cell.z, scene_data.light_grid_slice_scale,
+                                        scene_data.light_grid_slice_bias);
+    float far = light_grid_slice_depth(cell.z + 1, scene_data.light_grid_slice_scale,
+                                       scene_data.light_grid_slice_bias);
+    // The first slice reaches the camera and the last one reaches infinity, since shading clamps
+    // the slices
+    if (cell.z == 0) { near = 0.0; }
+    if (cell.z == LIGHT_GRID_DEPTH - 1) { far = 1e30; }
+
+    // A view space point at depth d projects to ndc = xy * proj_scale / d
+    vec2 inverse_proj_scale = vec2(1.0 / camera.proj[0][0], 1.0 / camera.proj[1][1]);
+    vec2 near_min = ndc_min * near * inverse_proj_scale;
+    vec2 near_max = ndc_max * near * inverse_proj_scale;
+    vec2 far_min = ndc_min * far * inverse_proj_scale;
+    vec2 far_max = ndc_max * far * inverse_proj_scale;
+
+    aabb_min = vec3(min(near_min, far_min), -far);
+    aabb_max = vec3(max(near_max, far_max), -near);
+}
+
+bool is_sphere_in_aabb(vec4 sphere, vec3 aabb_min, vec3 aabb_max) {
+    vec3 closest_point = clamp(sphere.xyz, aabb_min, aabb_max);
+    vec3 offset = sphere.xyz - closest_point;
+    return dot(offset, offset) <= sphere.w * sphere.w;
+}
+
+// One invocation per cluster. Lights are tested as bounding spheres, and the workgroup brings them
+// into view space in batches
+layout (local_size_x = LIGHT_BATCH_SIZE, local_size_y = 1, local_size_z = 1) in;
+void main() {
+    uint cluster_index = gl_GlobalInvocationID.x;
+    bool is_valid = cluster_index < LIGHT_CLUSTER_COUNT;
+
+    uvec3 cell = uvec3(cluster_index % LIGHT_GRID_WIDTH,
+                       (cluster_index / LIGHT_GRID_WIDTH) % LIGHT_GRID_HEIGHT,
+                       cluster_index / (LIGHT_GRID_WIDTH * LIGHT_GRID_HEIGHT));
+    vec3 aabb_min;
+    vec3 aabb_max;
+    light_cluster_bounds(cell, aabb_min, aabb_max);
+
+    uint light_count = 0;
+    for (uint batch_start = 0; batch_start < scene_data.light_count;
+         batch_start += LIGHT_BATCH_SIZE) {
+        uint light_index = batch_start + gl_LocalInvocationIndex;
+        if (light_index < scene_data.light_count) {
+            PunctualLight light = scene_data.light_buffer.lights[light_index];
+            vec3 view_position = (camera.view * vec4(light.position, 1.0)).xyz;
+            light_spheres[gl_LocalInvocationIndex] = vec4(view_position, light.range);
+        }
+        barrier();
+
+        uint batch_size = min(LIGHT_BATCH_SIZE, scene_data.light_count - batch_start);
+        for (uint i = 0; is_valid && i < batch_size && light_count < MAX_LIGHTS_PER_CLUSTER; ++i) {
+            if (is_sphere_in_aabb(light_spheres[i], aabb_min, aabb_max)) {
+                scene_data.light_cluster_buffer.clusters[cluster_index].light_indices[light_count] =
+                    batch_start + i;
+                ++light_count;
+            }
+        }
+        barrier();
+    }
+
+    if (is_valid) {
+        scene_data.light_cluster_buffer.clusters[cluster_index].light_count = light_count;
+    }
+}
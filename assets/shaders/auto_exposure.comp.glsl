@@ -0,0 +1,58 @@
+#version 460
+
+#include "prelude.h.glsl"
+#include "exposure.h.glsl"
+
+// Averages the luminance histogram into the log average luminance of the frame, moves the adapted
+// luminance towards it and derives the exposure that the tone mapping applies
+
+layout (push_constant) uniform constants {
+    LuminanceHistogramBuffer histogram_buffer;
+    ExposureBuffer exposure_buffer;
+    float min_log_luminance;
+    float log_luminance_range;
+    float pixel_count;
+    float adaptation_rate; // Fraction of the way to the frame luminance covered this frame
+    float exposure_compensation; // In stops
+    uint auto_exposure_enabled;
+};
+
+// The average luminance gets mapped to middle gray
+const float middle_gray = 0.18;
+
+shared float weighted_counts[LUMINANCE_HISTOGRAM_BIN_COUNT];
+
+layout (local_size_x = LUMINANCE_HISTOGRAM_BIN_COUNT, local_size_y = 1, local_size_z = 1) in;
+void main() {
+    uint bin = gl_LocalInvocationIndex;
+    uint count = histogram_buffer.bins[bin];
+    weighted_counts[bin] = float(count) * float(bin);
+    barrier();
+
+    for (uint stride = LUMINANCE_HISTOGRAM_BIN_COUNT / 2; stride > 0; stride >>= 1) {
+        if (bin < stride) {
+            weighted_counts[bin] += weighted_counts[bin + stride];
+        }
+        barrier();
+    }
+
+    if (bin != 0) {
+        return;
+    }
+
+    // The dark pixels of bin 0 do not take part in the average
+    float measured_pixel_count = max(pixel_count - float(count), 1.0);
+    float average_bin = weighted_counts[0] / measured_pixel_count - 1.0;
+    float average_log_luminance =
+        average_bin / float(LUMINANCE_HISTOGRAM_BIN_COUNT - 2) * log_luminance_range +
+        min_log_luminance;
+    float frame_luminance = exp2(average_log_luminance);
+
+    float previous_luminance = exposure_buffer.average_luminance;
+    float average_luminance =
+        previous_luminance + (frame_luminance - previous_luminance) * adaptation_rate;
+    exposure_buffer.average_luminance = average_luminance;
+
+    float exposure = auto_exposure_enabled != 0 ? middle_gray / max(average_luminance, 1e-4) : 1.0;
+    exposure_buffer.exposure = exposure * exp2(exposure_compensation);
+}
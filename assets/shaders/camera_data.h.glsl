@@ -0,0 +1,12 @@
+#ifndef CHARLIE3D_CAMERA_DATA_GLSL
+#define CHARLIE3D_CAMERA_DATA_GLSL
+
+layout (set = 0, binding = 0) uniform CameraBuffer {
+    mat4 view;
+    mat4 proj;
+    mat4 view_proj;
+    mat4 inverse_view_proj;
+    vec3 position;
+} camera;
+
+#endif // CHARLIE3D_CAMERA_DATA_GLSL
@@ -0,0 +1,155 @@
+#version 460
+
+#include "prelude.h.glsl"
+#include "camera_data.h.glsl"
+#include "object_data.h.glsl"
+#include "draw_data.h.glsl"
+#include "vertex_data.h.glsl"
+#include "meshlet_culling.h.glsl"
+
+// A cluster is a meshlet of a solid draw
+struct Cluster {
+    uint draw_index;
+    uint meshlet_index;
+};
+
+layout (buffer_reference, scalar) readonly restrict buffer ClusterBuffer {
+    Cluster clusters[];
+};
+
+// Same layout as the DrawIndirectBuffer of generate_draws, but the index counts are accumulated
+layout (buffer_reference, scalar) restrict buffer ClusterCommandBuffer {
+    IndirectCommand commands[];
+};
+
+layout (buffer_reference, scalar) readonly restrict buffer DrawSlotBuffer {
+    uint slots[];
+};
+const uint DRAW_NOT_EMITTED = 0xFFFFFFFF;
+
+layout (buffer_reference, scalar) writeonly restrict buffer ClusterIndexBuffer {
+    uint indices[];
+};
+
+layout (set = 2, binding = 0) uniform sampler2D depth_pyramid;
+
+layout (push_constant) uniform constants
+{
+    DrawsBuffer draws_buffer;
+    ClusterBuffer cluster_buffer;
+    ClusterCommandBuffer command_buffer; // The indirect commands written by generate_draws
+    DrawSlotBuffer draw_slot_buffer;
+    ClusterIndexBuffer cluster_index_buffer;
+    MeshletBuffer meshlet_buffer;
+    MeshletVertexBuffer meshlet_vertex_buffer;
+    MeshletTriangleBuffer meshlet_triangle_buffer;
+    PositionBuffer position_buffer;
+    uint cluster_count;
+    uint occlusion_culling_enabled; // Only in the late phase
+    vec2 depth_pyramid_size;
+    uint triangle_culling_enabled;
+};
+
+#define CLUSTER_GROUP_SIZE 64
+#define TRIANGLES_PER_INVOCATION 2 // Covers MAX_MESHLET_TRIANGLES
+const uint TRIANGLE_CULLED = 0xFFFFFFFF;
+
+// Back-facing and zero-area triangles are culled. Triangles crossing the near plane are kept, since
+// their projected winding is meaningless
+bool is_triangle_visible(vec4 p0, vec4 p1, vec4 p2) {
+    if (p0.w <= 0.0 || p1.w <= 0.0 || p2.w <= 0.0) {
+        return true;
+    }
+    vec2 a = p0.xy / p0.w;
+    vec2 b = p1.xy / p1.w;
+    vec2 c = p2.xy / p2.w;
+    // Front faces are counter-clockwise
+    vec2 ab = b - a;
+    vec2 ac = c - a;
+    return ab.x * ac.y - ab.y * ac.x > 0.0;
+}
+
+shared bool cluster_visible;
+shared uint visible_triangle_count;
+shared uint output_base;
+
+// One workgroup per cluster. Appends the indices of the visible triangles of the cluster to the
+// draw command that generate_draws emitted for its draw in the current phase
+layout (local_size_x = CLUSTER_GROUP_SIZE, local_size_y = 1, local_size_z = 1) in;
+void main() {
+    // The dispatch is two dimensional to get around the workgroup count limit
+    uint cluster_index = gl_WorkGroupID.x + gl_WorkGroupID.y * gl_NumWorkGroups.x;
+    if (cluster_index >= cluster_count) {
+        return;
+    }
+
+    Cluster cluster = cluster_buffer.clusters[cluster_index];
+    uint slot = draw_slot_buffer.slots[cluster.draw_index];
+    if (slot == DRAW_NOT_EMITTED) {
+        return;
+    }
+
+    Draw draw = draws_buffer.draws[cluster.draw_index];
+    Meshlet meshlet = meshlet_buffer.meshlets[cluster.meshlet_index];
+    mat4 model = object_buffer.objects[draw.node_index].model;
+
+    if (gl_LocalInvocationIndex == 0) {
+        cluster_visible = is_meshlet_visible(meshlet, model, occlusion_culling_enabled != 0,
+                                             depth_pyramid, depth_pyramid_size);
+        visible_triangle_count = 0;
+    }
+    barrier();
+    if (!cluster_visible) {
+        return;
+    }
+
+    mat4 transform_matrix = camera.view_proj * model;
+
+    uvec3 triangles[TRIANGLES_PER_INVOCATION];
+    uint local_offsets[TRIANGLES_PER_INVOCATION];
+    for (uint i = 0; i < TRIANGLES_PER_INVOCATION; ++i) {
+        uint triangle_index = gl_LocalInvocationIndex + i * CLUSTER_GROUP_SIZE;
+        local_offsets[i] = TRIANGLE_CULLED;
+        if (triangle_index >= meshlet.triangle_count) {
+            continue;
+        }
+
+        uvec3 local_indices = unpack_meshlet_triangle(
+            meshlet_triangle_buffer.triangles[meshlet.triangle_offset + triangle_index]);
+        uvec3 triangle = uvec3(
+            meshlet_vertex_buffer.vertices[meshlet.vertex_offset + local_indices.x],
+            meshlet_vertex_buffer.vertices[meshlet.vertex_offset + local_indices.y],
+            meshlet_vertex_buffer.vertices[meshlet.vertex_offset + local_indices.z]);
+
+        if (triangle_culling_enabled != 0) {
+            vec4 p0 = transform_matrix * vec4(position_buffer.position[triangle.x], 1.0);
+            vec4 p1 = transform_matrix * vec4(position_buffer.position[triangle.y], 1.0);
+            vec4 p2 = transform_matrix * vec4(position_buffer.position[triangle.z], 1.0);
+            if (!is_triangle_visible(p0, p1, p2)) {
+                continue;
+            }
+        }
+
+        triangles[i] = triangle;
+        local_offsets[i] = atomicAdd(visible_triangle_count, 1);
+    }
+    barrier();
+
+    if (gl_LocalInvocationIndex == 0) {
+        // Clusters of a draw run in any order, so they reserve their ranges from the index count
+        output_base = visible_triangle_count == 0
+            ? 0
+            : atomicAdd(command_buffer.commands[slot].index_count, visible_triangle_count * 3);
+    }
+    barrier();
+
+    for (uint i = 0; i < TRIANGLES_PER_INVOCATION; ++i) {
+        if (local_offsets[i] == TRIANGLE_CULLED) {
+            continue;
+        }
+        uint output_index = draw.cluster_index_offset + output_base + local_offsets[i] * 3;
+        cluster_index_buffer.indices[output_index] = triangles[i].x;
+        cluster_index_buffer.indices[output_index + 1] = triangles[i].y;
+        cluster_index_buffer.indices[output_index + 2] = triangles[i].z;
+    }
+}
@@ -0,0 +1,112 @@
+#ifndef CHARLIE3D_CULLING_GLSL
+#define CHARLIE3D_CULLING_GLSL
+
+// Planes of a frustum, with normals pointing inward. The normals are not normalized
+struct Frustum {
+    vec4 planes[6];
+};
+
+// Extract the frustum planes from a view projection matrix (Gribb & Hartmann).
+// Assumes the Vulkan clip space (z in [0, w])
+Frustum extract_frustum(mat4 m) {
+    vec4 row0 = vec4(m[0][0], m[1][0], m[2][0], m[3][0]);
+    vec4 row1 = vec4(m[0][1], m[1][1], m[2][1], m[3][1]);
+    vec4 row2 = vec4(m[0][2], m[1][2], m[2][2], m[3][2]);
+    vec4 row3 = vec4(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+    Frustum frustum;
+    frustum.planes[0] = row3 + row0; // left
+    frustum.planes[1] = row3 - row0; // right
+    frustum.planes[2] = row3 + row1; // bottom
+    frustum.planes[3] = row3 - row1; // top
+    frustum.planes[4] = row2; // z = 0
+    frustum.planes[5] = row3 - row2; // z = w
+    return frustum;
+}
+
+// Transform a local space AABB by an affine matrix, and returns the center and extents of the
+// resulting AABB (Arvo's method)
+void transform_aabb(mat4 model, vec3 aabb_min, vec3 aabb_max, out vec3 center, out vec3 extents) {
+    vec3 local_center = (aabb_min + aabb_max) * 0.5;
+    vec3 local_extents = (aabb_max - aabb_min) * 0.5;
+
+    mat3 abs_model = mat3(abs(model[0].xyz), abs(model[1].xyz), abs(model[2].xyz));
+    center = (model * vec4(local_center, 1.0)).xyz;
+    extents = abs_model * local_extents;
+}
+
+// Conservative test. May return true for boxes near the corners of the frustum
+bool is_aabb_in_frustum(Frustum frustum, vec3 center, vec3 extents) {
+    for (int i = 0; i < 6; ++i) {
+        vec4 plane = frustum.planes[i];
+        float radius = dot(abs(plane.xyz), extents);
+        if (dot(plane.xyz, center) + plane.w < -radius) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool is_sphere_in_frustum(Frustum frustum, vec3 center, float radius) {
+    for (int i = 0; i < 6; ++i) {
+        vec4 plane = frustum.planes[i];
+        if (dot(plane.xyz, center) + plane.w < -radius * length(plane.xyz)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Test whether a shadow caster can cast shadows into a frustum, by sweeping its AABB infinitely
+// along the direction the light travels. Conservative
+bool can_aabb_cast_shadow_into_frustum(Frustum frustum, vec3 center, vec3 extents,
+                                       vec3 light_direction) {
+    for (int i = 0; i < 6; ++i) {
+        vec4 plane = frustum.planes[i];
+        float radius = dot(abs(plane.xyz), extents);
+        // Outside of the plane, and the sweep only moves further away from it
+        if (dot(plane.xyz, center) + plane.w < -radius && dot(plane.xyz, light_direction) <= 0.0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Test a world space AABB against a hierarchical depth pyramid that stores the farthest reverse-Z
+// depth of each region. Returns false if the box is definitely occluded
+bool is_aabb_visible_in_depth_pyramid(mat4 view_proj, vec3 center, vec3 extents,
+                                      sampler2D depth_pyramid, vec2 depth_pyramid_size) {
+    vec2 uv_min = vec2(1.0);
+    vec2 uv_max = vec2(0.0);
+    float closest_depth = 0.0;
+    for (int i = 0; i < 8; ++i) {
+        vec3 corner_sign = vec3((i & 1) != 0 ? 1.0 : -1.0,
+                                (i & 2) != 0 ? 1.0 : -1.0,
+                                (i & 4) != 0 ? 1.0 : -1.0);
+        vec4 clip = view_proj * vec4(center + extents * corner_sign, 1.0);
+
+        // The box crosses the near plane, so we can't get a meaningful screen rectangle
+        if (clip.w <= 1e-5 || clip.z > clip.w) {
+            return true;
+        }
+
+        vec3 ndc = clip.xyz / clip.w;
+        // The viewport is flipped, so NDC y = 1 is at the top of the screen
+        vec2 uv = vec2(ndc.x * 0.5 + 0.5, 0.5 - ndc.y * 0.5);
+        uv_min = min(uv_min, uv);
+        uv_max = max(uv_max, uv);
+        closest_depth = max(closest_depth, ndc.z);
+    }
+    uv_min = clamp(uv_min, vec2(0.0), vec2(1.0));
+    uv_max = clamp(uv_max, vec2(0.0), vec2(1.0));
+
+    // Pick the level where the rectangle covers at most 2x2 texels, which the min reduction sampler
+    // fetches all at once
+    vec2 size = (uv_max - uv_min) * depth_pyramid_size;
+    float level = ceil(log2(max(max(size.x, size.y), 1.0)));
+    float occluder_depth = textureLod(depth_pyramid, (uv_min + uv_max) * 0.5, level).x;
+
+    return closest_depth >= occluder_depth;
+}
+
+#endif // CHARLIE3D_CULLING_GLSL
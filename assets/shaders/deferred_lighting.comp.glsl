@@ -0,0 +1,58 @@
+#version 460
+
+#include "prelude.h.glsl"
+#include "camera_data.h.glsl"
+#include "octahedron_encoding.h.glsl"
+#include "shading.h.glsl"
+
+// Shades every pixel covered by a solid draw exactly once from the G-buffer. Positions are
+// reconstructed from the depth image, and the light grid limits the punctual lights of each pixel
+// to the ones of its cluster. The G-buffer pass already wrote the emission into the output
+
+layout (set = 1, binding = 0) uniform sampler2D depth_image;
+layout (set = 1, binding = 1) uniform sampler2D gbuffer_base_color;
+layout (set = 1, binding = 2) uniform sampler2D gbuffer_normal;
+layout (set = 1, binding = 3) uniform sampler2D gbuffer_material;
+// Without a format qualifier, since the format of the HDR image is configurable
+layout (set = 1, binding = 4) uniform restrict image2D out_color;
+
+layout (local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+void main() {
+    ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 screen_size = imageSize(out_color);
+    if (any(greaterThanEqual(pixel, screen_size))) {
+        return;
+    }
+
+    // Nothing got rendered at this pixel (reverse-Z clears to 0), so it keeps the clear color
+    float depth = texelFetch(depth_image, pixel, 0).r;
+    if (depth == 0.0) {
+        return;
+    }
+
+    // The main viewport is flipped vertically
+    vec2 pixel_center = vec2(pixel) + vec2(0.5);
+    vec2 uv = pixel_center / vec2(screen_size);
+    vec4 clip_pos = vec4(uv.x * 2.0 - 1.0, 1.0 - uv.y * 2.0, depth, 1.0);
+    vec4 world_pos = camera.inverse_view_proj * clip_pos;
+
+    vec4 base_color = texelFetch(gbuffer_base_color, pixel, 0);
+    vec2 metallic_roughness = texelFetch(gbuffer_material, pixel, 0).rg;
+
+    // Texture coordinates are not needed, since the material got sampled in the G-buffer pass
+    SurfacePoint point;
+    point.world_pos = world_pos.xyz / world_pos.w;
+    point.view_pos = (camera.view * vec4(point.world_pos, 1.0)).xyz;
+    point.normal = vec3_from_oct(texelFetch(gbuffer_normal, pixel, 0).rg);
+    point.tex_coord = vec2(0.0);
+    point.tex_coord_dx = vec2(0.0);
+    point.tex_coord_dy = vec2(0.0);
+    point.pixel_coord = pixel_center;
+
+    Surface surface = make_surface(base_color.rgb, point.normal, metallic_roughness.r,
+                                   metallic_roughness.g);
+    vec3 Lo = shade_lighting(point, surface, base_color.a, true);
+
+    vec3 emission = imageLoad(out_color, pixel).rgb;
+    imageStore(out_color, pixel, vec4(emission + Lo, 1.0));
+}
@@ -0,0 +1,21 @@
+#version 460
+
+#include "prelude.h.glsl"
+#include "mesh_push_constant.h.glsl"
+
+layout (location = 0) in vec2 in_tex_coord;
+layout (location = 1) in flat uint in_material_index;
+
+layout (set = 2, binding = 10) uniform sampler2D global_textures[];
+
+// Only alpha tested materials do anything here. The test must match the one in mesh.frag.glsl
+void main()
+{
+    Material material = material_buffer.materials[in_material_index];
+    if (material.alpha_cutoff > 0.0) {
+        uint albedo_texture_index = material.albedo_texture_index;
+        float alpha = material.base_color_factor.a *
+                      texture(global_textures[nonuniformEXT(albedo_texture_index)], in_tex_coord).a;
+        if (alpha < material.alpha_cutoff) { discard; }
+    }
+}
@@ -0,0 +1,30 @@
+#version 460
+
+#include "prelude.h.glsl"
+#include "camera_data.h.glsl"
+#include "object_data.h.glsl"
+#include "mesh_push_constant.h.glsl"
+
+// Shared by the depth prepass and the visibility buffer pass. Positions come from a vertex stream,
+// the same as in the shadow pass
+layout (location = 0) in vec3 in_position;
+
+layout (location = 0) out vec2 out_tex_coord;
+layout (location = 1) out flat uint out_material_index;
+layout (location = 2) out flat uint out_draw_index; // Only used by the visibility buffer pass
+
+// Must produce the exact same depth as mesh.vert.glsl
+invariant gl_Position;
+
+void main()
+{
+    Draw in_per_draw = draws_buffer.draws[gl_InstanceIndex];
+
+    mat4 model = object_buffer.objects[in_per_draw.node_index].model;
+    mat4 transform_matrix = camera.view_proj * model;
+    gl_Position = transform_matrix * vec4(in_position, 1.0f);
+
+    out_tex_coord = vertex_buffer.vertices[gl_VertexIndex].tex_coord;
+    out_material_index = in_per_draw.material_index;
+    out_draw_index = gl_InstanceIndex;
+}
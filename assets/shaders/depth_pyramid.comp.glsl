@@ -0,0 +1,23 @@
+#version 460
+
+// Builds one level of the hierarchical depth pyramid used by occlusion culling.
+// The sampler uses a min reduction, so with reverse-Z each texel stores the farthest depth of the
+// 2x2 texels below it
+
+layout (set = 0, binding = 0) uniform sampler2D in_depth;
+layout (set = 0, binding = 1, r32f) uniform writeonly image2D out_depth;
+
+layout (push_constant) uniform constants {
+    vec2 out_image_size;
+};
+
+layout (local_size_x = 16, local_size_y = 16, local_size_z = 1) in;
+void main() {
+    uvec2 position = gl_GlobalInvocationID.xy;
+    if (any(greaterThanEqual(position, uvec2(out_image_size)))) {
+        return;
+    }
+
+    float depth = textureLod(in_depth, (vec2(position) + vec2(0.5)) / out_image_size, 0).x;
+    imageStore(out_depth, ivec2(position), vec4(depth));
+}
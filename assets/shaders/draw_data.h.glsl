@@ -10,10 +10,75 @@ struct Draw {
     uint index_offset;
     uint material_index;
     uint node_index;
+    vec3 aabb_min; // Local space bounding box of the mesh
+    vec3 aabb_max;
+    uint meshlet_offset; // Range in the meshlet buffer, used by the mesh shading path
+    uint meshlet_count;
+    uint cluster_index_offset; // First index of a solid draw in the cluster culled index buffer
 };
 
 layout (buffer_reference, scalar) readonly restrict buffer DrawsBuffer {
     Draw draws[];
 };
 
+// Output of culling: a draw indirect buffer that can directly feed into the GPU
+struct IndirectCommand {
+    uint index_count;
+    uint instance_count;
+    uint first_index;
+    int vertex_offset;
+    uint first_instance;
+};
+
+layout (buffer_reference, scalar) writeonly restrict buffer DrawIndirectBuffer {
+    IndirectCommand draws[];
+};
+
+IndirectCommand make_indirect_command(Draw draw, uint draw_index) {
+    IndirectCommand indirect_command;
+    indirect_command.index_count = draw.index_count;
+    indirect_command.instance_count = 1;
+    indirect_command.first_index = draw.index_offset;
+    indirect_command.vertex_offset = draw.vertex_offset;
+    indirect_command.first_instance = draw_index; // Used to get the original draw index
+    return indirect_command;
+}
+
+// With cluster culling, solid draws read the compacted triangles of their visible clusters, which
+// the cluster culling pass appends. The cluster indices are absolute vertex indices
+IndirectCommand make_cluster_indirect_command(Draw draw, uint draw_index) {
+    IndirectCommand indirect_command;
+    indirect_command.index_count = 0;
+    indirect_command.instance_count = 1;
+    indirect_command.first_index = draw.cluster_index_offset;
+    indirect_command.vertex_offset = 0;
+    indirect_command.first_instance = draw_index;
+    return indirect_command;
+}
+
+// Output of culling for the mesh shading path: a task shader dispatch per visible draw. Each task
+// workgroup handles TASK_GROUP_MESHLET_COUNT meshlets
+#define TASK_GROUP_MESHLET_COUNT 32
+
+struct MeshTaskCommand {
+    uint group_count_x;
+    uint group_count_y;
+    uint group_count_z;
+    uint draw_index;
+};
+
+layout (buffer_reference, scalar) restrict buffer MeshTaskBuffer {
+    MeshTaskCommand commands[];
+};
+
+MeshTaskCommand make_mesh_task_command(Draw draw, uint draw_index) {
+    MeshTaskCommand command;
+    command.group_count_x =
+        (draw.meshlet_count + TASK_GROUP_MESHLET_COUNT - 1) / TASK_GROUP_MESHLET_COUNT;
+    command.group_count_y = 1;
+    command.group_count_z = 1;
+    command.draw_index = draw_index;
+    return command;
+}
+
 #endif // CHARLIE3D_DRAW_DATA_GLSL
\ No newline at end of file
@@ -0,0 +1,25 @@
+#ifndef CHARLIE3D_EXPOSURE_GLSL
+#define CHARLIE3D_EXPOSURE_GLSL
+
+#include "prelude.h.glsl"
+
+// Must match luminance_histogram_bin_count in renderer.hpp
+#define LUMINANCE_HISTOGRAM_BIN_COUNT 256
+
+// Bin 0 counts the pixels that are too dark to be measured. The other bins split the log2 luminance
+// range evenly
+layout (buffer_reference, scalar) restrict buffer LuminanceHistogramBuffer {
+    uint bins[LUMINANCE_HISTOGRAM_BIN_COUNT];
+};
+
+// Persists across frames, so that the exposure adapts over time
+layout (buffer_reference, scalar) restrict buffer ExposureBuffer {
+    float average_luminance;
+    float exposure; // Scales the HDR color before tone mapping
+};
+
+float luminance(vec3 color) {
+    return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+#endif // CHARLIE3D_EXPOSURE_GLSL
@@ -0,0 +1,54 @@
+#version 460
+
+#include "prelude.h.glsl"
+#include "shading.h.glsl"
+#include "mesh_push_constant.h.glsl"
+#include "octahedron_encoding.h.glsl"
+
+layout (location = 0) in vec3 in_world_pos;
+layout (location = 1) in vec2 in_tex_coord;
+layout (location = 2) in vec3 in_normal;
+layout (location = 3) in vec3 in_tangent;
+layout (location = 4) in vec3 in_bi_tangent;
+layout (location = 5) in vec3 in_world_space_pos;
+layout (location = 6) in flat uint in_material_index;
+
+// The emission goes straight into the HDR image, and the deferred lighting pass adds the rest
+layout (location = 0) out vec4 out_emission;
+layout (location = 1) out vec4 out_base_color; // rgb: base color, a: ambient occlusion
+layout (location = 2) out vec2 out_normal;     // Octahedral encoding
+layout (location = 3) out vec2 out_material;   // r: metallic, g: perceptual roughness
+
+// Samples the material of the fragment into the G-buffer. The alpha test must match the one in
+// mesh.frag.glsl
+void main()
+{
+    Material material = material_buffer.materials[in_material_index];
+
+    SurfacePoint point;
+    point.view_pos = in_world_pos;
+    point.world_pos = in_world_space_pos;
+    point.normal = normalize(in_normal);
+    point.tex_coord = in_tex_coord;
+    point.tex_coord_dx = dFdx(in_tex_coord);
+    point.tex_coord_dy = dFdy(in_tex_coord);
+    point.pixel_coord = gl_FragCoord.xy;
+
+    write_texture_feedback(texture_feedback_buffer, in_material_index,
+                           point.tex_coord_dx, point.tex_coord_dy, uvec2(gl_FragCoord.xy));
+
+    vec4 albedo = material_albedo(material, point);
+    // alpha cutoff
+    if (albedo.a < material.alpha_cutoff) { discard; }
+
+    float ambient_occlusion = sample_material_texture(material.occlusion_texture_index, point).r;
+    vec2 metallic_roughness =
+        sample_material_texture(material.metallic_roughness_texture_index, point).bg;
+    vec3 emission = sample_material_texture(material.emissive_texture_index, point).xyz *
+                    material.emissive_factor;
+
+    out_emission = vec4(emission, 1.0);
+    out_base_color = vec4(albedo.rgb, ambient_occlusion);
+    out_normal = oct_from_vec3(point.normal);
+    out_material = metallic_roughness * vec2(material.metallic_factor, material.roughness_factor);
+}
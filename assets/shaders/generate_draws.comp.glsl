@@ -1,29 +1,61 @@
 #version 460
 
 #include "prelude.h.glsl"
+#include "camera_data.h.glsl"
+#include "object_data.h.glsl"
 #include "draw_data.h.glsl"
+#include "culling.h.glsl"
 
-// Output: a draw indirect buffer that can directly feed into the GPU
-struct IndirectCommand {
-    uint index_count;
-    uint instance_count;
-    uint first_index;
-    int vertex_offset;
-    uint first_instance;
+// Draw counts of each output region of the indirect buffer
+layout (buffer_reference, scalar) restrict buffer DrawCountBuffer {
+    uint early_solid_count;
+    uint late_solid_count;
+    uint transparent_count;
 };
 
-layout (buffer_reference, scalar) writeonly restrict buffer DrawIndirectBuffer {
-    IndirectCommand draws[];
+// Whether each draw passed the occlusion test in the late phase of last frame
+layout (buffer_reference, scalar) restrict buffer DrawVisibilityBuffer {
+    uint visibilities[];
 };
 
+// Index of the indirect command of each solid draw emitted in the current phase, for the cluster
+// culling pass
+layout (buffer_reference, scalar) writeonly restrict buffer DrawSlotBuffer {
+    uint slots[];
+};
+const uint DRAW_NOT_EMITTED = 0xFFFFFFFF;
+
+layout (set = 2, binding = 0) uniform sampler2D depth_pyramid;
+
+const uint early_phase = 0;
+const uint late_phase = 1;
+
 layout (push_constant) uniform constants
 {
     DrawsBuffer in_draws_buffer;
+    // Compacted visible draws. Early solid draws start at 0, late solid draws start at
+    // solid_draw_count, and transparent draws start at 2 * solid_draw_count
     DrawIndirectBuffer draw_indirect_buffer;
+    DrawCountBuffer draw_count_buffer;
+    DrawVisibilityBuffer draw_visibility_buffer;
+    // Task commands of the solid draws for the mesh shading path, in the same regions as the
+    // indirect commands
+    MeshTaskBuffer mesh_task_buffer;
+    DrawSlotBuffer draw_slot_buffer;
     uint total_draw_count;
+    uint solid_draw_count;
+    uint phase;
+    uint occlusion_culling_enabled;
+    vec2 depth_pyramid_size;
+    uint mesh_tasks_enabled;
+    uint cluster_culling_enabled;
 };
 
-
+// Two-phase occlusion culling:
+// - Early phase: draw solid objects that were visible last frame
+// - (The depth pyramid is built from the depth of the early phase)
+// - Late phase: test all solid objects against the depth pyramid, and draw the visible ones that
+//   were not drawn in the early phase. Transparent objects are only drawn in this phase
 layout (local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
 void main() {
     uint index = gl_GlobalInvocationID.x;
@@ -32,14 +64,64 @@ void main() {
     }
 
     Draw draw = in_draws_buffer.draws[index];
+    IndirectCommand indirect_command = make_indirect_command(draw, index);
+
+    bool is_solid = index < solid_draw_count;
+    if (phase == early_phase && !is_solid) {
+        return;
+    }
+    if (is_solid && cluster_culling_enabled != 0) {
+        draw_slot_buffer.slots[index] = DRAW_NOT_EMITTED;
+    }
 
-    IndirectCommand indirect_command;
-    indirect_command.index_count = draw.index_count;
-    indirect_command.instance_count = 1;
-    indirect_command.first_index = draw.index_offset;
-    indirect_command.vertex_offset = draw.vertex_offset;
-    indirect_command.first_instance = index; // Used to get the original draw index
+    mat4 model = object_buffer.objects[draw.node_index].model;
+    vec3 center;
+    vec3 extents;
+    transform_aabb(model, draw.aabb_min, draw.aabb_max, center, extents);
+    bool is_visible = is_aabb_in_frustum(extract_frustum(camera.view_proj), center, extents);
 
-    draw_indirect_buffer.draws[index] = indirect_command;
+    if (occlusion_culling_enabled == 0) {
+        // Everything is drawn in the early phase except transparent objects
+        bool should_draw = is_visible && (is_solid == (phase == early_phase));
+        if (!should_draw) {
+            return;
+        }
+    } else if (phase == early_phase) {
+        if (!is_visible || draw_visibility_buffer.visibilities[index] == 0) {
+            return;
+        }
+    } else {
+        if (is_visible) {
+            is_visible = is_aabb_visible_in_depth_pyramid(camera.view_proj, center, extents,
+                                                          depth_pyramid, depth_pyramid_size);
+        }
 
-}
\ No newline at end of file
+        if (is_solid) {
+            bool was_drawn = draw_visibility_buffer.visibilities[index] != 0;
+            draw_visibility_buffer.visibilities[index] = is_visible ? 1 : 0;
+            if (!is_visible || was_drawn) {
+                return;
+            }
+        } else if (!is_visible) {
+            return;
+        }
+    }
+
+    if (!is_solid) {
+        uint output_index = atomicAdd(draw_count_buffer.transparent_count, 1);
+        draw_indirect_buffer.draws[2 * solid_draw_count + output_index] = indirect_command;
+    } else {
+        uint output_index = phase == early_phase
+            ? atomicAdd(draw_count_buffer.early_solid_count, 1)
+            : solid_draw_count + atomicAdd(draw_count_buffer.late_solid_count, 1);
+        if (cluster_culling_enabled != 0) {
+            draw_indirect_buffer.draws[output_index] = make_cluster_indirect_command(draw, index);
+            draw_slot_buffer.slots[index] = output_index;
+        } else {
+            draw_indirect_buffer.draws[output_index] = indirect_command;
+        }
+        if (mesh_tasks_enabled != 0) {
+            mesh_task_buffer.commands[output_index] = make_mesh_task_command(draw, index);
+        }
+    }
+}
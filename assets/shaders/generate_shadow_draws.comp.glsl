@@ -0,0 +1,59 @@
+#version 460
+
+#include "prelude.h.glsl"
+#include "camera_data.h.glsl"
+#include "scene_data.h.glsl"
+#include "object_data.h.glsl"
+#include "draw_data.h.glsl"
+#include "culling.h.glsl"
+
+layout (buffer_reference, scalar) restrict buffer DrawCountBuffer {
+    uint counts[]; // One per cascade
+};
+
+layout (push_constant) uniform constants
+{
+    DrawsBuffer in_draws_buffer;
+    // Compacted shadow caster draws. The draws of cascade i start at i * solid_draw_count
+    DrawIndirectBuffer draw_indirect_buffer;
+    DrawCountBuffer draw_count_buffer;
+    uint solid_draw_count;
+    uint cascade_mask; // Bit i is set if cascade i gets re-rendered this frame
+    // Cached cascades are reused when the camera turns, so they can't cull against the view frustum
+    uint cull_to_view_frustum;
+};
+
+// Culls solid draws for each cascade of the sun shadow map. A draw is kept if it is inside the
+// light volume of the cascade, and (unless the cascade is cached) its shadow can reach the view
+// frustum
+// The y dimension of the dispatch is the cascade index
+layout (local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+void main() {
+    uint index = gl_GlobalInvocationID.x;
+    uint cascade = gl_GlobalInvocationID.y;
+    if (index >= solid_draw_count || (cascade_mask & (1u << cascade)) == 0) {
+        return;
+    }
+
+    Draw draw = in_draws_buffer.draws[index];
+
+    mat4 model = object_buffer.objects[draw.node_index].model;
+    vec3 center;
+    vec3 extents;
+    transform_aabb(model, draw.aabb_min, draw.aabb_max, center, extents);
+
+    if (!is_aabb_in_frustum(extract_frustum(scene_data.sunlight_view_proj[cascade]), center, extents)) {
+        return;
+    }
+
+    vec3 light_direction = scene_data.sunlight_direction.xyz;
+    if (cull_to_view_frustum != 0 &&
+        !can_aabb_cast_shadow_into_frustum(extract_frustum(camera.view_proj), center, extents,
+                                           light_direction)) {
+        return;
+    }
+
+    uint output_index = atomicAdd(draw_count_buffer.counts[cascade], 1);
+    draw_indirect_buffer.draws[cascade * solid_draw_count + output_index] =
+        make_indirect_command(draw, index);
+}
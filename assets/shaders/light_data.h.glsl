@@ -0,0 +1,48 @@
+#ifndef CHARLIE3D_LIGHT_DATA_GLSL
+#define CHARLIE3D_LIGHT_DATA_GLSL
+
+#include "prelude.h.glsl"
+
+// Clustered lighting. The view frustum is split into a froxel grid of screen tiles and exponential
+// depth slices, and each cluster lists the punctual lights that touch it. Must match renderer.hpp
+#define LIGHT_GRID_WIDTH 16
+#define LIGHT_GRID_HEIGHT 9
+#define LIGHT_GRID_DEPTH 24
+#define LIGHT_CLUSTER_COUNT (LIGHT_GRID_WIDTH * LIGHT_GRID_HEIGHT * LIGHT_GRID_DEPTH)
+#define MAX_LIGHTS_PER_CLUSTER 127 // A cluster takes 128 uints with its light count
+
+// Point or spot light
+struct PunctualLight {
+    vec3 position; // World space
+    float range;
+    vec3 color; // Premultiplied by the intensity
+    // Angular attenuation is saturate(cos_angle * scale + offset), which is always 1 for point lights
+    float spot_angle_scale;
+    vec3 direction; // Where spot lights point to
+    float spot_angle_offset;
+};
+
+layout (buffer_reference, scalar) readonly restrict buffer LightBuffer {
+    PunctualLight lights[];
+};
+
+struct LightCluster {
+    uint light_count;
+    uint light_indices[MAX_LIGHTS_PER_CLUSTER];
+};
+
+layout (buffer_reference, scalar) restrict buffer LightClusterBuffer {
+    LightCluster clusters[];
+};
+
+// Tiles are counted from the top left of the screen
+uint light_cluster_index(uvec3 cell) {
+    return (cell.z * LIGHT_GRID_HEIGHT + cell.y) * LIGHT_GRID_WIDTH + cell.x;
+}
+
+// View space depth where a depth slice starts
+float light_grid_slice_depth(uint slice, float slice_scale, float slice_bias) {
+    return exp2((float(slice) - slice_bias) / slice_scale);
+}
+
+#endif // CHARLIE3D_LIGHT_DATA_GLSL
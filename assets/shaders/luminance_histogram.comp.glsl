@@ -0,0 +1,45 @@
+#version 460
+
+#include "prelude.h.glsl"
+#include "exposure.h.glsl"
+
+// Accumulates the log luminance of every pixel of the HDR image into a histogram. Each workgroup
+// builds its own histogram in shared memory first, so that the global atomics stay few
+
+layout (set = 0, binding = 0) uniform sampler2D hdr_image;
+
+layout (push_constant) uniform constants {
+    LuminanceHistogramBuffer histogram_buffer;
+    float min_log_luminance;
+    float inverse_log_luminance_range;
+};
+
+const float min_measured_luminance = 0.0001;
+
+shared uint local_histogram[LUMINANCE_HISTOGRAM_BIN_COUNT];
+
+uint histogram_bin(float luminance) {
+    if (luminance < min_measured_luminance) {
+        return 0;
+    }
+    float t = clamp((log2(luminance) - min_log_luminance) * inverse_log_luminance_range, 0.0, 1.0);
+    return uint(t * float(LUMINANCE_HISTOGRAM_BIN_COUNT - 2)) + 1;
+}
+
+layout (local_size_x = 16, local_size_y = 16, local_size_z = 1) in;
+void main() {
+    local_histogram[gl_LocalInvocationIndex] = 0;
+    barrier();
+
+    ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+    if (all(lessThan(pixel, textureSize(hdr_image, 0)))) {
+        vec3 color = texelFetch(hdr_image, pixel, 0).rgb;
+        atomicAdd(local_histogram[histogram_bin(luminance(color))], 1);
+    }
+    barrier();
+
+    uint count = local_histogram[gl_LocalInvocationIndex];
+    if (count > 0) {
+        atomicAdd(histogram_buffer.bins[gl_LocalInvocationIndex], count);
+    }
+}
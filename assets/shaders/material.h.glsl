@@ -0,0 +1,26 @@
+#ifndef CHARLIE3D_MATERIAL_GLSL
+#define CHARLIE3D_MATERIAL_GLSL
+
+#include "prelude.h.glsl"
+
+struct Material {
+    vec4 base_color_factor;
+    uint albedo_texture_index;
+    uint normal_texture_index;
+    uint metallic_roughness_texture_index;
+    uint occlusion_texture_index;
+
+    vec3 emissive_factor;
+    uint emissive_texture_index;
+
+    float metallic_factor;
+    float roughness_factor;
+    float alpha_cutoff;
+    float padding;
+};
+
+layout (buffer_reference, std430) readonly restrict buffer MaterialBuffer {
+    Material materials[];
+};
+
+#endif // CHARLIE3D_MATERIAL_GLSL
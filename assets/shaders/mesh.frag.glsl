@@ -1,54 +1,27 @@
 #version 460
 
 #include "prelude.h.glsl"
-#include "scene_data.h.glsl"
-#include "pbr.h.glsl"
-#include "shadow.h.glsl"
+#include "shading.h.glsl"
+#include "mesh_push_constant.h.glsl"
 
 layout (location = 0) in vec3 in_world_pos;
 layout (location = 1) in vec2 in_tex_coord;
 layout (location = 2) in vec3 in_normal;
 layout (location = 3) in vec3 in_tangent;
 layout (location = 4) in vec3 in_bi_tangent;
-layout (location = 5) in vec4 in_shadow_coord;
+layout (location = 5) in vec3 in_world_space_pos;
 layout (location = 6) in flat uint in_material_index;
 
 layout (location = 0) out vec4 out_frag_color;
 
-
-layout (set = 0, binding = 0) uniform CameraBuffer {
-    mat4 view;
-    mat4 proj;
-    mat4 view_proj;
-    vec3 position;
-} camera;
-
-struct Material {
-    vec4 base_color_factor;
-    uint albedo_texture_index;
-    uint normal_texture_index;
-    uint metallic_roughness_texture_index;
-    uint occlusion_texture_index;
-
-    vec3 emissive_factor;
-    uint emissive_texture_index;
-
-    float metallic_factor;
-    float roughness_factor;
-    float alpha_cutoff;
-    float padding;
-};
-layout (std430, set = 2, binding = 0) readonly restrict buffer MaterialBuffer {
-    readonly Material materials[];
-};
-
-layout (set = 3, binding = 10) uniform sampler2D global_textures[];
+// Only solid draws are in the depth prepass, so only they can read the screen-space shadow mask
+layout (constant_id = 2) const bool SHADOW_MASK_AVAILABLE = false;
 
 
 // #define VISUALIZE_SHADOW_MAP
 
 Material current_material() {
-    return materials[in_material_index];
+    return material_buffer.materials[in_material_index];
 }
 
 vec3 calculate_pixel_normal() {
@@ -64,74 +37,36 @@ vec3 calculate_pixel_normal() {
     return pixel_normal;
 }
 
-
-vec3 calculate_emission(in Material material) {
-    return texture(global_textures[nonuniformEXT(material.emissive_texture_index)], in_tex_coord).xyz * material.emissive_factor;
-}
-
 void main()
 {
     #ifdef VISUALIZE_SHADOW_MAP
 
-    float color = texture(shadow_map, in_shadow_coord.xy).r;
+    vec4 shadow_coord = shadow_coord_of_cascade(in_world_space_pos, 0);
+    float color = texture(shadow_map, vec3(shadow_coord.xy, 0)).r;
     out_frag_color = vec4(color, color, color, 1.0);
 
     #else
 
     Material material = current_material();
 
-    uint occlusion_texture_index = material.occlusion_texture_index;
-    float ambient_occlusion = texture(global_textures[nonuniformEXT(occlusion_texture_index)], in_tex_coord).r;
+    SurfacePoint point;
+    point.view_pos = in_world_pos;
+    point.world_pos = in_world_space_pos;
+    //point.normal = calculate_pixel_normal();
+    point.normal = in_normal;
+    point.tex_coord = in_tex_coord;
+    point.tex_coord_dx = dFdx(in_tex_coord);
+    point.tex_coord_dy = dFdy(in_tex_coord);
+    point.pixel_coord = gl_FragCoord.xy;
 
-    uint albedo_texture_index = material.albedo_texture_index;
-    vec4 albedo = material.base_color_factor * texture(global_textures[nonuniformEXT(albedo_texture_index)], in_tex_coord);
+    write_texture_feedback(texture_feedback_buffer, in_material_index,
+                           point.tex_coord_dx, point.tex_coord_dy, uvec2(gl_FragCoord.xy));
+
+    vec4 albedo = material_albedo(material, point);
     // alpha cutoff
     if (albedo.a < material.alpha_cutoff) { discard; }
-    vec3 base_color = albedo.rgb;
-
-    vec2 metallic_roughness = texture(global_textures[nonuniformEXT(material.metallic_roughness_texture_index)], in_tex_coord).bg;
-    float metallic = metallic_roughness.r * material.metallic_factor;
-    float perceptual_roughness = metallic_roughness.g * material.roughness_factor;
-
-    //vec3 normal = calculate_pixel_normal();
-    vec3 normal = in_normal;
-
-    // lighting
-    vec3 sunlight_direction = scene_data.sunlight_direction.xyz;
-    float ambient_strength = scene_data.sunlight_direction.w;
-    vec3 ambient = base_color * ambient_occlusion * ambient_strength;
-
-    vec3 view_direction = normalize(camera.position - in_world_pos); // view unit vector
-    vec3 light_direction = normalize(-sunlight_direction);
-
-    Surface surface;
-    surface.base_color = base_color;
-    surface.normal = normal;
-    surface.reflectance = 0.5;
-    surface.perceptual_roughness = perceptual_roughness;
-    surface.metallic = metallic;
-
-    vec3 F = BRDF(view_direction, light_direction, surface);
-
-    float NoL = clamp(dot(normal, light_direction), 0.0, 1.0);
-
-    // lightIntensity is the illuminance
-    // at perpendicular incidence in lux
-    vec3 sunlight_color = scene_data.sunlight_color.xyz;
-    float sunlight_intensity = scene_data.sunlight_color.w;
-
-    float illuminance = sunlight_intensity * NoL;
-    vec3 luminance = F * sunlight_color * illuminance;
-
-    float visibility = 1.0;
-    uint shadow_mode = scene_data.sunlight_shadow_mode;
-    if (shadow_mode > 0) {
-        visibility = shadow_mapping(in_shadow_coord, shadow_mode);
-    }
-
-    vec3 emission = calculate_emission(material);
 
-    vec3 Lo = ambient + emission + luminance * visibility;
+    vec3 Lo = shade_surface(material, point, albedo.rgb, SHADOW_MASK_AVAILABLE);
     out_frag_color = vec4(Lo, 1.0f);
 
     #endif
@@ -0,0 +1,35 @@
+#ifndef CHARLIE3D_MESH_PUSH_CONSTANT_GLSL
+#define CHARLIE3D_MESH_PUSH_CONSTANT_GLSL
+
+#include "prelude.h.glsl"
+#include "draw_data.h.glsl"
+#include "material.h.glsl"
+#include "texture_feedback.h.glsl"
+#include "vertex_data.h.glsl"
+
+#ifdef MESH_SHADING_PUSH_CONSTANT
+#include "meshlet.h.glsl"
+#endif
+
+// Shared by the stages of the mesh pipelines and by the visibility buffer resolve. The task and
+// mesh shaders of the mesh shading path define MESH_SHADING_PUSH_CONSTANT to see the fields that
+// follow the common ones
+layout (push_constant) uniform constants
+{
+    PositionBuffer position_buffer;
+    VertexBuffer vertex_buffer;
+    DrawsBuffer draws_buffer;
+    TextureFeedbackBuffer texture_feedback_buffer;
+    MaterialBuffer material_buffer;
+    IndexBuffer index_buffer; // Only read by the visibility buffer resolve
+#ifdef MESH_SHADING_PUSH_CONSTANT
+    MeshletBuffer meshlet_buffer;
+    MeshletVertexBuffer meshlet_vertex_buffer;
+    MeshletTriangleBuffer meshlet_triangle_buffer;
+    MeshTaskBuffer mesh_task_buffer; // Task commands of the current phase
+    vec2 depth_pyramid_size;
+    uint meshlet_occlusion_culling_enabled; // Only in the late phase
+#endif
+};
+
+#endif // CHARLIE3D_MESH_PUSH_CONSTANT_GLSL
@@ -0,0 +1,50 @@
+#ifndef CHARLIE3D_MESHLET_GLSL
+#define CHARLIE3D_MESHLET_GLSL
+
+#include "prelude.h.glsl"
+#include "draw_data.h.glsl"
+
+// Limits of a meshlet. Must match cpu_mesh.hpp
+#define MAX_MESHLET_VERTICES 64
+#define MAX_MESHLET_TRIANGLES 124
+
+struct Meshlet {
+    vec3 center; // Local space bounding sphere
+    float radius;
+    // Backface culling cone. The whole meshlet faces away from viewers at `position` if
+    // dot(normalize(cone_apex - position), cone_axis) >= cone_cutoff
+    vec3 cone_apex;
+    float cone_cutoff;
+    vec3 cone_axis;
+    uint vertex_offset;
+    uint triangle_offset;
+    uint vertex_count;
+    uint triangle_count;
+};
+
+layout (buffer_reference, scalar) readonly restrict buffer MeshletBuffer {
+    Meshlet meshlets[];
+};
+
+// Absolute indices into the vertex buffers
+layout (buffer_reference, scalar) readonly restrict buffer MeshletVertexBuffer {
+    uint vertices[];
+};
+
+// Three 8 bit indices into the vertices of a meshlet per triangle
+layout (buffer_reference, scalar) readonly restrict buffer MeshletTriangleBuffer {
+    uint triangles[];
+};
+
+uvec3 unpack_meshlet_triangle(uint packed_triangle) {
+    return uvec3(packed_triangle & 0xFF, (packed_triangle >> 8) & 0xFF,
+                 (packed_triangle >> 16) & 0xFF);
+}
+
+// Passed from a task workgroup to the mesh workgroups it launches
+struct MeshletTaskPayload {
+    uint draw_index;
+    uint meshlet_indices[TASK_GROUP_MESHLET_COUNT]; // Visible meshlets, in the meshlet buffer
+};
+
+#endif // CHARLIE3D_MESHLET_GLSL
@@ -0,0 +1,67 @@
+#version 460
+
+#extension GL_EXT_mesh_shader : require
+
+#define MESH_SHADING_PUSH_CONSTANT
+
+#include "prelude.h.glsl"
+#include "camera_data.h.glsl"
+#include "object_data.h.glsl"
+#include "mesh_push_constant.h.glsl"
+#include "octahedron_encoding.h.glsl"
+
+#define MESH_GROUP_SIZE 32
+
+layout (local_size_x = MESH_GROUP_SIZE, local_size_y = 1, local_size_z = 1) in;
+layout (triangles, max_vertices = MAX_MESHLET_VERTICES, max_primitives = MAX_MESHLET_TRIANGLES) out;
+
+taskPayloadSharedEXT MeshletTaskPayload payload;
+
+// Same outputs as mesh.vert.glsl, so that the fragment shader is shared
+layout (location = 0) out vec3 out_world_pos[];
+layout (location = 1) out vec2 out_tex_coord[];
+layout (location = 2) out vec3 out_normal[];
+layout (location = 3) out vec3 out_tangent[];
+layout (location = 4) out vec3 out_bi_tangent[];
+layout (location = 5) out vec3 out_world_space_pos[];
+layout (location = 6) out flat uint out_material_index[];
+
+void main()
+{
+    uint meshlet_index = payload.meshlet_indices[gl_WorkGroupID.x];
+    Meshlet meshlet = meshlet_buffer.meshlets[meshlet_index];
+    Draw draw = draws_buffer.draws[payload.draw_index];
+
+    mat4 model = object_buffer.objects[draw.node_index].model;
+    mat4 transform_matrix = camera.view_proj * model;
+    mat3 normal_matrix = inverse(mat3(model));
+
+    SetMeshOutputsEXT(meshlet.vertex_count, meshlet.triangle_count);
+
+    for (uint i = gl_LocalInvocationIndex; i < meshlet.vertex_count; i += MESH_GROUP_SIZE) {
+        uint vertex_index = meshlet_vertex_buffer.vertices[meshlet.vertex_offset + i];
+        vec3 in_position = position_buffer.position[vertex_index];
+        Vertex in_vertex = vertex_buffer.vertices[vertex_index];
+        vec3 in_normal = vec3_from_oct(in_vertex.normal);
+        vec4 in_tangent = in_vertex.tangent;
+
+        vec4 world_pos = camera.view * model * vec4(in_position, 1.0f);
+        out_world_pos[i] = (world_pos / world_pos.w).xyz;
+        gl_MeshVerticesEXT[i].gl_Position = transform_matrix * vec4(in_position, 1.0f);
+        out_tex_coord[i] = in_vertex.tex_coord;
+
+        vec3 normal = normalize(normal_matrix * in_normal);
+        vec3 tangent = normalize(mat3(model) * in_tangent.xyz);
+        out_normal[i] = normal;
+        out_tangent[i] = tangent;
+        out_bi_tangent[i] = cross(normal, tangent) * in_tangent.w;
+
+        out_world_space_pos[i] = (model * vec4(in_position, 1.0)).xyz;
+        out_material_index[i] = draw.material_index;
+    }
+
+    for (uint i = gl_LocalInvocationIndex; i < meshlet.triangle_count; i += MESH_GROUP_SIZE) {
+        gl_PrimitiveTriangleIndicesEXT[i] =
+            unpack_meshlet_triangle(meshlet_triangle_buffer.triangles[meshlet.triangle_offset + i]);
+    }
+}
@@ -0,0 +1,46 @@
+#version 460
+
+#extension GL_EXT_mesh_shader : require
+
+#define MESH_SHADING_PUSH_CONSTANT
+
+#include "prelude.h.glsl"
+#include "camera_data.h.glsl"
+#include "object_data.h.glsl"
+#include "mesh_push_constant.h.glsl"
+#include "meshlet_culling.h.glsl"
+
+layout (set = 3, binding = 0) uniform sampler2D depth_pyramid;
+
+// Each invocation culls one meshlet of the draw, and the workgroup launches a mesh workgroup per
+// visible meshlet
+layout (local_size_x = TASK_GROUP_MESHLET_COUNT, local_size_y = 1, local_size_z = 1) in;
+
+taskPayloadSharedEXT MeshletTaskPayload payload;
+
+shared uint visible_meshlet_count;
+
+void main() {
+    MeshTaskCommand command = mesh_task_buffer.commands[gl_DrawID];
+    Draw draw = draws_buffer.draws[command.draw_index];
+
+    if (gl_LocalInvocationIndex == 0) {
+        visible_meshlet_count = 0;
+        payload.draw_index = command.draw_index;
+    }
+    barrier();
+
+    uint meshlet_index = gl_WorkGroupID.x * TASK_GROUP_MESHLET_COUNT + gl_LocalInvocationIndex;
+    if (meshlet_index < draw.meshlet_count) {
+        mat4 model = object_buffer.objects[draw.node_index].model;
+        Meshlet meshlet = meshlet_buffer.meshlets[draw.meshlet_offset + meshlet_index];
+        if (is_meshlet_visible(meshlet, model, meshlet_occlusion_culling_enabled != 0,
+                               depth_pyramid, depth_pyramid_size)) {
+            uint output_index = atomicAdd(visible_meshlet_count, 1);
+            payload.meshlet_indices[output_index] = draw.meshlet_offset + meshlet_index;
+        }
+    }
+    barrier();
+
+    EmitMeshTasksEXT(visible_meshlet_count, 1, 1);
+}
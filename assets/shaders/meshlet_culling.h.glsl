@@ -0,0 +1,38 @@
+#ifndef CHARLIE3D_MESHLET_CULLING_GLSL
+#define CHARLIE3D_MESHLET_CULLING_GLSL
+
+#include "prelude.h.glsl"
+#include "camera_data.h.glsl"
+#include "culling.h.glsl"
+#include "meshlet.h.glsl"
+
+// Shared by the task shader of the mesh shading path and by the compute cluster culling. Tests a
+// meshlet of a draw against the view frustum, its normal cone, and optionally the depth pyramid
+bool is_meshlet_visible(Meshlet meshlet, mat4 model, bool test_occlusion,
+                        sampler2D depth_pyramid, vec2 depth_pyramid_size) {
+    // Non-uniform scaling makes the sphere an ellipsoid, so bound it with the largest scale
+    float scale = max(max(length(model[0].xyz), length(model[1].xyz)), length(model[2].xyz));
+    vec3 center = (model * vec4(meshlet.center, 1.0)).xyz;
+    float radius = meshlet.radius * scale;
+
+    if (!is_sphere_in_frustum(extract_frustum(camera.view_proj), center, radius)) {
+        return false;
+    }
+
+    // A cutoff of 1 means the triangles face all sorts of directions
+    if (meshlet.cone_cutoff < 1.0) {
+        vec3 cone_apex = (model * vec4(meshlet.cone_apex, 1.0)).xyz;
+        vec3 cone_axis = normalize(mat3(model) * meshlet.cone_axis);
+        if (dot(normalize(cone_apex - camera.position), cone_axis) >= meshlet.cone_cutoff) {
+            return false;
+        }
+    }
+
+    if (test_occlusion) {
+        return is_aabb_visible_in_depth_pyramid(camera.view_proj, center, vec3(radius),
+                                                depth_pyramid, depth_pyramid_size);
+    }
+    return true;
+}
+
+#endif // CHARLIE3D_MESHLET_CULLING_GLSL
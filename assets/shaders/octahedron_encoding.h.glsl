@@ -13,4 +13,11 @@ vec3 vec3_from_oct(vec2 e)
     return normalize(v);
 }
 
+// Inverse of vec3_from_oct. Components are in [-1, 1]
+vec2 oct_from_vec3(vec3 v)
+{
+    vec2 p = v.xy * (1.0 / (abs(v.x) + abs(v.y) + abs(v.z)));
+    return (v.z <= 0.0) ? ((1.0 - abs(p.yx)) * sign_not_zero(p)) : p;
+}
+
 #endif // CHARLIE3D_OCTAHEDRAON_ENCODING_GLSL
\ No newline at end of file
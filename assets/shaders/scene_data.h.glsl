@@ -1,12 +1,29 @@
 #ifndef CHARLIE3D_SCENE_DATA_GLSL
 #define CHARLIE3D_SCENE_DATA_GLSL
 
+#include "light_data.h.glsl"
+
+#define MAX_SHADOW_CASCADE_COUNT 4
+
 layout (std140, set = 0, binding = 1) uniform SceneData {
     vec4 sunlight_direction; // w is used for ambient strength
     vec4 sunlight_color;
-    mat4 sunlight_view_proj;
+    mat4 sunlight_view_proj[MAX_SHADOW_CASCADE_COUNT]; // One per shadow cascade
+    vec4 sunlight_cascade_splits; // View space depth where each cascade ends
 
     uint sunlight_shadow_mode;
+    uint sunlight_cascade_count;
+    uint sunlight_shadow_filtering;
+    uint sunlight_shadow_mask;
+
+    // Clustered punctual lights
+    LightBuffer light_buffer;
+    LightClusterBuffer light_cluster_buffer;
+    vec2 light_grid_tile_size; // In pixels
+    uint light_count;
+    // The depth slice of view space depth d is log2(d) * scale + bias
+    float light_grid_slice_scale;
+    float light_grid_slice_bias;
 } scene_data;
 
-#endif
\ No newline at end of file
+#endif
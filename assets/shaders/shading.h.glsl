@@ -0,0 +1,152 @@
+#ifndef CHARLIE3D_SHADING_GLSL
+#define CHARLIE3D_SHADING_GLSL
+
+#include "prelude.h.glsl"
+#include "camera_data.h.glsl"
+#include "scene_data.h.glsl"
+#include "material.h.glsl"
+#include "pbr.h.glsl"
+#include "shadow.h.glsl"
+#include "shadow_mask.h.glsl"
+
+// Surface shading shared by the forward mesh pass, the visibility buffer resolve and the deferred
+// lighting pass. Textures are sampled with explicit UV gradients, since the resolve runs in a
+// compute shader
+
+layout (set = 2, binding = 10) uniform sampler2D global_textures[];
+
+struct SurfacePoint {
+    vec3 view_pos; // Position in view space
+    vec3 world_pos;
+    vec3 normal;
+    vec2 tex_coord;
+    vec2 tex_coord_dx; // Screen-space derivatives of the texture coordinates
+    vec2 tex_coord_dy;
+    vec2 pixel_coord;
+};
+
+vec4 sample_material_texture(uint texture_index, SurfacePoint point) {
+    return textureGrad(global_textures[nonuniformEXT(texture_index)], point.tex_coord,
+                       point.tex_coord_dx, point.tex_coord_dy);
+}
+
+vec4 material_albedo(Material material, SurfacePoint point) {
+    return material.base_color_factor *
+           sample_material_texture(material.albedo_texture_index, point);
+}
+
+// Radiance from the punctual lights of the light grid cluster that contains the point. Punctual
+// lights cast no shadows
+vec3 shade_punctual_lights(SurfacePoint point, Surface surface, vec3 view_direction,
+                           float view_depth) {
+    if (scene_data.light_count == 0) {
+        return vec3(0.0);
+    }
+
+    uvec2 tile = min(uvec2(point.pixel_coord / scene_data.light_grid_tile_size),
+                     uvec2(LIGHT_GRID_WIDTH - 1, LIGHT_GRID_HEIGHT - 1));
+    float slice = log2(max(view_depth, 1e-4)) * scene_data.light_grid_slice_scale +
+                  scene_data.light_grid_slice_bias;
+    uint cluster_index = light_cluster_index(
+        uvec3(tile, uint(clamp(slice, 0.0, float(LIGHT_GRID_DEPTH - 1)))));
+    LightClusterBuffer clusters = scene_data.light_cluster_buffer;
+    uint light_count = clusters.clusters[cluster_index].light_count;
+
+    vec3 radiance = vec3(0.0);
+    for (uint i = 0; i < light_count; ++i) {
+        uint light_index = clusters.clusters[cluster_index].light_indices[i];
+        PunctualLight light = scene_data.light_buffer.lights[light_index];
+
+        vec3 to_light = light.position - point.world_pos;
+        float distance_squared = max(dot(to_light, to_light), 1e-4);
+        vec3 light_direction = to_light * inversesqrt(distance_squared);
+        float NoL = clamp(dot(surface.normal, light_direction), 0.0, 1.0);
+        if (NoL <= 0.0) {
+            continue;
+        }
+
+        // Inverse square falloff with the smooth window of KHR_lights_punctual
+        float distance_ratio_squared = distance_squared / (light.range * light.range);
+        float window = clamp(1.0 - distance_ratio_squared * distance_ratio_squared, 0.0, 1.0);
+        float attenuation = window * window / distance_squared;
+        float spot = clamp(dot(light.direction, -light_direction) * light.spot_angle_scale +
+                           light.spot_angle_offset, 0.0, 1.0);
+        attenuation *= spot * spot;
+
+        radiance += BRDF(view_direction, light_direction, surface) * light.color * attenuation * NoL;
+    }
+    return radiance;
+}
+
+Surface make_surface(vec3 base_color, vec3 normal, float metallic, float perceptual_roughness) {
+    Surface surface;
+    surface.base_color = base_color;
+    surface.normal = normal;
+    surface.reflectance = 0.5;
+    surface.perceptual_roughness = perceptual_roughness;
+    surface.metallic = metallic;
+    return surface;
+}
+
+// Radiance reflected from the ambient light, the sun and the punctual lights. Only solid surfaces
+// are in the depth that the shadow mask is built from, so only they can use it
+vec3 shade_lighting(SurfacePoint point, Surface surface, float ambient_occlusion,
+                    bool use_shadow_mask) {
+    vec3 normal = surface.normal;
+
+    // lighting
+    vec3 sunlight_direction = scene_data.sunlight_direction.xyz;
+    float ambient_strength = scene_data.sunlight_direction.w;
+    vec3 ambient = surface.base_color * ambient_occlusion * ambient_strength;
+
+    vec3 view_direction = normalize(camera.position - point.view_pos); // view unit vector
+    vec3 light_direction = normalize(-sunlight_direction);
+
+    vec3 F = BRDF(view_direction, light_direction, surface);
+
+    float NoL = clamp(dot(normal, light_direction), 0.0, 1.0);
+
+    // lightIntensity is the illuminance
+    // at perpendicular incidence in lux
+    vec3 sunlight_color = scene_data.sunlight_color.xyz;
+    float sunlight_intensity = scene_data.sunlight_color.w;
+
+    float illuminance = sunlight_intensity * NoL;
+    vec3 luminance = F * sunlight_color * illuminance;
+
+    float view_depth = -(camera.view * vec4(point.world_pos, 1.0)).z;
+
+    float visibility = 1.0;
+    uint shadow_mode = scene_data.sunlight_shadow_mode;
+    if (shadow_mode > 0) {
+        if (use_shadow_mask && scene_data.sunlight_shadow_mask != 0) {
+            visibility = sample_shadow_mask(point.pixel_coord, view_depth);
+        } else {
+            visibility =
+                shadow_mapping(point.world_pos, view_depth, point.pixel_coord, shadow_mode);
+        }
+    }
+
+    vec3 punctual_luminance = shade_punctual_lights(point, surface, view_direction, view_depth);
+
+    return ambient + luminance * visibility + punctual_luminance;
+}
+
+// Returns the outgoing radiance
+vec3 shade_surface(Material material, SurfacePoint point, vec3 base_color, bool use_shadow_mask) {
+    float ambient_occlusion = sample_material_texture(material.occlusion_texture_index, point).r;
+
+    vec2 metallic_roughness =
+        sample_material_texture(material.metallic_roughness_texture_index, point).bg;
+    float metallic = metallic_roughness.r * material.metallic_factor;
+    float perceptual_roughness = metallic_roughness.g * material.roughness_factor;
+
+    Surface surface = make_surface(base_color, point.normal, metallic, perceptual_roughness);
+
+    vec3 emission = sample_material_texture(material.emissive_texture_index, point).xyz *
+                    material.emissive_factor;
+
+    return shade_lighting(point, surface, ambient_occlusion, use_shadow_mask) + emission;
+}
+
+#endif // CHARLIE3D_SHADING_GLSL
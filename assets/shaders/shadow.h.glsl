@@ -2,8 +2,24 @@
 #define CHARLIE3D_SHADOW_GLSL
 
 #include "prelude.h.glsl"
+#include "scene_data.h.glsl"
 
-layout (set = 0, binding = 2) uniform sampler2D shadow_map;
+// Each layer is a shadow cascade
+layout (set = 0, binding = 2) uniform sampler2DArray shadow_map;
+// The same image with a LESS_OR_EQUAL comparison sampler
+layout (set = 0, binding = 3) uniform sampler2DArrayShadow shadow_map_compare;
+// Tiled blue noise that rotates the sample patterns of the hardware filtering path
+layout (set = 0, binding = 4) uniform sampler2D blue_noise;
+
+// Sample counts of the hardware filtering path (at most 16)
+layout (constant_id = 0) const int SHADOW_BLOCKER_SEARCH_SAMPLE_COUNT = 4;
+layout (constant_id = 1) const int SHADOW_PCF_SAMPLE_COUNT = 8;
+
+const mat4 light_space_to_NDC = mat4(
+    0.5, 0.0, 0.0, 0.0,
+    0.0, 0.5, 0.0, 0.0,
+    0.0, 0.0, 1.0, 0.0,
+    0.5, 0.5, 0.0, 1.0);
 
 const float sun_light_size = 20.0f;
 
@@ -28,11 +44,11 @@ const vec2 poisson_disk_16[SHADOW_SAMPLE_COUNT] = vec2[](
 );
 
 
-float shadow_map_proj(vec4 shadow_coord)
+float shadow_map_proj(vec4 shadow_coord, float cascade)
 {
     if (0.0 < shadow_coord.z && shadow_coord.z < 1.0)
     {
-        float z = texture(shadow_map, shadow_coord.xy).r;
+        float z = texture(shadow_map, vec3(shadow_coord.xy, cascade)).r;
         if (shadow_coord.w > 0.0 && z < shadow_coord.z)
         {
             return 0.0;
@@ -60,7 +76,7 @@ mat2 rotation2d(float angle) {
 
 
 // percentage closer filter
-float shadow_PCF(vec4 shadow_coord, vec2 texel_size, float scale) {
+float shadow_PCF(vec4 shadow_coord, vec2 texel_size, float scale, float cascade) {
     float visibility = 0.0;
     for (int i = 0; i < SHADOW_SAMPLE_COUNT; ++i) {
         int index = int(random4(vec4(shadow_coord.xyz, i)) * 16.0) % 16;
@@ -68,24 +84,24 @@ float shadow_PCF(vec4 shadow_coord, vec2 texel_size, float scale) {
 
         vec2 offset = poisson_disk_16[i] * scale * texel_size;
         offset = rotation2d(rotate) * offset;
-        visibility += shadow_map_proj(shadow_coord + vec4(offset, 0.0, 0.0));
+        visibility += shadow_map_proj(shadow_coord + vec4(offset, 0.0, 0.0), cascade);
     }
     return visibility / float(SHADOW_SAMPLE_COUNT);
 }
 
 // Calculate the average depth of occluders
 // return false if no blocker
-bool estimate_blocker_depth(vec2 uv, float z_receiver, out float z_blocker) {
+bool estimate_blocker_depth(vec2 uv, float z_receiver, float cascade, out float z_blocker) {
     int blocker_count = 0;
     float blocker_depth_sum = 0.0;
 
-    ivec2 tex_dim = textureSize(shadow_map, 0);
+    ivec2 tex_dim = textureSize(shadow_map, 0).xy;
     vec2 delta = vec2(1.0) / tex_dim * 5.0;
 
     for (int i = 0; i < 4; i++) {
         int index = int(random4(vec4(uv, z_receiver, i)) * 16.0) % 16;
         vec2 offset = poisson_disk_16[index] * delta;
-        float depth_on_shadow_map = texture(shadow_map, uv + offset).r;
+        float depth_on_shadow_map = texture(shadow_map, vec3(uv + offset, cascade)).r;
         if (depth_on_shadow_map < z_receiver) {
             blocker_count++;
             blocker_depth_sum += depth_on_shadow_map;
@@ -99,28 +115,116 @@ bool estimate_blocker_depth(vec2 uv, float z_receiver, out float z_blocker) {
     return true;
 }
 
-float shadow_PCSS(vec4 shadow_coord, vec2 texel_size, float light_size) {
+float shadow_PCSS(vec4 shadow_coord, vec2 texel_size, float light_size, float cascade) {
     float z_receiver = shadow_coord.z;
 
     float z_blocker;
-    bool has_blocker = estimate_blocker_depth(shadow_coord.xy, z_receiver, z_blocker);
+    bool has_blocker = estimate_blocker_depth(shadow_coord.xy, z_receiver, cascade, z_blocker);
     if (!has_blocker) { return 1.0; } // Fully visible if no blockers
 
     float penumbra_size = (z_receiver - z_blocker) * light_size / z_blocker;
-    return shadow_PCF(shadow_coord, texel_size, penumbra_size);
+    return shadow_PCF(shadow_coord, texel_size, penumbra_size, cascade);
+}
+
+// Hardware filtering path
+// Blocker search gathers 2x2 depth texels per sample, and PCF uses bilinear depth comparisons. The
+// sample patterns are rotated by blue noise instead of a per-sample hash
+
+float blue_noise_rotation(vec2 pixel_coord) {
+    ivec2 size = textureSize(blue_noise, 0);
+    return texelFetch(blue_noise, ivec2(pixel_coord) % size, 0).r * TWO_PI;
+}
+
+float shadow_PCF_hardware(vec4 shadow_coord, vec2 texel_size, float scale, float cascade,
+                          mat2 rotation) {
+    float visibility = 0.0;
+    for (int i = 0; i < SHADOW_PCF_SAMPLE_COUNT; ++i) {
+        vec2 offset = rotation * (poisson_disk_16[i] * scale * texel_size);
+        visibility += texture(shadow_map_compare,
+                              vec4(shadow_coord.xy + offset, cascade, shadow_coord.z));
+    }
+    return visibility / float(SHADOW_PCF_SAMPLE_COUNT);
+}
+
+bool estimate_blocker_depth_gather(vec2 uv, float z_receiver, float cascade, mat2 rotation,
+                                   out float z_blocker) {
+    float blocker_count = 0.0;
+    float blocker_depth_sum = 0.0;
+
+    vec2 delta = vec2(1.0) / textureSize(shadow_map, 0).xy * 5.0;
+
+    for (int i = 0; i < SHADOW_BLOCKER_SEARCH_SAMPLE_COUNT; ++i) {
+        vec2 offset = rotation * (poisson_disk_16[i] * delta);
+        vec4 depths = textureGather(shadow_map, vec3(uv + offset, cascade), 0);
+        vec4 is_blocker = vec4(lessThan(depths, vec4(z_receiver)));
+        blocker_count += dot(is_blocker, vec4(1.0));
+        blocker_depth_sum += dot(is_blocker, depths);
+    }
+
+    if (blocker_count == 0.0) return false;
+
+    z_blocker = blocker_depth_sum / blocker_count;
+    return true;
+}
+
+float shadow_PCSS_hardware(vec4 shadow_coord, vec2 texel_size, float light_size, float cascade,
+                           mat2 rotation) {
+    float z_receiver = shadow_coord.z;
+
+    float z_blocker;
+    if (!estimate_blocker_depth_gather(shadow_coord.xy, z_receiver, cascade, rotation, z_blocker)) {
+        return 1.0;
+    }
+
+    float penumbra_size = (z_receiver - z_blocker) * light_size / z_blocker;
+    return shadow_PCF_hardware(shadow_coord, texel_size, penumbra_size, cascade, rotation);
+}
+
+vec4 shadow_coord_of_cascade(vec3 world_pos, uint cascade) {
+    return light_space_to_NDC * scene_data.sunlight_view_proj[cascade] * vec4(world_pos, 1.0);
+}
+
+// Returns the first cascade that covers a view space depth, or the cascade count if none does
+uint select_shadow_cascade(float view_depth) {
+    for (uint i = 0; i < scene_data.sunlight_cascade_count; ++i) {
+        if (view_depth < scene_data.sunlight_cascade_splits[i]) {
+            return i;
+        }
+    }
+    return scene_data.sunlight_cascade_count;
 }
 
 // Returns a visibility between [0, 1]
-float shadow_mapping(vec4 shadow_coord, uint shadow_mode) {
-    ivec2 shadow_map_size = textureSize(shadow_map, 0);
+// `pixel_coord` is the screen position of the shaded point, which indexes the blue noise
+float shadow_mapping(vec3 world_pos, float view_depth, vec2 pixel_coord, uint shadow_mode) {
+    uint cascade = select_shadow_cascade(view_depth);
+    // Beyond the shadow distance
+    if (cascade == scene_data.sunlight_cascade_count) {
+        return 1.0;
+    }
+    vec4 shadow_coord = shadow_coord_of_cascade(world_pos, cascade);
+
+    ivec2 shadow_map_size = textureSize(shadow_map, 0).xy;
     vec2 shadow_texel_size = vec2(1.0) / shadow_map_size;
 
     if (shadow_mode == 1) {
-        return shadow_map_proj(shadow_coord);
+        return shadow_map_proj(shadow_coord, float(cascade));
+    } else if (scene_data.sunlight_shadow_filtering != 0) {
+        // Beyond the far plane of the cascade
+        if (shadow_coord.z >= 1.0) { return 1.0; }
+
+        mat2 rotation = rotation2d(blue_noise_rotation(pixel_coord));
+        if (shadow_mode == 2) {
+            return shadow_PCF_hardware(shadow_coord, shadow_texel_size, 1.0, float(cascade),
+                                       rotation);
+        } else { // 3
+            return shadow_PCSS_hardware(shadow_coord, shadow_texel_size, sun_light_size,
+                                        float(cascade), rotation);
+        }
     } else if (shadow_mode == 2) {
-        return shadow_PCF(shadow_coord, shadow_texel_size, 1.0);
+        return shadow_PCF(shadow_coord, shadow_texel_size, 1.0, float(cascade));
     } else { // 3
-             return shadow_PCSS(shadow_coord, shadow_texel_size, sun_light_size);
+             return shadow_PCSS(shadow_coord, shadow_texel_size, sun_light_size, float(cascade));
     }
 }
 
@@ -2,8 +2,16 @@
 
 layout (location = 0) in vec3 in_pos;
 
+#include "prelude.h.glsl"
 #include "scene_data.h.glsl"
 #include "object_data.h.glsl"
+#include "draw_data.h.glsl"
+
+layout (push_constant) uniform constants
+{
+    DrawsBuffer draws_buffer;
+    uint cascade_index;
+};
 
 out gl_PerVertex
 {
@@ -12,6 +20,7 @@ out gl_PerVertex
 
 void main()
 {
-    mat4 model = object_buffer.objects[gl_BaseInstance].model;
-    gl_Position = scene_data.sunlight_view_proj * model * vec4(in_pos, 1.0);
-}
\ No newline at end of file
+    Draw draw = draws_buffer.draws[gl_InstanceIndex];
+    mat4 model = object_buffer.objects[draw.node_index].model;
+    gl_Position = scene_data.sunlight_view_proj[cascade_index] * model * vec4(in_pos, 1.0);
+}
@@ -0,0 +1,45 @@
+#version 460
+
+#include "prelude.h.glsl"
+#include "camera_data.h.glsl"
+#include "scene_data.h.glsl"
+#include "shadow.h.glsl"
+
+// Evaluates the sun visibility once per texel of a half resolution screen-space mask, at the
+// positions reconstructed from the depth prepass. Each texel also stores the view space depth it
+// was evaluated at, for the bilateral upsampling in shadow_mask.h.glsl
+
+layout (set = 1, binding = 0) uniform sampler2D depth_image;
+layout (set = 1, binding = 1, rg16f) uniform writeonly image2D out_shadow_mask;
+
+const float max_half_float = 65504.0;
+
+layout (local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+void main() {
+    ivec2 position = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(position, imageSize(out_shadow_mask)))) {
+        return;
+    }
+
+    ivec2 depth_size = textureSize(depth_image, 0);
+    ivec2 pixel = min(position * 2, depth_size - 1);
+    float depth = texelFetch(depth_image, pixel, 0).r;
+
+    // Nothing got rendered at this pixel (reverse-Z clears to 0)
+    if (depth == 0.0) {
+        imageStore(out_shadow_mask, position, vec4(1.0, max_half_float, 0.0, 0.0));
+        return;
+    }
+
+    // The main viewport is flipped vertically
+    vec2 pixel_center = vec2(pixel) + vec2(0.5);
+    vec2 uv = pixel_center / vec2(depth_size);
+    vec4 clip_pos = vec4(uv.x * 2.0 - 1.0, 1.0 - uv.y * 2.0, depth, 1.0);
+    vec4 world_pos = camera.inverse_view_proj * clip_pos;
+    world_pos /= world_pos.w;
+
+    float view_depth = -(camera.view * vec4(world_pos.xyz, 1.0)).z;
+    float visibility = shadow_mapping(world_pos.xyz, view_depth, pixel_center,
+                                      scene_data.sunlight_shadow_mode);
+    imageStore(out_shadow_mask, position, vec4(visibility, view_depth, 0.0, 0.0));
+}
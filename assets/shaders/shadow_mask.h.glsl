@@ -0,0 +1,37 @@
+#ifndef CHARLIE3D_SHADOW_MASK_GLSL
+#define CHARLIE3D_SHADOW_MASK_GLSL
+
+// Half resolution sun visibility (r) and the view space depth it was evaluated at (g)
+layout (set = 0, binding = 5) uniform sampler2D shadow_mask;
+
+// Depth-aware bilateral upsampling of the shadow mask. The four nearest mask texels are weighted
+// bilinearly and by how close their depths are to the depth of the shaded pixel, so that shadows
+// don't bleed across depth discontinuities
+float sample_shadow_mask(vec2 pixel_coord, float view_depth) {
+    ivec2 mask_size = textureSize(shadow_mask, 0);
+
+    // Mask texel i was evaluated at the center of the full resolution pixel 2i
+    vec2 mask_coord = (pixel_coord - vec2(0.5)) * 0.5;
+    ivec2 base_texel = ivec2(floor(mask_coord));
+    vec2 t = mask_coord - vec2(base_texel);
+
+    float visibility_sum = 0.0;
+    float weight_sum = 0.0;
+    for (int y = 0; y < 2; ++y) {
+        for (int x = 0; x < 2; ++x) {
+            ivec2 texel = clamp(base_texel + ivec2(x, y), ivec2(0), mask_size - 1);
+            vec2 visibility_and_depth = texelFetch(shadow_mask, texel, 0).rg;
+
+            float bilinear_weight = (x == 0 ? 1.0 - t.x : t.x) * (y == 0 ? 1.0 - t.y : t.y);
+            float relative_depth_difference =
+                abs(visibility_and_depth.g - view_depth) / max(view_depth, 1e-4);
+            float weight = bilinear_weight / (relative_depth_difference + 1e-3) + 1e-5;
+
+            visibility_sum += visibility_and_depth.r * weight;
+            weight_sum += weight;
+        }
+    }
+    return visibility_sum / weight_sum;
+}
+
+#endif // CHARLIE3D_SHADOW_MASK_GLSL
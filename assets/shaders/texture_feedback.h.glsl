@@ -0,0 +1,23 @@
+#ifndef CHARLIE3D_TEXTURE_FEEDBACK_GLSL
+#define CHARLIE3D_TEXTURE_FEEDBACK_GLSL
+
+#include "prelude.h.glsl"
+
+// Texture streaming feedback
+// For each material, the highest texel density (in log2 texels per UV unit) it was sampled with,
+// plus one. Zero is the cleared value and means that the material was not sampled at all
+layout (buffer_reference, std430) restrict buffer TextureFeedbackBuffer {
+    uint densities[];
+};
+
+// Only one pixel of every 4x4 block writes feedback to keep the atomic traffic low
+void write_texture_feedback(TextureFeedbackBuffer feedback, uint material_index,
+                            vec2 uv_dx, vec2 uv_dy, uvec2 pixel) {
+    if (any(notEqual(pixel & 3u, uvec2(0)))) { return; }
+
+    float footprint = max(length(uv_dx), length(uv_dy));
+    uint density = uint(clamp(ceil(-log2(max(footprint, 1e-10))), 0.0, 31.0));
+    atomicMax(feedback.densities[material_index], density + 1u);
+}
+
+#endif // CHARLIE3D_TEXTURE_FEEDBACK_GLSL
@@ -1,9 +1,16 @@
 #version 460
 
+#include "prelude.h.glsl"
+#include "exposure.h.glsl"
+
 layout (location = 0) out vec4 out_frag_color;
 
 layout (set = 0, binding = 0) uniform sampler2D final_hdr_texture;
 
+layout (push_constant) uniform constants {
+    ExposureBuffer exposure_buffer; // Written by auto_exposure.comp.glsl
+};
+
 layout (location = 0) in vec2 v_uv;
 
 
@@ -27,6 +34,6 @@ vec3 tone_mapping(vec3 x) {
 
 void main() {
     vec3 color = texture(final_hdr_texture, v_uv).xyz;
-    color = tone_mapping(color);
+    color = tone_mapping(color * exposure_buffer.exposure);
     out_frag_color = vec4(color, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,24 @@
+#ifndef CHARLIE3D_VERTEX_DATA_GLSL
+#define CHARLIE3D_VERTEX_DATA_GLSL
+
+#include "prelude.h.glsl"
+
+layout (buffer_reference, scalar) readonly restrict buffer PositionBuffer {
+    vec3 position[];
+};
+
+struct Vertex {
+    vec2 normal;
+    vec2 tex_coord;
+    vec4 tangent;
+};
+
+layout (buffer_reference, std430) readonly restrict buffer VertexBuffer {
+    Vertex vertices[];
+};
+
+layout (buffer_reference, scalar) readonly restrict buffer IndexBuffer {
+    uint indices[];
+};
+
+#endif // CHARLIE3D_VERTEX_DATA_GLSL
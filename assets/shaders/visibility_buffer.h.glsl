@@ -0,0 +1,20 @@
+#ifndef CHARLIE3D_VISIBILITY_BUFFER_GLSL
+#define CHARLIE3D_VISIBILITY_BUFFER_GLSL
+
+// Each visibility buffer texel packs the index of the draw and the index of the triangle in that
+// draw. Must match the limits in renderer.hpp
+#define VISIBILITY_TRIANGLE_BITS 18
+#define VISIBILITY_TRIANGLE_MASK ((1u << VISIBILITY_TRIANGLE_BITS) - 1u)
+// Pixels that are not covered by any solid draw
+#define VISIBILITY_EMPTY 0xFFFFFFFFu
+
+uint pack_visibility(uint draw_index, uint triangle_index) {
+    return (draw_index << VISIBILITY_TRIANGLE_BITS) | (triangle_index & VISIBILITY_TRIANGLE_MASK);
+}
+
+void unpack_visibility(uint visibility, out uint draw_index, out uint triangle_index) {
+    draw_index = visibility >> VISIBILITY_TRIANGLE_BITS;
+    triangle_index = visibility & VISIBILITY_TRIANGLE_MASK;
+}
+
+#endif // CHARLIE3D_VISIBILITY_BUFFER_GLSL
@@ -0,0 +1,143 @@
+#version 460
+
+#include "prelude.h.glsl"
+#include "camera_data.h.glsl"
+#include "object_data.h.glsl"
+#include "mesh_push_constant.h.glsl"
+#include "octahedron_encoding.h.glsl"
+#include "shading.h.glsl"
+#include "visibility_buffer.h.glsl"
+
+// Shades every pixel covered by a solid draw exactly once. The attributes of the visible triangle
+// are fetched from the mesh buffers and interpolated with perspective-correct barycentrics, whose
+// screen-space derivatives replace the ones a fragment shader would get from its 2x2 quad
+
+layout (set = 3, binding = 0, r32ui) uniform readonly uimage2D visibility_buffer;
+// Without a format qualifier, since the format of the HDR image is configurable
+layout (set = 3, binding = 1) uniform writeonly image2D out_color;
+
+// Clear color of the forward mesh pass
+const vec4 background_color = vec4(1.0);
+
+struct Barycentrics {
+    vec3 lambda;
+    vec3 ddx; // Change of lambda per pixel to the right
+    vec3 ddy; // Change of lambda per pixel downwards
+};
+
+// "Perspective-correct interpolation" from Schied and Dachsbacher, High-Performance Graphics 2015
+Barycentrics compute_barycentrics(vec4 clip0, vec4 clip1, vec4 clip2, vec2 pixel_ndc,
+                                  vec2 screen_size) {
+    Barycentrics result;
+
+    vec3 inv_w = 1.0 / vec3(clip0.w, clip1.w, clip2.w);
+    vec2 ndc0 = clip0.xy * inv_w.x;
+    vec2 ndc1 = clip1.xy * inv_w.y;
+    vec2 ndc2 = clip2.xy * inv_w.z;
+
+    float inv_det = 1.0 / determinant(mat2(ndc2 - ndc1, ndc0 - ndc1));
+    result.ddx = vec3(ndc1.y - ndc2.y, ndc2.y - ndc0.y, ndc0.y - ndc1.y) * inv_det * inv_w;
+    result.ddy = vec3(ndc2.x - ndc1.x, ndc0.x - ndc2.x, ndc1.x - ndc0.x) * inv_det * inv_w;
+    float ddx_sum = dot(result.ddx, vec3(1.0));
+    float ddy_sum = dot(result.ddy, vec3(1.0));
+
+    vec2 delta = pixel_ndc - ndc0;
+    float interpolated_inv_w = inv_w.x + delta.x * ddx_sum + delta.y * ddy_sum;
+    float interpolated_w = 1.0 / interpolated_inv_w;
+
+    result.lambda =
+        interpolated_w * (vec3(inv_w.x, 0.0, 0.0) + delta.x * result.ddx + delta.y * result.ddy);
+
+    // From NDC units to pixels. NDC y points up while pixel rows go down (the viewport is flipped)
+    result.ddx *= 2.0 / screen_size.x;
+    result.ddy *= -2.0 / screen_size.y;
+    ddx_sum *= 2.0 / screen_size.x;
+    ddy_sum *= -2.0 / screen_size.y;
+
+    float interpolated_w_ddx = 1.0 / (interpolated_inv_w + ddx_sum);
+    float interpolated_w_ddy = 1.0 / (interpolated_inv_w + ddy_sum);
+    result.ddx =
+        interpolated_w_ddx * (result.lambda * interpolated_inv_w + result.ddx) - result.lambda;
+    result.ddy =
+        interpolated_w_ddy * (result.lambda * interpolated_inv_w + result.ddy) - result.lambda;
+
+    return result;
+}
+
+vec3 interpolate(Barycentrics barycentrics, vec3 v0, vec3 v1, vec3 v2) {
+    return barycentrics.lambda.x * v0 + barycentrics.lambda.y * v1 + barycentrics.lambda.z * v2;
+}
+
+// Also outputs the screen-space derivatives of the attribute
+vec2 interpolate_with_derivatives(Barycentrics barycentrics, vec2 v0, vec2 v1, vec2 v2,
+                                  out vec2 ddx, out vec2 ddy) {
+    mat3x2 attributes = mat3x2(v0, v1, v2);
+    ddx = attributes * barycentrics.ddx;
+    ddy = attributes * barycentrics.ddy;
+    return attributes * barycentrics.lambda;
+}
+
+layout (local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+void main() {
+    ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 screen_size = imageSize(out_color);
+    if (any(greaterThanEqual(pixel, screen_size))) {
+        return;
+    }
+
+    uint visibility = imageLoad(visibility_buffer, pixel).r;
+    if (visibility == VISIBILITY_EMPTY) {
+        imageStore(out_color, pixel, background_color);
+        return;
+    }
+
+    uint draw_index;
+    uint triangle_index;
+    unpack_visibility(visibility, draw_index, triangle_index);
+
+    Draw draw = draws_buffer.draws[draw_index];
+    mat4 model = object_buffer.objects[draw.node_index].model;
+
+    uint first_index = draw.index_offset + triangle_index * 3;
+    uint vertex_indices[3];
+    vec3 world_positions[3];
+    vec4 clip_positions[3];
+    vec3 normals[3];
+    vec2 tex_coords[3];
+    for (int i = 0; i < 3; ++i) {
+        vertex_indices[i] = uint(int(index_buffer.indices[first_index + i]) + draw.vertex_offset);
+        vec3 position = position_buffer.position[vertex_indices[i]];
+        Vertex vertex = vertex_buffer.vertices[vertex_indices[i]];
+
+        // Must match mesh.vert.glsl
+        world_positions[i] = (model * vec4(position, 1.0)).xyz;
+        clip_positions[i] = camera.view_proj * model * vec4(position, 1.0);
+        normals[i] = normalize(inverse(mat3(model)) * vec3_from_oct(vertex.normal));
+        tex_coords[i] = vertex.tex_coord;
+    }
+
+    vec2 pixel_center = vec2(pixel) + vec2(0.5);
+    vec2 uv = pixel_center / vec2(screen_size);
+    vec2 pixel_ndc = vec2(uv.x * 2.0 - 1.0, 1.0 - uv.y * 2.0);
+    Barycentrics barycentrics = compute_barycentrics(
+        clip_positions[0], clip_positions[1], clip_positions[2], pixel_ndc, vec2(screen_size));
+
+    SurfacePoint point;
+    point.world_pos = interpolate(barycentrics, world_positions[0], world_positions[1],
+                                  world_positions[2]);
+    point.view_pos = (camera.view * vec4(point.world_pos, 1.0)).xyz;
+    point.normal = normalize(interpolate(barycentrics, normals[0], normals[1], normals[2]));
+    point.tex_coord = interpolate_with_derivatives(barycentrics, tex_coords[0], tex_coords[1],
+                                                   tex_coords[2], point.tex_coord_dx,
+                                                   point.tex_coord_dy);
+    point.pixel_coord = pixel_center;
+
+    write_texture_feedback(texture_feedback_buffer, draw.material_index, point.tex_coord_dx,
+                           point.tex_coord_dy, uvec2(pixel));
+
+    // The alpha test already happened in the visibility buffer pass
+    Material material = material_buffer.materials[draw.material_index];
+    vec3 base_color = material_albedo(material, point).rgb;
+    vec3 Lo = shade_surface(material, point, base_color, true);
+    imageStore(out_color, pixel, vec4(Lo, 1.0));
+}
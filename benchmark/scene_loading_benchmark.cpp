@@ -0,0 +1,478 @@
+// Microbenchmarks of scene loading. Everything runs on the CPU, so no GPU is needed.
+//
+// The scenes are the glTF files bundled in the assets folder, plus synthetic scenes that are
+// generated into a temporary directory at startup, so that the numbers don't depend on which
+// assets are checked out. Catch2 reports the mean and the standard deviation of each benchmark
+// with bootstrapped confidence intervals. To track regressions, keep the machine otherwise idle
+// and save the results, e.g.
+//     charlie3d_benchmark --benchmark-samples 200 --reporter xml --out scene_loading.xml
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include "../Charlie/asset_handling/cpu_image.hpp"
+#include "../Charlie/asset_handling/cpu_mesh.hpp"
+#include "../Charlie/asset_handling/gltf_loader.hpp"
+#include "../Charlie/asset_handling/gltf_loader_stages.hpp"
+#include "../Charlie/utils/asset_path.hpp"
+
+#include <beyond/math/transform.hpp>
+
+#include <fmt/format.h>
+#include <stb_image.h>
+#include <stb_image_write.h>
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <numbers>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace charlie;
+
+namespace {
+
+struct SyntheticSceneDesc {
+  std::string name;
+  u32 grid_resolution = 0; // Quads per side of the grid that every mesh uses
+  u32 mesh_count = 0;
+  u32 node_depth = 0; // The leaves of the node tree reference the meshes
+  u32 node_fanout = 0;
+  u32 image_count = 0; // PNG textures
+  u32 image_size = 0;
+};
+
+const std::array synthetic_scene_descs = {
+    SyntheticSceneDesc{.name = "synthetic small",
+                       .grid_resolution = 32,
+                       .mesh_count = 16,
+                       .node_depth = 3,
+                       .node_fanout = 4,
+                       .image_count = 4,
+                       .image_size = 128},
+    SyntheticSceneDesc{.name = "synthetic large",
+                       .grid_resolution = 64,
+                       .mesh_count = 256,
+                       .node_depth = 5,
+                       .node_fanout = 6,
+                       .image_count = 16,
+                       .image_size = 512},
+};
+
+// Deterministic, so that every run measures the same data
+[[nodiscard]] auto hash_u32(u32 x) -> u32
+{
+  x ^= x >> 16;
+  x *= 0x7feb352d;
+  x ^= x >> 15;
+  x *= 0x846ca68b;
+  x ^= x >> 16;
+  return x;
+}
+
+// A gradient with some noise, so that the encoders can't compress it too well
+[[nodiscard]] auto make_test_image(u32 size) -> CPUImage
+{
+  CPUImage image{
+      .name = "Benchmark Image",
+      .width = size,
+      .height = size,
+      .components = 4,
+      .data = std::make_unique_for_overwrite<u8[]>(usize{size} * size * 4),
+  };
+  for (u32 y = 0; y < size; ++y) {
+    for (u32 x = 0; x < size; ++x) {
+      u8* texel = image.data.get() + (usize{y} * size + x) * 4;
+      const u32 noise = hash_u32(y * size + x);
+      texel[0] = static_cast<u8>(x * 255 / size + (noise & 15));
+      texel[1] = static_cast<u8>(y * 255 / size + ((noise >> 4) & 15));
+      texel[2] = static_cast<u8>((x ^ y) + ((noise >> 8) & 15));
+      texel[3] = 255;
+    }
+  }
+  return image;
+}
+
+using ImageWriter = int (*)(stbi_write_func* func, void* context, int w, int h, int comp,
+                            const void* data);
+
+[[nodiscard]] auto encode_image(const CPUImage& image, ImageWriter write) -> std::vector<u8>
+{
+  std::vector<u8> bytes;
+  const auto append = [](void* context, void* data, int size) {
+    const auto* begin = static_cast<const u8*>(data);
+    static_cast<std::vector<u8>*>(context)->insert(
+        static_cast<std::vector<u8>*>(context)->end(), begin, begin + size);
+  };
+  const int result = write(append, &bytes, narrow<int>(image.width), narrow<int>(image.height),
+                           narrow<int>(image.components), image.data.get());
+  BEYOND_ENSURE(result != 0);
+  return bytes;
+}
+
+struct GridMesh {
+  std::vector<Point3> positions;
+  std::vector<Vec3> normals;
+  std::vector<Vec2> tex_coords;
+  std::vector<Vec4> tangents;
+  std::vector<u32> indices;
+};
+
+// A gently rolling terrain
+[[nodiscard]] auto make_grid_mesh(u32 resolution) -> GridMesh
+{
+  GridMesh mesh;
+  const u32 side = resolution + 1;
+  for (u32 z = 0; z < side; ++z) {
+    for (u32 x = 0; x < side; ++x) {
+      const f32 fx = static_cast<f32>(x) / static_cast<f32>(resolution);
+      const f32 fz = static_cast<f32>(z) / static_cast<f32>(resolution);
+      const f32 height = 0.05f * std::sin(fx * 20.f) * std::cos(fz * 15.f);
+      const f32 dx = std::cos(fx * 20.f) * std::cos(fz * 15.f);
+      const f32 dz = -0.75f * std::sin(fx * 20.f) * std::sin(fz * 15.f);
+      const f32 length = std::sqrt(dx * dx + 1.f + dz * dz);
+
+      mesh.positions.push_back(Point3{fx - 0.5f, height, fz - 0.5f});
+      mesh.normals.push_back(Vec3{-dx / length, 1.f / length, -dz / length});
+      mesh.tex_coords.push_back(Vec2{fx, fz});
+      mesh.tangents.push_back(Vec4{1, 0, 0, 1});
+    }
+  }
+  for (u32 z = 0; z < resolution; ++z) {
+    for (u32 x = 0; x < resolution; ++x) {
+      const u32 i = z * side + x;
+      for (const u32 index : {i, i + side, i + 1, i + 1, i + side, i + side + 1}) {
+        mesh.indices.push_back(index);
+      }
+    }
+  }
+  return mesh;
+}
+
+template <typename T> void append_bytes(std::vector<char>& buffer, const std::vector<T>& data)
+{
+  const auto* begin = reinterpret_cast<const char*>(data.data());
+  buffer.insert(buffer.end(), begin, begin + data.size() * sizeof(T));
+}
+
+// Writes a glTF file with a binary buffer and PNG images into `directory`
+[[nodiscard]] auto write_synthetic_scene(const SyntheticSceneDesc& desc,
+                                         const std::filesystem::path& directory)
+    -> std::filesystem::path
+{
+  std::filesystem::create_directories(directory);
+
+  const GridMesh grid = make_grid_mesh(desc.grid_resolution);
+  std::vector<char> buffer;
+  std::vector<usize> view_offsets;
+  view_offsets.push_back(buffer.size());
+  append_bytes(buffer, grid.positions);
+  view_offsets.push_back(buffer.size());
+  append_bytes(buffer, grid.normals);
+  view_offsets.push_back(buffer.size());
+  append_bytes(buffer, grid.tex_coords);
+  view_offsets.push_back(buffer.size());
+  append_bytes(buffer, grid.tangents);
+  view_offsets.push_back(buffer.size());
+  append_bytes(buffer, grid.indices);
+  view_offsets.push_back(buffer.size());
+  std::ofstream bin_file{directory / "scene.bin", std::ios::binary};
+  bin_file.write(buffer.data(), narrow<std::streamsize>(buffer.size()));
+
+  const auto vertex_count = grid.positions.size();
+  std::string json = R"({"asset": {"version": "2.0"}, "scene": 0, "scenes": [{"nodes": [0]}],)";
+  fmt::format_to(std::back_inserter(json),
+                 R"("buffers": [{{"uri": "scene.bin", "byteLength": {}}}], "bufferViews": [)",
+                 buffer.size());
+  for (usize i = 0; i + 1 < view_offsets.size(); ++i) {
+    fmt::format_to(std::back_inserter(json),
+                   R"({}{{"buffer": 0, "byteOffset": {}, "byteLength": {}}})", i == 0 ? "" : ", ",
+                   view_offsets[i], view_offsets[i + 1] - view_offsets[i]);
+  }
+  fmt::format_to(
+      std::back_inserter(json),
+      R"(], "accessors": [)"
+      R"({{"bufferView": 0, "componentType": 5126, "count": {0}, "type": "VEC3", )"
+      R"("min": [-0.5, -0.05, -0.5], "max": [0.5, 0.05, 0.5]}}, )"
+      R"({{"bufferView": 1, "componentType": 5126, "count": {0}, "type": "VEC3"}}, )"
+      R"({{"bufferView": 2, "componentType": 5126, "count": {0}, "type": "VEC2"}}, )"
+      R"({{"bufferView": 3, "componentType": 5126, "count": {0}, "type": "VEC4"}}, )"
+      R"({{"bufferView": 4, "componentType": 5125, "count": {1}, "type": "SCALAR"}}], )",
+      vertex_count, grid.indices.size());
+
+  json += R"("meshes": [)";
+  for (u32 i = 0; i < desc.mesh_count; ++i) {
+    const std::string material =
+        desc.image_count == 0 ? "" : fmt::format(R"(, "material": {})", i % desc.image_count);
+    fmt::format_to(std::back_inserter(json),
+                   R"({}{{"primitives": [{{"attributes": {{"POSITION": 0, "NORMAL": 1, )"
+                   R"("TEXCOORD_0": 2, "TANGENT": 3}}, "indices": 4{}}}]}})",
+                   i == 0 ? "" : ", ", material);
+  }
+  json += "]";
+
+  if (desc.image_count > 0) {
+    const CPUImage image = make_test_image(desc.image_size);
+    std::string images, textures, materials;
+    for (u32 i = 0; i < desc.image_count; ++i) {
+      const std::string file_name = fmt::format("image{}.png", i);
+      BEYOND_ENSURE(save_image_to_png(image, directory / file_name));
+      const std::string_view separator = i == 0 ? "" : ", ";
+      fmt::format_to(std::back_inserter(images), R"({}{{"uri": "{}"}})", separator, file_name);
+      fmt::format_to(std::back_inserter(textures), R"({}{{"source": {}}})", separator, i);
+      fmt::format_to(std::back_inserter(materials),
+                     R"({}{{"pbrMetallicRoughness": {{"baseColorTexture": {{"index": {}}}}}}})",
+                     separator, i);
+    }
+    fmt::format_to(std::back_inserter(json),
+                   R"(, "images": [{}], "textures": [{}], "materials": [{}])", images, textures,
+                   materials);
+  }
+
+  // A complete tree in breadth-first order, so node i has the children
+  // [i * fanout + 1, i * fanout + fanout]
+  u32 node_count = 0;
+  u32 level_size = 1;
+  for (u32 level = 0; level <= desc.node_depth; ++level) {
+    node_count += level_size;
+    level_size *= desc.node_fanout;
+  }
+  const u32 leaf_begin = node_count - level_size / desc.node_fanout;
+
+  json += R"(, "nodes": [)";
+  for (u32 i = 0; i < node_count; ++i) {
+    const f32 angle = static_cast<f32>(i % 16) * std::numbers::pi_v<f32> / 8.f;
+    fmt::format_to(std::back_inserter(json),
+                   R"({}{{"translation": [{}, 0, {}], "rotation": [0, {}, 0, {}])",
+                   i == 0 ? "" : ", ", static_cast<f32>(i % desc.node_fanout) * 1.5f,
+                   static_cast<f32>(i % 7) * 0.5f, std::sin(angle / 2), std::cos(angle / 2));
+    if (i < leaf_begin) {
+      json += R"(, "children": [)";
+      for (u32 child = 0; child < desc.node_fanout; ++child) {
+        fmt::format_to(std::back_inserter(json), "{}{}", child == 0 ? "" : ", ",
+                       i * desc.node_fanout + child + 1);
+      }
+      json += "]";
+    } else {
+      fmt::format_to(std::back_inserter(json), R"(, "mesh": {})", i % desc.mesh_count);
+    }
+    json += "}";
+  }
+  json += "]}";
+
+  const std::filesystem::path path = directory / "scene.gltf";
+  std::ofstream{path} << json;
+  return path;
+}
+
+struct BenchmarkScene {
+  std::string name;
+  std::filesystem::path path;
+};
+
+// The synthetic scenes are removed when the benchmarks exit
+class BenchmarkScenes {
+  std::filesystem::path synthetic_directory_ =
+      std::filesystem::temp_directory_path() / "charlie3d_benchmark";
+  std::vector<BenchmarkScene> scenes_;
+
+public:
+  BenchmarkScenes()
+  {
+    for (const SyntheticSceneDesc& desc : synthetic_scene_descs) {
+      std::string directory_name = desc.name;
+      std::ranges::replace(directory_name, ' ', '_');
+      const std::filesystem::path directory = synthetic_directory_ / directory_name;
+      scenes_.push_back({.name = desc.name, .path = write_synthetic_scene(desc, directory)});
+    }
+
+    // Assets that are not pulled from git-lfs fail to parse and are skipped
+    const std::filesystem::path models_path = get_asset_path() / "models";
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(models_path)) {
+      const std::filesystem::path& path = entry.path();
+      if (path.extension() != ".gltf" && path.extension() != ".glb") { continue; }
+      if (parse_gltf_from_file(path).error() != fastgltf::Error::None) {
+        WARN("Skipped " << path.string() << ", which fails to parse");
+        continue;
+      }
+      scenes_.push_back({.name = std::filesystem::relative(path, models_path).generic_string(),
+                         .path = path});
+    }
+  }
+
+  ~BenchmarkScenes()
+  {
+    std::error_code error;
+    std::filesystem::remove_all(synthetic_directory_, error);
+  }
+
+  BenchmarkScenes(const BenchmarkScenes&) = delete;
+  auto operator=(const BenchmarkScenes&) & -> BenchmarkScenes& = delete;
+  BenchmarkScenes(BenchmarkScenes&&) noexcept = delete;
+  auto operator=(BenchmarkScenes&&) & noexcept -> BenchmarkScenes& = delete;
+
+  [[nodiscard]] auto scenes() const -> const std::vector<BenchmarkScene>& { return scenes_; }
+};
+
+[[nodiscard]] auto benchmark_scenes() -> const std::vector<BenchmarkScene>&
+{
+  static const BenchmarkScenes scenes;
+  return scenes.scenes();
+}
+
+} // anonymous namespace
+
+TEST_CASE("load_gltf", "[scene-loading]")
+{
+  for (const BenchmarkScene& scene : benchmark_scenes()) {
+    BENCHMARK(fmt::format("load_gltf {}", scene.name))
+    {
+      return load_gltf(scene.path);
+    };
+  }
+}
+
+TEST_CASE("glTF loading stages", "[scene-loading]")
+{
+  for (const BenchmarkScene& scene : benchmark_scenes()) {
+    BENCHMARK(fmt::format("parse_gltf_from_file {}", scene.name))
+    {
+      return parse_gltf_from_file(scene.path);
+    };
+
+    auto maybe_asset = parse_gltf_from_file(scene.path);
+    REQUIRE(maybe_asset.error() == fastgltf::Error::None);
+    const fastgltf::Asset& asset = maybe_asset.get();
+
+    BENCHMARK(fmt::format("populate_nodes {}", scene.name))
+    {
+      return populate_nodes(asset.nodes);
+    };
+
+    BENCHMARK(fmt::format("convert_meshes {}", scene.name))
+    {
+      CPUMeshBuffers buffers;
+      return convert_meshes(asset, beyond::ref(buffers));
+    };
+  }
+}
+
+TEST_CASE("populate_global_transforms", "[scene-loading]")
+{
+  for (const u32 node_count : {1'000u, 10'000u, 100'000u}) {
+    // A tree in breadth-first order, which is topologically sorted
+    constexpr i32 fanout = 4;
+    std::vector<i32> parent_indices;
+    std::vector<Mat4> local_transforms;
+    for (u32 i = 0; i < node_count; ++i) {
+      parent_indices.push_back(i == 0 ? -1 : (narrow<i32>(i) - 1) / fanout);
+      const auto offset = static_cast<f32>(narrow<i32>(i) % fanout);
+      local_transforms.push_back(beyond::translate(Vec3{offset, 0, 1}));
+    }
+
+    BENCHMARK(fmt::format("populate_global_transforms {} nodes", node_count))
+    {
+      return populate_global_transforms(parent_indices, local_transforms);
+    };
+  }
+}
+
+TEST_CASE("Image decoding", "[scene-loading]")
+{
+  constexpr u32 image_size = 1024;
+  const CPUImage image = make_test_image(image_size);
+
+  const auto write_jpg = [](stbi_write_func* func, void* context, int w, int h, int comp,
+                            const void* data) {
+    return stbi_write_jpg_to_func(func, context, w, h, comp, data, 90);
+  };
+  const auto write_png = [](stbi_write_func* func, void* context, int w, int h, int comp,
+                            const void* data) {
+    return stbi_write_png_to_func(func, context, w, h, comp, data, w * comp);
+  };
+  const std::array<std::pair<const char*, ImageWriter>, 4> encoders = {{
+      {"PNG", write_png},
+      {"JPEG", write_jpg},
+      {"TGA", stbi_write_tga_to_func},
+      {"BMP", stbi_write_bmp_to_func},
+  }};
+  for (const auto& [format, write] : encoders) {
+    const std::vector<u8> bytes = encode_image(image, write);
+    BENCHMARK(fmt::format("decode {} {}x{}", format, image_size, image_size))
+    {
+      return load_image_from_memory(bytes, "Benchmark Image");
+    };
+  }
+
+  // The first bundled texture of each format
+  std::vector<std::string> benchmarked_extensions;
+  for (const auto& entry :
+       std::filesystem::recursive_directory_iterator(get_asset_path() / "models")) {
+    std::string extension = entry.path().extension().string();
+    std::ranges::transform(extension, extension.begin(),
+                           [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    if (extension != ".png" && extension != ".jpg" && extension != ".jpeg" &&
+        extension != ".tga") {
+      continue;
+    }
+    if (std::ranges::find(benchmarked_extensions, extension) != benchmarked_extensions.end()) {
+      continue;
+    }
+
+    std::ifstream file{entry.path(), std::ios::binary};
+    const std::vector<u8> bytes{std::istreambuf_iterator<char>{file}, {}};
+    int width = 0, height = 0, components = 0;
+    if (stbi_info_from_memory(bytes.data(), narrow<int>(bytes.size()), &width, &height,
+                              &components) == 0) {
+      continue; // Not pulled from git-lfs
+    }
+
+    benchmarked_extensions.push_back(extension);
+    BENCHMARK(fmt::format("decode {} {}x{}", entry.path().filename().string(), width, height))
+    {
+      return load_image_from_memory(bytes, entry.path().filename().string());
+    };
+  }
+}
+
+TEST_CASE("vec3_to_oct", "[scene-loading]")
+{
+  // Evenly distributed on the unit sphere
+  constexpr u32 count = 1'000'000;
+  std::vector<Vec3> normals;
+  normals.reserve(count);
+  const f32 golden_angle = std::numbers::pi_v<f32> * (3.f - std::sqrt(5.f));
+  for (u32 i = 0; i < count; ++i) {
+    const f32 y = 1.f - 2.f * (static_cast<f32>(i) + 0.5f) / static_cast<f32>(count);
+    const f32 radius = std::sqrt(1.f - y * y);
+    const f32 theta = golden_angle * static_cast<f32>(i);
+    normals.push_back(Vec3{std::cos(theta) * radius, y, std::sin(theta) * radius});
+  }
+
+  BENCHMARK("vec3_to_oct 1M normals")
+  {
+    f32 sum = 0;
+    for (const Vec3& normal : normals) {
+      const Vec2 oct = vec3_to_oct(normal);
+      sum += oct.x + oct.y;
+    }
+    return sum;
+  };
+}
+
+TEST_CASE("AABB construction", "[scene-loading]")
+{
+  for (const u32 resolution : {64u, 1024u}) {
+    const GridMesh grid = make_grid_mesh(resolution);
+    BENCHMARK(fmt::format("construct_submesh_aabb {} positions", grid.positions.size()))
+    {
+      return construct_submesh_aabb(grid.positions);
+    };
+  }
+}
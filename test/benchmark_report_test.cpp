@@ -0,0 +1,116 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "../Charlie/utils/benchmark_report.hpp"
+#include "../Charlie/utils/cpu_timer.hpp"
+
+#include <chrono>
+#include <vector>
+
+TEST_CASE("Timing statistics")
+{
+  SECTION("Nearest-rank percentiles")
+  {
+    std::vector<double> samples;
+    for (int i = 100; i >= 1; --i) { samples.push_back(i); }
+    const auto statistics = charlie::compute_timing_statistics(samples);
+    REQUIRE(statistics.mean == 50.5);
+    REQUIRE(statistics.p50 == 50);
+    REQUIRE(statistics.p95 == 95);
+    REQUIRE(statistics.p99 == 99);
+    REQUIRE(statistics.max == 100);
+  }
+
+  SECTION("A single sample")
+  {
+    const std::vector<double> samples = {4};
+    const auto statistics = charlie::compute_timing_statistics(samples);
+    REQUIRE(statistics.p50 == 4);
+    REQUIRE(statistics.p99 == 4);
+  }
+
+  SECTION("No samples")
+  {
+    const auto statistics = charlie::compute_timing_statistics({});
+    REQUIRE(statistics.max == 0);
+  }
+}
+
+TEST_CASE("Benchmark report")
+{
+  charlie::BenchmarkRecorder recorder;
+  for (int i = 0; i < 10; ++i) {
+    recorder.add_frame_time(10);
+    recorder.add_cpu_stage("Update", 1);
+    recorder.add_cpu_stage("GUI", 2);
+    recorder.add_gpu_pass("Mesh, Early", 3);
+  }
+  charlie::BenchmarkReport report = recorder.report();
+  report.scene = "models/sponza/Sponza.gltf";
+  report.scene_load_milliseconds = 500;
+  report.memory = {{.name = "Textures", .mebibytes = 128}, {.name = "Geometry", .mebibytes = 16}};
+  REQUIRE(report.frame_count == 10);
+  REQUIRE(report.cpu_stages.size() == 2);
+  REQUIRE(report.cpu_stages[0].name == "Update");
+
+  SECTION("CSV round-trip")
+  {
+    const auto parsed =
+        charlie::parse_benchmark_report_csv(charlie::format_benchmark_report_csv(report));
+    REQUIRE(parsed.has_value());
+    REQUIRE(parsed->scene_load_milliseconds == 500);
+    REQUIRE(parsed->frame_time.p95 == 10);
+    REQUIRE(parsed->cpu_stages.size() == 2);
+    REQUIRE(parsed->cpu_stages[1].name == "GUI");
+    REQUIRE(parsed->cpu_stages[1].statistics.mean == 2);
+    REQUIRE(parsed->gpu_passes.size() == 1);
+    REQUIRE(parsed->gpu_passes[0].name == "Mesh; Early");
+    REQUIRE(parsed->memory.size() == 2);
+    REQUIRE(parsed->memory[1].name == "Geometry");
+    REQUIRE(parsed->memory[1].mebibytes == 16);
+  }
+
+  SECTION("Regressions")
+  {
+    REQUIRE(charlie::find_benchmark_regressions(report, report, {}).empty());
+
+    charlie::BenchmarkReport slower = report;
+    slower.frame_time.p95 = 12;
+    slower.cpu_stages[1].statistics.mean = 2.01; // Within the noise threshold
+    const auto regressions = charlie::find_benchmark_regressions(slower, report, {});
+    REQUIRE(regressions.size() == 1);
+
+    // Stages that only one of the reports has are skipped
+    slower.cpu_stages.push_back({.name = "New Stage", .statistics = {.mean = 100}});
+    REQUIRE(charlie::find_benchmark_regressions(slower, report, {.max_regression = 0.5}).empty());
+  }
+
+  SECTION("Invalid CSV")
+  {
+    REQUIRE(!charlie::parse_benchmark_report_csv("").has_value());
+    REQUIRE(!charlie::parse_benchmark_report_csv("category,name\nframe,frame,1").has_value());
+  }
+}
+
+TEST_CASE("CPU timer")
+{
+  using namespace std::literals::chrono_literals;
+
+  charlie::CPUTimer timer;
+  timer.add_stage("Update", 1ms);
+  timer.add_stage("Render", 2ms);
+  timer.add_stage("Update", 3ms);
+  timer.end_frame();
+
+  const auto& timings = timer.timings();
+  REQUIRE(timings.size() == 2);
+  REQUIRE(timings[0].name == "Update");
+  REQUIRE(timings[0].frame_milliseconds == 4);
+  REQUIRE(timings[1].frame_milliseconds == 2);
+
+  timer.add_stage("Update", 2ms);
+  timer.add_stage("Render", 2ms);
+  timer.end_frame();
+  REQUIRE(timings[0].frame_milliseconds == 2);
+  REQUIRE(timings[0].milliseconds > 2);
+  REQUIRE(timings[0].milliseconds < 4);
+}
@@ -0,0 +1,78 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "../Charlie/renderer/camera_path.hpp"
+
+#include <cstring>
+#include <string>
+
+namespace {
+
+auto make_frame() -> charlie::CameraPathFrame
+{
+  charlie::CameraPathFrame frame;
+  // clang-format off
+  frame.view_matrix = beyond::Mat4{
+      0.1f, 0.2f, 0.3f, 0.4f,
+      1.f / 3.f, 1e-7f, -2.5f, 0,
+      0, 0, 1, -1e20f,
+      7, 8, 9, 1
+  };
+  // clang-format on
+  frame.position = {1.f / 7.f, -2, 3};
+  frame.fovy = 1.2217305f;
+  frame.aspect_ratio = 16.f / 9.f;
+  frame.z_near = 0.1f;
+  frame.z_far = 20000.f;
+  frame.settings.shading_path = charlie::ShadingPath::deferred;
+  frame.settings.mesh_shading = false;
+  frame.settings.exposure_compensation = -1.5f;
+  frame.settings.sunlight_direction = {0.25f, -0.75f, 0.1f, 0.3f};
+  frame.settings.sunlight_shadow_mode = 2;
+  return frame;
+}
+
+auto camera_path_text(const charlie::CameraPathFrame& frame) -> std::string
+{
+  return "charlie3d_camera_path 2\n" + charlie::format_camera_path_frame(frame) + "\n";
+}
+
+} // anonymous namespace
+
+TEST_CASE("Camera path")
+{
+  SECTION("Frames round-trip exactly")
+  {
+    const charlie::CameraPathFrame frame = make_frame();
+    const auto frames = charlie::parse_camera_path(camera_path_text(frame));
+    REQUIRE(frames.has_value());
+    REQUIRE(frames->size() == 1);
+
+    const charlie::CameraPathFrame& parsed = frames->front();
+    REQUIRE(std::memcmp(&parsed.view_matrix, &frame.view_matrix, sizeof(beyond::Mat4)) == 0);
+    REQUIRE(parsed.position.x == frame.position.x);
+    REQUIRE(parsed.position.y == frame.position.y);
+    REQUIRE(parsed.position.z == frame.position.z);
+    REQUIRE(parsed.fovy == frame.fovy);
+    REQUIRE(parsed.aspect_ratio == frame.aspect_ratio);
+    REQUIRE(parsed.z_far == frame.z_far);
+    REQUIRE(parsed.settings.shading_path == charlie::ShadingPath::deferred);
+    REQUIRE(parsed.settings.mesh_shading == false);
+    REQUIRE(parsed.settings.cluster_culling == true);
+    REQUIRE(parsed.settings.exposure_compensation == -1.5f);
+    REQUIRE(parsed.settings.sunlight_direction.y == -0.75f);
+    REQUIRE(parsed.settings.sunlight_direction.w == 0.3f);
+    REQUIRE(parsed.settings.sunlight_shadow_mode == 2);
+  }
+
+  SECTION("Invalid camera paths are rejected")
+  {
+    const std::string line = charlie::format_camera_path_frame(make_frame());
+    REQUIRE(!charlie::parse_camera_path("").has_value());
+    REQUIRE(!charlie::parse_camera_path("charlie3d_camera_path 2\n").has_value());
+    REQUIRE(!charlie::parse_camera_path("charlie3d_camera_path 1\n" + line).has_value());
+    REQUIRE(!charlie::parse_camera_path(line).has_value());
+    REQUIRE(!charlie::parse_camera_path("charlie3d_camera_path 2\n" + line + " 42").has_value());
+    REQUIRE(!charlie::parse_camera_path("charlie3d_camera_path 2\n" + line.substr(0, 20))
+                 .has_value());
+  }
+}
@@ -0,0 +1,238 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "../Charlie/renderer/frame_graph.hpp"
+#include "../Charlie/vulkan_helpers/context.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+namespace {
+
+constexpr u32 all_memory_types = ~0u;
+
+auto request(u32 first_pass, u32 last_pass, VkDeviceSize size,
+             u32 memory_type_bits = all_memory_types) -> charlie::TransientMemoryRequest
+{
+  return {.first_pass = first_pass,
+          .last_pass = last_pass,
+          .requirements = {.size = size, .alignment = 256, .memoryTypeBits = memory_type_bits}};
+}
+
+// Handles that only identify the resources. The graphs below import all their resources, so
+// compiling them and planning their barriers never touches the device
+template <typename Handle> auto fake_handle(std::uintptr_t value) -> Handle
+{
+  return reinterpret_cast<Handle>(value); // NOLINT(performance-no-int-to-ptr)
+}
+
+void no_op(VkCommandBuffer) {}
+
+constexpr VkPipelineStageFlags2 fragment_stage = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+constexpr VkPipelineStageFlags2 compute_stage = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+
+} // anonymous namespace
+
+TEST_CASE("Transient memory planning")
+{
+  SECTION("Disjoint lifetimes share a block")
+  {
+    const std::array requests = {request(0, 1, 1024), request(2, 3, 2048)};
+    const auto plan = charlie::plan_transient_memory(requests);
+    REQUIRE(plan.blocks.size() == 1);
+    REQUIRE(plan.blocks[0].size == 2048);
+    REQUIRE(plan.block_indices == std::vector<u32>{0, 0});
+  }
+
+  SECTION("Overlapping lifetimes get separate blocks")
+  {
+    const std::array requests = {request(0, 2, 1024), request(2, 3, 1024)};
+    const auto plan = charlie::plan_transient_memory(requests);
+    REQUIRE(plan.blocks.size() == 2);
+    REQUIRE(plan.block_indices[0] != plan.block_indices[1]);
+  }
+
+  SECTION("Incompatible memory types get separate blocks")
+  {
+    const std::array requests = {request(0, 0, 1024, 0b01), request(1, 1, 1024, 0b10)};
+    const auto plan = charlie::plan_transient_memory(requests);
+    REQUIRE(plan.blocks.size() == 2);
+  }
+
+  SECTION("Compatible memory types narrow the block")
+  {
+    const std::array requests = {request(0, 0, 1024, 0b011), request(1, 1, 1024, 0b110)};
+    const auto plan = charlie::plan_transient_memory(requests);
+    REQUIRE(plan.blocks.size() == 1);
+    REQUIRE(plan.blocks[0].memoryTypeBits == 0b010);
+  }
+
+  SECTION("Unused requests go into an existing block")
+  {
+    const std::array requests = {request(0, 3, 1024), request(1, 0, 4096)};
+    const auto plan = charlie::plan_transient_memory(requests);
+    REQUIRE(plan.blocks.size() == 1);
+    REQUIRE(plan.blocks[0].size == 4096);
+  }
+
+  SECTION("Larger requests are placed first")
+  {
+    const std::array requests = {request(0, 0, 512), request(1, 1, 4096), request(0, 1, 1024)};
+    const auto plan = charlie::plan_transient_memory(requests);
+    REQUIRE(plan.blocks.size() == 2);
+    REQUIRE(plan.block_indices[1] == 0);
+    REQUIRE(plan.blocks[0].size == 4096);
+    REQUIRE(plan.blocks[1].size == 1024);
+  }
+}
+
+TEST_CASE("Frame graph pass culling")
+{
+  vkh::Context context;
+  charlie::FrameGraph graph{context};
+  const auto depth =
+      graph.import_image("Depth", fake_handle<VkImage>(1), VK_IMAGE_ASPECT_DEPTH_BIT);
+  const auto debug =
+      graph.import_image("Debug", fake_handle<VkImage>(2), VK_IMAGE_ASPECT_COLOR_BIT);
+  const auto output =
+      graph.import_image("Output", fake_handle<VkImage>(3), VK_IMAGE_ASPECT_COLOR_BIT);
+  const auto readback = graph.import_buffer("Readback", fake_handle<VkBuffer>(4));
+
+  graph.add_pass("Depth Prepass", no_op).write(depth, charlie::image_access::depth_attachment());
+  graph.add_pass("Debug View", no_op)
+      .read(depth, charlie::image_access::sampled(fragment_stage,
+                                                  VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL))
+      .write(debug, charlie::image_access::color_attachment());
+  graph.add_pass("Shading", no_op)
+      .read(depth, charlie::image_access::sampled(fragment_stage,
+                                                  VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL))
+      .write(output, charlie::image_access::color_attachment());
+  graph.add_pass("Readback", no_op)
+      .write(readback, {.stage_mask = VK_PIPELINE_STAGE_2_COPY_BIT,
+                        .access_mask = VK_ACCESS_2_TRANSFER_WRITE_BIT})
+      .side_effect();
+  graph.set_output(output, charlie::image_access::sampled(fragment_stage));
+
+  static_cast<void>(graph.compile());
+  graph.plan_barriers();
+
+  // Nothing reads the debug view, while the readback is kept for its side effect
+  REQUIRE(graph.stats().pass_count == 4);
+  REQUIRE(graph.stats().culled_pass_count == 1);
+  REQUIRE(std::ranges::none_of(graph.barrier_batches(),
+                               [](const auto& batch) { return batch.pass_index == 1; }));
+  REQUIRE(std::ranges::any_of(graph.barrier_batches(),
+                              [](const auto& batch) { return batch.pass_index == 3; }));
+}
+
+TEST_CASE("Frame graph barriers")
+{
+  vkh::Context context;
+  charlie::FrameGraph graph{context};
+  const auto depth_image = fake_handle<VkImage>(1);
+  const auto output_image = fake_handle<VkImage>(2);
+  const auto depth = graph.import_image("Depth", depth_image, VK_IMAGE_ASPECT_DEPTH_BIT);
+  const auto output = graph.import_image("Output", output_image, VK_IMAGE_ASPECT_COLOR_BIT);
+
+  graph.add_pass("Depth Prepass", no_op).write(depth, charlie::image_access::depth_attachment());
+  graph.add_pass("Forward", no_op)
+      .read(depth, charlie::image_access::sampled(fragment_stage,
+                                                  VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL))
+      .write(output, charlie::image_access::color_attachment());
+  graph.add_pass("Compute Overlay", no_op)
+      .read(depth, charlie::image_access::sampled(compute_stage,
+                                                  VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL))
+      .write(output, charlie::image_access::storage_read_write(compute_stage));
+  graph.set_output(output, charlie::image_access::sampled(fragment_stage));
+
+  static_cast<void>(graph.compile());
+  graph.plan_barriers();
+
+  const auto batches = graph.barrier_batches();
+  const auto barriers = graph.image_barriers();
+  REQUIRE(batches.size() == 4);
+  REQUIRE(graph.stats().barrier_count == 5);
+  REQUIRE(graph.buffer_barriers().empty());
+
+  SECTION("Imported images start in their initial layout")
+  {
+    REQUIRE(batches[0].pass_index == 0);
+    REQUIRE(batches[0].image_barrier_count == 1);
+    const VkImageMemoryBarrier2& barrier = barriers[batches[0].first_image_barrier];
+    REQUIRE(barrier.image == depth_image);
+    REQUIRE(barrier.oldLayout == VK_IMAGE_LAYOUT_UNDEFINED);
+    REQUIRE(barrier.newLayout == VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+  }
+
+  SECTION("Consecutive reads in the same layout share a barrier")
+  {
+    REQUIRE(batches[1].pass_index == 1);
+    REQUIRE(batches[1].image_barrier_count == 2);
+    const VkImageMemoryBarrier2& barrier = barriers[batches[1].first_image_barrier];
+    REQUIRE(barrier.image == depth_image);
+    REQUIRE(barrier.oldLayout == VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+    REQUIRE(barrier.newLayout == VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL);
+    REQUIRE(barrier.srcAccessMask == VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+    REQUIRE(barrier.dstStageMask == (fragment_stage | compute_stage));
+  }
+
+  SECTION("Writes wait for the previous write")
+  {
+    REQUIRE(batches[2].pass_index == 2);
+    REQUIRE(batches[2].image_barrier_count == 1);
+    const VkImageMemoryBarrier2& barrier = barriers[batches[2].first_image_barrier];
+    REQUIRE(barrier.image == output_image);
+    REQUIRE(barrier.oldLayout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    REQUIRE(barrier.newLayout == VK_IMAGE_LAYOUT_GENERAL);
+    REQUIRE(barrier.srcStageMask == VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT);
+    REQUIRE(barrier.srcAccessMask == VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT);
+  }
+
+  SECTION("Outputs end up in their final layout")
+  {
+    REQUIRE(batches[3].pass_index == 3);
+    REQUIRE(batches[3].image_barrier_count == 1);
+    const VkImageMemoryBarrier2& barrier = barriers[batches[3].first_image_barrier];
+    REQUIRE(barrier.image == output_image);
+    REQUIRE(barrier.oldLayout == VK_IMAGE_LAYOUT_GENERAL);
+    REQUIRE(barrier.newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+  }
+}
+
+TEST_CASE("Frame graph barrier batching")
+{
+  vkh::Context context;
+  charlie::FrameGraph graph{context};
+  const auto draws = graph.import_buffer("Draws", fake_handle<VkBuffer>(1));
+  const auto mask = graph.import_image("Mask", fake_handle<VkImage>(2), VK_IMAGE_ASPECT_COLOR_BIT);
+  const auto output =
+      graph.import_image("Output", fake_handle<VkImage>(3), VK_IMAGE_ASPECT_COLOR_BIT);
+
+  graph.add_pass("Generate", no_op)
+      .write(draws, {.stage_mask = compute_stage,
+                     .access_mask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT})
+      .write(mask, charlie::image_access::storage_write(compute_stage));
+  graph.add_pass("Draw", no_op)
+      .read(draws, {.stage_mask = VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+                    .access_mask = VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT})
+      .read(mask, charlie::image_access::sampled(fragment_stage))
+      .write(output, charlie::image_access::color_attachment());
+  graph.set_output(output, charlie::image_access::color_attachment());
+
+  static_cast<void>(graph.compile());
+  graph.plan_barriers();
+
+  // A single batch in front of each pass holds the barriers of all its resources
+  const auto batches = graph.barrier_batches();
+  REQUIRE(batches.size() == 2);
+  REQUIRE(batches[1].pass_index == 1);
+  REQUIRE(batches[1].image_barrier_count == 2);
+  REQUIRE(batches[1].buffer_barrier_count == 1);
+
+  const VkBufferMemoryBarrier2& barrier =
+      graph.buffer_barriers()[batches[1].first_buffer_barrier];
+  REQUIRE(barrier.srcStageMask == compute_stage);
+  REQUIRE(barrier.srcAccessMask == VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+  REQUIRE(barrier.dstStageMask == VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT);
+  REQUIRE(barrier.dstAccessMask == VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT);
+}